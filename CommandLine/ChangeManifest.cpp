@@ -0,0 +1,218 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "ChangeManifest.h"
+#include "MetadataArchive.h"
+#include <errno.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+static const char ManifestHeader[] = "# FileMeta export manifest\n";
+
+static void AppendHex(std::vector<BYTE>& data, ULONGLONG value)
+{
+	char digits[16];
+	int cDigits = 0;
+	do
+	{
+		digits[cDigits++] = "0123456789abcdef"[value & 0xF];
+		value >>= 4;
+	}
+	while (value != 0);
+
+	while (cDigits > 0)
+		data.push_back(digits[--cDigits]);
+	data.push_back(' ');
+}
+
+// Parses a number and the space after it, advancing pos past them
+static bool ParseHex(const std::wstring& line, size_t& pos, ULONGLONG& value)
+{
+	value = 0;
+	size_t start = pos;
+	for (; pos < line.size() && line[pos] != L' '; pos++)
+	{
+		WCHAR ch = line[pos];
+		unsigned digit;
+		if (ch >= L'0' && ch <= L'9')
+			digit = ch - L'0';
+		else if (ch >= L'a' && ch <= L'f')
+			digit = ch - L'a' + 10;
+		else
+			return false;
+
+		if (pos - start == 16)
+			return false;
+		value = (value << 4) | digit;
+	}
+
+	if (pos == start || pos == line.size())
+		return false;
+	pos++;
+	return true;
+}
+
+static bool FileExists(const std::wstring& path)
+{
+#ifdef _WIN32
+	return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+	struct stat st;
+	return stat(NarrowPath(path.c_str()).c_str(), &st) == 0;
+#endif
+}
+
+bool CChangeManifest::PathLess::operator()(const std::wstring& path1, const std::wstring& path2) const
+{
+	return CMetadataArchive::ComparePaths(path1, path2) < 0;
+}
+
+CChangeManifest::CChangeManifest()
+{
+}
+
+int CChangeManifest::Load(const WCHAR* pszPath)
+{
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(pszPath, data);
+	if (err != 0)
+		return err;
+
+	std::wstring text;
+	if (data.size() < sizeof(ManifestHeader) - 1 || memcmp(&data[0], ManifestHeader, sizeof(ManifestHeader) - 1) != 0 ||
+		!DecodeUtf8(&data[0], data.size(), text))
+		return ERROR_FILE_CORRUPT;
+
+	// Check every line before keeping any of them
+	std::map<std::wstring, Entry, PathLess> entries;
+	size_t start = 0;
+	while (start < text.size())
+	{
+		size_t end = text.find(L'\n', start);
+		if (end == std::wstring::npos)
+			end = text.size();
+		std::wstring line(text, start, end - start);
+		start = end + 1;
+
+		if (line.empty() || line[0] == L'#')
+			continue;
+
+		// ID size changed hash target<tab>export
+		Entry entry;
+		size_t pos = 0;
+		if (!ParseHex(line, pos, entry.stamp.fileId) || !ParseHex(line, pos, entry.stamp.size) ||
+			!ParseHex(line, pos, entry.stamp.changed) || !ParseHex(line, pos, entry.hash))
+			return ERROR_FILE_CORRUPT;
+
+		size_t tab = line.find(L'\t', pos);
+		if (tab == std::wstring::npos || tab == pos || tab + 1 == line.size())
+			return ERROR_FILE_CORRUPT;
+
+		entry.exportFile = line.substr(tab + 1);
+		entry.bSeen = false;
+		entries[line.substr(pos, tab - pos)] = entry;
+	}
+
+	CAutoLock lock(_lock);
+	_entries.swap(entries);
+	return 0;
+}
+
+int CChangeManifest::Save(const WCHAR* pszPath)
+{
+	std::vector<BYTE> data(ManifestHeader, ManifestHeader + sizeof(ManifestHeader) - 1);
+	{
+		CAutoLock lock(_lock);
+		for (auto pos = _entries.begin(); pos != _entries.end(); ++pos)
+		{
+			AppendHex(data, pos->second.stamp.fileId);
+			AppendHex(data, pos->second.stamp.size);
+			AppendHex(data, pos->second.stamp.changed);
+			AppendHex(data, pos->second.hash);
+			AppendUtf8(data, pos->first.c_str(), pos->first.size());
+			data.push_back('\t');
+			AppendUtf8(data, pos->second.exportFile.c_str(), pos->second.exportFile.size());
+			data.push_back('\n');
+		}
+	}
+
+	std::wstring newPath(pszPath);
+	newPath += L".new";
+
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	int err = _wfopen_s(&pfile, newPath.c_str(), L"wb");
+	if (err != 0)
+		return err;
+#else
+	pfile = fopen(NarrowPath(newPath.c_str()).c_str(), "wb");
+	if (!pfile)
+		return errno;
+	int err = 0;
+#endif
+
+	if (fwrite(&data[0], 1, data.size(), pfile) != data.size())
+		err = errno;
+	if (fclose(pfile) != 0 && err == 0)
+		err = errno;
+
+#ifdef _WIN32
+	if (err == 0 && !MoveFileExW(newPath.c_str(), pszPath, MOVEFILE_REPLACE_EXISTING))
+		err = GetLastError();
+	if (err != 0)
+		_wremove(newPath.c_str());
+#else
+	if (err == 0 && rename(NarrowPath(newPath.c_str()).c_str(), NarrowPath(pszPath).c_str()) != 0)
+		err = errno;
+	if (err != 0)
+		remove(NarrowPath(newPath.c_str()).c_str());
+#endif
+	return err;
+}
+
+bool CChangeManifest::IsUnchanged(const std::wstring& targetFile, const MetadataStamp& stamp, const std::wstring& exportFile, ULONGLONG* pHash)
+{
+	*pHash = 0;
+
+	CAutoLock lock(_lock);
+	auto pos = _entries.find(targetFile);
+	if (pos == _entries.end())
+		return false;
+
+	pos->second.bSeen = true;
+	if (pos->second.exportFile != exportFile)
+		return false;
+
+	*pHash = pos->second.hash;
+	return pos->second.stamp.fileId == stamp.fileId && pos->second.stamp.size == stamp.size &&
+		pos->second.stamp.changed == stamp.changed;
+}
+
+void CChangeManifest::Update(const std::wstring& targetFile, const MetadataStamp& stamp, const std::wstring& exportFile, ULONGLONG hash)
+{
+	CAutoLock lock(_lock);
+	Entry& entry = _entries[targetFile];
+	entry.stamp = stamp;
+	entry.exportFile = exportFile;
+	entry.hash = hash;
+	entry.bSeen = true;
+}
+
+void CChangeManifest::RemoveDeleted(std::vector<std::wstring>& deleted)
+{
+	deleted.clear();
+
+	CAutoLock lock(_lock);
+	for (auto pos = _entries.begin(); pos != _entries.end(); )
+	{
+		// Files that were simply not among the targets this time keep their entries
+		if (!pos->second.bSeen && !FileExists(pos->first))
+		{
+			deleted.push_back(pos->first);
+			pos = _entries.erase(pos);
+		}
+		else
+			++pos;
+	}
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// A record of what an export wrote for each file, so that repeating the export over a large tree costs
+// in proportion to what has changed since, rather than to the size of the tree. For each target file it
+// holds the stamp of the file's metadata, the file the metadata was exported to, and a hash of what was
+// written there. A file whose stamp has not changed, and whose export is still there, need not be read
+// at all, and one that is read but exports just as before need not be written again.
+//
+// A manifest is UTF-8 text, starting with a header line, with one line for each target file: its file ID,
+// metadata size, change time and export hash, each in hexadecimal and followed by a space, then the path
+// of the target file, a tab, and the path of its export.
+
+#pragma once
+
+#include "MetadataStore.h"
+#include <map>
+
+class CChangeManifest
+{
+public:
+	CChangeManifest();
+
+	// Returns 0, or the system error code, which is ERROR_FILE_CORRUPT if the file is not a manifest
+	int Load(const WCHAR* pszPath);
+
+	// Writes the manifest alongside and then replaces the file, so that a failure leaves the old one intact.
+	// Returns 0, or the system error code.
+	int Save(const WCHAR* pszPath);
+
+	// Whether the metadata of a file has the stamp it had when it was last exported to exportFile.
+	// Returns the hash of that export in *pHash, or 0 if the file was not exported there, to pass to
+	// the export so that it can tell if what it would write is the same.
+	// Notes that the file is still there, for RemoveDeleted.
+	bool IsUnchanged(const std::wstring& targetFile, const MetadataStamp& stamp, const std::wstring& exportFile, ULONGLONG* pHash);
+
+	// Records the export of a file. The stamp should be taken before the metadata is read, so that a change
+	// while it is being exported is caught the next time.
+	void Update(const std::wstring& targetFile, const MetadataStamp& stamp, const std::wstring& exportFile, ULONGLONG hash);
+
+	// Removes the files that were not seen since the manifest was loaded and no longer exist,
+	// returning their paths in order
+	void RemoveDeleted(std::vector<std::wstring>& deleted);
+
+private:
+	CChangeManifest(const CChangeManifest&);
+	CChangeManifest& operator=(const CChangeManifest&);
+
+	struct Entry
+	{
+		MetadataStamp	stamp;
+		std::wstring	exportFile;
+		ULONGLONG		hash;
+		bool			bSeen;
+	};
+
+	struct PathLess
+	{
+		bool operator()(const std::wstring& path1, const std::wstring& path2) const;
+	};
+
+	std::map<std::wstring, Entry, PathLess>	_entries;
+	CLock									_lock;		// files are exported on several threads at once
+};
@@ -0,0 +1,596 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Throughput benchmark for the export and import engine, so that a change that slows the hot path shows up
+// as a number rather than as a complaint. It generates synthetic corpora, from a few properties to several
+// hundred, weighted towards scalars, vectors or long strings, on empty and on large files, and times XML and
+// binary export and import of every file against the in-memory store and the platform's native store, which
+// on Linux is extended attributes.
+//
+// Each operation goes through the engine itself: ExportMetadata, ImportMetadataFromXml and their binary
+// equivalents, in the forms that take a store, so that the store can be chosen, and that keep the XML and
+// binary data in memory, so that what is measured is the metadata path rather than writing metadata files.
+// The synthetic values are all of the types that are formatted and parsed directly, so the Windows build's
+// PSFormatForDisplay and COM coercion fallbacks are never needed.
+//
+// For each store, corpus and operation, it reports files and properties per second, the bytes allocated
+// through operator new per file, and the median and 99th percentile time taken by a single file.
+//
+// It also times the classification of file names by the property handler registered for their extensions,
+// as export and import do for every file, with the registry stood in for by a file of registrations that it
+// writes to the target directory. This reports names per second and the bytes allocated per name.
+//
+// To build and run on Linux, from this directory:
+//	cmake -S . -B build -DCMAKE_BUILD_TYPE=Release && cmake --build build
+//	build/Benchmark [files per corpus] [directory for the target files]
+// The directory must be on a file system with user extended attributes; the default is the current directory.
+// Where a corpus holds more metadata than the file system allows a file, as ext4 with its single block
+// for attributes does for the larger ones, the native store reports it as not set up and the run goes on.
+
+#include "XmlHelpers.h"
+#include <algorithm>
+#include <ctype.h>
+#include <memory>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#pragma region Allocation counting
+
+// Any thread may allocate, so the count is only ever changed and read with atomic operations
+static volatile LONGLONG s_cbAllocated = 0;
+
+static void CountAllocation(size_t cb)
+{
+#ifdef _WIN32
+	InterlockedExchangeAdd64(&s_cbAllocated, (LONGLONG)cb);
+#else
+	__sync_fetch_and_add(&s_cbAllocated, (LONGLONG)cb);
+#endif
+}
+
+static ULONGLONG AllocatedBytes()
+{
+#ifdef _WIN32
+	return (ULONGLONG)InterlockedCompareExchange64(&s_cbAllocated, 0, 0);
+#else
+	return (ULONGLONG)__sync_fetch_and_add(&s_cbAllocated, 0);
+#endif
+}
+
+void* operator new(size_t cb)
+{
+	CountAllocation(cb);
+	void* p = malloc(cb > 0 ? cb : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t cb)
+{
+	return operator new(cb);
+}
+
+void* operator new(size_t cb, const std::nothrow_t&) throw()
+{
+	CountAllocation(cb);
+	return malloc(cb > 0 ? cb : 1);
+}
+
+void* operator new[](size_t cb, const std::nothrow_t&) throw()
+{
+	return operator new(cb, std::nothrow);
+}
+
+void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+	free(p);
+}
+
+#pragma endregion
+
+#pragma region Corpora
+
+// What each target file of a corpus holds
+struct Corpus
+{
+	const char*	pszName;
+	DWORD		cScalars;		// signed and unsigned integers, booleans and dates, in turn
+	DWORD		cVectors;		// string and integer vectors of eight elements, in turn
+	DWORD		cStrings;
+	size_t		cchString;
+	size_t		cbFile;			// of the target file's own contents
+};
+
+static const Corpus Corpora[] =
+{
+	{ "few",		4,		1,		2,		16,		0 },
+	{ "many",		400,	100,	100,	24,		0 },
+	{ "scalar",		120,	0,		0,		0,		0 },
+	{ "vector",		0,		60,		0,		0,		0 },
+	{ "string",		0,		0,		40,		1000,	0 },
+	{ "few-large",	4,		1,		2,		16,		16 * 1024 * 1024 },
+};
+
+// Where the synthetic properties go, two sets of them, as most files have at least SummaryInformation and one other
+static const FMTID FMTID_Benchmark1 = { 0x6c0f5ab4, 0x1d3e, 0x4e7a, { 0x9b, 0x2f, 0x41, 0x0c, 0x6d, 0x52, 0x8e, 0x01 } };
+static const FMTID FMTID_Benchmark2 = { 0x6c0f5ab4, 0x1d3e, 0x4e7a, { 0x9b, 0x2f, 0x41, 0x0c, 0x6d, 0x52, 0x8e, 0x02 } };
+
+// Fills the sets with the corpus's properties, varying the values from file to file
+static void MakeProperties(const Corpus& corpus, DWORD iFile, std::vector<CPropertySet>& sets)
+{
+	sets.clear();
+	sets.push_back(CPropertySet(FMTID_Benchmark1));
+	sets.push_back(CPropertySet(FMTID_Benchmark2));
+
+	PROPID pid = 2;
+	for (DWORD i = 0; i < corpus.cScalars; i++, pid++)
+	{
+		PROPVARIANT propvar;
+		PropVariantInit(&propvar);
+		switch (i % 4)
+		{
+		case 0:
+			propvar.vt = VT_I4;
+			propvar.lVal = (LONG)(i * 7919 + iFile);
+			break;
+		case 1:
+			propvar.vt = VT_UI8;
+			propvar.uhVal.QuadPart = (ULONGLONG)i * 0x100000001ULL + iFile;
+			break;
+		case 2:
+			propvar.vt = VT_BOOL;
+			propvar.boolVal = ((i + iFile) & 1) ? VARIANT_TRUE : VARIANT_FALSE;
+			break;
+		default:
+			propvar.vt = VT_FILETIME;
+			propvar.filetime.dwLowDateTime = 0xd53e8000 + i + iFile;
+			propvar.filetime.dwHighDateTime = 0x01d9a000;
+			break;
+		}
+		sets[pid & 1].SetValue(pid, propvar);
+	}
+
+	WCHAR szElem[32];
+	for (DWORD i = 0; i < corpus.cVectors; i++, pid++)
+	{
+		PROPVARIANT propvar;
+		PropVariantInit(&propvar);
+		LPWSTR rgpsz[8];
+		LONG rgl[8];
+		if (i % 2 == 0)
+		{
+			std::vector<std::wstring> elems;
+			for (int j = 0; j < 8; j++)
+			{
+				swprintf(szElem, 32, L"tag%u-%d", iFile, j);
+				elems.push_back(szElem);
+			}
+			for (int j = 0; j < 8; j++)
+				rgpsz[j] = &elems[j][0];
+			propvar.vt = VT_VECTOR | VT_LPWSTR;
+			propvar.calpwstr.cElems = 8;
+			propvar.calpwstr.pElems = rgpsz;
+			sets[pid & 1].SetValue(pid, propvar);
+		}
+		else
+		{
+			for (int j = 0; j < 8; j++)
+				rgl[j] = (LONG)(iFile * 8 + j);
+			propvar.vt = VT_VECTOR | VT_I4;
+			propvar.cal.cElems = 8;
+			propvar.cal.pElems = rgl;
+			sets[pid & 1].SetValue(pid, propvar);
+		}
+	}
+
+	for (DWORD i = 0; i < corpus.cStrings; i++, pid++)
+	{
+		std::wstring text;
+		for (size_t j = 0; j < corpus.cchString; j++)
+			text += (WCHAR)(L'a' + (j + i + iFile) % 26);
+
+		PROPVARIANT propvar;
+		PropVariantInit(&propvar);
+		propvar.vt = VT_LPWSTR;
+		propvar.pwszVal = &text[0];
+		sets[pid & 1].SetValue(pid, propvar);
+	}
+}
+
+static bool CreateTargetFile(const std::wstring& path, size_t cbFile)
+{
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	if (_wfopen_s(&pfile, path.c_str(), L"wb") != 0)
+		return false;
+#else
+	pfile = fopen(NarrowPath(path.c_str()).c_str(), "wb");
+	if (!pfile)
+		return false;
+#endif
+
+	std::vector<BYTE> block(64 * 1024, 0x5a);
+	bool bOK = true;
+	for (size_t cb = 0; cb < cbFile && bOK; cb += block.size())
+		bOK = fwrite(&block[0], 1, std::min(block.size(), cbFile - cb), pfile) == std::min(block.size(), cbFile - cb);
+	return fclose(pfile) == 0 && bOK;
+}
+
+static void RemoveFile(const std::wstring& path)
+{
+#ifdef _WIN32
+	_wremove(path.c_str());
+#else
+	remove(NarrowPath(path.c_str()).c_str());
+#endif
+}
+
+#pragma endregion
+
+#pragma region The engine
+
+// The store being measured
+static MetadataStoreKind s_kind = MemoryMetadataStore;
+
+// Each operation creates its own store, as the engine does for each file
+
+static HRESULT ExportXml(const std::wstring& targetFile, std::wstring& xml)
+{
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(s_kind));
+	xml.clear();
+	CStringXmlWriter writer(xml);
+	try
+	{
+		ExportMetadata(writer, pStore.get(), targetFile);
+	}
+	catch (CPHException& e)
+	{
+		return e.GetHResult();
+	}
+	writer.Close();
+	return S_OK;
+}
+
+// The XML is parsed in place, so each import has its own copy, as it would read its own file
+static HRESULT ImportXml(std::wstring xml, const std::wstring& targetFile)
+{
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore(s_kind));
+	try
+	{
+		ImportMetadataFromXml(&xml[0], pStore.get(), targetFile, targetFile + MetadataFileSuffix);
+	}
+	catch (CPHException& e)
+	{
+		return e.GetHResult();
+	}
+	return S_OK;
+}
+
+static HRESULT ExportBinary(const std::wstring& targetFile, std::vector<BYTE>& data)
+{
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(s_kind));
+	try
+	{
+		ExportMetadataToBinary(pStore.get(), targetFile, targetFile + MetadataBinaryFileSuffix, data);
+	}
+	catch (CPHException& e)
+	{
+		return e.GetHResult();
+	}
+	return S_OK;
+}
+
+static HRESULT ImportBinary(const std::vector<BYTE>& data, const std::wstring& targetFile)
+{
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore(s_kind));
+	try
+	{
+		ImportMetadataFromBinary(data, pStore.get(), targetFile, targetFile + MetadataBinaryFileSuffix);
+	}
+	catch (CPHException& e)
+	{
+		return e.GetHResult();
+	}
+	return S_OK;
+}
+
+#pragma endregion
+
+#pragma region Measurement
+
+// Elapsed time in microseconds, from an arbitrary start
+static ULONGLONG Now()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq = { 0 };
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (ULONGLONG)(count.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ULONGLONG)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+enum Operation { ExportXmlOp, ImportXmlOp, ExportBinaryOp, ImportBinaryOp, OperationCount };
+
+static const char* OperationNames[OperationCount] = { "export xml", "import xml", "export binary", "import binary" };
+
+struct Measurement
+{
+	std::vector<ULONGLONG>	times;		// per file, in microseconds
+	ULONGLONG				cbAllocated;
+	HRESULT					hr;
+
+	Measurement() : cbAllocated(0), hr(S_OK) {}
+};
+
+static void Report(const char* pszStore, const Corpus& corpus, Operation op, DWORD cPropsPerFile, Measurement& m)
+{
+	if (FAILED(m.hr))
+	{
+		printf("%-7s %-10s %-14s failed with 0x%08x\n", pszStore, corpus.pszName, OperationNames[op], (unsigned int)m.hr);
+		return;
+	}
+	else if (m.times.empty())
+	{
+		printf("%-7s %-10s %-14s not run\n", pszStore, corpus.pszName, OperationNames[op]);
+		return;
+	}
+
+	ULONGLONG total = 0;
+	for (size_t i = 0; i < m.times.size(); i++)
+		total += m.times[i];
+	std::sort(m.times.begin(), m.times.end());
+
+	size_t cFiles = m.times.size();
+	double seconds = total > 0 ? total / 1000000.0 : 1e-6;
+	printf("%-7s %-10s %-14s %10.0f %12.0f %12llu %9llu %9llu\n", pszStore, corpus.pszName, OperationNames[op],
+		cFiles / seconds, (double)cFiles * cPropsPerFile / seconds, (unsigned long long)(m.cbAllocated / cFiles),
+		(unsigned long long)m.times[cFiles / 2], (unsigned long long)m.times[std::min(cFiles - 1, cFiles * 99 / 100)]);
+}
+
+// Sets up the corpus's target files in the store, then times each operation over all of them.
+// Import goes to a second set of files without metadata, so that every import writes.
+static void RunCorpus(const char* pszStore, const Corpus& corpus, DWORD cFiles, const std::wstring& directory)
+{
+	std::vector<std::wstring> sources, targets;
+	Measurement m[OperationCount];
+	std::vector<CPropertySet> sets;
+	DWORD cPropsPerFile = corpus.cScalars + corpus.cVectors + corpus.cStrings;
+
+	for (DWORD i = 0; i < cFiles; i++)
+	{
+		char szName[64];
+		sprintf(szName, "/bench-%s-%u.src", corpus.pszName, i);
+		sources.push_back(directory + WidePath(szName));
+		sprintf(szName, "/bench-%s-%u.dst", corpus.pszName, i);
+		targets.push_back(directory + WidePath(szName));
+	}
+
+	// Write each source file's metadata directly, outside the timings
+	HRESULT hrSetup = S_OK;
+	for (DWORD i = 0; i < cFiles && SUCCEEDED(hrSetup); i++)
+	{
+		if (!CreateTargetFile(sources[i], corpus.cbFile))
+		{
+			hrSetup = E_FAIL;
+			break;
+		}
+
+		MakeProperties(corpus, i, sets);
+		std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(s_kind));
+		HRESULT hr = pStore->Open(sources[i].c_str(), true);
+		for (size_t j = 0; j < sets.size() && SUCCEEDED(hr); j++)
+		{
+			PROPERTYKEY key;
+			key.fmtid = sets[j].GetFmtid();
+			for (DWORD k = 0; k < sets[j].GetCount() && SUCCEEDED(hr); k++)
+			{
+				key.pid = sets[j].GetIdAt(k);
+				hr = pStore->SetValue(key, sets[j].GetValueAt(k));
+			}
+		}
+		if (SUCCEEDED(hr))
+			hr = pStore->Commit();
+		hrSetup = hr;
+	}
+
+	// Once for XML, once for binary, on fresh targets each time
+	for (int format = 0; format < 2 && SUCCEEDED(hrSetup); format++)
+	{
+		Operation exportOp = format == 0 ? ExportXmlOp : ExportBinaryOp;
+		Operation importOp = format == 0 ? ImportXmlOp : ImportBinaryOp;
+		std::vector<std::wstring> xml(cFiles);
+		std::vector<std::vector<BYTE> > data(cFiles);
+
+		ULONGLONG cbStart = AllocatedBytes();
+		for (DWORD i = 0; i < cFiles && SUCCEEDED(m[exportOp].hr); i++)
+		{
+			ULONGLONG start = Now();
+			m[exportOp].hr = format == 0 ? ExportXml(sources[i], xml[i]) : ExportBinary(sources[i], data[i]);
+			m[exportOp].times.push_back(Now() - start);
+		}
+		m[exportOp].cbAllocated = AllocatedBytes() - cbStart;
+
+		for (DWORD i = 0; i < cFiles && SUCCEEDED(m[importOp].hr); i++)
+		{
+			if (!CreateTargetFile(targets[i], corpus.cbFile))
+				m[importOp].hr = E_FAIL;
+		}
+
+		cbStart = AllocatedBytes();
+		for (DWORD i = 0; i < cFiles && SUCCEEDED(m[exportOp].hr) && SUCCEEDED(m[importOp].hr); i++)
+		{
+			ULONGLONG start = Now();
+			m[importOp].hr = format == 0 ? ImportXml(xml[i], targets[i]) : ImportBinary(data[i], targets[i]);
+			m[importOp].times.push_back(Now() - start);
+		}
+		m[importOp].cbAllocated = AllocatedBytes() - cbStart;
+
+		for (DWORD i = 0; i < cFiles; i++)
+			RemoveFile(targets[i]);
+	}
+
+	for (DWORD i = 0; i < cFiles; i++)
+		RemoveFile(sources[i]);
+
+	if (FAILED(hrSetup))
+		printf("%-7s %-10s could not set up the corpus: 0x%08x\n", pszStore, corpus.pszName, (unsigned int)hrSetup);
+	else
+	{
+		for (int op = 0; op < OperationCount; op++)
+			Report(pszStore, corpus, (Operation)op, cPropsPerFile, m[op]);
+	}
+}
+
+#pragma endregion
+
+#pragma region Classification
+
+// As many registrations as a well-used machine has, with some extensions too long to be held in a table slot
+static const DWORD StandInExtensions = 1000;
+
+// Names cycle through registered extensions, in mixed case, unregistered ones, and names without an extension
+enum NameKind { OursName, ForeignName, UnregisteredName, NoDotName, NameKindCount };
+
+static std::string StandInExtension(DWORD i)
+{
+	char szExt[32];
+	sprintf(szExt, i % 10 == 9 ? ".extension%u" : ".e%u", i);
+	return szExt;
+}
+
+// The handler we are checked against is the one that the engine uses for this build
+static bool WriteStandIn(const std::wstring& path)
+{
+#ifdef _WIN64
+	const char* pszOurs = "{D06391EE-2FEB-419B-9667-AD160D0849F3}";
+#else
+	const char* pszOurs = "{60211757-EF87-465e-B6C1-B37CF98295F9}";
+#endif
+	std::string text = "# Registrations standing in for the registry\n\n";
+	for (DWORD i = 0; i < StandInExtensions; i++)
+		text += StandInExtension(i) + " " + (i % 2 == 0 ? pszOurs : "{0C1A3D5E-7F90-4B2C-8D4E-6F8091A2B3C4}") + "\n";
+
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	if (_wfopen_s(&pfile, path.c_str(), L"wb") != 0)
+		return false;
+#else
+	pfile = fopen(NarrowPath(path.c_str()).c_str(), "wb");
+	if (!pfile)
+		return false;
+#endif
+	bool bOK = fwrite(text.data(), 1, text.size(), pfile) == text.size();
+	return fclose(pfile) == 0 && bOK;
+}
+
+// Returns false if any name is not classified as it should be
+static bool RunClassification(DWORD cNames, const std::wstring& directory)
+{
+	std::wstring standInPath = directory + L"/bench-handlers.txt";
+	if (!WriteStandIn(standInPath))
+	{
+		printf("%-7s could not write the stand-in registrations\n", "classify");
+		return false;
+	}
+
+	CFileHandlerSource source(standInPath.c_str());
+	CExtensionChecker checker(&source);
+	RemoveFile(standInPath);
+
+	std::vector<std::wstring> names;
+	DWORD expected[NameKindCount] = { 0 };
+	for (DWORD i = 0; i < cNames; i++)
+	{
+		char szName[64];
+		DWORD iExt = (i / NameKindCount) % (StandInExtensions / 2);
+		NameKind kind = (NameKind)(i % NameKindCount);
+		std::string ext = kind == OursName ? StandInExtension(iExt * 2) : kind == ForeignName ? StandInExtension(iExt * 2 + 1) :
+			kind == UnregisteredName ? ".x" + StandInExtension(iExt).substr(1) : "";
+		if (i % 3 == 0)
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::toupper);
+		sprintf(szName, "/tree/dir%u/file%u%s", i % 7, i, ext.c_str());
+		names.push_back(WidePath(szName));
+		expected[kind]++;
+	}
+
+	DWORD counts[3] = { 0 };
+	ULONGLONG cbStart = AllocatedBytes();
+	ULONGLONG start = Now();
+	for (DWORD i = 0; i < cNames; i++)
+		counts[checker.HasPropertyHandler(names[i]) + 1]++;
+	ULONGLONG elapsed = Now() - start;
+	ULONGLONG cbAllocated = AllocatedBytes() - cbStart;
+
+	bool bOK = counts[2] == expected[OursName] && counts[0] == expected[ForeignName] &&
+		counts[1] == expected[UnregisteredName] + expected[NoDotName];
+	if (!bOK)
+		printf("%-7s misclassified: %u ours, %u foreign and %u without a handler\n", "classify", counts[2], counts[0], counts[1]);
+	else
+	{
+		double seconds = elapsed > 0 ? elapsed / 1000000.0 : 1e-6;
+		printf("\n%-7s %10s %12s %12s\n", "classify", "names", "names/s", "bytes/name");
+		printf("%-7s %10u %12.0f %12llu\n", "classify", cNames, cNames / seconds, (unsigned long long)(cbAllocated / cNames));
+	}
+	return bOK;
+}
+
+#pragma endregion
+
+int main(int argc, char* argv[])
+{
+	DWORD cFiles = argc > 1 ? (DWORD)atoi(argv[1]) : 200;
+	std::wstring directory = argc > 2 ? WidePath(argv[2]) : L".";
+	if (cFiles == 0)
+	{
+		printf("Usage: benchmark [files per corpus] [directory for the target files]\n");
+		return 1;
+	}
+
+	struct { MetadataStoreKind kind; const char* pszName; } stores[] =
+	{
+		{ MemoryMetadataStore, "memory" },
+		{ NativeMetadataStore, "native" },
+	};
+
+	printf("%-7s %-10s %-14s %10s %12s %12s %9s %9s\n", "store", "corpus", "operation", "files/s", "props/s", "bytes/file", "p50 us", "p99 us");
+	for (size_t i = 0; i < sizeof(stores) / sizeof(stores[0]); i++)
+	{
+		s_kind = stores[i].kind;
+		for (size_t j = 0; j < sizeof(Corpora) / sizeof(Corpora[0]); j++)
+		{
+			// Files with large contents take longer to set up, and the metadata path does not read them
+			const Corpus& corpus = Corpora[j];
+			RunCorpus(stores[i].pszName, corpus, corpus.cbFile > 0 ? std::max<DWORD>(1, cFiles / 20) : cFiles, directory);
+		}
+	}
+
+	// Classification is cheap enough per name to need far more names than files to time
+	return RunClassification(cFiles * 1000, directory) ? 0 : 1;
+}
@@ -0,0 +1,346 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for CChainedMetadataStore, over fake stores that count the calls made to them, so that the tests can see
+// not only what the chained store returns, but when it loads the store that it is chained to, and when it
+// builds its index of the keys of both stores again.
+
+#include "FakeStore.h"
+#include "TestSupport.h"
+
+static const WCHAR* TestFile = L"/fake/file.txt";
+
+#pragma region Loading the chained store
+
+// Our own values come from our store alone
+static void TestOwnHit()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(2, 20);
+	pChained->Add(2, 200);
+	pChained->Add(5, 50);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, true));
+	CHECK(pOwn->cOpens == 1 && pOwn->bOpenedReadWrite);
+
+	CHECK(ValueOf(store, 2) == 20);
+	CHECK(ValueOf(store, 2) == 20);
+	CHECK(pChained->cOpens == 0);
+	CHECK(!store.IsChainedOpen());
+}
+
+// A property we do not have is looked up in the chained store, which is opened once, and only to read
+static void TestOwnMiss()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(2, 20);
+	pChained->Add(5, 50);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, true));
+
+	CHECK(ValueOf(store, 5) == 50);
+	CHECK(store.IsChainedOpen());
+	CHECK(pChained->cOpens == 1 && !pChained->bOpenedReadWrite);
+
+	CHECK(ValueOf(store, 7) == -1);
+	CHECK(ValueOf(store, 5) == 50);
+	CHECK(pChained->cOpens == 1);
+
+	// Closing lets go of the chained store too, so that it is loaded again for the next file
+	store.Close();
+	CHECK(!store.IsChainedOpen());
+	CHECK_HR(S_OK, store.Open(TestFile, false));
+	CHECK(ValueOf(store, 2) == 20);
+	CHECK(pChained->cOpens == 1);
+	CHECK(ValueOf(store, 5) == 50);
+	CHECK(pChained->cOpens == 2);
+}
+
+// Enumerating needs both stores' keys, whichever call comes first
+static void TestEnumerationLoads()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(2, 20);
+	pChained->Add(5, 50);
+
+	CChainedMetadataStore byCount(pOwn, pChained);
+	CHECK_HR(S_OK, byCount.Open(TestFile, false));
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, byCount.GetCount(&cProps));
+	CHECK(cProps == 2);
+	CHECK(pChained->cOpens == 1 && byCount.IsChainedOpen());
+
+	pOwn = new CFakeStore();
+	pChained = new CFakeStore();
+	pOwn->Add(2, 20);
+	pChained->Add(5, 50);
+
+	CChainedMetadataStore byAt(pOwn, pChained);
+	CHECK_HR(S_OK, byAt.Open(TestFile, false));
+	PROPERTYKEY key;
+	CHECK_HR(S_OK, byAt.GetAt(1, &key));
+	CHECK(key.pid == 5);
+	CHECK(pChained->cOpens == 1 && byAt.IsChainedOpen());
+}
+
+// The marker stands in for a value we do not have, ahead of the chained store, which it does not load
+static void TestMarker()
+{
+	static const PROPID MarkerPid = 9;
+
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pChained->Add(MarkerPid, 90);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	store.SetMarker(CFakeStore::Key(MarkerPid), L"File Metadata");
+	CHECK_HR(S_OK, store.Open(TestFile, true));
+
+	PROPVARIANT propvar;
+	CHECK_HR(S_OK, store.GetValue(CFakeStore::Key(MarkerPid), &propvar));
+	CHECK(propvar.vt == VT_LPWSTR && wcscmp(propvar.pwszVal, L"File Metadata") == 0);
+	PropVariantClear(&propvar);
+	CHECK(pChained->cOpens == 0);
+
+	// Still so once enumeration has indexed the chained store's value for it
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 1);
+	CHECK_HR(S_OK, store.GetValue(CFakeStore::Key(MarkerPid), &propvar));
+	CHECK(propvar.vt == VT_LPWSTR && wcscmp(propvar.pwszVal, L"File Metadata") == 0);
+	PropVariantClear(&propvar);
+	CHECK(pChained->cGetValues == 0);
+
+	// Once we have a value of our own, that is what is returned
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(MarkerPid), I4(7)));
+	CHECK(ValueOf(store, MarkerPid) == 7);
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(ValueOf(store, MarkerPid) == 7);
+}
+
+// A chained store that will not open is treated as having no properties, and is not tried again
+static void TestChainedUnavailable()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(2, 20);
+	pChained->Add(5, 50);
+	pChained->bFailOpen = true;
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, false));
+	CHECK(ValueOf(store, 5) == -1);
+	CHECK(!store.IsChainedOpen());
+
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 1);
+	CHECK(ValueOf(store, 2) == 20);
+	CHECK(ValueOf(store, 5) == -1);
+	CHECK(pChained->cOpens == 1);
+	CHECK(pChained->cGetCounts == 0 && pChained->cGetValues == 0);
+
+	// Nor does it matter if there is nothing to chain to
+	pOwn = new CFakeStore();
+	pOwn->Add(2, 20);
+	CChainedMetadataStore unchained(pOwn, NULL);
+	CHECK_HR(S_OK, unchained.Open(TestFile, false));
+	CHECK(ValueOf(unchained, 5) == -1);
+	CHECK_HR(S_OK, unchained.GetCount(&cProps));
+	CHECK(cProps == 1);
+}
+
+#pragma endregion
+
+#pragma region The key index
+
+// A key that both stores have is listed once, in order, and its value is ours, without asking the chained store
+static void TestIndexDuplicates()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(3, 30);
+	pOwn->Add(1, 10);
+	pChained->Add(3, 300);
+	pChained->Add(2, 20);
+	pChained->Add(1, 100);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, false));
+
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+
+	static const PROPID Pids[] = { 1, 2, 3 };
+	static const LONG Values[] = { 10, 20, 30 };
+	for (DWORD i = 0; i < cProps && i < 3; i++)
+	{
+		PROPERTYKEY key;
+		CHECK_HR(S_OK, store.GetAt(i, &key));
+		CHECK(key.fmtid == FMTID_Test && key.pid == Pids[i]);
+		CHECK(ValueOf(store, key.pid) == Values[i]);
+	}
+	CHECK(pOwn->cGetValues == 2);
+	CHECK(pChained->cGetValues == 1);
+}
+
+// Changing the value of a property we already have leaves the index as it was, so enumeration is undisturbed
+static void TestIndexStableOnUpdate()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(1, 10);
+	pOwn->Add(3, 30);
+	pChained->Add(2, 20);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, true));
+
+	PROPERTYKEY key;
+	CHECK_HR(S_OK, store.GetAt(0, &key));
+	CHECK(key.pid == 1);
+	int cOwnGetCounts = pOwn->cGetCounts;
+	int cChainedGetAts = pChained->cGetAts;
+
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(3), I4(33)));
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(1), I4(11)));
+
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+	CHECK_HR(S_OK, store.GetAt(1, &key));
+	CHECK(key.pid == 2);
+	CHECK_HR(S_OK, store.GetAt(2, &key));
+	CHECK(key.pid == 3);
+	CHECK(ValueOf(store, 3) == 33);
+	CHECK(ValueOf(store, 1) == 11);
+	CHECK(pOwn->cGetCounts == cOwnGetCounts);
+	CHECK(pChained->cGetAts == cChainedGetAts);
+}
+
+// Gaining a property or losing one of ours changes what is listed, and from which store
+static void TestIndexInvalidation()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(1, 10);
+	pOwn->Add(3, 30);
+	pChained->Add(2, 20);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, true));
+
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+
+	// A new property
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(4), I4(40)));
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 4);
+	PROPERTYKEY key;
+	CHECK_HR(S_OK, store.GetAt(3, &key));
+	CHECK(key.pid == 4);
+	CHECK(ValueOf(store, 4) == 40);
+
+	// One that only the chained store had, which is now ours
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(2), I4(22)));
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 4);
+	CHECK(ValueOf(store, 2) == 22);
+
+	// Removing one that only we had
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(4), Empty()));
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+	CHECK(ValueOf(store, 4) == -1);
+
+	// Removing ours shows the chained value again
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(2), Empty()));
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+	CHECK_HR(S_OK, store.GetAt(1, &key));
+	CHECK(key.pid == 2);
+	CHECK(ValueOf(store, 2) == 20);
+
+	// Removing something that neither store has changes nothing
+	int cOwnGetCounts = pOwn->cGetCounts;
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(9), Empty()));
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+	CHECK(pOwn->cGetCounts == cOwnGetCounts);
+}
+
+// The value of the key last given out by GetAt, and of any other in the index, comes from its own store alone
+static void TestIndexLastAt()
+{
+	CFakeStore* pOwn = new CFakeStore();
+	CFakeStore* pChained = new CFakeStore();
+	pOwn->Add(5, 50);
+	pOwn->Add(1, 10);
+	pOwn->Add(3, 30);
+	pChained->Add(4, 40);
+	pChained->Add(2, 20);
+
+	CChainedMetadataStore store(pOwn, pChained);
+	CHECK_HR(S_OK, store.Open(TestFile, true));
+
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 5);
+	for (DWORD i = 0; i < cProps; i++)
+	{
+		PROPERTYKEY key;
+		CHECK_HR(S_OK, store.GetAt(i, &key));
+		CHECK(key.pid == i + 1);
+
+		int cOwnGetValues = pOwn->cGetValues;
+		int cChainedGetValues = pChained->cGetValues;
+		CHECK(ValueOf(store, key.pid) == (LONG)(key.pid * 10));
+		if (key.pid % 2 == 1)
+			CHECK(pOwn->cGetValues == cOwnGetValues + 1 && pChained->cGetValues == cChainedGetValues);
+		else
+			CHECK(pOwn->cGetValues == cOwnGetValues && pChained->cGetValues == cChainedGetValues + 1);
+	}
+
+	// Other keys than the last are found by search, and one that is in neither store is still looked for in both
+	PROPERTYKEY key;
+	CHECK_HR(S_OK, store.GetAt(4, &key));
+	CHECK(ValueOf(store, 2) == 20);
+	CHECK(ValueOf(store, 1) == 10);
+	int cOwnGetValues = pOwn->cGetValues;
+	int cChainedGetValues = pChained->cGetValues;
+	CHECK(ValueOf(store, 6) == -1);
+	CHECK(pOwn->cGetValues == cOwnGetValues + 1 && pChained->cGetValues == cChainedGetValues + 1);
+
+	// Once the index is shorter than the last position given out, that position is not used
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(5), Empty()));
+	CHECK_HR(S_OK, store.SetValue(CFakeStore::Key(3), Empty()));
+	CHECK_HR(S_OK, store.GetCount(&cProps));
+	CHECK(cProps == 3);
+	CHECK(ValueOf(store, 5) == -1);
+	CHECK(ValueOf(store, 4) == 40);
+	CHECK_HR(E_INVALIDARG, store.GetAt(3, &key));
+}
+
+#pragma endregion
+
+int main()
+{
+	TestOwnHit();
+	TestOwnMiss();
+	TestEnumerationLoads();
+	TestMarker();
+	TestChainedUnavailable();
+	TestIndexDuplicates();
+	TestIndexStableOnUpdate();
+	TestIndexInvalidation();
+	TestIndexLastAt();
+
+	return TestResult("chained store");
+}
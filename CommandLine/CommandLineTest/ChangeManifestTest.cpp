@@ -0,0 +1,167 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for CChangeManifest, whose manifest and target files are written to the directory given on the
+// command line, with the targets' metadata kept in memory and stamped by the memory store.
+
+#include "ChangeManifest.h"
+#include "FakeStore.h"
+#include "TestSupport.h"
+#include <memory>
+
+static std::wstring s_directory = L".";
+
+static MetadataStamp MakeStamp(ULONGLONG fileId, ULONGLONG size, ULONGLONG changed)
+{
+	MetadataStamp stamp;
+	stamp.fileId = fileId;
+	stamp.size = size;
+	stamp.changed = changed;
+	return stamp;
+}
+
+// Sets a property of a file in memory, and returns the stamp that its metadata has after
+static MetadataStamp WriteMetadata(const std::wstring& targetFile, LONG lValue)
+{
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(MemoryMetadataStore));
+	CHECK_HR(S_OK, pStore->Open(targetFile.c_str(), true));
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(2), I4(lValue)));
+	CHECK_HR(S_OK, pStore->Commit());
+	pStore->Close();
+
+	MetadataStamp stamp;
+	CHECK_HR(S_OK, pStore->Stamp(targetFile.c_str(), &stamp));
+	return stamp;
+}
+
+// What is saved is what is loaded, including paths that are not ASCII and values that need all 64 bits
+static void TestRoundTrip()
+{
+	std::wstring path = s_directory + L"/manifest-round-trip.txt";
+	std::wstring target1 = L"/tree/caf\x00e9.txt";
+	std::wstring target2 = L"/tree/b.txt";
+	MetadataStamp stamp1 = MakeStamp(0xfedcba9876543210ULL, 0x1234, 0x01d9000000000000ULL);
+	MetadataStamp stamp2 = MakeStamp(7, 0, 1);
+
+	CChangeManifest manifest;
+	manifest.Update(target1, stamp1, L"/out/caf\x00e9.txt.metadata.xml", 0x8000000000000001ULL);
+	manifest.Update(target2, stamp2, L"/out/b.txt.metadata.xml", 42);
+	CHECK(manifest.Save(path.c_str()) == 0);
+
+	CChangeManifest loaded;
+	CHECK(loaded.Load(path.c_str()) == 0);
+	ULONGLONG hash;
+	CHECK(loaded.IsUnchanged(target1, stamp1, L"/out/caf\x00e9.txt.metadata.xml", &hash));
+	CHECK(hash == 0x8000000000000001ULL);
+	CHECK(loaded.IsUnchanged(target2, stamp2, L"/out/b.txt.metadata.xml", &hash));
+	CHECK(hash == 42);
+
+	// Saved again, it is just as it was
+	std::vector<BYTE> before, after;
+	CHECK(ReadFileBytes(path.c_str(), before) == 0);
+	CHECK(loaded.Save(path.c_str()) == 0);
+	CHECK(ReadFileBytes(path.c_str(), after) == 0);
+	CHECK(before == after);
+
+	// Anything else is not a manifest at all
+	const char szOther[] = "not a manifest\n";
+	CHECK(WriteFileBytes(path, std::vector<BYTE>(szOther, szOther + sizeof(szOther) - 1)));
+	CHECK(loaded.Load(path.c_str()) == ERROR_FILE_CORRUPT);
+	RemoveFile(path);
+}
+
+// Any part of the stamp changing, or the export going elsewhere, means that the file must be exported again
+static void TestIsUnchanged()
+{
+	std::wstring target = L"/tree/a.txt";
+	std::wstring exportFile = L"/out/a.txt.metadata.xml";
+	MetadataStamp stamp = MakeStamp(1, 2, 3);
+
+	CChangeManifest manifest;
+	ULONGLONG hash = 99;
+	CHECK(!manifest.IsUnchanged(target, stamp, exportFile, &hash));
+	CHECK(hash == 0);
+
+	manifest.Update(target, stamp, exportFile, 77);
+	CHECK(manifest.IsUnchanged(target, stamp, exportFile, &hash));
+	CHECK(hash == 77);
+
+	// The hash of the same export is still given, so that an unchanged export need not be written
+	CHECK(!manifest.IsUnchanged(target, MakeStamp(9, 2, 3), exportFile, &hash));
+	CHECK(hash == 77);
+	CHECK(!manifest.IsUnchanged(target, MakeStamp(1, 9, 3), exportFile, &hash));
+	CHECK(!manifest.IsUnchanged(target, MakeStamp(1, 2, 9), exportFile, &hash));
+
+	CHECK(!manifest.IsUnchanged(target, stamp, L"/other/a.txt.metadata.xml", &hash));
+	CHECK(hash == 0);
+
+	// The memory store's stamp changes with each commit
+	std::wstring memoryTarget = s_directory + L"/manifest-stamped.txt";
+	MetadataStamp stamped = WriteMetadata(memoryTarget, 1);
+	manifest.Update(memoryTarget, stamped, exportFile, 5);
+	CHECK(manifest.IsUnchanged(memoryTarget, stamped, exportFile, &hash));
+	MetadataStamp restamped = WriteMetadata(memoryTarget, 2);
+	CHECK(!manifest.IsUnchanged(memoryTarget, restamped, exportFile, &hash));
+
+	// Update records the new export
+	manifest.Update(memoryTarget, restamped, exportFile, 6);
+	CHECK(manifest.IsUnchanged(memoryTarget, restamped, exportFile, &hash));
+	CHECK(hash == 6);
+}
+
+// Only files that were neither seen this time nor are still there are taken to be deleted
+static void TestRemoveDeleted()
+{
+	std::wstring path = s_directory + L"/manifest-deleted.txt";
+	std::wstring seen = s_directory + L"/manifest-seen.txt";
+	std::wstring present = s_directory + L"/manifest-present.txt";
+	std::wstring gone = s_directory + L"/manifest-gone.txt";
+	std::vector<BYTE> content(1, 'x');
+	CHECK(WriteFileBytes(seen, content));
+	CHECK(WriteFileBytes(present, content));
+	CHECK(WriteFileBytes(gone, content));
+
+	MetadataStamp stampSeen = WriteMetadata(seen, 1);
+	MetadataStamp stampPresent = WriteMetadata(present, 1);
+	MetadataStamp stampGone = WriteMetadata(gone, 1);
+
+	{
+		CChangeManifest manifest;
+		manifest.Update(seen, stampSeen, seen + L".metadata.xml", 1);
+		manifest.Update(present, stampPresent, present + L".metadata.xml", 2);
+		manifest.Update(gone, stampGone, gone + L".metadata.xml", 3);
+		CHECK(manifest.Save(path.c_str()) == 0);
+	}
+	RemoveFile(gone);
+	RemoveFile(seen);
+
+	CChangeManifest manifest;
+	CHECK(manifest.Load(path.c_str()) == 0);
+	ULONGLONG hash;
+	CHECK(manifest.IsUnchanged(seen, stampSeen, seen + L".metadata.xml", &hash));
+
+	std::vector<std::wstring> deleted;
+	manifest.RemoveDeleted(deleted);
+	CHECK(deleted.size() == 1 && deleted[0] == gone);
+
+	CHECK(manifest.IsUnchanged(seen, stampSeen, seen + L".metadata.xml", &hash));
+	CHECK(manifest.IsUnchanged(present, stampPresent, present + L".metadata.xml", &hash));
+	CHECK(!manifest.IsUnchanged(gone, stampGone, gone + L".metadata.xml", &hash));
+
+	manifest.RemoveDeleted(deleted);
+	CHECK(deleted.empty());
+
+	RemoveFile(present);
+	RemoveFile(path);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+		s_directory = WidePath(argv[1]);
+
+	TestRoundTrip();
+	TestIsUnchanged();
+	TestRemoveDeleted();
+
+	return TestResult("change manifest");
+}
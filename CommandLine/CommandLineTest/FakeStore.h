@@ -0,0 +1,145 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// A store of VT_I4 values for tests, which counts the calls made to it, so that a test can see not only what
+// a store over it returns, but when it is opened and read.
+
+#pragma once
+
+#include "MetadataStore.h"
+
+static const FMTID FMTID_Test = { 0x3b5c2e10, 0x7a41, 0x4d8e, { 0xa1, 0x6f, 0x02, 0x9c, 0x5e, 0x43, 0xb7, 0x18 } };
+
+// VT_I4 values kept in the order they were added, as a real store has no particular order
+class CFakeStore : public IMetadataStore
+{
+public:
+	CFakeStore() : cOpens(0), cGetCounts(0), cGetAts(0), cGetValues(0), bOpenedReadWrite(false), bFailOpen(false) {}
+
+	void Add(PROPID pid, LONG lValue)
+	{
+		_keys.push_back(Key(pid));
+		_values.push_back(lValue);
+	}
+
+	virtual HRESULT Open(const WCHAR* /*pszFilePath*/, bool bReadWrite)
+	{
+		cOpens++;
+		bOpenedReadWrite = bReadWrite;
+		return bFailOpen ? STG_E_FILENOTFOUND : S_OK;
+	}
+
+	virtual void Close() {}
+
+	virtual HRESULT GetCount(DWORD* pcProps)
+	{
+		cGetCounts++;
+		*pcProps = (DWORD)_keys.size();
+		return S_OK;
+	}
+
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey)
+	{
+		cGetAts++;
+		if (iProp >= _keys.size())
+			return E_INVALIDARG;
+		*pkey = _keys[iProp];
+		return S_OK;
+	}
+
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+	{
+		cGetValues++;
+		PropVariantInit(pPropVar);
+		size_t i = Find(key);
+		if (i < _keys.size())
+		{
+			pPropVar->vt = VT_I4;
+			pPropVar->lVal = _values[i];
+		}
+		return S_OK;
+	}
+
+	// An empty value removes the property
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar)
+	{
+		size_t i = Find(key);
+		if (propVar.vt == VT_EMPTY)
+		{
+			if (i < _keys.size())
+			{
+				_keys.erase(_keys.begin() + i);
+				_values.erase(_values.begin() + i);
+			}
+		}
+		else if (propVar.vt != VT_I4)
+			return E_INVALIDARG;
+		else if (i < _keys.size())
+			_values[i] = propVar.lVal;
+		else
+		{
+			_keys.push_back(key);
+			_values.push_back(propVar.lVal);
+		}
+		return S_OK;
+	}
+
+	virtual HRESULT Commit() { return S_OK; }
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& /*fmtids*/) { return E_NOTIMPL; }
+	virtual HRESULT DeletePropertySet(REFFMTID /*fmtid*/) { return E_NOTIMPL; }
+	virtual HRESULT Probe(const WCHAR* /*pszFilePath*/) { return E_NOTIMPL; }
+	virtual HRESULT Stamp(const WCHAR* /*pszFilePath*/, MetadataStamp* /*pStamp*/) { return E_NOTIMPL; }
+
+	static PROPERTYKEY Key(PROPID pid)
+	{
+		PROPERTYKEY key;
+		key.fmtid = FMTID_Test;
+		key.pid = pid;
+		return key;
+	}
+
+	int		cOpens;
+	int		cGetCounts;
+	int		cGetAts;
+	int		cGetValues;
+	bool	bOpenedReadWrite;
+	bool	bFailOpen;
+
+private:
+	size_t Find(REFPROPERTYKEY key) const
+	{
+		size_t i = 0;
+		while (i < _keys.size() && !(_keys[i].fmtid == key.fmtid && _keys[i].pid == key.pid))
+			i++;
+		return i;
+	}
+
+	std::vector<PROPERTYKEY>	_keys;
+	std::vector<LONG>			_values;
+};
+
+inline PROPVARIANT I4(LONG lValue)
+{
+	PROPVARIANT propvar;
+	PropVariantInit(&propvar);
+	propvar.vt = VT_I4;
+	propvar.lVal = lValue;
+	return propvar;
+}
+
+inline PROPVARIANT Empty()
+{
+	PROPVARIANT propvar;
+	PropVariantInit(&propvar);
+	return propvar;
+}
+
+// The value of a property, or -1 if it has none, or -2 if it cannot be read
+inline LONG ValueOf(IMetadataStore& store, PROPID pid)
+{
+	PROPVARIANT propvar;
+	if (FAILED(store.GetValue(CFakeStore::Key(pid), &propvar)))
+		return -2;
+	LONG lValue = propvar.vt == VT_I4 ? propvar.lVal : -1;
+	PropVariantClear(&propvar);
+	return lValue;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for CHandlerTable, loaded from stand-in registrations written to the directory given on the command line
+
+#include "HandlerTable.h"
+#include "TestSupport.h"
+#include <string.h>
+
+static std::wstring s_directory = L".";
+
+static const WCHAR* OurHandler64 = L"{D06391EE-2FEB-419B-9667-AD160D0849F3}";
+static const WCHAR* OurHandler32 = L"{60211757-EF87-465e-B6C1-B37CF98295F9}";
+
+// Both of our handlers, one in another case, someone else's, extensions either side of what fits in a slot,
+// and the comments, blank lines and line endings that the stand-in allows
+static const char StandIn[] =
+	"# Stand-in registrations\n"
+	"\n"
+	".txt {D06391EE-2FEB-419B-9667-AD160D0849F3}\n"
+	".Md {d06391ee-2feb-419b-9667-ad160d0849f3}\r\n"
+	".bit32 {60211757-EF87-465e-B6C1-B37CF98295F9}\n"
+	".DOCX {F2D3E4C5-0A1B-4C2D-9E8F-A0B1C2D3E4F5}\n"
+	".abcdefg {D06391EE-2FEB-419B-9667-AD160D0849F3}\n"
+	".abcdefgh {D06391EE-2FEB-419B-9667-AD160D0849F3}\n"
+	".longerextension {F2D3E4C5-0A1B-4C2D-9E8F-A0B1C2D3E4F5}\n"
+	"# .skipped {D06391EE-2FEB-419B-9667-AD160D0849F3}\n";
+
+static std::wstring WriteStandIn(const char* pszName, const char* pszText)
+{
+	std::wstring path = s_directory + L"/" + WidePath(pszName);
+	CHECK(WriteFileBytes(path, std::vector<BYTE>(pszText, pszText + strlen(pszText))));
+	return path;
+}
+
+// Extensions match whatever their case, in the file name or in the registrations
+static void TestClassify()
+{
+	std::wstring path = WriteStandIn("handlers-classify.txt", StandIn);
+	CFileHandlerSource source(path.c_str());
+	CHandlerTable table;
+	CHECK(table.Load(source, OurHandler64) == 0);
+	CHECK(table.GetCount() == 7);
+
+	CHECK(table.Classify(L"/tree/notes.txt") == 1);
+	CHECK(table.Classify(L"/tree/NOTES.TXT") == 1);
+	CHECK(table.Classify(L"C:\\tree\\Read.Me.md") == 1);
+	CHECK(table.Classify(L"report.docx") == -1);
+	CHECK(table.Classify(L"report.DocX") == -1);
+	CHECK(table.Classify(L"old.bit32") == -1);
+
+	// Inline up to the length of a slot, and in the pool beyond it
+	CHECK(table.Classify(L"a.ABCDEFG") == 1);
+	CHECK(table.Classify(L"a.abcdefgh") == 1);
+	CHECK(table.Classify(L"a.abcdefghi") == 0);
+	CHECK(table.Classify(L"a.LongerExtension") == -1);
+	CHECK(table.Classify(L"a.longerextensio") == 0);
+
+	// Nothing registered, or no extension at all, including where the only dot is in a directory
+	CHECK(table.Classify(L"a.skipped") == 0);
+	CHECK(table.Classify(L"a.tx") == 0);
+	CHECK(table.Classify(L"README") == 0);
+	CHECK(table.Classify(L"/tree/dir.txt/README") == 0);
+	CHECK(table.Classify(L"") == 0);
+
+	// Which handler is ours depends on the build
+	CHECK(table.Load(source, OurHandler32) == 0);
+	CHECK(table.Classify(L"old.bit32") == 1);
+	CHECK(table.Classify(L"notes.txt") == -1);
+	RemoveFile(path);
+}
+
+// A source that cannot be read leaves the table empty
+static void TestLoadFailure()
+{
+	std::wstring path = WriteStandIn("handlers-corrupt.txt", ".txt {D06391EE-2FEB-419B-9667-AD160D0849F3}\ntxt {D06391EE-2FEB-419B-9667-AD160D0849F3}\n");
+	CFileHandlerSource corrupt(path.c_str());
+	CHandlerTable table;
+	CHECK(table.Load(corrupt, OurHandler64) == ERROR_FILE_CORRUPT);
+	CHECK(table.GetCount() == 0);
+	CHECK(table.Classify(L"notes.txt") == 0);
+	RemoveFile(path);
+
+	CFileHandlerSource missing(path.c_str());
+	CHECK(table.Load(missing, OurHandler64) == ERROR_FILE_NOT_FOUND);
+	CHECK(table.GetCount() == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+		s_directory = WidePath(argv[1]);
+
+	TestClassify();
+	TestLoadFailure();
+
+	return TestResult("handler table");
+}
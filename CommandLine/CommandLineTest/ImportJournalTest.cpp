@@ -0,0 +1,239 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for the import journal and the undo log, whose files are written to the directory given on the command
+// line, and for putting back what an import into a memory store overwrote.
+
+#include "FakeStore.h"
+#include "ImportJournal.h"
+#include "TestSupport.h"
+#include "XmlHelpers.h"
+#include <memory>
+
+static std::wstring s_directory = L".";
+
+#pragma region Helpers
+
+static PROPERTYKEY SummaryKey(PROPID pid)
+{
+	PROPERTYKEY key;
+	key.fmtid = FMTID_SummaryInformation;
+	key.pid = pid;
+	return key;
+}
+
+// The string value of a property, or an empty string if it has none
+static std::wstring StringOf(IMetadataStore& store, REFPROPERTYKEY key)
+{
+	PROPVARIANT propvar;
+	if (FAILED(store.GetValue(key, &propvar)))
+		return L"(failed)";
+	std::wstring s = propvar.vt == VT_LPWSTR ? propvar.pwszVal : L"";
+	PropVariantClear(&propvar);
+	return s;
+}
+
+// Replaces a file's metadata with a subject and a comment, recording what it overwrites
+static void ImportReplacing(const std::wstring& targetFile, const WCHAR* pszSubject, IUndoRecorder* pUndo)
+{
+	std::wstring xml = std::wstring(
+		L"<Metadata>\n"
+		L"\t<Storage FormatID=\"{F29F85E0-4FF9-1068-AB91-08002B27B3D9}\">\n"
+		L"\t\t<Property Id=\"3\" Type=\"VT_LPWSTR\" TypeId=\"31\">\n"
+		L"\t\t\t<Value>") + pszSubject + L"</Value>\n"
+		L"\t\t</Property>\n"
+		L"\t\t<Property Id=\"6\" Type=\"VT_LPWSTR\" TypeId=\"31\">\n"
+		L"\t\t\t<Value>comment</Value>\n"
+		L"\t\t</Property>\n"
+		L"\t</Storage>\n"
+		L"</Metadata>\n";
+
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore(MemoryMetadataStore));
+	try
+	{
+		ImportMetadataFromXml(&xml[0], pStore.get(), targetFile, targetFile + MetadataFileSuffix, ReplaceImport, pUndo);
+	}
+	catch (CPHException& e)
+	{
+		CHECK_HR(S_OK, e.GetHResult());
+	}
+}
+
+#pragma endregion
+
+#pragma region The journal
+
+// What was committed is done when the journal is reopened, and what was only started is not
+static void TestJournalResume()
+{
+	std::wstring path = s_directory + L"/journal-resume.txt";
+	RemoveFile(path);
+
+	CImportJournal journal;
+	CHECK(journal.Open(path.c_str()) == 0);
+	CHECK(journal.Start(L"/a.txt") == 0);
+	CHECK(journal.Done(L"/a.txt") == 0);
+	CHECK(journal.Start(L"/b.txt") == 0);
+	CHECK(!journal.IsDone(L"/a.txt"));		// only what an earlier run recorded
+	CHECK(journal.Close(false) == 0);
+
+	CHECK(journal.Open(path.c_str()) == 0);
+	CHECK(journal.IsDone(L"/a.txt"));
+	CHECK(!journal.IsDone(L"/b.txt"));
+	CHECK(journal.Done(L"/b.txt") == 0);
+	CHECK(journal.Close(false) == 0);
+
+	CHECK(journal.Open(path.c_str()) == 0);
+	CHECK(journal.IsDone(L"/a.txt") && journal.IsDone(L"/b.txt"));
+
+	// Once everything is imported, there is nothing left to resume
+	CHECK(journal.Close(true) == 0);
+	std::vector<BYTE> data;
+	CHECK(ReadFileBytes(path.c_str(), data) == ERROR_FILE_NOT_FOUND);
+}
+
+// A line cut short by a run that stopped while writing it does not count, and is written over
+static void TestJournalIncompleteLine()
+{
+	std::wstring path = s_directory + L"/journal-incomplete.txt";
+	RemoveFile(path);
+
+	CImportJournal journal;
+	CHECK(journal.Open(path.c_str()) == 0);
+	CHECK(journal.Done(L"/a.txt") == 0);
+	CHECK(journal.Close(false) == 0);
+
+	std::vector<BYTE> data;
+	CHECK(ReadFileBytes(path.c_str(), data) == 0);
+	const char szPartial[] = "= /c.txt";
+	data.insert(data.end(), szPartial, szPartial + sizeof(szPartial) - 1);
+	CHECK(WriteFileBytes(path, data));
+
+	CHECK(journal.Open(path.c_str()) == 0);
+	CHECK(journal.IsDone(L"/a.txt"));
+	CHECK(!journal.IsDone(L"/c.txt"));
+	CHECK(journal.Done(L"/d.txt") == 0);
+	CHECK(journal.Close(false) == 0);
+
+	CHECK(journal.Open(path.c_str()) == 0);
+	CHECK(journal.IsDone(L"/a.txt") && journal.IsDone(L"/d.txt"));
+	CHECK(!journal.IsDone(L"/c.txt"));
+	CHECK(journal.Close(true) == 0);
+
+	// Anything else is not a journal at all
+	const char szOther[] = "not a journal\n";
+	CHECK(WriteFileBytes(path, std::vector<BYTE>(szOther, szOther + sizeof(szOther) - 1)));
+	CHECK(journal.Open(path.c_str()) == ERROR_FILE_CORRUPT);
+	RemoveFile(path);
+}
+
+#pragma endregion
+
+#pragma region The undo log
+
+// A replace import removes what it does not import, and putting back what it recorded restores the lot
+static void TestUndoRoundTrip()
+{
+	std::wstring logPath = s_directory + L"/undo-round-trip.log";
+	std::wstring targetFile = L"/undo/round-trip.txt";
+	RemoveFile(logPath);
+
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(MemoryMetadataStore));
+	CHECK_HR(S_OK, pStore->Open(targetFile.c_str(), true));
+	LPWSTR pszOld = AllocString(L"old subject");
+	PROPVARIANT propvar;
+	PropVariantInit(&propvar);
+	propvar.vt = VT_LPWSTR;
+	propvar.pwszVal = pszOld;
+	CHECK_HR(S_OK, pStore->SetValue(SummaryKey(3), propvar));
+	PropVariantClear(&propvar);
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(7), I4(70)));
+	CHECK_HR(S_OK, pStore->Commit());
+	pStore->Close();
+
+	CUndoLog log;
+	CHECK(log.Open(logPath.c_str()) == 0);
+	ImportReplacing(targetFile, L"new subject", &log);
+	CHECK(log.Close() == 0);
+
+	CHECK_HR(S_OK, pStore->Open(targetFile.c_str(), false));
+	CHECK(StringOf(*pStore, SummaryKey(3)) == L"new subject");
+	CHECK(StringOf(*pStore, SummaryKey(6)) == L"comment");
+	CHECK(ValueOf(*pStore, 7) == -1);
+	pStore->Close();
+
+	std::vector<UndoRecord> records;
+	CHECK(CUndoLog::Read(logPath.c_str(), records) == 0);
+	CHECK(records.size() == 1);
+	if (records.size() != 1)
+		return;
+	CHECK(records[0].targetFile == targetFile);
+	CHECK_HR(S_OK, ApplyUndo(records[0].targetFile, records[0].undo, MemoryMetadataStore));
+
+	CHECK_HR(S_OK, pStore->Open(targetFile.c_str(), false));
+	CHECK(StringOf(*pStore, SummaryKey(3)) == L"old subject");
+	CHECK(StringOf(*pStore, SummaryKey(6)) == L"");
+	CHECK(ValueOf(*pStore, 7) == 70);
+	pStore->Close();
+	RemoveFile(logPath);
+}
+
+// A record cut short at the end is ignored, and written over by the next record appended
+static void TestUndoTruncatedRecord()
+{
+	std::wstring logPath = s_directory + L"/undo-truncated.log";
+	std::wstring targetFile = L"/undo/truncated.txt";
+	RemoveFile(logPath);
+
+	CUndoLog log;
+	CHECK(log.Open(logPath.c_str()) == 0);
+	ImportReplacing(targetFile, L"first", &log);
+	ImportReplacing(targetFile, L"second", &log);
+	CHECK(log.Close() == 0);
+
+	std::vector<UndoRecord> records;
+	CHECK(CUndoLog::Read(logPath.c_str(), records) == 0);
+	CHECK(records.size() == 2);
+
+	std::vector<BYTE> data;
+	CHECK(ReadFileBytes(logPath.c_str(), data) == 0);
+	CHECK(data.size() > 8);
+	data.resize(data.size() - 5);
+	CHECK(WriteFileBytes(logPath, data));
+
+	CHECK(CUndoLog::Read(logPath.c_str(), records) == 0);
+	CHECK(records.size() == 1 && records[0].targetFile == targetFile);
+
+	CHECK(log.Open(logPath.c_str()) == 0);
+	ImportReplacing(targetFile, L"third", &log);
+	CHECK(log.Close() == 0);
+
+	CHECK(CUndoLog::Read(logPath.c_str(), records) == 0);
+	CHECK(records.size() == 2);
+
+	// The record for the second import was lost, so the third's holds the second's subject
+	if (records.size() == 2 && records[1].undo.prior.size() == 1)
+	{
+		PROPVARIANT propvar;
+		CHECK_HR(S_OK, records[1].undo.prior[0].GetValue(3, &propvar));
+		CHECK(propvar.vt == VT_LPWSTR && wcscmp(propvar.pwszVal, L"second") == 0);
+		PropVariantClear(&propvar);
+	}
+	else
+		CHECK(false);
+	RemoveFile(logPath);
+}
+
+#pragma endregion
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+		s_directory = WidePath(argv[1]);
+
+	TestJournalResume();
+	TestJournalIncompleteLine();
+	TestUndoRoundTrip();
+	TestUndoTruncatedRecord();
+
+	return TestResult("import journal");
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for CMetadataSnapshot, taken over a chained store whose own store is in memory, so that it holds
+// strings and vectors, and whose chained store is a fake, so that the snapshot sees own, chained and marker
+// keys alike.
+
+#include "FakeStore.h"
+#include "MetadataSnapshot.h"
+#include "TestSupport.h"
+
+static const WCHAR* TestFile = L"/snapshot/file.txt";
+static const PROPID MarkerPid = 9;
+static const WCHAR* MarkerValue = L"FileMetadata";
+
+static PROPVARIANT String(VARTYPE vt, const WCHAR* psz)
+{
+	PROPVARIANT propvar;
+	PropVariantInit(&propvar);
+	propvar.vt = vt;
+	if (vt == VT_BSTR)
+		propvar.bstrVal = AllocBstr(psz);
+	else
+		propvar.pwszVal = AllocString(psz);
+	return propvar;
+}
+
+// Our own values, written through a store of their own, as an earlier import would have
+static void WriteOwn()
+{
+	IMetadataStore* pStore = CreateMetadataStore(MemoryMetadataStore);
+	CHECK_HR(S_OK, pStore->Open(TestFile, true));
+
+	PROPVARIANT propvar = String(VT_LPWSTR, L"alpha");
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(2), propvar));
+	PropVariantClear(&propvar);
+
+	PropVariantInit(&propvar);
+	propvar.vt = VT_VECTOR | VT_LPWSTR;
+	propvar.calpwstr.cElems = 2;
+	propvar.calpwstr.pElems = (LPWSTR*)CoTaskMemAlloc(2 * sizeof(LPWSTR));
+	propvar.calpwstr.pElems[0] = AllocString(L"x");
+	propvar.calpwstr.pElems[1] = AllocString(L"yz");
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(3), propvar));
+	PropVariantClear(&propvar);
+
+	PropVariantInit(&propvar);
+	propvar.vt = VT_VECTOR | VT_I4;
+	propvar.cal.cElems = 3;
+	propvar.cal.pElems = (LONG*)CoTaskMemAlloc(3 * sizeof(LONG));
+	for (LONG i = 0; i < 3; i++)
+		propvar.cal.pElems[i] = i + 1;
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(4), propvar));
+	PropVariantClear(&propvar);
+
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(5), I4(50)));
+
+	propvar = String(VT_BSTR, L"kept");
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(6), propvar));
+	PropVariantClear(&propvar);
+
+	CHECK_HR(S_OK, pStore->Commit());
+	pStore->Close();
+	delete pStore;
+}
+
+static CChainedMetadataStore* OpenChained()
+{
+	CFakeStore* pChained = new CFakeStore();
+	pChained->Add(5, 500);
+	pChained->Add(7, 70);
+	pChained->Add(MarkerPid, 90);
+
+	CChainedMetadataStore* pStore = new CChainedMetadataStore(CreateMetadataStore(MemoryMetadataStore), pChained);
+	pStore->SetMarker(CFakeStore::Key(MarkerPid), MarkerValue);
+	CHECK_HR(S_OK, pStore->Open(TestFile, true));
+	return pStore;
+}
+
+static bool InSpan(const void* pv, const BYTE* pLow, const BYTE* pHigh)
+{
+	return (const BYTE*)pv >= pLow && (const BYTE*)pv < pHigh;
+}
+
+// Every key, whichever store it comes from, in the order the store enumerates them, with the values to match
+static void TestTake()
+{
+	CChainedMetadataStore* pStore = OpenChained();
+	CMetadataSnapshot snapshot;
+	CHECK_HR(S_OK, snapshot.Take(pStore));
+
+	DWORD cProps = 0;
+	CHECK_HR(S_OK, pStore->GetCount(&cProps));
+	CHECK(cProps == 7);
+	CHECK(snapshot.GetCount() == cProps);
+	for (DWORD i = 0; i < cProps && i < snapshot.GetCount(); i++)
+	{
+		PROPERTYKEY key;
+		CHECK_HR(S_OK, pStore->GetAt(i, &key));
+		CHECK(snapshot.GetKeys()[i] == key);
+	}
+
+	// Our value hides the chained one, the chained store fills in what we lack, and the marker hides the chained value
+	const PROPVARIANT* pValue = snapshot.Find(CFakeStore::Key(5));
+	CHECK(pValue != NULL && pValue->vt == VT_I4 && pValue->lVal == 50);
+	pValue = snapshot.Find(CFakeStore::Key(7));
+	CHECK(pValue != NULL && pValue->vt == VT_I4 && pValue->lVal == 70);
+	pValue = snapshot.Find(CFakeStore::Key(MarkerPid));
+	CHECK(pValue != NULL && pValue->vt == VT_LPWSTR && wcscmp(pValue->pwszVal, MarkerValue) == 0);
+	CHECK(snapshot.Find(CFakeStore::Key(8)) == NULL);
+
+	// Found again, and in reverse order, to go round the fast path for the next key
+	for (PROPID pid = 9; pid >= 2; pid--)
+		CHECK((snapshot.Find(CFakeStore::Key(pid)) != NULL) == (pid != 8));
+
+	// The values must outlast the store they came from
+	delete pStore;
+
+	const PROPVARIANT* pString = snapshot.Find(CFakeStore::Key(2));
+	const PROPVARIANT* pStrings = snapshot.Find(CFakeStore::Key(3));
+	const PROPVARIANT* pLongs = snapshot.Find(CFakeStore::Key(4));
+	const PROPVARIANT* pBstr = snapshot.Find(CFakeStore::Key(6));
+	CHECK(pString != NULL && pString->vt == VT_LPWSTR && wcscmp(pString->pwszVal, L"alpha") == 0);
+	CHECK(pStrings != NULL && pStrings->vt == (VT_VECTOR | VT_LPWSTR) && pStrings->calpwstr.cElems == 2);
+	CHECK(pLongs != NULL && pLongs->vt == (VT_VECTOR | VT_I4) && pLongs->cal.cElems == 3);
+	CHECK(pBstr != NULL && pBstr->vt == VT_BSTR && wcscmp(pBstr->bstrVal, L"kept") == 0);
+	if (pString == NULL || pStrings == NULL || pLongs == NULL || pStrings->calpwstr.cElems != 2 || pLongs->cal.cElems != 3)
+		return;
+	CHECK(wcscmp(pStrings->calpwstr.pElems[0], L"x") == 0 && wcscmp(pStrings->calpwstr.pElems[1], L"yz") == 0);
+	CHECK(pLongs->cal.pElems[0] == 1 && pLongs->cal.pElems[1] == 2 && pLongs->cal.pElems[2] == 3);
+
+	// Strings and vectors are copied into one block, each part aligned for anything it might hold
+	const void* pParts[] = { pString->pwszVal, pStrings->calpwstr.pElems, pStrings->calpwstr.pElems[0],
+		pStrings->calpwstr.pElems[1], pLongs->cal.pElems };
+	const BYTE* pLow = (const BYTE*)pParts[0];
+	for (size_t i = 0; i < sizeof(pParts) / sizeof(pParts[0]); i++)
+	{
+		CHECK(((size_t)pParts[i] & (sizeof(ULONGLONG) - 1)) == 0);
+		if ((const BYTE*)pParts[i] < pLow)
+			pLow = (const BYTE*)pParts[i];
+	}
+	for (size_t i = 0; i < sizeof(pParts) / sizeof(pParts[0]); i++)
+		CHECK(InSpan(pParts[i], pLow, pLow + 256));
+}
+
+// Clear leaves nothing, and a snapshot taken again sees what has changed since
+static void TestClearAndRetake()
+{
+	CChainedMetadataStore* pStore = OpenChained();
+	CMetadataSnapshot snapshot;
+	CHECK_HR(S_OK, snapshot.Take(pStore));
+	CHECK(snapshot.GetCount() == 7);
+
+	snapshot.Clear();
+	CHECK(snapshot.GetCount() == 0);
+	CHECK(snapshot.GetKeys() == NULL && snapshot.GetValues() == NULL);
+	CHECK(snapshot.Find(CFakeStore::Key(5)) == NULL);
+
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(5), I4(51)));
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(8), I4(80)));
+	CHECK_HR(S_OK, snapshot.Take(pStore));
+	CHECK(snapshot.GetCount() == 8);
+	const PROPVARIANT* pValue = snapshot.Find(CFakeStore::Key(5));
+	CHECK(pValue != NULL && pValue->vt == VT_I4 && pValue->lVal == 51);
+	pValue = snapshot.Find(CFakeStore::Key(8));
+	CHECK(pValue != NULL && pValue->vt == VT_I4 && pValue->lVal == 80);
+	pValue = snapshot.Find(CFakeStore::Key(2));
+	CHECK(pValue != NULL && pValue->vt == VT_LPWSTR && wcscmp(pValue->pwszVal, L"alpha") == 0);
+
+	// Taken over a snapshot that is not empty, with no Clear between
+	CHECK_HR(S_OK, pStore->SetValue(CFakeStore::Key(8), Empty()));
+	CHECK_HR(S_OK, snapshot.Take(pStore));
+	CHECK(snapshot.GetCount() == 7);
+	CHECK(snapshot.Find(CFakeStore::Key(8)) == NULL);
+
+	delete pStore;
+}
+
+int main()
+{
+	WriteOwn();
+	TestTake();
+	TestClearAndRetake();
+
+	return TestResult("metadata snapshot");
+}
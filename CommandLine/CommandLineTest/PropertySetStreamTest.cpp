@@ -0,0 +1,442 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for the property set stream codec, against streams laid out byte by byte as [MS-OLEPS] describes them.
+// Each fixture is in the layout that WritePropertySetStream produces, so reading it and writing it again must
+// give back exactly the same bytes. Truncated and damaged copies of the fixtures must fail with the right error,
+// and must never read outside the data they are given.
+
+#include "PropertySetStream.h"
+#include <stdio.h>
+
+static int s_cFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); s_cFailures++; } } while (0)
+
+#define CHECK_HR(expected, actual) \
+	do { HRESULT _hr = (actual); if (_hr != (HRESULT)(expected)) { \
+		printf("%s(%d): expected 0x%08x, got 0x%08x: %s\n", __FILE__, __LINE__, (unsigned)(expected), (unsigned)_hr, #actual); s_cFailures++; } } while (0)
+
+// Little endian fields
+#define U16(x)	(BYTE)((x) & 0xFF), (BYTE)(((x) >> 8) & 0xFF)
+#define U32(x)	U16((x) & 0xFFFF), U16(((x) >> 16) & 0xFFFF)
+
+#define ZERO_CLSID				0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+#define FMTID_SUMMARY_BYTES		0xE0, 0x85, 0x9F, 0xF2, 0xF9, 0x4F, 0x68, 0x10, 0xAB, 0x91, 0x08, 0x00, 0x2B, 0x27, 0xB3, 0xD9
+#define FMTID_DOCSUMMARY_BYTES	0x02, 0xD5, 0xCD, 0xD5, 0x9C, 0x2E, 0x1B, 0x10, 0x93, 0x97, 0x08, 0x00, 0x2B, 0x2C, 0xF9, 0xAE
+#define FMTID_USERDEFINED_BYTES	0x05, 0xD5, 0xCD, 0xD5, 0x9C, 0x2E, 0x1B, 0x10, 0x93, 0x97, 0x08, 0x00, 0x2B, 0x2C, 0xF9, 0xAE
+#define FMTID_CUSTOM_BYTES		0x78, 0x56, 0x34, 0x12, 0xBC, 0x9A, 0xF0, 0xDE, 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF
+
+static const FMTID FMTID_Custom = { 0x12345678, 0x9ABC, 0xDEF0, { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF } };
+
+#pragma region Fixtures
+
+// One Unicode section of strings and scalars
+static const BYTE SummaryStream[] =
+{
+	// Header: byte order, version 0, system identifier, CLSID, one section
+	U16(0xFFFE), U16(0), U32(0x00020006), ZERO_CLSID, U32(1),
+	FMTID_SUMMARY_BYTES, U32(48),
+
+	// Section at 48: size, count, then the table of identifiers and offsets
+	U32(108), U32(5),
+	U32(1), U32(48),
+	U32(2), U32(56),
+	U32(4), U32(72),
+	U32(12), U32(88),
+	U32(19), U32(100),
+	// 48: code page 1200
+	U16(VT_I2), U16(0), U16(1200), U16(0),
+	// 56: VT_LPWSTR "Hi", counted in characters including the terminator, padded to 4
+	U16(VT_LPWSTR), U16(0), U32(3), U16('H'), U16('i'), U16(0), U16(0),
+	// 72: VT_LPSTR "ab", which in a Unicode section is UTF-16 counted in bytes
+	U16(VT_LPSTR), U16(0), U32(6), U16('a'), U16('b'), U16(0), U16(0),
+	// 88: VT_FILETIME
+	U16(VT_FILETIME), U16(0), U32(0x89ABCDEF), U32(0x01D2A3B4),
+	// 100: VT_I4
+	U16(VT_I4), U16(0), U32(0x12345678),
+};
+
+// Two sections in one stream, as DocumentSummaryInformation has them, in code page 1252
+// with a dictionary of property names in the second
+static const BYTE DocSummaryStream[] =
+{
+	U16(0xFFFE), U16(0), U32(0x00020006), ZERO_CLSID, U32(2),
+	FMTID_DOCSUMMARY_BYTES, U32(68),
+	FMTID_USERDEFINED_BYTES, U32(128),
+
+	// Section at 68
+	U32(60), U32(3),
+	U32(1), U32(32),
+	U32(2), U32(40),
+	U32(11), U32(52),
+	// 32: code page 1252
+	U16(VT_I2), U16(0), U16(1252), U16(0),
+	// 40: VT_LPSTR "Cat", counted in bytes including the terminator
+	U16(VT_LPSTR), U16(0), U32(4), 'C', 'a', 't', 0,
+	// 52: VT_BOOL true
+	U16(VT_BOOL), U16(0), U16(0xFFFF), U16(0),
+
+	// Section at 128
+	U32(72), U32(3),
+	U32(1), U32(32),
+	U32(0), U32(40),
+	U32(2), U32(60),
+	// 32: code page 1252
+	U16(VT_I2), U16(0), U16(1252), U16(0),
+	// 40: dictionary, which has no type: one entry, the name counted in bytes, then padding for the whole
+	U32(1), U32(2), U32(6), 'O', 'w', 'n', 'e', 'r', 0, 0, 0,
+	// 60: VT_LPSTR "Me"
+	U16(VT_LPSTR), U16(0), U32(3), 'M', 'e', 0, 0,
+};
+
+// Vectors, including a vector of variants; the VT_I1 makes it a version 1 stream
+static const BYTE VectorStream[] =
+{
+	U16(0xFFFE), U16(1), U32(0x00020006), ZERO_CLSID, U32(1),
+	FMTID_CUSTOM_BYTES, U32(48),
+
+	// Section at 48
+	U32(152), U32(5),
+	U32(1), U32(48),
+	U32(2), U32(56),
+	U32(3), U32(72),
+	U32(4), U32(100),
+	U32(5), U32(116),
+	// 48: code page 1200
+	U16(VT_I2), U16(0), U16(1200), U16(0),
+	// 56: VT_VECTOR | VT_I2 { 1, -2, 3 }, padded after the last element
+	U16(VT_VECTOR | VT_I2), U16(0), U32(3), U16(1), U16(0xFFFE), U16(3), U16(0),
+	// 72: VT_VECTOR | VT_LPWSTR { "a", "bc" }, each string padded
+	U16(VT_VECTOR | VT_LPWSTR), U16(0), U32(2),
+	U32(2), U16('a'), U16(0),
+	U32(3), U16('b'), U16('c'), U16(0), U16(0),
+	// 100: VT_VECTOR | VT_BSTR { "x" }, counted in bytes
+	U16(VT_VECTOR | VT_BSTR), U16(0), U32(1),
+	U32(4), U16('x'), U16(0),
+	// 116: VT_VECTOR | VT_VARIANT { VT_I4 7, VT_LPWSTR "z", VT_I1 -1 }, each a typed value padded to 4
+	U16(VT_VECTOR | VT_VARIANT), U16(0), U32(3),
+	U16(VT_I4), U16(0), U32(7),
+	U16(VT_LPWSTR), U16(0), U32(2), U16('z'), U16(0),
+	U16(VT_I1), U16(0), 0xFF, 0, 0, 0,
+};
+
+#pragma endregion
+
+#pragma region Helpers
+
+static std::vector<BYTE> Bytes(const BYTE* pData, size_t cbData)
+{
+	return std::vector<BYTE>(pData, pData + cbData);
+}
+
+static void PatchUInt32(std::vector<BYTE>& data, size_t pos, DWORD dw)
+{
+	data[pos] = (BYTE)(dw & 0xFF);
+	data[pos + 1] = (BYTE)((dw >> 8) & 0xFF);
+	data[pos + 2] = (BYTE)((dw >> 16) & 0xFF);
+	data[pos + 3] = (BYTE)(dw >> 24);
+}
+
+static HRESULT Read(const std::vector<BYTE>& data, std::vector<CPropertySet>& sets)
+{
+	// Read from a copy of exactly the right size, so that the sanitizers catch any read beyond it
+	BYTE* pCopy = new BYTE[data.size() > 0 ? data.size() : 1];
+	if (!data.empty())
+		memcpy(pCopy, &data[0], data.size());
+	HRESULT hr = ReadPropertySetStream(pCopy, data.size(), sets);
+	delete[] pCopy;
+	return hr;
+}
+
+static bool StringIs(const WCHAR* psz, const WCHAR* pszExpected)
+{
+	return psz != NULL && wcscmp(psz, pszExpected) == 0;
+}
+
+// Reads a fixture, writes it back, and checks that nothing changed
+static void CheckRoundTrip(const char* pszName, const BYTE* pData, size_t cbData)
+{
+	std::vector<CPropertySet> sets;
+	std::vector<BYTE> written;
+
+	CHECK_HR(S_OK, Read(Bytes(pData, cbData), sets));
+	CHECK_HR(S_OK, WritePropertySetStream(sets, written));
+	if (written != Bytes(pData, cbData))
+	{
+		printf("%s: written stream differs from the fixture\n", pszName);
+		s_cFailures++;
+	}
+}
+
+// Every proper prefix of a stream is truncated somewhere, and must be refused. The header is at fault when
+// it points to a section at or beyond the end, and otherwise the section that runs off the end is.
+static void CheckTruncations(const BYTE* pData, size_t cbData, size_t offFirstSection, size_t offSecondSection = 0)
+{
+	for (size_t cb = 0; cb < cbData; cb++)
+	{
+		std::vector<CPropertySet> sets;
+		HRESULT hr = Read(Bytes(pData, cb), sets);
+		if (cb <= offFirstSection || cb == offSecondSection)
+			CHECK_HR(STG_E_INVALIDHEADER, hr);
+		else
+			CHECK_HR(STG_E_DOCFILECORRUPT, hr);
+		CHECK(sets.empty());
+	}
+}
+
+#pragma endregion
+
+#pragma region Tests
+
+static void TestSummaryStream()
+{
+	std::vector<CPropertySet> sets;
+	CHECK_HR(S_OK, Read(Bytes(SummaryStream, sizeof(SummaryStream)), sets));
+	CHECK(sets.size() == 1);
+	if (sets.size() != 1)
+		return;
+
+	const CPropertySet& set = sets[0];
+	CHECK(set.GetFmtid() == FMTID_SummaryInformation);
+	CHECK(set.GetCodePage() == CP_WINUNICODE);
+	CHECK(set.Dictionary().empty());
+	CHECK(set.GetCount() == 4);
+	if (set.GetCount() != 4)
+		return;
+
+	CHECK(set.GetIdAt(0) == 2 && set.GetValueAt(0).vt == VT_LPWSTR && StringIs(set.GetValueAt(0).pwszVal, L"Hi"));
+	CHECK(set.GetIdAt(1) == 4 && set.GetValueAt(1).vt == VT_LPSTR && set.GetValueAt(1).pszVal != NULL &&
+		strcmp(set.GetValueAt(1).pszVal, "ab") == 0);
+	CHECK(set.GetIdAt(2) == 12 && set.GetValueAt(2).vt == VT_FILETIME &&
+		set.GetValueAt(2).filetime.dwLowDateTime == 0x89ABCDEF && set.GetValueAt(2).filetime.dwHighDateTime == 0x01D2A3B4);
+	CHECK(set.GetIdAt(3) == 19 && set.GetValueAt(3).vt == VT_I4 && set.GetValueAt(3).lVal == 0x12345678);
+
+	CheckRoundTrip("SummaryStream", SummaryStream, sizeof(SummaryStream));
+}
+
+static void TestDocSummaryStream()
+{
+	std::vector<CPropertySet> sets;
+	CHECK_HR(S_OK, Read(Bytes(DocSummaryStream, sizeof(DocSummaryStream)), sets));
+	CHECK(sets.size() == 2);
+	if (sets.size() != 2)
+		return;
+
+	CHECK(sets[0].GetFmtid() == FMTID_DocSummaryInformation);
+	CHECK(sets[0].GetCodePage() == 1252);
+	CHECK(sets[0].GetCount() == 2);
+	if (sets[0].GetCount() == 2)
+	{
+		CHECK(sets[0].GetIdAt(0) == 2 && sets[0].GetValueAt(0).vt == VT_LPSTR && strcmp(sets[0].GetValueAt(0).pszVal, "Cat") == 0);
+		CHECK(sets[0].GetIdAt(1) == 11 && sets[0].GetValueAt(1).vt == VT_BOOL && sets[0].GetValueAt(1).boolVal == VARIANT_TRUE);
+	}
+
+	CHECK(sets[1].GetFmtid() == FMTID_UserDefinedProperties);
+	CHECK(sets[1].GetCodePage() == 1252);
+	CHECK(sets[1].Dictionary().size() == 1 && sets[1].Dictionary()[2] == L"Owner");
+	CHECK(sets[1].GetCount() == 1);
+	if (sets[1].GetCount() == 1)
+		CHECK(sets[1].GetIdAt(0) == 2 && sets[1].GetValueAt(0).vt == VT_LPSTR && strcmp(sets[1].GetValueAt(0).pszVal, "Me") == 0);
+
+	CheckRoundTrip("DocSummaryStream", DocSummaryStream, sizeof(DocSummaryStream));
+}
+
+static void TestVectorStream()
+{
+	std::vector<CPropertySet> sets;
+	CHECK_HR(S_OK, Read(Bytes(VectorStream, sizeof(VectorStream)), sets));
+	CHECK(sets.size() == 1);
+	if (sets.size() != 1 || sets[0].GetCount() != 4)
+	{
+		CHECK(!"four vectors");
+		return;
+	}
+
+	const CPropertySet& set = sets[0];
+	CHECK(set.GetFmtid() == FMTID_Custom);
+
+	const PROPVARIANT& shorts = set.GetValueAt(0);
+	CHECK(shorts.vt == (VT_VECTOR | VT_I2) && shorts.cai.cElems == 3 &&
+		shorts.cai.pElems[0] == 1 && shorts.cai.pElems[1] == -2 && shorts.cai.pElems[2] == 3);
+
+	const PROPVARIANT& strings = set.GetValueAt(1);
+	CHECK(strings.vt == (VT_VECTOR | VT_LPWSTR) && strings.calpwstr.cElems == 2 &&
+		StringIs(strings.calpwstr.pElems[0], L"a") && StringIs(strings.calpwstr.pElems[1], L"bc"));
+
+	const PROPVARIANT& bstrs = set.GetValueAt(2);
+	CHECK(bstrs.vt == (VT_VECTOR | VT_BSTR) && bstrs.cabstr.cElems == 1 && StringIs(bstrs.cabstr.pElems[0], L"x"));
+
+	const PROPVARIANT& variants = set.GetValueAt(3);
+	CHECK(variants.vt == (VT_VECTOR | VT_VARIANT) && variants.capropvar.cElems == 3);
+	if (variants.capropvar.cElems == 3)
+	{
+		CHECK(variants.capropvar.pElems[0].vt == VT_I4 && variants.capropvar.pElems[0].lVal == 7);
+		CHECK(variants.capropvar.pElems[1].vt == VT_LPWSTR && StringIs(variants.capropvar.pElems[1].pwszVal, L"z"));
+		CHECK(variants.capropvar.pElems[2].vt == VT_I1 && variants.capropvar.pElems[2].cVal == -1);
+	}
+
+	// Copies must compare equal, element by element
+	PROPVARIANT copy;
+	CHECK_HR(S_OK, PropVariantCopy(&copy, &variants));
+	CHECK(PropVariantEquals(copy, variants));
+	PropVariantClear(&copy);
+	CHECK_HR(S_OK, PropVariantCopy(&copy, &bstrs));
+	CHECK(PropVariantEquals(copy, bstrs));
+	PropVariantClear(&copy);
+
+	CheckRoundTrip("VectorStream", VectorStream, sizeof(VectorStream));
+}
+
+// Only the version 1 types make a version 1 stream
+static void TestVersion()
+{
+	std::vector<CPropertySet> sets;
+	std::vector<BYTE> written;
+
+	CHECK_HR(S_OK, Read(Bytes(VectorStream, sizeof(VectorStream)), sets));
+	PROPVARIANT empty;
+	PropVariantInit(&empty);
+	CHECK_HR(S_OK, sets[0].SetValue(5, empty));
+	CHECK_HR(S_OK, WritePropertySetStream(sets, written));
+	CHECK(written.size() > 2 && written[2] == 0);
+}
+
+// The code page is found first, wherever the table lists it
+static void TestCodePageOrder()
+{
+	std::vector<BYTE> data = Bytes(SummaryStream, sizeof(SummaryStream));
+	size_t table = 48 + 8;
+	PatchUInt32(data, table, 19);
+	PatchUInt32(data, table + 4, 100);
+	PatchUInt32(data, table + 32, 1);
+	PatchUInt32(data, table + 36, 48);
+
+	std::vector<CPropertySet> sets;
+	CHECK_HR(S_OK, Read(data, sets));
+	CHECK(sets.size() == 1 && sets[0].GetCodePage() == CP_WINUNICODE && sets[0].GetCount() == 4);
+	if (sets.size() == 1 && sets[0].GetCount() == 4)
+	{
+		CHECK(sets[0].GetIdAt(0) == 19 && sets[0].GetValueAt(0).vt == VT_I4);
+		CHECK(sets[0].GetIdAt(1) == 2 && sets[0].GetValueAt(1).vt == VT_LPWSTR && StringIs(sets[0].GetValueAt(1).pwszVal, L"Hi"));
+	}
+}
+
+static void TestTruncated()
+{
+	CheckTruncations(SummaryStream, sizeof(SummaryStream), 48);
+	CheckTruncations(DocSummaryStream, sizeof(DocSummaryStream), 68, 128);
+	CheckTruncations(VectorStream, sizeof(VectorStream), 48);
+}
+
+static void CheckCorrupt(const BYTE* pData, size_t cbData, size_t pos, DWORD dw, HRESULT hrExpected)
+{
+	std::vector<BYTE> data = Bytes(pData, cbData);
+	PatchUInt32(data, pos, dw);
+
+	std::vector<CPropertySet> sets;
+	HRESULT hr = Read(data, sets);
+	if (hr != hrExpected)
+	{
+		printf("corrupting offset %u with 0x%08x: expected 0x%08x, got 0x%08x\n", (unsigned)pos, (unsigned)dw, (unsigned)hrExpected, (unsigned)hr);
+		s_cFailures++;
+	}
+	CHECK(sets.empty());
+}
+
+static void TestCorrupt()
+{
+	// Header: byte order, version, section count, section offset
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 0, 0x0000FEFF, STG_E_INVALIDHEADER);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 0, 0x0002FFFE, STG_E_INVALIDHEADER);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 24, 0, STG_E_INVALIDHEADER);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 24, 0x10000, STG_E_INVALIDHEADER);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 44, sizeof(SummaryStream), STG_E_INVALIDHEADER);
+
+	// Section: size beyond the stream, too many properties, a value outside the section
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 48, 0x10000, STG_E_DOCFILECORRUPT);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 48, 4, STG_E_DOCFILECORRUPT);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 52, 0x1000000, STG_E_DOCFILECORRUPT);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 48 + 8 + 12, 108, STG_E_DOCFILECORRUPT);
+
+	// Values: a string longer than the section, and types that never appear in property sets
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 48 + 56 + 4, 0x7FFFFFFF, STG_E_DOCFILECORRUPT);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 48 + 100, VT_ARRAY | VT_I4, STG_E_UNIMPLEMENTEDFUNCTION);
+	CheckCorrupt(SummaryStream, sizeof(SummaryStream), 48 + 100, VT_UNKNOWN, STG_E_UNIMPLEMENTEDFUNCTION);
+
+	// Dictionary with more entries than there is room for
+	CheckCorrupt(DocSummaryStream, sizeof(DocSummaryStream), 128 + 40, 0x100000, STG_E_DOCFILECORRUPT);
+
+	// Vectors: more elements than bytes, and a vector of variants inside a vector of variants
+	CheckCorrupt(VectorStream, sizeof(VectorStream), 48 + 56 + 4, 0x7FFFFFFF, STG_E_DOCFILECORRUPT);
+	CheckCorrupt(VectorStream, sizeof(VectorStream), 48 + 116 + 4, 4, STG_E_DOCFILECORRUPT);
+	CheckCorrupt(VectorStream, sizeof(VectorStream), 48 + 116 + 8, VT_VECTOR | VT_VARIANT, STG_E_DOCFILECORRUPT);
+}
+
+static void TestWriteErrors()
+{
+	std::vector<CPropertySet> sets;
+	std::vector<BYTE> data;
+	CHECK_HR(E_INVALIDARG, WritePropertySetStream(sets, data));
+
+	// A type that has no serialized form
+	sets.push_back(CPropertySet(FMTID_Custom));
+	PROPVARIANT propvar;
+	PropVariantInit(&propvar);
+	propvar.vt = VT_UNKNOWN;
+	sets[0].AttachValue(2, propvar);
+	CHECK_HR(STG_E_INVALIDPARAMETER, WritePropertySetStream(sets, data));
+	CHECK(data.empty());
+
+	// A vector of variants may not hold another
+	PropVariantInit(&propvar);
+	propvar.vt = VT_VECTOR | VT_VARIANT;
+	propvar.capropvar.cElems = 1;
+	propvar.capropvar.pElems = (PROPVARIANT*)CoTaskMemAlloc(sizeof(PROPVARIANT));
+	PropVariantInit(&propvar.capropvar.pElems[0]);
+	propvar.capropvar.pElems[0].vt = VT_VECTOR | VT_VARIANT;
+	sets[0].Clear();
+	sets[0].AttachValue(2, propvar);
+	CHECK_HR(STG_E_INVALIDPARAMETER, WritePropertySetStream(sets, data));
+	CHECK(data.empty());
+}
+
+static void TestStreamNames()
+{
+	std::wstring name;
+	FMTID fmtid;
+
+	FmtIdToStreamName(FMTID_SummaryInformation, name);
+	CHECK(name == L"\005SummaryInformation");
+	FmtIdToStreamName(FMTID_UserDefinedProperties, name);
+	CHECK(name == L"\005DocumentSummaryInformation");
+
+	FmtIdToStreamName(FMTID_Custom, name);
+	CHECK(name.size() == 27 && name[0] == PropertySetStreamPrefix);
+	CHECK_HR(S_OK, StreamNameToFmtId(name.c_str(), &fmtid));
+	CHECK(fmtid == FMTID_Custom);
+	CHECK_HR(STG_E_INVALIDNAME, StreamNameToFmtId(L"\005NotAPropertySet", &fmtid));
+}
+
+#pragma endregion
+
+int main()
+{
+	TestSummaryStream();
+	TestDocSummaryStream();
+	TestVectorStream();
+	TestVersion();
+	TestCodePageOrder();
+	TestTruncated();
+	TestCorrupt();
+	TestWriteErrors();
+	TestStreamNames();
+
+	if (s_cFailures > 0)
+	{
+		printf("%d checks failed\n", s_cFailures);
+		return 1;
+	}
+	printf("All property set stream tests passed\n");
+	return 0;
+}
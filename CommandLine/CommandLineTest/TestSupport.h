@@ -0,0 +1,56 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// What the engine's test programs share. Each is its own executable, which counts the checks that fail,
+// reports each one with where it is, and returns nonzero from main if there were any.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include <stdio.h>
+
+static int s_cFailures = 0;
+
+#define CHECK(expr) \
+	do { if (!(expr)) { printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); s_cFailures++; } } while (0)
+
+#define CHECK_HR(expected, actual) \
+	do { HRESULT _hr = (actual); if (_hr != (HRESULT)(expected)) { \
+		printf("%s(%d): expected 0x%08x, got 0x%08x: %s\n", __FILE__, __LINE__, (unsigned)(expected), (unsigned)_hr, #actual); s_cFailures++; } } while (0)
+
+// The result for main, having said how it went
+inline int TestResult(const char* pszTests)
+{
+	if (s_cFailures > 0)
+	{
+		printf("%d checks failed\n", s_cFailures);
+		return 1;
+	}
+	printf("All %s tests passed\n", pszTests);
+	return 0;
+}
+
+// For the files that tests write in the directory that they are given
+
+inline bool WriteFileBytes(const std::wstring& path, const std::vector<BYTE>& data)
+{
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	if (_wfopen_s(&pfile, path.c_str(), L"wb") != 0)
+		return false;
+#else
+	pfile = fopen(NarrowPath(path.c_str()).c_str(), "wb");
+	if (!pfile)
+		return false;
+#endif
+	bool bOK = data.empty() || fwrite(&data[0], 1, data.size(), pfile) == data.size();
+	return fclose(pfile) == 0 && bOK;
+}
+
+inline void RemoveFile(const std::wstring& path)
+{
+#ifdef _WIN32
+	_wremove(path.c_str());
+#else
+	remove(NarrowPath(path.c_str()).c_str());
+#endif
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Tests for RunParallel and COrderedResults
+
+#include "TestSupport.h"
+#include "WorkerPool.h"
+
+// Counts how many times each index is executed, and how many threads took part
+class CCountingTask : public CParallelTask
+{
+public:
+	CCountingTask(size_t count) : executions(count, 0), cStarts(0), cEnds(0) {}
+
+	virtual void ThreadStart()
+	{
+		CAutoLock lock(_lock);
+		cStarts++;
+	}
+
+	virtual void ThreadEnd()
+	{
+		CAutoLock lock(_lock);
+		cEnds++;
+	}
+
+	virtual void Execute(size_t index)
+	{
+		CAutoLock lock(_lock);
+		executions[index]++;
+	}
+
+	std::vector<int>	executions;
+	unsigned			cStarts;
+	unsigned			cEnds;
+
+private:
+	CLock				_lock;
+};
+
+// Every index runs exactly once, however many threads there are
+static void TestRunParallel()
+{
+	static const unsigned ThreadCounts[] = { 1, 2, 4, 16 };
+	static const size_t Counts[] = { 0, 1, 3, 1000 };
+	for (size_t t = 0; t < sizeof(ThreadCounts) / sizeof(ThreadCounts[0]); t++)
+	{
+		for (size_t c = 0; c < sizeof(Counts) / sizeof(Counts[0]); c++)
+		{
+			CCountingTask task(Counts[c]);
+			RunParallel(ThreadCounts[t], Counts[c], task);
+			bool bOnce = true;
+			for (size_t i = 0; i < Counts[c]; i++)
+				bOnce = bOnce && task.executions[i] == 1;
+			CHECK(bOnce);
+			CHECK(task.cStarts == task.cEnds);
+			CHECK(task.cStarts <= ThreadCounts[t]);
+		}
+	}
+}
+
+// Records the order that results are emitted in
+class CRecordingResults : public COrderedResults
+{
+public:
+	CRecordingResults(size_t count) : COrderedResults(count) {}
+	std::vector<size_t>	emitted;
+
+protected:
+	virtual void Emit(size_t index) { emitted.push_back(index); }
+};
+
+static bool IsInOrder(const std::vector<size_t>& emitted)
+{
+	for (size_t i = 0; i < emitted.size(); i++)
+	{
+		if (emitted[i] != i)
+			return false;
+	}
+	return true;
+}
+
+// Nothing is emitted until every earlier item is complete, and then everything that is waiting goes at once
+static void TestOrderedResults()
+{
+	static const size_t Order[] = { 3, 1, 4, 0, 2, 7, 6, 5 };
+	static const size_t EmittedAfter[] = { 0, 0, 0, 2, 5, 5, 5, 8 };
+	CRecordingResults results(8);
+	for (size_t i = 0; i < 8; i++)
+	{
+		results.Complete(Order[i]);
+		CHECK(results.emitted.size() == EmittedAfter[i]);
+		CHECK(IsInOrder(results.emitted));
+	}
+}
+
+// Items that finish out of order on several threads are still emitted in order
+class CCompletingTask : public CParallelTask
+{
+public:
+	CCompletingTask(COrderedResults& results) : _results(results) {}
+
+	virtual void Execute(size_t index)
+	{
+		// Later items in each group of eight finish sooner
+		volatile unsigned spin = 0;
+		for (unsigned i = 0; i < (8 - index % 8) * 2000; i++)
+			spin++;
+		_results.Complete(index);
+	}
+
+private:
+	CCompletingTask& operator=(const CCompletingTask&);
+	COrderedResults& _results;
+};
+
+static void TestOrderedResultsParallel()
+{
+	static const size_t Count = 500;
+	CRecordingResults results(Count);
+	CCompletingTask task(results);
+	RunParallel(8, Count, task);
+	CHECK(results.emitted.size() == Count);
+	CHECK(IsInOrder(results.emitted));
+}
+
+int main()
+{
+	TestRunParallel();
+	TestOrderedResults();
+	TestOrderedResultsParallel();
+
+	return TestResult("worker pool");
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Imports each of the checked-in metadata files into the memory store, exports it again through the file writer,
+// and compares the two files. Property names come from the property system, which is not there to ask on every
+// platform, so Name attributes are left out of the comparison; everything else must match byte for byte.
+//
+// Usage: XmlRoundTripTest <directory of the checked-in files> <directory for the exported files>
+
+#include "MappedXmlFile.h"
+#include "TestSupport.h"
+#include "XmlHelpers.h"
+#include <memory>
+
+static const char* Fixtures[] = { "allprops.txt", "fewprops.txt" };
+
+// The text of a UTF-16LE file with a BOM, with any Name attributes removed; returns false if it is not such a file
+static bool ReadWithoutNames(const std::wstring& path, std::wstring& text)
+{
+	std::vector<BYTE> data;
+	if (ReadFileBytes(path.c_str(), data) != 0 || data.size() < 2 || data[0] != 0xFF || data[1] != 0xFE)
+		return false;
+
+	std::wstring raw;
+	DecodeUtf16(&data[2], (data.size() - 2) / 2, raw);
+
+	static const WCHAR NameAttribute[] = L" Name=\"";
+	text.clear();
+	size_t start = 0, pos;
+	while ((pos = raw.find(NameAttribute, start)) != std::wstring::npos)
+	{
+		size_t end = raw.find(L'"', pos + wcslen(NameAttribute));
+		if (end == std::wstring::npos)
+			break;
+		text.append(raw, start, pos - start);
+		start = end + 1;
+	}
+	text.append(raw, start, std::wstring::npos);
+	return true;
+}
+
+// Says where the texts first differ, as a line number, if they do
+static bool SameText(const char* pszFixture, const std::wstring& expected, const std::wstring& actual)
+{
+	size_t i = 0;
+	while (i < expected.size() && i < actual.size() && expected[i] == actual[i])
+		i++;
+	if (i == expected.size() && i == actual.size())
+		return true;
+
+	size_t line = 1;
+	for (size_t j = 0; j < i; j++)
+		line += expected[j] == L'\n' ? 1 : 0;
+	printf("%s: the export differs from the original at line %u\n", pszFixture, (unsigned)line);
+	return false;
+}
+
+static void TestRoundTrip(const char* pszFixture, const std::wstring& fixtures, const std::wstring& output)
+{
+	std::wstring name = WidePath(pszFixture);
+	std::wstring xmlFile = fixtures + L"/" + name + MetadataFileSuffix;
+	std::wstring exportFile = output + L"/roundtrip-" + name + MetadataFileSuffix;
+	std::wstring targetFile = L"/fixtures/" + name;
+
+	CMappedXmlFile xml;
+	CHECK(xml.Open(xmlFile.c_str()) == 0);
+	if (xml.Text() == NULL)
+		return;
+
+	try
+	{
+		std::unique_ptr<CDeferredWriteMetadataStore> pImportStore(CreateDeferredWriteMetadataStore(MemoryMetadataStore));
+		ImportMetadataFromXml(xml.Text(), pImportStore.get(), targetFile, xmlFile);
+
+		std::unique_ptr<IMetadataStore> pExportStore(CreateMetadataStore(MemoryMetadataStore));
+		CFileXmlWriter writer(exportFile.c_str());
+		ExportMetadata(writer, pExportStore.get(), targetFile);
+		CHECK(writer.Close());
+	}
+	catch (CPHException& e)
+	{
+		CHECK_HR(S_OK, e.GetHResult());
+		return;
+	}
+
+	std::wstring expected, actual;
+	CHECK(ReadWithoutNames(xmlFile, expected));
+	CHECK(ReadWithoutNames(exportFile, actual));
+	CHECK(!expected.empty() && SameText(pszFixture, expected, actual));
+	RemoveFile(exportFile);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		printf("Usage: XmlRoundTripTest <directory of the checked-in files> <directory for the exported files>\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(Fixtures) / sizeof(Fixtures[0]); i++)
+		TestRoundTrip(Fixtures[i], WidePath(argv[1]), WidePath(argv[2]));
+
+	return TestResult("XML round trip");
+}
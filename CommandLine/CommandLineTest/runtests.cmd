@@ -2,6 +2,10 @@
 SETLOCAL
 :: Run this with CommandLineTest as the working folder
 ::
+:: This tests FileMeta.exe itself. The portable parts of the engine have their own unit tests and
+:: throughput benchmark, built and run by CMakeLists.txt in this folder:
+::   cmake -S . -B build && cmake --build build && ctest --test-dir build --output-on-failure
+::
 :: If FileMeta.exe is not on the path, tweak the following line to point to its location
 ::SET _filemeta="FileMeta.exe"
 SET _filemeta="C:\Program Files\File Metadata\FileMeta.exe"
@@ -98,6 +102,163 @@ del before.xml
 del after.xml
 ECHO %Test% passed
 
+ECHO Test7: Test parallel export against serial export
+SET Test=Test7
+md temp
+md temp2
+type NUL > temp.txt
+CALL %_filemeta% -e -f=temp *.txt > nul || goto error
+CALL %_filemeta% -e -j=4 -f=temp2 *.txt > nul || goto error
+FOR /f %%G IN ('dir /b temp\*.xml') DO (
+  fc /b temp\%%G temp2\%%G > nul || goto error )
+del /q temp\*.*
+del /q temp2\*.*
+del temp.txt
+rd temp
+rd temp2
+ECHO %Test% passed
+
+ECHO Test8: Test export to and import from a single archive
+SET Test=Test8
+copy allprops.txt temp1.txt > nul || goto error
+copy fewprops.txt temp2.txt > nul || goto error
+CALL %_filemeta% -e -x=before1.xml temp1.txt > nul || goto error
+CALL %_filemeta% -e -x=before2.xml temp2.txt > nul || goto error
+CALL %_filemeta% -e -a=temp.fmar temp1.txt temp2.txt > nul || goto error
+CALL %_filemeta% -d temp1.txt > nul || goto error
+CALL %_filemeta% -d temp2.txt > nul || goto error
+CALL %_filemeta% -i -a=temp.fmar temp2.txt > nul || goto error
+CALL %_filemeta% -e -x=after2.xml temp2.txt > nul || goto error
+fc /b before2.xml after2.xml > nul || goto error
+CALL %_filemeta% -i -a=temp.fmar > nul || goto error
+CALL %_filemeta% -e -x=after1.xml temp1.txt > nul || goto error
+fc /b before1.xml after1.xml > nul || goto error
+del temp1.txt
+del temp2.txt
+del temp.fmar
+del before?.xml
+del after?.xml
+ECHO %Test% passed
+
+ECHO Test9: Test round trip through the binary format
+SET Test=Test9
+copy allprops.txt temp.txt > nul || goto error
+CALL %_filemeta% -e -x=before.xml temp.txt > nul || goto error
+CALL %_filemeta% -e -b temp.txt > nul || goto error
+CALL %_filemeta% -d temp.txt > nul || goto error
+CALL %_filemeta% -i -b temp.txt > nul || goto error
+CALL %_filemeta% -e -x=after.xml temp.txt > nul || goto error
+fc /b before.xml after.xml > nul || goto error
+set size=0
+call :filesize temp.txt.metadata.fmb
+IF %size% GEQ 32768 goto error
+del temp.txt
+del temp.txt.metadata.fmb
+del before.xml
+del after.xml
+ECHO %Test% passed
+
+ECHO Test10: Test that names from a property name snapshot match those from the schema
+SET Test=Test10
+copy allprops.txt temp.txt > nul || goto error
+CALL %_filemeta% -e -x=before.xml temp.txt > nul || goto error
+IF EXIST names.txt del names.txt
+CALL %_filemeta% -e -n=names.txt -x=after.xml temp.txt > nul || goto error
+IF NOT EXIST names.txt goto error
+fc /b before.xml after.xml > nul || goto error
+CALL %_filemeta% -e -n=names.txt -x=after.xml temp.txt > nul || goto error
+fc /b before.xml after.xml > nul || goto error
+del temp.txt
+del names.txt
+del before.xml
+del after.xml
+ECHO %Test% passed
+
+ECHO Test11: Test export of a directory tree with -r
+SET Test=Test11
+IF EXIST tree rd /s /q tree
+md tree\sub || goto error
+copy allprops.txt tree\one.txt > nul || goto error
+copy allprops.txt tree\sub\two.txt > nul || goto error
+CALL %_filemeta% -e -r tree > nul || goto error
+IF NOT EXIST tree\one.txt.metadata.xml goto error
+IF NOT EXIST tree\sub\two.txt.metadata.xml goto error
+fc /b tree\one.txt.metadata.xml tree\sub\two.txt.metadata.xml > nul || goto error
+rd /s /q tree
+ECHO %Test% passed
+
+ECHO Test12: Test export of files named in a list
+SET Test=Test12
+IF EXIST list rd /s /q list
+md list || goto error
+copy allprops.txt list\one.txt > nul || goto error
+copy allprops.txt list\two.txt > nul || goto error
+(ECHO list\one.txt& ECHO list\two.txt) > list\files.txt
+CALL %_filemeta% -e @list\files.txt > nul || goto error
+IF NOT EXIST list\one.txt.metadata.xml goto error
+IF NOT EXIST list\two.txt.metadata.xml goto error
+fc /b list\one.txt.metadata.xml list\two.txt.metadata.xml > nul || goto error
+del list\*.metadata.xml
+TYPE list\files.txt | %_filemeta% -e @- > nul || goto error
+IF NOT EXIST list\two.txt.metadata.xml goto error
+rd /s /q list
+ECHO %Test% passed
+
+ECHO Test13: Test that export with a manifest only writes what has changed
+SET Test=Test13
+IF EXIST manifest.txt del manifest.txt
+copy allprops.txt incremental.txt > nul || goto error
+CALL %_filemeta% -e -m manifest.txt incremental.txt > nul || goto error
+IF NOT EXIST incremental.txt.metadata.xml goto error
+CALL %_filemeta% -e -m manifest.txt incremental.txt > output.txt || goto error
+find "Exported" output.txt > nul && goto error
+del incremental.txt.metadata.xml
+CALL %_filemeta% -e -m manifest.txt incremental.txt > nul || goto error
+IF NOT EXIST incremental.txt.metadata.xml goto error
+del incremental.txt incremental.txt.metadata.xml
+type NUL > temp.txt
+CALL %_filemeta% -e -m manifest.txt temp.txt > output.txt || goto error
+find "incremental.txt" output.txt > nul || goto error
+del temp.txt temp.txt.metadata.xml output.txt manifest.txt
+ECHO %Test% passed
+
+ECHO Test14: Test import modes
+SET Test=Test14
+CALL %_filemeta% -e -x=props.xml fewprops.txt > nul || goto error
+copy allprops.txt temp.txt > nul || goto error
+CALL %_filemeta% -i --mode=replace -x=props.xml temp.txt > nul || goto error
+CALL %_filemeta% -e -x=props2.xml temp.txt > nul || goto error
+fc /b props.xml props2.xml > nul || goto error
+del temp.txt props2.xml
+type NUL > temp.txt
+CALL %_filemeta% -i --mode=add-only -x=props.xml temp.txt > nul || goto error
+CALL %_filemeta% -e -x=props2.xml temp.txt > nul || goto error
+fc /b props.xml props2.xml > nul || goto error
+CALL %_filemeta% -i --mode=bogus -x=props.xml temp.txt 2> nul && goto error
+CALL %_filemeta% -e --mode=replace temp.txt 2> nul && goto error
+del temp.txt props.xml props2.xml
+ECHO %Test% passed
+
+ECHO Test15: Test import with a journal and an undo log, and rolling it back
+SET Test=Test15
+IF EXIST journal.txt del journal.txt
+IF EXIST undo.log del undo.log
+CALL %_filemeta% -e -x=props.xml fewprops.txt > nul || goto error
+type NUL > temp.txt
+type NUL > empty.txt
+CALL %_filemeta% -i -x=props.xml --journal=journal.txt -u=undo.log temp.txt > nul || goto error
+IF EXIST journal.txt goto error
+CALL %_filemeta% -e -x=props2.xml temp.txt > nul || goto error
+fc /b props.xml props2.xml > nul || goto error
+CALL %_filemeta% -i --rollback -u=undo.log > nul || goto error
+CALL %_filemeta% -e -x=props2.xml temp.txt > nul || goto error
+CALL %_filemeta% -e -x=props3.xml empty.txt > nul || goto error
+fc /b props2.xml props3.xml > nul || goto error
+CALL %_filemeta% -i --rollback -u=undo.log temp.txt 2> nul && goto error
+CALL %_filemeta% -e --journal=journal.txt temp.txt 2> nul && goto error
+del temp.txt empty.txt props.xml props2.xml props3.xml undo.log
+ECHO %Test% passed
+
 :passed
 del allprops.txt
 del fewprops.txt
@@ -0,0 +1,204 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "DirectoryWalk.h"
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifdef _WIN32
+static const WCHAR PathSeparator = L'\\';
+#else
+static const WCHAR PathSeparator = L'/';
+#endif
+
+#pragma region Helpers
+
+static std::wstring JoinPath(const std::wstring& directory, const WCHAR* pszName)
+{
+	std::wstring path(directory);
+	if (!path.empty() && path[path.size() - 1] != L'\\' && path[path.size() - 1] != L'/')
+		path += PathSeparator;
+	path += pszName;
+	return path;
+}
+
+template <class CHAR_T>
+static bool IsDots(const CHAR_T* pszName)
+{
+	return pszName[0] == '.' && (pszName[1] == '\0' || (pszName[1] == '.' && pszName[2] == '\0'));
+}
+
+#pragma endregion
+
+#ifdef _WIN32
+
+// Reads the entries of one directory, visiting its files and collecting its subdirectories
+static int ReadDirectory(const std::wstring& directory, CDirectoryVisitor& visitor, std::vector<std::wstring>& subdirectories, bool* pbStopped)
+{
+	WIN32_FIND_DATA fd;
+	std::wstring pattern = JoinPath(directory, L"*");
+
+	// Basic information leaves out the short names, and large fetches read many entries in each call
+	HANDLE hFind = FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER)
+		hFind = FindFirstFileEx(pattern.c_str(), FindExInfoStandard, &fd, FindExSearchNameMatch, NULL, 0);	// before Windows 7
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		// The root of an empty drive has no entries at all
+		DWORD err = GetLastError();
+		return err == ERROR_FILE_NOT_FOUND ? 0 : (int)err;
+	}
+
+	do
+	{
+		if (IsDots(fd.cFileName))
+			continue;
+
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+				subdirectories.push_back(JoinPath(directory, fd.cFileName));
+		}
+		else if (!visitor.VisitFile(JoinPath(directory, fd.cFileName)))
+		{
+			*pbStopped = true;
+			break;
+		}
+	}
+	while (FindNextFile(hFind, &fd));
+
+	DWORD err = *pbStopped ? ERROR_NO_MORE_FILES : GetLastError();
+	FindClose(hFind);
+	return err == ERROR_NO_MORE_FILES ? 0 : (int)err;
+}
+
+#else
+
+// Type of a directory entry, looking at the entry itself only if the file system does not say
+static unsigned char EntryType(int fdDirectory, const char* pszName, unsigned char type)
+{
+	struct stat st;
+	if (type != DT_UNKNOWN)
+		return type;
+	else if (fstatat(fdDirectory, pszName, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		return DT_UNKNOWN;
+	else
+		return S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+}
+
+// Reads the entries of one directory, visiting its files and collecting its subdirectories
+static int ReadDirectory(const std::wstring& directory, CDirectoryVisitor& visitor, std::vector<std::wstring>& subdirectories, bool* pbStopped)
+{
+	int fd = open(NarrowPath(directory.c_str()).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+
+	int err = 0;
+
+#ifdef __linux__
+	struct Dirent64
+	{
+		ULONGLONG		d_ino;
+		LONGLONG		d_off;
+		unsigned short	d_reclen;
+		unsigned char	d_type;
+		char			d_name[1];
+	};
+
+	// Each call returns as many entries as fit, so a large buffer means few calls for a large directory
+	static const size_t BufferSize = 256 * 1024;
+	std::vector<ULONGLONG> buffer(BufferSize / sizeof(ULONGLONG));
+
+	for (;;)
+	{
+		long cb = syscall(SYS_getdents64, fd, &buffer[0], BufferSize);
+		if (cb <= 0)
+		{
+			if (cb < 0)
+				err = errno;
+			break;
+		}
+
+		for (long pos = 0; pos < cb; )
+		{
+			const Dirent64* pEntry = (const Dirent64*)((const char*)&buffer[0] + pos);
+			pos += pEntry->d_reclen;
+			if (IsDots(pEntry->d_name))
+				continue;
+
+			unsigned char type = EntryType(fd, pEntry->d_name, pEntry->d_type);
+			if (type == DT_DIR)
+				subdirectories.push_back(JoinPath(directory, WidePath(pEntry->d_name).c_str()));
+			else if (type == DT_REG && !visitor.VisitFile(JoinPath(directory, WidePath(pEntry->d_name).c_str())))
+			{
+				*pbStopped = true;
+				break;
+			}
+		}
+		if (*pbStopped)
+			break;
+	}
+	close(fd);
+#else
+	DIR* pdir = fdopendir(fd);
+	if (!pdir)
+	{
+		err = errno;
+		close(fd);
+		return err;
+	}
+
+	errno = 0;
+	for (struct dirent* pEntry; (pEntry = readdir(pdir)) != NULL; errno = 0)
+	{
+		if (IsDots(pEntry->d_name))
+			continue;
+
+		unsigned char type = EntryType(dirfd(pdir), pEntry->d_name, pEntry->d_type);
+		if (type == DT_DIR)
+			subdirectories.push_back(JoinPath(directory, WidePath(pEntry->d_name).c_str()));
+		else if (type == DT_REG && !visitor.VisitFile(JoinPath(directory, WidePath(pEntry->d_name).c_str())))
+		{
+			*pbStopped = true;
+			break;
+		}
+	}
+	if (!*pbStopped)
+		err = errno;
+	closedir(pdir);
+#endif
+
+	return err;
+}
+
+#endif
+
+bool WalkDirectory(const std::wstring& directory, CDirectoryVisitor& visitor)
+{
+	std::vector<std::wstring> pending(1, directory);
+	std::vector<std::wstring> subdirectories;
+
+	while (!pending.empty())
+	{
+		std::wstring current;
+		current.swap(pending.back());
+		pending.pop_back();
+
+		bool bStopped = false;
+		subdirectories.clear();
+		int err = ReadDirectory(current, visitor, subdirectories, &bStopped);
+		if (bStopped || (err != 0 && !visitor.DirectoryError(current, err)))
+			return false;
+
+		// Pushed in reverse, so that they are entered in the order they were found
+		pending.insert(pending.end(), subdirectories.rbegin(), subdirectories.rend());
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Walks a directory tree, reading each directory in as few system calls as possible: FindFirstFileEx
+// with large fetches and no short names on Windows, and getdents64 with a large buffer on Linux.
+// Only names and types are read, so no file is opened or examined along the way.
+
+#pragma once
+
+#include "PortableTypes.h"
+
+// Receives what WalkDirectory finds
+class CDirectoryVisitor
+{
+public:
+	virtual ~CDirectoryVisitor() {}
+
+	// Called for each file, with its path; return false to end the walk
+	virtual bool VisitFile(const std::wstring& path) = 0;
+
+	// Called for a directory that cannot be read, with the system error code;
+	// return false to end the walk, or true to carry on without it
+	virtual bool DirectoryError(const std::wstring& path, int err) = 0;
+};
+
+// Visits every file under a directory, and in all the directories below it, depth first.
+// The files of a directory are visited before its subdirectories are entered, each in the order
+// that the file system gives them. Symbolic links and junctions are not followed.
+// Returns false if the visitor ended the walk.
+bool WalkDirectory(const std::wstring& directory, CDirectoryVisitor& visitor);
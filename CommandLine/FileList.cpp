@@ -0,0 +1,156 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "FileList.h"
+#include <errno.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static const size_t BufferSize = 64 * 1024;
+
+CFileListReader::CFileListReader()
+	: _pfile(NULL), _ownFile(false), _encoding(Unknown), _pos(0), _cb(0), _err(0)
+{
+}
+
+CFileListReader::~CFileListReader()
+{
+	if (_pfile && _ownFile)
+		fclose(_pfile);
+}
+
+int CFileListReader::Open(const WCHAR* pszPath)
+{
+	if (0 == wcscmp(pszPath, L"-"))
+	{
+		// Paths are decoded here, not by the C runtime
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		_pfile = stdin;
+		_ownFile = false;
+	}
+	else
+	{
+#ifdef _WIN32
+		int err = _wfopen_s(&_pfile, pszPath, L"rb");
+		if (err != 0)
+			return err;
+#else
+		_pfile = fopen(NarrowPath(pszPath).c_str(), "rb");
+		if (!_pfile)
+			return errno;
+#endif
+		_ownFile = true;
+	}
+
+	_buffer.resize(BufferSize);
+	_pos = _cb = 0;
+	_encoding = Unknown;
+	_err = 0;
+	return 0;
+}
+
+bool CFileListReader::Fill()
+{
+	// Part of a character left at the end is moved to the start, to be completed by the read
+	size_t cbLeft = _cb - _pos;
+	if (cbLeft > 0)
+		memmove(&_buffer[0], &_buffer[_pos], cbLeft);
+	_pos = 0;
+
+	size_t cbRead = fread(&_buffer[cbLeft], 1, _buffer.size() - cbLeft, _pfile);
+	_cb = cbLeft + cbRead;
+	if (cbRead == 0 && ferror(_pfile))
+		_err = errno != 0 ? errno : EIO;
+	return cbRead > 0;
+}
+
+void CFileListReader::Decode(const BYTE* pData, size_t cb, std::wstring& path) const
+{
+	if (_encoding == Utf16)
+	{
+		DecodeUtf16(pData, cb / 2, path);
+		return;
+	}
+	else if (DecodeUtf8(pData, cb, path))
+		return;
+
+	// Lists written by the shell are in the system code page
+	std::string narrow((const char*)pData, cb);
+#ifdef _WIN32
+	int cch = MultiByteToWideChar(CP_ACP, 0, narrow.c_str(), (int)narrow.size(), NULL, 0);
+	path.resize(cch);
+	if (cch > 0)
+		MultiByteToWideChar(CP_ACP, 0, narrow.c_str(), (int)narrow.size(), &path[0], cch);
+#else
+	path = WidePath(narrow.c_str());
+#endif
+}
+
+bool CFileListReader::Next(std::wstring& path)
+{
+	if (!_pfile || _err != 0)
+		return false;
+
+	if (_encoding == Unknown)
+	{
+		if (!Fill())
+			return false;
+
+		// The byte order mark, if there is one, says how to read the rest
+		if (_cb >= 2 && _buffer[0] == 0xFF && _buffer[1] == 0xFE)
+		{
+			_encoding = Utf16;
+			_pos = 2;
+		}
+		else
+		{
+			_encoding = Utf8;
+			if (_cb >= 3 && _buffer[0] == 0xEF && _buffer[1] == 0xBB && _buffer[2] == 0xBF)
+				_pos = 3;
+		}
+	}
+
+	size_t cbUnit = _encoding == Utf16 ? 2 : 1;
+	_entry.clear();
+
+	for (bool bEnd = false; !bEnd; )
+	{
+		while (_cb - _pos < cbUnit)
+		{
+			if (!Fill())
+			{
+				// The last entry need not be terminated
+				bEnd = true;
+				break;
+			}
+		}
+
+		unsigned unit = 0;
+		if (!bEnd)
+		{
+			const BYTE* p = &_buffer[_pos];
+			unit = cbUnit == 2 ? (p[0] | (p[1] << 8)) : p[0];
+			_pos += cbUnit;
+			if (unit != L'\n' && unit != 0)
+			{
+				_entry.insert(_entry.end(), p, p + cbUnit);
+				continue;
+			}
+		}
+
+		// A carriage return before the newline is not part of the path
+		if (_entry.size() >= cbUnit && _entry[_entry.size() - cbUnit] == '\r' && (cbUnit == 1 || _entry[_entry.size() - 1] == 0))
+			_entry.resize(_entry.size() - cbUnit);
+
+		if (!_entry.empty())
+		{
+			Decode(&_entry[0], _entry.size(), path);
+			return true;
+		}
+	}
+
+	return false;
+}
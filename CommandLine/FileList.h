@@ -0,0 +1,46 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Reads a list of paths from a file or from standard input, one at a time, so that a list of any
+// length can be worked through without holding it all in memory. Paths are separated by newlines
+// (with or without carriage returns) or by NUL characters, and empty entries are skipped.
+// The list may be UTF-16LE or UTF-8 with a byte order mark; without one, each path is read as
+// UTF-8 if it is valid UTF-8, and otherwise in the system code page.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include <stdio.h>
+
+class CFileListReader
+{
+public:
+	CFileListReader();
+	~CFileListReader();
+
+	// Opens a list file, or standard input if the name is "-"; returns 0, or the system error code
+	int Open(const WCHAR* pszPath);
+
+	// Gets the next path, returning false at the end of the list or on an error
+	bool Next(std::wstring& path);
+
+	// The system error code of any failure to read, or 0
+	int Error() const { return _err; }
+
+private:
+	CFileListReader(const CFileListReader&);
+	CFileListReader& operator=(const CFileListReader&);
+
+	bool Fill();
+	void Decode(const BYTE* pData, size_t cb, std::wstring& path) const;
+
+	enum Encoding { Unknown, Utf8, Utf16 };
+
+	FILE*				_pfile;
+	bool				_ownFile;		// false for standard input
+	Encoding			_encoding;
+	std::vector<BYTE>	_buffer;
+	size_t				_pos;			// next byte of the buffer to be read
+	size_t				_cb;			// bytes in the buffer
+	std::vector<BYTE>	_entry;			// the entry being read, which may span reads
+	int					_err;
+};
@@ -8,11 +8,246 @@
 #include <algorithm>
 #include <strsafe.h>
 #include <direct.h>
+#include <sstream>
+#include "WorkerPool.h"
+#include "MetadataArchive.h"
+#include "DirectoryWalk.h"
+#include "FileList.h"
+#include "ChangeManifest.h"
+#include "ImportJournal.h"
 
 using namespace rapidxml;
 using namespace TCLAP;
 using namespace std;
 
+// What to do to each target file, as given on the command line
+struct FileOptions
+{
+	bool	exportMetadata;
+	bool	deleteMetadata;
+	bool	explorerView;
+	bool	console;
+	bool	binary;			// metadata files are in the compact binary format
+	wstring	xmlFile;		// explicit XML file, if any
+	wstring	xmlDir;			// directory for XML files, if any
+	wstring	archive;		// single archive for all the files, if any
+	ImportMode	importMode;		// how imported metadata combines with what is there
+	CMetadataArchiveReader*	pArchiveReader;		// open archive, when importing from one
+	CChangeManifest*		pManifest;			// what was exported last time, when exporting only what has changed
+	CImportJournal*			pJournal;			// import progress, when it can be resumed
+	CUndoLog*				pUndoLog;			// what import overwrites, when it can be undone
+};
+
+static wstring ArchiveKey(const wstring& targetFile);
+static int ProcessFile(const wstring& targetFile, const FileOptions& options, wstring& archiveXml, wostream& out, wostream& err);
+static int ExportChangedMetadata(const wstring& targetFile, const wstring& xmlFile, const FileOptions& options, wostream& out);
+static void JournalImported(const wstring& targetFile, const FileOptions& options);
+static void RollBack(const wstring& undoLog);
+
+// Processes the target files on a pool of threads. Each file's messages are buffered and written
+// out in the order the files were given, so the output does not depend on the timing of the threads.
+// With one thread, processing stops at the first error, as it always has; with more, every file is
+// processed and each error is reported against its file.
+// When exporting to an archive, each file's XML is added to it as its turn comes, so the archive
+// is written sequentially, and its entries are in the order the files were given.
+class CFileTask : public CParallelTask, private COrderedResults
+{
+public:
+	CFileTask(const vector<wstring>& files, const FileOptions& options, bool bParallel, CMetadataArchiveWriter* pArchiveWriter) : 
+		COrderedResults(files.size()), _files(files), _options(options), _bParallel(bParallel), _pArchiveWriter(pArchiveWriter),
+		_outcomes(new Outcome[files.size()]), _stopped(false), _archiveFailed(false), _result(0)
+	{
+	}
+
+	int Result() const { return _result; }
+	bool ArchiveFailed() const { return _archiveFailed; }
+
+	virtual void ThreadStart() { CoInitialize(NULL); }
+	virtual void ThreadEnd() { CoUninitialize(); }
+
+	virtual void Execute(size_t index)
+	{
+		Outcome& outcome = _outcomes[index];
+
+		// Run serially, there is only the one thread, so output can go straight to the console
+		wostream& out = _bParallel ? (wostream&)outcome.out : wcout;
+		wostream& err = _bParallel ? (wostream&)outcome.err : wcerr;
+
+		if (!_stopped)
+		{
+			try
+			{
+				outcome.result = ProcessFile(_files[index], _options, outcome.archiveXml, out, err);
+			}
+			catch (CPHException &e)
+			{
+				if (_bParallel)
+					err << L"\"" << _files[index] << L"\": ";
+				err << e.GetMessage() << endl;
+				outcome.result = e.GetError();
+			}
+
+			if (outcome.result != 0 && !_bParallel)
+				_stopped = true;
+		}
+
+		Complete(index);
+	}
+
+private:
+	struct Outcome
+	{
+		Outcome() : result(0) {}
+
+		int				result;
+		wstring			archiveXml;
+		wostringstream	out;
+		wostringstream	err;
+
+	private:
+		Outcome(const Outcome&);
+		Outcome& operator=(const Outcome&);
+	};
+
+	virtual void Emit(size_t index)
+	{
+		Outcome& outcome = _outcomes[index];
+		wcout << outcome.out.str();
+		wcerr << outcome.err.str();
+		outcome.out.str(L"");
+		outcome.err.str(L"");
+
+		// Once a write to the archive has failed, the archive is no use
+		if (_pArchiveWriter != NULL && outcome.result == 0 && !_archiveFailed)
+		{
+			int errWrite = _pArchiveWriter->Add(ArchiveKey(_files[index]), outcome.archiveXml);
+			if (errWrite == 0)
+				wcout << L"Exported metadata from " << _files[index] << L" to " << _options.archive << endl;
+			else
+			{
+				wcerr << CPHException(errWrite, E_FAIL, IDS_E_ARCHIVEWRITE_1, errWrite).GetMessage() << endl;
+				outcome.result = errWrite;
+				_archiveFailed = true;
+				if (!_bParallel)
+					_stopped = true;
+			}
+		}
+		wstring().swap(outcome.archiveXml);
+
+		if (_result == 0)
+			_result = outcome.result;
+	}
+
+	const vector<wstring>&	_files;
+	const FileOptions&		_options;
+	bool					_bParallel;
+	CMetadataArchiveWriter*	_pArchiveWriter;
+	unique_ptr<Outcome[]>	_outcomes;
+	bool					_stopped;
+	bool					_archiveFailed;
+	int						_result;
+};
+
+// Collects the files to process, from the command line, from lists and from walking directories,
+// and processes them in batches as they come, so that there can be any number of them.
+// A file is judged by its extension before anything opens it. The batches are processed one after
+// another, so the output is still in the order the files were given.
+class CTargetCollector : public CDirectoryVisitor
+{
+public:
+	CTargetCollector(const CExtensionChecker& checker, const FileOptions& options, unsigned cThreads, CMetadataArchiveWriter* pArchiveWriter) :
+		_checker(checker), _options(options), _cThreads(cThreads), _pArchiveWriter(pArchiveWriter),
+		_stopped(false), _result(0), _stopError(0)
+	{
+	}
+
+	// The result of processing the files so far
+	int Result() const { return _result; }
+
+	// Whether no more files will be processed, after an error with one thread, or after StopWith
+	bool Stopped() const { return _stopped; }
+
+	// The reason for StopWith, if it was called
+	int StopError() const { return _stopError; }
+	const wstring& StopMessage() const { return _stopMessage; }
+
+	// Adds a file named on the command line or in a list, walking it instead if it is a directory and we are recursing
+	// Like a missing file, a directory that cannot be read ends the list, and is reported after the files before it
+	void AddTarget(const wstring& target, bool recurse)
+	{
+		if (!PathFileExists(target.c_str()))
+			StopWith(ERROR_FILE_NOT_FOUND, L"Cannot find file \"" + target + L"\"");
+		else if (recurse && PathIsDirectory(target.c_str()))
+			WalkDirectory(target, *this);
+		else
+			VisitFile(target);
+	}
+
+	// Processes the files that are still waiting, and adds no more
+	void StopWith(int err, const wstring& message)
+	{
+		Finish();
+		_stopped = true;
+		_stopError = err;
+		_stopMessage = message;
+	}
+
+	// Processes the files that are still waiting
+	void Finish()
+	{
+		if (_files.empty() || _stopped)
+			return;
+
+		CFileTask task(_files, _options, _cThreads > 1, _pArchiveWriter);
+		RunParallel(_cThreads, _files.size(), task);
+		_files.clear();
+
+		if (_result == 0)
+			_result = task.Result();
+		if (task.Result() != 0 && _cThreads == 1)
+			_stopped = true;
+
+		// The archive is no use once a write to it has failed
+		if (task.ArchiveFailed())
+			_pArchiveWriter = NULL;
+	}
+
+	// Files that do not have our property handler are skipped, unless we were asked for the Explorer view
+	virtual bool VisitFile(const wstring& path)
+	{
+		int handler = _checker.HasPropertyHandler(path);
+		if (handler == 1 || (handler == -1 && _options.explorerView))
+		{
+			_files.push_back(path);
+			if (_files.size() == BatchSize)
+				Finish();
+		}
+		return !_stopped;
+	}
+
+	virtual bool DirectoryError(const wstring& path, int err)
+	{
+		StopWith(err, CPHException(err, E_FAIL, IDS_E_DIRREAD_2, err, path.c_str()).GetMessage());
+		return false;
+	}
+
+private:
+	CTargetCollector& operator=(const CTargetCollector&);
+
+	// Enough to keep the threads busy, without holding much output
+	static const size_t BatchSize = 1024;
+
+	const CExtensionChecker&	_checker;
+	const FileOptions&			_options;
+	unsigned					_cThreads;
+	CMetadataArchiveWriter*		_pArchiveWriter;
+	vector<wstring>				_files;
+	bool						_stopped;
+	int							_result;
+	int							_stopError;
+	wstring						_stopMessage;
+};
+
 int wmain(int argc, WCHAR* argv[])
 {
 	int result = 0;
@@ -56,8 +291,48 @@ int wmain(int argc, WCHAR* argv[])
 		SwitchArg xmlConsoleSwitch(L"c",L"console",L"Output XML to console instead of file (only valid for --export)",false);
 		cmd.add( xmlConsoleSwitch );
 
+		// Define binary format switch
+		SwitchArg binarySwitch(L"b",L"binary",L"Use the compact binary format for metadata files (.metadata.fmb); import recognises either format",false);
+		cmd.add( binarySwitch );
+
+		// Define single archive for all files
+		ValueArg<wstring> archiveArg(L"a",L"archive",L"Single indexed archive holding the metadata of all the target files, keyed by path relative to the current directory (import restores every file in the archive if no target files are given)",false,L"",L"file name");
+		cmd.add( archiveArg );
+
+		// Define number of files to process at once
+		ValueArg<wstring> jobsArg(L"j",L"jobs",L"Number of files to process in parallel (default 1)",false,L"1",L"count");
+		cmd.add( jobsArg );
+
+		// Define snapshot of property names
+		ValueArg<wstring> namesArg(L"n",L"names",L"Snapshot of property names for export to use, created from the property schema if it does not exist",false,L"",L"file name");
+		cmd.add( namesArg );
+
+		// Define recursion into directories
+		SwitchArg recurseSwitch(L"r",L"recurse",L"Process the files in any target directories, and in all the directories below them",false);
+		cmd.add( recurseSwitch );
+
+		// Define manifest for incremental export
+		ValueArg<wstring> manifestArg(L"m",L"manifest",L"Manifest of what was exported last time, so that only metadata that has changed since is exported again; created if it does not exist",false,L"",L"file name");
+		cmd.add( manifestArg );
+
+		// Define how import combines metadata with what the files already have
+		ValueArg<wstring> modeArg(L"",L"mode",L"How import treats metadata already on a file: merge (the default) keeps properties that are not imported, replace leaves exactly the imported properties, add-only imports only properties the file does not have",false,L"merge",L"merge|replace|add-only");
+		cmd.add( modeArg );
+
+		// Define journal for resumable import
+		ValueArg<wstring> journalArg(L"",L"journal",L"Journal of an import, so that if it is interrupted, running it again with the same journal carries on where it stopped; deleted once every file has been imported",false,L"",L"file name");
+		cmd.add( journalArg );
+
+		// Define log of what import overwrites
+		ValueArg<wstring> undoArg(L"u",L"undo",L"Log that import adds the values it overwrites to, so that they can be put back with --rollback",false,L"",L"file name");
+		cmd.add( undoArg );
+
+		// Define undoing of imports
+		SwitchArg rollbackSwitch(L"",L"rollback",L"Instead of importing, put back what the imports recorded in the undo log overwrote, latest first",false);
+		cmd.add( rollbackSwitch );
+
 		// Define target file
-		UnlabeledMultiArg<wstring> fileArg(L"file",L"Names of target files", true,L"file name",false);
+		UnlabeledMultiArg<wstring> fileArg(L"file",L"Names of target files, or @ and the name of a file listing them, one to a line, or @- to read the list from standard input", false,L"file name",false);
 		cmd.add( fileArg );
 
 		// Parse the args.
@@ -66,9 +341,37 @@ int wmain(int argc, WCHAR* argv[])
 		prompt = promptSwitch.getValue();
 		vector<wstring> targetFiles(fileArg.getValue());
 
+		if (archiveArg.isSet())
+		{
+			if (deleteSwitch.isSet())
+				throw ArgException(L"-a cannot be used with -d", L"archive");
+			else if (xmlFileArg.isSet() || xmlDirArg.isSet() || xmlConsoleSwitch.isSet())
+				throw ArgException(L"-a cannot be used with -x, -f or -c", L"archive");
+		}
+		if (binarySwitch.isSet())
+		{
+			if (deleteSwitch.isSet())
+				throw ArgException(L"-b cannot be used with -d", L"binary");
+			else if (xmlConsoleSwitch.isSet() || archiveArg.isSet())
+				throw ArgException(L"-b cannot be used with -c or -a", L"binary");
+		}
+		if (rollbackSwitch.isSet())
+		{
+			if (!importSwitch.isSet() || !undoArg.isSet())
+				throw ArgException(L"--rollback can only be used with -i and -u", L"rollback");
+			else if (!targetFiles.empty() || archiveArg.isSet() || journalArg.isSet())
+				throw ArgException(L"--rollback cannot be used with target files, -a or --journal", L"rollback");
+		}
+		else if (targetFiles.empty() && !(archiveArg.isSet() && importSwitch.isSet()))
+			throw ArgException(L"Target files are required, unless importing from an archive", L"file");
+
 		if (xmlFileArg.isSet())
 		{
-			if (targetFiles.size() > 1)
+			if (recurseSwitch.isSet())
+				throw ArgException(L"-x cannot be used with -r", L"xml");
+			else if (!targetFiles.empty() && targetFiles[0].compare(0, 1, L"@") == 0)
+				throw ArgException(L"-x cannot be used with a list of files", L"xml");
+			else if (targetFiles.size() > 1)
 				throw ArgException(L"-x cannot be used with multiple files", L"xml");
 			else if (xmlDirArg.isSet())
 				throw ArgException(L"-x and -f cannot be used together", L"xml");
@@ -93,177 +396,187 @@ int wmain(int argc, WCHAR* argv[])
 				throw ArgException(L"-v can only be used with -e", L"explorer");
 		}
 
-		for (auto pos = targetFiles.begin(); pos != targetFiles.end(); ++pos)
+		WCHAR* stop;
+		long jobs = wcstol(jobsArg.getValue().c_str(), &stop, 10);
+		if (*stop != L'\0' || jobs < 1 || jobs > MAXIMUM_WAIT_OBJECTS)
+			throw ArgException(L"-j must be a number from 1 to 64", L"jobs");
+
+		if (manifestArg.isSet())
 		{
-			wstring targetFile(*pos);
+			if (!exportSwitch.isSet())
+				throw ArgException(L"-m can only be used with -e", L"manifest");
+			else if (xmlConsoleSwitch.isSet() || archiveArg.isSet() || explorerSwitch.isSet())
+				throw ArgException(L"-m cannot be used with -c, -a or -v", L"manifest");
+		}
 
-			if (!PathFileExists(targetFile.c_str()))
-			{
-				wcerr << L"Cannot find file \"" << targetFile.c_str() << L"\"" << endl;
-				result = ERROR_FILE_NOT_FOUND;
-				break;
-			}
-			else if (0 == checker.HasPropertyHandler(targetFile) ||
-					 (-1 == checker.HasPropertyHandler(targetFile) && !explorerSwitch.isSet()))
+		ImportMode importMode = MergeImport;
+		if (modeArg.isSet())
+		{
+			if (!importSwitch.isSet())
+				throw ArgException(L"--mode can only be used with -i", L"mode");
+			else if (modeArg.getValue() == L"replace")
+				importMode = ReplaceImport;
+			else if (modeArg.getValue() == L"add-only")
+				importMode = AddOnlyImport;
+			else if (modeArg.getValue() != L"merge")
+				throw ArgException(L"--mode must be merge, replace or add-only", L"mode");
+		}
+
+		if (journalArg.isSet() && !importSwitch.isSet())
+			throw ArgException(L"--journal can only be used with -i", L"journal");
+		if (undoArg.isSet() && !importSwitch.isSet())
+			throw ArgException(L"-u can only be used with -i", L"undo");
+
+		if (namesArg.isSet())
+		{
+			if (!exportSwitch.isSet())
+				throw ArgException(L"-n can only be used with -e", L"names");
+
+			// Names are documentation only, so if there is no schema to take a snapshot of, export goes on without them
+			CPropertyNameCache& names = CPropertyNameCache::Instance();
+			int errNames = names.LoadSnapshot(namesArg.getValue().c_str());
+			if (errNames == ERROR_FILE_NOT_FOUND)
+				errNames = SUCCEEDED(names.LoadSchema()) ? names.SaveSnapshot(namesArg.getValue().c_str()) : 0;
+			if (errNames != 0)
+				throw CPHException(errNames, E_FAIL, IDS_E_NAMES_1, errNames);
+		}
+
+		FileOptions options;
+		options.exportMetadata = exportSwitch.isSet();
+		options.deleteMetadata = deleteSwitch.isSet();
+		options.explorerView = explorerSwitch.isSet();
+		options.console = xmlConsoleSwitch.isSet();
+		options.binary = binarySwitch.isSet();
+		options.xmlFile = xmlFileArg.getValue();
+		options.xmlDir = xmlDirArg.getValue();
+		options.archive = archiveArg.getValue();
+		options.importMode = importMode;
+		options.pArchiveReader = NULL;
+		options.pManifest = NULL;
+		options.pJournal = NULL;
+		options.pUndoLog = NULL;
+
+		// The first export with a manifest starts it
+		CChangeManifest manifest;
+		if (manifestArg.isSet())
+		{
+			int errManifest = manifest.Load(manifestArg.getValue().c_str());
+			if (errManifest != 0 && errManifest != ERROR_FILE_NOT_FOUND)
+				throw CPHException(errManifest, E_FAIL, IDS_E_MANIFEST_1, errManifest);
+			options.pManifest = &manifest;
+		}
+
+		// An import with a journal carries on from where the last run with it stopped
+		CImportJournal journal;
+		if (journalArg.isSet())
+		{
+			int errJournal = journal.Open(journalArg.getValue().c_str());
+			if (errJournal != 0)
+				throw CPHException(errJournal, E_FAIL, IDS_E_JOURNAL_1, errJournal);
+			options.pJournal = &journal;
+		}
+
+		CUndoLog undoLog;
+		if (undoArg.isSet() && !rollbackSwitch.isSet())
+		{
+			int errUndo = undoLog.Open(undoArg.getValue().c_str());
+			if (errUndo != 0)
+				throw CPHException(errUndo, E_FAIL, IDS_E_UNDO_1, errUndo);
+			options.pUndoLog = &undoLog;
+		}
+
+		CMetadataArchiveReader archiveReader;
+		CMetadataArchiveWriter archiveWriter;
+		if (archiveArg.isSet() && importSwitch.isSet())
+		{
+			int errOpen = archiveReader.Open(options.archive.c_str());
+			if (errOpen != 0)
+				throw CPHException(errOpen, E_FAIL, IDS_E_ARCHIVEOPEN_1, errOpen);
+			options.pArchiveReader = &archiveReader;
+
+			// Restore everything in the archive
+			if (targetFiles.empty())
 			{
-				// Skip files that do not have our property handler,
-				// unless we were asked for the Explorer view
-				continue;
+				for (size_t i = 0; i < archiveReader.GetCount(); i++)
+					targetFiles.push_back(archiveReader.GetPathAt(i));
 			}
-			else if (deleteSwitch.isSet())
-			{
-				// We need to check if metadata is present, to avoid adding an empty alternate stream by opening
-				// r/w when no metadata stream is present
-				if (S_OK != MetadataPresent(targetFile))
-					continue;
+		}
+
+		if (archiveArg.isSet() && exportSwitch.isSet())
+		{
+			int errOpen = archiveWriter.Create(options.archive.c_str());
+			if (errOpen != 0)
+				throw CPHException(errOpen, E_FAIL, IDS_E_ARCHIVEOPEN_1, errOpen);
+		}
 
-				DeleteMetadata(targetFile);
+		// Process the files as they are found, stopping at the first that does not exist
+		CTargetCollector collector(checker, options, (unsigned)jobs, archiveArg.isSet() && exportSwitch.isSet() ? &archiveWriter : NULL);
 
-				wcout << L"Removed all metadata from " << targetFile <<  endl;
-			}
-			else
+		for (auto pos = targetFiles.begin(); pos != targetFiles.end() && !collector.Stopped(); ++pos)
+		{
+			wstring targetFile(*pos);
+
+			// A list of files, read as it is processed
+			if (targetFile.compare(0, 1, L"@") == 0)
 			{
-				wstring xmlFile;
-
-				// Build XML file name 
-				if (xmlFileArg.isSet())
-				{
-					// use specified file
-					xmlFile = xmlFileArg.getValue();
-				}
-				else if (xmlDirArg.isSet())
-				{
-					// build from specified directory and target file stem
-					WCHAR buf[MAX_PATH];
-					wcscpy_s(buf, MAX_PATH, xmlDirArg.getValue().c_str());
-					PathAppend(buf, PathFindFileName(targetFile.c_str()));
-					xmlFile = buf;
-					xmlFile += MetadataFileSuffix;
-				}
-				else
-				{
-					// build from full target file name
-					xmlFile = targetFile + MetadataFileSuffix;
-				}
-
-
-				if (exportSwitch.isSet())
-				{
-					xml_document<WCHAR> doc;
-					ExportMetadata(&doc, targetFile, explorerSwitch.isSet());
-
-					// writing to a string rather than directly to the stream is odd, but writing directly does not compile
-					// (trying to access a private constructor on traits - a typically arcane template issue)
-					wstring s;
-					print(std::back_inserter(s), doc, 0);
-
-					if (xmlConsoleSwitch.isSet())
-					{
-						wcout << s << endl;
-					}
-					else
-					{
-						// Now write from the XML string to a file stream
-						// This used to be STL, but wofstream by default writes 8-bit encoded files, and changing that is complex
-						FILE *pfile;
-						errno_t err = _wfopen_s(&pfile, xmlFile.c_str(), L"w+, ccs=UTF-16LE");
-						if (0 == err)
-						{
-							fwrite(s.c_str(), sizeof(WCHAR), s.length(), pfile);
-							fclose(pfile);
-						}
-						else
-							throw CPHException(err, E_FAIL, IDS_E_FILEOPEN_1, err);
-
-						wcout << L"Exported metadata to " << xmlFile << endl;
-					}
-				}
-				// Must be import, so XML file needs to exist
-				else if (!PathFileExists(xmlFile.c_str()))
-				{
-					wcerr << L"Cannot find XML file \"" << xmlFile.c_str() << L"\"" << endl;
-					result = ERROR_FILE_NOT_FOUND;
-					break;
-				}
-				else
-				{
-					// rapidxml parsing works only from a string, so read the whole file
-					FILE *pfile;
-					errno_t err = _wfopen_s(&pfile, xmlFile.c_str(), L"rb");
-					if (0 == err)
-					{
-						fseek (pfile , 0 , SEEK_END);
-						size_t lSize = ftell (pfile);  // size in bytes
-						rewind (pfile);
-
-						CHAR* buffer = new CHAR[lSize + sizeof(WCHAR)];
-						WCHAR* wbuffer;
-						size_t lwSize;
-						size_t offset = 0;
-
-						fread(buffer, sizeof(CHAR), lSize, pfile);
-						fclose(pfile);
-
-						// export files are now UTF-16 with BOM
-						if (buffer[0] == (CHAR)0xFF && buffer[1] == (CHAR)0xFE)
-						{
-							wbuffer = (WCHAR*) buffer;
-							lwSize = lSize / sizeof(WCHAR);
-							wbuffer[lwSize] = L'\0';  // ensure termination
-							offset++;  // skip BOM
-						}
-						// but also cope with ASCII files from our previous versions, or that have been hand-edited in ASCII
-						else
-						{
-							wbuffer = new WCHAR[lSize + 1];
-							lwSize = lSize;
-							size_t conv;
-							mbstowcs_s(&conv, wbuffer, lSize+1, buffer, lSize);
-							delete [] buffer;
-						}
-
-						// parse the XML
-						xml_document<WCHAR> doc;
-						WCHAR * xml = doc.allocate_string(wbuffer+offset, lwSize+1-offset);  
-
-						if (offset == 0) // ASCII file
-							delete [] wbuffer;
-						else
-							delete [] buffer;
-	
-						try
-						{
-							doc.parse<0>(xml);
-						}
-						catch(parse_error& e)
-						{
-							size_t size = strlen(e.what()) + 1;
-							WCHAR * error = new WCHAR[size];
-							size_t convertedChars = 0;
-							mbstowcs_s(&convertedChars, error, size, e.what(), _TRUNCATE);
-
-		#define MAX_ERRLENGTH 20
-							WCHAR content[MAX_ERRLENGTH + 1];
-							size = wcslen(e.where<WCHAR>());
-							if (size > MAX_ERRLENGTH)
-								size = MAX_ERRLENGTH;
-							wmemcpy(content, e.where<WCHAR>(), size);
-							content[MAX_ERRLENGTH] = L'\0';  // ensure termination
-
-							CPHException cphe = CPHException(ERROR_XML_PARSE_ERROR, E_FAIL, IDS_E_XML_PARSE_ERROR_3, error, content, xmlFile.c_str());
-							delete [] error;
-							throw cphe;
-						}
-
-						// apply it 
-						ImportMetadata(&doc, targetFile);
-					}
-					else
-						throw CPHException(err, E_FAIL, IDS_E_FILEOPEN_1, err);
-
-					wcout << L"Imported metadata to " << targetFile << L" from " << xmlFile <<  endl;
-				}
+				wstring listFile = targetFile.substr(1);
+				CFileListReader list;
+				int errList = list.Open(listFile.c_str());
+
+				wstring listedFile;
+				while (errList == 0 && !collector.Stopped() && list.Next(listedFile))
+					collector.AddTarget(listedFile, recurseSwitch.isSet());
+
+				if (errList == 0)
+					errList = list.Error();
+				if (errList != 0 && !collector.Stopped())
+					collector.StopWith(errList, CPHException(errList, E_FAIL, IDS_E_FILELIST_2, errList, listFile.c_str()).GetMessage());
 			}
+			else
+				collector.AddTarget(targetFile, recurseSwitch.isSet());
+		}
+
+		collector.Finish();
+		result = collector.Result();
+
+		// There are no target files to roll back, only the records in the undo log
+		if (rollbackSwitch.isSet())
+			RollBack(undoArg.getValue());
+
+		// Keep what was exported before any failure, just as separate XML files would be kept
+		if (archiveArg.isSet() && exportSwitch.isSet())
+		{
+			int errClose = archiveWriter.Close();
+			if (errClose != 0 && result == 0)
+				throw CPHException(errClose, E_FAIL, IDS_E_ARCHIVEWRITE_1, errClose);
+		}
+
+		// Files that have gone are listed, so that their exports can be tidied up, and then forgotten
+		if (manifestArg.isSet())
+		{
+			vector<wstring> deleted;
+			manifest.RemoveDeleted(deleted);
+			for (auto pos = deleted.begin(); pos != deleted.end(); ++pos)
+				wcout << L"Removed " << *pos << L" from the manifest, as it no longer exists" << endl;
+
+			int errSave = manifest.Save(manifestArg.getValue().c_str());
+			if (errSave != 0 && result == 0)
+				throw CPHException(errSave, E_FAIL, IDS_E_MANIFEST_1, errSave);
+		}
+
+		// Once every file has been imported, there is nothing left to resume
+		int errJournal = journal.Close(result == 0 && collector.StopError() == 0);
+		if (errJournal != 0 && result == 0)
+			throw CPHException(errJournal, E_FAIL, IDS_E_JOURNAL_1, errJournal);
+
+		int errUndo = undoLog.Close();
+		if (errUndo != 0 && result == 0)
+			throw CPHException(errUndo, E_FAIL, IDS_E_UNDO_1, errUndo);
+
+		if (result == 0 && collector.StopError() != 0)
+		{
+			wcerr << collector.StopMessage() << endl;
+			result = collector.StopError();
 		}
 	}
 	catch (ArgException &e)  // catch any exceptions
@@ -288,9 +601,227 @@ int wmain(int argc, WCHAR* argv[])
 	return result;
 }
 
+// The key of a file in an archive is its path relative to the current directory, if it is below it
+static wstring ArchiveKey(const wstring& targetFile)
+{
+	WCHAR fullPath[MAX_PATH];
+	WCHAR currentDir[MAX_PATH + 1];
+	if (0 == GetFullPathName(targetFile.c_str(), MAX_PATH, fullPath, NULL) ||
+		0 == GetCurrentDirectory(MAX_PATH, currentDir) || NULL == PathAddBackslash(currentDir))
+		return targetFile;
+
+	size_t cch = wcslen(currentDir);
+	if (0 == _wcsnicmp(fullPath, currentDir, cch))
+		return fullPath + cch;
+	else
+		return fullPath;
+}
+
+// Export, import or delete the metadata of one file, writing any messages to out and err
+// When exporting to an archive, the XML is returned in archiveXml, to be added to it in order
+// throws CPHException on error
+static int ProcessFile(const wstring& targetFile, const FileOptions& options, wstring& archiveXml, wostream& out, wostream& err)
+{
+	if (options.deleteMetadata)
+	{
+		// We need to check if metadata is present, to avoid adding an empty alternate stream by opening
+		// r/w when no metadata stream is present
+		if (S_OK != MetadataPresent(targetFile))
+			return 0;
+
+		DeleteMetadata(targetFile);
+
+		out << L"Removed all metadata from " << targetFile <<  endl;
+		return 0;
+	}
+
+	// A resumed import passes over the files that were done before it was interrupted
+	if (options.pJournal != NULL)
+	{
+		if (options.pJournal->IsDone(targetFile))
+		{
+			out << L"Skipped " << targetFile << L", which was imported before the import was interrupted" << endl;
+			return 0;
+		}
+
+		int errJournal = options.pJournal->Start(targetFile);
+		if (errJournal != 0)
+			throw CPHException(errJournal, E_FAIL, IDS_E_JOURNAL_1, errJournal);
+	}
+
+	if (!options.archive.empty())
+	{
+		if (options.exportMetadata)
+		{
+			CStringXmlWriter writer(archiveXml);
+			ExportMetadata(writer, targetFile, options.explorerView);
+			writer.Close();
+			return 0;
+		}
+
+		wstring key = ArchiveKey(targetFile);
+		int index = options.pArchiveReader->Find(key);
+		if (index < 0)
+		{
+			err << L"Cannot find \"" << key.c_str() << L"\" in archive \"" << options.archive.c_str() << L"\"" << endl;
+			return ERROR_FILE_NOT_FOUND;
+		}
+
+		wstring xml;
+		int errRead = options.pArchiveReader->Read(index, xml);
+		if (errRead != 0)
+			throw CPHException(errRead, E_FAIL, IDS_E_ARCHIVEREAD_1, errRead);
+
+		// Parse errors name the entry within the archive
+		ImportMetadataFromXml(&xml[0], targetFile, options.archive + L"(" + key + L")", options.importMode, options.pUndoLog);
+		JournalImported(targetFile, options);
+
+		out << L"Imported metadata to " << targetFile << L" from " << options.archive <<  endl;
+		return 0;
+	}
+
+	wstring xmlFile;
+
+	// Build XML file name 
+	if (!options.xmlFile.empty())
+	{
+		// use specified file
+		xmlFile = options.xmlFile;
+	}
+	else if (!options.xmlDir.empty())
+	{
+		// build from specified directory and target file stem
+		WCHAR buf[MAX_PATH];
+		wcscpy_s(buf, MAX_PATH, options.xmlDir.c_str());
+		PathAppend(buf, PathFindFileName(targetFile.c_str()));
+		xmlFile = buf;
+		xmlFile += options.binary ? MetadataBinaryFileSuffix : MetadataFileSuffix;
+	}
+	else
+	{
+		// build from full target file name
+		xmlFile = targetFile + (options.binary ? MetadataBinaryFileSuffix : MetadataFileSuffix);
+	}
+
+	if (options.exportMetadata)
+	{
+		if (options.console)
+		{
+			// Elements are written out as the properties are read
+			CStreamXmlWriter writer(out);
+			ExportMetadata(writer, targetFile, options.explorerView);
+			writer.Close();
+			out << endl;
+		}
+		else if (options.pManifest != NULL)
+			return ExportChangedMetadata(targetFile, xmlFile, options, out);
+		else if (options.binary)
+		{
+			ExportMetadataToBinaryFile(targetFile, xmlFile, options.explorerView);
+
+			out << L"Exported metadata to " << xmlFile << endl;
+		}
+		else
+		{
+			ExportMetadataToFile(targetFile, xmlFile, options.explorerView);
+
+			out << L"Exported metadata to " << xmlFile << endl;
+		}
+	}
+	// Must be import, so XML file needs to exist
+	else if (!PathFileExists(xmlFile.c_str()))
+	{
+		err << L"Cannot find XML file \"" << xmlFile.c_str() << L"\"" << endl;
+		return ERROR_FILE_NOT_FOUND;
+	}
+	else if (IsBinaryMetadataFile(xmlFile))
+	{
+		ImportMetadataFromBinaryFile(targetFile, xmlFile, options.importMode, options.pUndoLog);
+		JournalImported(targetFile, options);
+
+		out << L"Imported metadata to " << targetFile << L" from " << xmlFile <<  endl;
+	}
+	else
+	{
+		// Parse straight from the mapped file where we can
+		CMappedXmlFile xml;
+		int errOpen = xml.Open(xmlFile.c_str());
+		if (0 == errOpen)
+			ImportMetadataFromXml(xml.Text(), targetFile, xmlFile, options.importMode, options.pUndoLog);
+		else
+			throw CPHException(errOpen, E_FAIL, IDS_E_FILEOPEN_1, errOpen);
+		JournalImported(targetFile, options);
+
+		out << L"Imported metadata to " << targetFile << L" from " << xmlFile <<  endl;
+	}
+
+	return 0;
+}
+
+// Notes in the journal, if there is one, that the import of a file has been committed
+// throws CPHException on error
+static void JournalImported(const wstring& targetFile, const FileOptions& options)
+{
+	if (options.pJournal == NULL)
+		return;
+
+	int errJournal = options.pJournal->Done(targetFile);
+	if (errJournal != 0)
+		throw CPHException(errJournal, E_FAIL, IDS_E_JOURNAL_1, errJournal);
+}
+
+// Puts back what the imports recorded in an undo log overwrote, latest first, so that each file
+// ends up as it was before the first of them
+// throws CPHException on error
+static void RollBack(const wstring& undoLog)
+{
+	vector<UndoRecord> records;
+	int errRead = CUndoLog::Read(undoLog.c_str(), records);
+	if (errRead != 0)
+		throw CPHException(errRead, E_FAIL, IDS_E_UNDO_1, errRead);
+
+	for (auto pos = records.rbegin(); pos != records.rend(); ++pos)
+	{
+		HRESULT hr = ApplyUndo(pos->targetFile, pos->undo);
+		if (FAILED(hr))
+			throw CPHException(ERROR_WRITE_FAULT, hr, IDS_E_ROLLBACK_2, hr, pos->targetFile.c_str());
+
+		wcout << L"Restored metadata of " << pos->targetFile << L" from " << undoLog << endl;
+	}
+}
+
 // An implementation of this is required by XmlHelpers
 int AccessResourceString(UINT uId, LPWSTR lpBuffer, int nBufferMax)
 {
 	return LoadStringW(GetModuleHandle(NULL), uId, lpBuffer, nBufferMax);
 }
 
+// Export the metadata of one file, unless the manifest shows that it has not changed since the last export,
+// and then write it only if it is not the same as before
+// throws CPHException on error
+static int ExportChangedMetadata(const wstring& targetFile, const wstring& xmlFile, const FileOptions& options, wostream& out)
+{
+	// Stamped before it is read, so that a change made during the export is seen next time
+	MetadataStamp stamp;
+	HRESULT hrStamp = StampMetadata(targetFile, &stamp);
+	if (FAILED(hrStamp))
+		memset(&stamp, 0, sizeof(stamp));
+
+	ULONGLONG hash;
+	bool unchanged = options.pManifest->IsUnchanged(targetFile, stamp, xmlFile, &hash);
+	if (!PathFileExists(xmlFile.c_str()))
+		hash = 0;
+	else if (unchanged && SUCCEEDED(hrStamp))
+		return 0;
+
+	bool written = options.binary ? ExportMetadataToBinaryFile(targetFile, xmlFile, false, &hash) :
+		ExportMetadataToFile(targetFile, xmlFile, false, &hash);
+
+	// Without a stamp, the metadata is read again next time, but is still only written if it has changed
+	options.pManifest->Update(targetFile, stamp, xmlFile, hash);
+
+	if (written)
+		out << L"Exported metadata to " << xmlFile << endl;
+	return 0;
+}
+
@@ -0,0 +1,261 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "HandlerTable.h"
+#include <wctype.h>
+
+// Extensions as long as this are rejected by _wsplitpath_s, and so never had a handler
+static const size_t MaxExtension = 256;
+
+#pragma region Helpers
+
+static WCHAR FoldCase(WCHAR ch)
+{
+	if (ch < 0x80)
+		return (ch >= L'A' && ch <= L'Z') ? (WCHAR)(ch + (L'a' - L'A')) : ch;
+	return (WCHAR)towlower(ch);
+}
+
+static bool EqualIgnoringCase(const WCHAR* psz1, const WCHAR* psz2)
+{
+	for (; *psz1 && FoldCase(*psz1) == FoldCase(*psz2); psz1++, psz2++)
+		;
+	return FoldCase(*psz1) == FoldCase(*psz2);
+}
+
+// FNV-1a, of the text as it would be in lower case
+static DWORD HashFolded(const WCHAR* pch, size_t cch)
+{
+	DWORD hash = 2166136261U;
+	for (size_t i = 0; i < cch; i++)
+	{
+		hash ^= (DWORD)FoldCase(pch[i]);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+// The extension of a file, including its dot, as _wsplitpath_s finds it, or NULL if there is none
+static const WCHAR* FindExtension(const WCHAR* pszFileName, size_t* pcch)
+{
+	const WCHAR* pchDot = NULL;
+	const WCHAR* pch = pszFileName;
+	for (; *pch; pch++)
+	{
+		if (*pch == L'.')
+			pchDot = pch;
+		else if (*pch == L'\\' || *pch == L'/' || *pch == L':')
+			pchDot = NULL;
+	}
+
+	if (!pchDot)
+		return NULL;
+	*pcch = pch - pchDot;
+	return pchDot;
+}
+
+#pragma endregion
+
+#ifdef _WIN32
+CRegistryHandlerSource::CRegistryHandlerSource()
+	: _hkey(NULL), _hevent(NULL), _watching(false)
+{
+}
+
+CRegistryHandlerSource::~CRegistryHandlerSource()
+{
+	if (_hkey)
+		RegCloseKey(_hkey);
+	if (_hevent)
+		CloseHandle(_hevent);
+}
+
+bool CRegistryHandlerSource::HasChanged()
+{
+	return !_watching || WaitForSingleObject(_hevent, 0) != WAIT_TIMEOUT;
+}
+
+int CRegistryHandlerSource::Read(std::vector<HandlerRegistration>& registrations)
+{
+	registrations.clear();
+	_watching = false;
+
+	LONG err = ERROR_SUCCESS;
+	if (!_hkey)
+	{
+		err = RegOpenKeyEx(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\PropertySystem\\PropertyHandlers",
+						   0, KEY_READ | KEY_NOTIFY, &_hkey);
+		if (err != ERROR_SUCCESS)
+		{
+			_hkey = NULL;
+			return err;
+		}
+	}
+	if (!_hevent)
+		_hevent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	// Watch before reading, so that a change made while reading is not missed
+	if (_hevent && ResetEvent(_hevent))
+		_watching = ERROR_SUCCESS == RegNotifyChangeKeyValue(_hkey, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, _hevent, TRUE);
+
+	for (DWORD i = 0; ; i++)
+	{
+		WCHAR name[MaxExtension];
+		DWORD cchName = MaxExtension;
+		err = RegEnumKeyEx(_hkey, i, name, &cchName, NULL, NULL, NULL, NULL);
+		if (err == ERROR_NO_MORE_ITEMS)
+		{
+			err = ERROR_SUCCESS;
+			break;
+		}
+		else if (err == ERROR_MORE_DATA)
+			continue;		// too long to be an extension that is ever looked up
+		else if (err != ERROR_SUCCESS)
+			break;
+
+		WCHAR buffer[MaxExtension];
+		DWORD size = sizeof(buffer);
+		// A key without a handler is treated as no key, as it always has been
+		if (ERROR_SUCCESS == RegGetValue(_hkey, name, NULL, RRF_RT_REG_SZ, NULL, buffer, &size))
+		{
+			HandlerRegistration registration;
+			registration.extension = name;
+			registration.handler = buffer;
+			registrations.push_back(registration);
+		}
+	}
+
+	return err;
+}
+#endif
+
+int CFileHandlerSource::Read(std::vector<HandlerRegistration>& registrations)
+{
+	registrations.clear();
+
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(_path.c_str(), data);
+	if (err != 0)
+		return err;
+
+	std::wstring text;
+	if (!data.empty() && !DecodeUtf8(&data[0], data.size(), text))
+		return ERROR_FILE_CORRUPT;
+
+	size_t start = 0;
+	while (start < text.size())
+	{
+		size_t end = text.find(L'\n', start);
+		if (end == std::wstring::npos)
+			end = text.size();
+		std::wstring line(text, start, end - start);
+		start = end + 1;
+
+		if (!line.empty() && line[line.size() - 1] == L'\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == L'#')
+			continue;
+
+		// .ext {CLSID}
+		size_t space = line.find(L' ');
+		if (line[0] != L'.' || space == std::wstring::npos || space + 1 == line.size())
+			return ERROR_FILE_CORRUPT;
+
+		HandlerRegistration registration;
+		registration.extension = line.substr(0, space);
+		registration.handler = line.substr(space + 1);
+		registrations.push_back(registration);
+	}
+	return 0;
+}
+
+CHandlerTable::CHandlerTable()
+	: _cEntries(0)
+{
+}
+
+int CHandlerTable::Load(IHandlerSource& source, const WCHAR* pszOurHandler)
+{
+	_slots.clear();
+	_pool.clear();
+	_cEntries = 0;
+
+	std::vector<HandlerRegistration> registrations;
+	int err = source.Read(registrations);
+	if (err != 0)
+		return err;
+
+	size_t cSlots = 16;
+	while (cSlots < registrations.size() * 2)
+		cSlots *= 2;
+	Slot empty;
+	memset(&empty, 0, sizeof(empty));
+	_slots.assign(cSlots, empty);
+
+	for (size_t i = 0; i < registrations.size(); i++)
+	{
+		const std::wstring& extension = registrations[i].extension;
+		if (extension.empty() || extension.size() >= MaxExtension)
+			continue;
+
+		// The registry cannot hold the same extension twice, but a stand-in could
+		if (Find(extension.c_str(), extension.size()))
+			continue;
+
+		Slot slot = empty;
+		slot.hash = HashFolded(extension.c_str(), extension.size());
+		slot.cch = (WORD)extension.size();
+		slot.value = EqualIgnoringCase(registrations[i].handler.c_str(), pszOurHandler) ? 1 : -1;
+
+		WCHAR* pchText = slot.text;
+		if (extension.size() > InlineLength)
+		{
+			slot.offset = (DWORD)_pool.size();
+			_pool.resize(_pool.size() + extension.size());
+			pchText = &_pool[slot.offset];
+		}
+		for (size_t j = 0; j < extension.size(); j++)
+			pchText[j] = FoldCase(extension[j]);
+
+		size_t mask = _slots.size() - 1;
+		size_t index = slot.hash & mask;
+		while (_slots[index].cch != 0)
+			index = (index + 1) & mask;
+		_slots[index] = slot;
+		_cEntries++;
+	}
+	return 0;
+}
+
+const CHandlerTable::Slot* CHandlerTable::Find(const WCHAR* pchExt, size_t cchExt) const
+{
+	if (_slots.empty())
+		return NULL;
+
+	DWORD hash = HashFolded(pchExt, cchExt);
+	size_t mask = _slots.size() - 1;
+	for (size_t index = hash & mask; _slots[index].cch != 0; index = (index + 1) & mask)
+	{
+		const Slot& slot = _slots[index];
+		if (slot.hash != hash || slot.cch != cchExt)
+			continue;
+
+		const WCHAR* pchText = SlotText(slot);
+		size_t i = 0;
+		while (i < cchExt && FoldCase(pchExt[i]) == pchText[i])
+			i++;
+		if (i == cchExt)
+			return &slot;
+	}
+	return NULL;
+}
+
+int CHandlerTable::Classify(const WCHAR* pszFileName) const
+{
+	size_t cchExt;
+	const WCHAR* pchExt = FindExtension(pszFileName, &cchExt);
+	if (!pchExt || cchExt >= MaxExtension)
+		return 0;
+
+	const Slot* pSlot = Find(pchExt, cchExt);
+	return pSlot ? pSlot->value : 0;
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// The property handlers registered for file extensions, under
+// HKEY_LOCAL_MACHINE\SOFTWARE\Microsoft\Windows\CurrentVersion\PropertySystem\PropertyHandlers.
+// Rather than going to the registry for each extension, the whole key is read once into a table,
+// after which a file can be classified without any system calls. Where the registrations come from
+// is left to a source, so that a file can stand in for the registry in testing and benchmarks.
+//
+// The stand-in is UTF-8 text with one extension on each line: the extension with its leading dot,
+// a space, and the CLSID of the handler in braces. Blank lines and lines that begin with '#' are ignored.
+
+#pragma once
+
+#include "PortableTypes.h"
+
+struct HandlerRegistration
+{
+	std::wstring	extension;
+	std::wstring	handler;
+};
+
+// Where the registrations come from
+class IHandlerSource
+{
+public:
+	virtual ~IHandlerSource() {}
+
+	// Replaces the contents of registrations with every extension that has a handler.
+	// Returns 0, or the system error code.
+	virtual int Read(std::vector<HandlerRegistration>& registrations) = 0;
+};
+
+#ifdef _WIN32
+class CRegistryHandlerSource : public IHandlerSource
+{
+public:
+	CRegistryHandlerSource();
+	~CRegistryHandlerSource();
+
+	virtual int Read(std::vector<HandlerRegistration>& registrations);
+
+	// Whether the registrations may have changed since they were last read,
+	// which is always the case if the registry cannot say
+	bool HasChanged();
+
+private:
+	CRegistryHandlerSource(const CRegistryHandlerSource&);
+	CRegistryHandlerSource& operator=(const CRegistryHandlerSource&);
+
+	HKEY	_hkey;
+	HANDLE	_hevent;		// signalled when anything under the key changes
+	bool	_watching;
+};
+#endif
+
+class CFileHandlerSource : public IHandlerSource
+{
+public:
+	CFileHandlerSource(const WCHAR* pszPath) : _path(pszPath) {}
+
+	// Returns ERROR_FILE_CORRUPT if a line is not in the expected form
+	virtual int Read(std::vector<HandlerRegistration>& registrations);
+
+private:
+	std::wstring	_path;
+};
+
+// Extensions and what handles them, in a single open-addressed hash table.
+// Once loaded, the table is only read, so any number of threads can classify files at once without locking.
+class CHandlerTable
+{
+public:
+	CHandlerTable();
+
+	// Replaces the contents with the registrations from a source, noting which of them are ours.
+	// Returns 0, or the system error code, in which case the table is left empty.
+	// Not to be called while other threads are classifying.
+	int Load(IHandlerSource& source, const WCHAR* pszOurHandler);
+
+	// Classifies a file by its extension: 1 if our handler is registered for it,
+	// -1 if another handler is, or 0 if there is none. The extension is hashed and
+	// compared ignoring case where it lies in the file name, without being copied.
+	int Classify(const WCHAR* pszFileName) const;
+
+	size_t GetCount() const { return _cEntries; }
+
+private:
+	// Long enough for nearly every extension, including its dot, to be held in its slot
+	static const size_t InlineLength = 8;
+
+	struct Slot
+	{
+		DWORD	hash;
+		WORD	cch;		// 0 for an empty slot
+		SHORT	value;
+		union
+		{
+			WCHAR	text[InlineLength];		// the extension in lower case, if it fits
+			DWORD	offset;					// otherwise where it is in the pool
+		};
+	};
+
+	const WCHAR* SlotText(const Slot& slot) const { return slot.cch <= InlineLength ? slot.text : &_pool[slot.offset]; }
+	const Slot* Find(const WCHAR* pchExt, size_t cchExt) const;
+
+	std::vector<Slot>	_slots;		// a power of two in size, and never more than half full
+	std::vector<WCHAR>	_pool;
+	size_t				_cEntries;
+};
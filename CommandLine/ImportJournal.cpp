@@ -0,0 +1,425 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "ImportJournal.h"
+#include "MetadataArchive.h"
+#include "MetadataBinary.h"
+#include <algorithm>
+#include <errno.h>
+#include <memory>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char JournalHeader[] = "# FileMeta import journal\n";
+static const BYTE UndoSignature[8] = { 'F', 'M', 'E', 'T', 'A', 'U', 'N', 'D' };
+
+#pragma region Helpers
+
+// Opens a file to add to, keeping only its first cbKeep bytes, which drops anything a stopped run left half written
+static int OpenToAppend(const WCHAR* pszPath, bool bExists, size_t cbKeep, FILE** ppfile)
+{
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	int err = _wfopen_s(&pfile, pszPath, bExists ? L"r+b" : L"wb");
+	if (err != 0)
+		return err;
+	if (_chsize_s(_fileno(pfile), (__int64)cbKeep) != 0)
+		err = errno;
+	else if (_fseeki64(pfile, 0, SEEK_END) != 0)
+		err = errno;
+#else
+	pfile = fopen(NarrowPath(pszPath).c_str(), bExists ? "r+b" : "wb");
+	if (!pfile)
+		return errno;
+	int err = 0;
+	if (ftruncate(fileno(pfile), (off_t)cbKeep) != 0)
+		err = errno;
+	else if (fseeko(pfile, 0, SEEK_END) != 0)
+		err = errno;
+#endif
+
+	if (err != 0)
+		fclose(pfile);
+	else
+		*ppfile = pfile;
+	return err;
+}
+
+// Writes and flushes, so that what is written survives this process stopping
+static int WriteFlushed(FILE* pfile, const std::vector<BYTE>& data)
+{
+	if (fwrite(&data[0], 1, data.size(), pfile) != data.size() || fflush(pfile) != 0)
+		return errno;
+	return 0;
+}
+
+static void PutUInt32(std::vector<BYTE>& data, DWORD dw)
+{
+	for (int i = 0; i < 4; i++)
+		data.push_back((BYTE)(dw >> (8 * i)));
+}
+
+static void PutUInt64(std::vector<BYTE>& data, ULONGLONG ull)
+{
+	for (int i = 0; i < 8; i++)
+		data.push_back((BYTE)(ull >> (8 * i)));
+}
+
+static DWORD GetUInt32(const BYTE* p)
+{
+	return (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static ULONGLONG GetUInt64(const BYTE* p)
+{
+	return (ULONGLONG)GetUInt32(p) | ((ULONGLONG)GetUInt32(p + 4) << 32);
+}
+
+static void PutKey(std::vector<BYTE>& data, REFPROPERTYKEY key)
+{
+	PutUInt32(data, key.fmtid.Data1);
+	data.push_back((BYTE)key.fmtid.Data2);
+	data.push_back((BYTE)(key.fmtid.Data2 >> 8));
+	data.push_back((BYTE)key.fmtid.Data3);
+	data.push_back((BYTE)(key.fmtid.Data3 >> 8));
+	data.insert(data.end(), key.fmtid.Data4, key.fmtid.Data4 + 8);
+	PutUInt32(data, key.pid);
+}
+
+static void GetKey(const BYTE* p, PROPERTYKEY* pkey)
+{
+	pkey->fmtid.Data1 = GetUInt32(p);
+	pkey->fmtid.Data2 = (WORD)(p[4] | (p[5] << 8));
+	pkey->fmtid.Data3 = (WORD)(p[6] | (p[7] << 8));
+	memcpy(pkey->fmtid.Data4, p + 8, 8);
+	pkey->pid = GetUInt32(p + 16);
+}
+
+// Parses the records of an undo log, stopping at one that is cut short, and returning in *pcbValid the size of what is complete
+static int ParseUndoLog(const std::vector<BYTE>& data, std::vector<UndoRecord>* pRecords, size_t* pcbValid)
+{
+	if (data.size() < sizeof(UndoSignature) || memcmp(&data[0], UndoSignature, sizeof(UndoSignature)) != 0)
+		return ERROR_FILE_CORRUPT;
+
+	size_t pos = sizeof(UndoSignature);
+	while (data.size() - pos >= 4 && data.size() - pos - 4 >= GetUInt32(&data[pos]))
+	{
+		const BYTE* p = &data[pos + 4];
+		size_t cb = GetUInt32(&data[pos]);
+		if (cb < 16 || GetUInt64(p) != HashBytes(p + 8, cb - 8))
+			return ERROR_FILE_CORRUPT;
+
+		size_t cbPath = GetUInt32(p + 8);
+		if (cbPath > cb - 16)
+			return ERROR_FILE_CORRUPT;
+		size_t offset = 12 + cbPath;
+		DWORD cAdded = GetUInt32(p + offset);
+		offset += 4;
+		if (cAdded > (cb - offset) / 20)
+			return ERROR_FILE_CORRUPT;
+
+		if (pRecords != NULL)
+		{
+			UndoRecord record;
+			if (!DecodeUtf8(p + 12, cbPath, record.targetFile))
+				return ERROR_FILE_CORRUPT;
+
+			record.undo.added.resize(cAdded);
+			for (DWORD i = 0; i < cAdded; i++)
+				GetKey(p + offset + 20 * i, &record.undo.added[i]);
+			offset += 20 * cAdded;
+
+			if (FAILED(ReadBinaryMetadata(p + offset, cb - offset, record.undo.prior)))
+				return ERROR_FILE_CORRUPT;
+			pRecords->push_back(record);
+		}
+
+		pos += 4 + cb;
+	}
+
+	*pcbValid = pos;
+	return 0;
+}
+
+#pragma endregion
+
+#pragma region CImportJournal
+
+bool CImportJournal::PathLess::operator()(const std::wstring& path1, const std::wstring& path2) const
+{
+	return CMetadataArchive::ComparePaths(path1, path2) < 0;
+}
+
+CImportJournal::CImportJournal() : _pfile(NULL)
+{
+}
+
+CImportJournal::~CImportJournal()
+{
+	Close(false);
+}
+
+int CImportJournal::Open(const WCHAR* pszPath)
+{
+	Close(false);
+
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(pszPath, data);
+	bool bExists = err == 0;
+	if (err == ERROR_FILE_NOT_FOUND)
+		err = 0;
+	if (err != 0)
+		return err;
+
+	// A journal that is new, or was created by a run that stopped before it could write anything, starts afresh
+	size_t cbKeep = 0;
+	std::set<std::wstring, PathLess> done;
+	if (data.size() >= sizeof(JournalHeader) - 1)
+	{
+		if (memcmp(&data[0], JournalHeader, sizeof(JournalHeader) - 1) != 0)
+			return ERROR_FILE_CORRUPT;
+
+		// Only complete lines count
+		size_t start = sizeof(JournalHeader) - 1;
+		size_t end;
+		while ((end = std::find(data.begin() + start, data.end(), '\n') - data.begin()) < data.size())
+		{
+			std::wstring line;
+			if (end - start < 3 || data[start + 1] != ' ' || !DecodeUtf8(&data[start + 2], end - start - 2, line))
+				return ERROR_FILE_CORRUPT;
+
+			if (data[start] == '=')
+				done.insert(line);
+			else if (data[start] != '+')
+				return ERROR_FILE_CORRUPT;
+			start = end + 1;
+		}
+		cbKeep = start;
+	}
+	else if (data.size() > 0 && memcmp(&data[0], JournalHeader, data.size()) != 0)
+		return ERROR_FILE_CORRUPT;
+
+	FILE* pfile = NULL;
+	err = OpenToAppend(pszPath, bExists, cbKeep, &pfile);
+	if (err == 0 && cbKeep == 0)
+	{
+		std::vector<BYTE> header(JournalHeader, JournalHeader + sizeof(JournalHeader) - 1);
+		err = WriteFlushed(pfile, header);
+		if (err != 0)
+			fclose(pfile);
+	}
+	if (err != 0)
+		return err;
+
+	CAutoLock lock(_lock);
+	_path = pszPath;
+	_pfile = pfile;
+	_done.swap(done);
+	return 0;
+}
+
+bool CImportJournal::IsDone(const std::wstring& targetFile)
+{
+	CAutoLock lock(_lock);
+	return _done.find(targetFile) != _done.end();
+}
+
+int CImportJournal::Start(const std::wstring& targetFile)
+{
+	return Append('+', targetFile);
+}
+
+int CImportJournal::Done(const std::wstring& targetFile)
+{
+	return Append('=', targetFile);
+}
+
+int CImportJournal::Close(bool bDelete)
+{
+	CAutoLock lock(_lock);
+	if (!_pfile)
+		return 0;
+
+	int err = fclose(_pfile) != 0 ? errno : 0;
+	_pfile = NULL;
+	_done.clear();
+
+	if (err == 0 && bDelete)
+	{
+#ifdef _WIN32
+		if (!DeleteFileW(_path.c_str()))
+			err = GetLastError();
+#else
+		if (remove(NarrowPath(_path.c_str()).c_str()) != 0)
+			err = errno;
+#endif
+	}
+	return err;
+}
+
+int CImportJournal::Append(char note, const std::wstring& targetFile)
+{
+	std::vector<BYTE> data;
+	data.push_back(note);
+	data.push_back(' ');
+	AppendUtf8(data, targetFile.c_str(), targetFile.size());
+	data.push_back('\n');
+
+	CAutoLock lock(_lock);
+	return _pfile != NULL ? WriteFlushed(_pfile, data) : EBADF;
+}
+
+#pragma endregion
+
+#pragma region CUndoLog
+
+CUndoLog::CUndoLog() : _pfile(NULL)
+{
+}
+
+CUndoLog::~CUndoLog()
+{
+	Close();
+}
+
+int CUndoLog::Open(const WCHAR* pszPath)
+{
+	Close();
+
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(pszPath, data);
+	bool bExists = err == 0;
+	if (err == ERROR_FILE_NOT_FOUND)
+		err = 0;
+	if (err != 0)
+		return err;
+
+	// Any record that a stopped run left incomplete is dropped
+	size_t cbKeep = 0;
+	if (data.size() >= sizeof(UndoSignature))
+		err = ParseUndoLog(data, NULL, &cbKeep);
+	else if (data.size() > 0 && memcmp(&data[0], UndoSignature, data.size()) != 0)
+		err = ERROR_FILE_CORRUPT;
+	if (err != 0)
+		return err;
+
+	FILE* pfile = NULL;
+	err = OpenToAppend(pszPath, bExists, cbKeep, &pfile);
+	if (err == 0 && cbKeep == 0)
+	{
+		std::vector<BYTE> header(UndoSignature, UndoSignature + sizeof(UndoSignature));
+		err = WriteFlushed(pfile, header);
+		if (err != 0)
+			fclose(pfile);
+	}
+	if (err != 0)
+		return err;
+
+	CAutoLock lock(_lock);
+	_pfile = pfile;
+	return 0;
+}
+
+int CUndoLog::Close()
+{
+	CAutoLock lock(_lock);
+	if (!_pfile)
+		return 0;
+
+	int err = fclose(_pfile) != 0 ? errno : 0;
+	_pfile = NULL;
+	return err;
+}
+
+HRESULT CUndoLog::RecordUndo(const WCHAR* pszFilePath, const MetadataUndo& undo)
+{
+	std::vector<BYTE> prior;
+	HRESULT hr = WriteBinaryMetadata(undo.prior, prior);
+	if (FAILED(hr))
+		return hr;
+
+	// The length and hash go in front once the rest is known
+	// The full path, so that the log can be rolled back from anywhere
+	std::wstring fullPath(pszFilePath);
+#ifdef _WIN32
+	WCHAR szFullPath[MAX_PATH];
+	if (_wfullpath(szFullPath, pszFilePath, MAX_PATH) != NULL)
+		fullPath = szFullPath;
+#else
+	char* pszFullPath = realpath(NarrowPath(pszFilePath).c_str(), NULL);
+	if (pszFullPath != NULL)
+	{
+		fullPath = WidePath(pszFullPath);
+		free(pszFullPath);
+	}
+#endif
+
+	std::vector<BYTE> body;
+	std::vector<BYTE> path;
+	AppendUtf8(path, fullPath.c_str(), fullPath.size());
+	PutUInt32(body, (DWORD)path.size());
+	body.insert(body.end(), path.begin(), path.end());
+	PutUInt32(body, (DWORD)undo.added.size());
+	for (size_t i = 0; i < undo.added.size(); i++)
+		PutKey(body, undo.added[i]);
+	body.insert(body.end(), prior.begin(), prior.end());
+
+	std::vector<BYTE> data;
+	PutUInt32(data, (DWORD)(8 + body.size()));
+	PutUInt64(data, HashBytes(&body[0], body.size()));
+	data.insert(data.end(), body.begin(), body.end());
+
+	CAutoLock lock(_lock);
+	if (!_pfile)
+		return E_UNEXPECTED;
+	return WriteFlushed(_pfile, data) == 0 ? S_OK : STG_E_WRITEFAULT;
+}
+
+int CUndoLog::Read(const WCHAR* pszPath, std::vector<UndoRecord>& records)
+{
+	records.clear();
+
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(pszPath, data);
+	if (err != 0)
+		return err;
+
+	size_t cbValid;
+	err = ParseUndoLog(data, &records, &cbValid);
+	if (err != 0)
+		records.clear();
+	return err;
+}
+
+#pragma endregion
+
+HRESULT ApplyUndo(const std::wstring& targetFile, const MetadataUndo& undo, MetadataStoreKind kind)
+{
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore(kind));
+	if (!pStore)
+		return E_OUTOFMEMORY;
+
+	HRESULT hr = pStore->Open(targetFile.c_str(), true);
+	for (size_t i = 0; i < undo.prior.size() && SUCCEEDED(hr); i++)
+	{
+		PROPERTYKEY key;
+		key.fmtid = undo.prior[i].GetFmtid();
+		for (DWORD j = 0; j < undo.prior[i].GetCount() && SUCCEEDED(hr); j++)
+		{
+			key.pid = undo.prior[i].GetIdAt(j);
+			hr = pStore->SetValue(key, undo.prior[i].GetValueAt(j));
+		}
+	}
+
+	PROPVARIANT empty;
+	PropVariantInit(&empty);
+	for (size_t i = 0; i < undo.added.size() && SUCCEEDED(hr); i++)
+		hr = pStore->SetValue(undo.added[i], empty);
+
+	if (SUCCEEDED(hr))
+		hr = pStore->Commit();
+	return hr;
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Records kept by an import as it goes, so that a run that stops part way through can be resumed, and
+// what it did can be undone.
+//
+// The journal notes each target file as its import starts, and again once its metadata has been committed,
+// so that the same run repeated with the same journal passes over the files that are done, and redoes the
+// one that was under way. It is UTF-8 text: a header line, then a line for each note, "+ " and the path of
+// the target file as its import starts, or "= " and the path once it is committed. Each line is flushed as it
+// is written, so that a run that is stopped leaves at most an incomplete last line, which is ignored.
+//
+// The undo log holds, for each file that an import changes, the values that it overwrites and the properties
+// that it adds, written before anything is written to the file itself. Records are appended, so that one log
+// can cover several runs, and putting them back latest first restores the metadata as it was before the first.
+//
+// Layout of the undo log, all integers little-endian:
+//	header		"FMETAUND"
+//	records		length (4) of what follows, FNV-1a hash (8) of what follows the hash,
+//				path length in bytes (4), path as UTF-8, count of added properties (4),
+//				each added property as its FMTID (16) and PID (4), then the prior values in the binary metadata format
+//
+// A record cut short at the end, by a run that stopped while writing it, is ignored, as its import was never
+// committed, and is overwritten by the next record to be appended.
+
+#pragma once
+
+#include "MetadataStore.h"
+#include <set>
+#include <stdio.h>
+
+class CImportJournal
+{
+public:
+	CImportJournal();
+	~CImportJournal();
+
+	// Reads what an earlier run recorded, and opens the journal to add to, creating it if it does not exist.
+	// Returns 0, or the system error code, which is ERROR_FILE_CORRUPT if the file is not a journal.
+	int Open(const WCHAR* pszPath);
+
+	// Whether an earlier run committed the import of a file
+	bool IsDone(const std::wstring& targetFile);
+
+	// Each returns 0, or the system error code
+	int Start(const std::wstring& targetFile);
+	int Done(const std::wstring& targetFile);
+
+	// With bDelete, once every file has been imported, the journal is deleted, as there is nothing left to resume.
+	// Returns 0, or the system error code.
+	int Close(bool bDelete);
+
+private:
+	CImportJournal(const CImportJournal&);
+	CImportJournal& operator=(const CImportJournal&);
+
+	int Append(char note, const std::wstring& targetFile);
+
+	struct PathLess
+	{
+		bool operator()(const std::wstring& path1, const std::wstring& path2) const;
+	};
+
+	std::wstring						_path;
+	FILE*								_pfile;
+	std::set<std::wstring, PathLess>	_done;
+	CLock								_lock;		// files are imported on several threads at once
+};
+
+// One file's entry in an undo log
+struct UndoRecord
+{
+	std::wstring	targetFile;
+	MetadataUndo	undo;
+};
+
+class CUndoLog : public IUndoRecorder
+{
+public:
+	CUndoLog();
+	virtual ~CUndoLog();
+
+	// Opens the log to append to, creating it if it does not exist.
+	// Returns 0, or the system error code, which is ERROR_FILE_CORRUPT if the file is not an undo log.
+	int Open(const WCHAR* pszPath);
+	int Close();
+
+	// Appends a record, flushing it before returning, as the import will go on to overwrite what it holds
+	virtual HRESULT RecordUndo(const WCHAR* pszFilePath, const MetadataUndo& undo);
+
+	// Reads all the complete records in a log, in the order that they were written.
+	// Returns 0, or the system error code, which is ERROR_FILE_CORRUPT if the file is not an undo log or is damaged.
+	static int Read(const WCHAR* pszPath, std::vector<UndoRecord>& records);
+
+private:
+	CUndoLog(const CUndoLog&);
+	CUndoLog& operator=(const CUndoLog&);
+
+	FILE*	_pfile;
+	CLock	_lock;
+};
+
+// Puts back what an import overwrote, itself through a CDeferredWriteMetadataStore
+HRESULT ApplyUndo(const std::wstring& targetFile, const MetadataUndo& undo, MetadataStoreKind kind = NativeMetadataStore);
@@ -0,0 +1,193 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "MappedXmlFile.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedXmlFile::CMappedXmlFile() : _pView(NULL), _cbView(0),
+#ifdef _WIN32
+	_hFile(INVALID_HANDLE_VALUE), _hMapping(NULL),
+#endif
+	_pText(NULL)
+{
+}
+
+CMappedXmlFile::~CMappedXmlFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+int CMappedXmlFile::Open(const WCHAR* pszPath)
+{
+	Close();
+
+	_hFile = CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_hFile == INVALID_HANDLE_VALUE)
+		return (int)GetLastError();
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_hFile, &size))
+	{
+		int err = (int)GetLastError();
+		Close();
+		return err;
+	}
+	if (size.HighPart != 0)
+	{
+		Close();
+		return ERROR_FILE_TOO_LARGE;
+	}
+
+	_cbView = size.LowPart;
+	if (_cbView == 0)
+	{
+		_converted.push_back(L'\0');
+		_pText = &_converted[0];
+		return 0;
+	}
+
+	// Copy-on-write, so that the parser can write into the view without touching the file
+	_hMapping = CreateFileMapping(_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (_hMapping != NULL)
+		_pView = MapViewOfFile(_hMapping, FILE_MAP_COPY, 0, 0, 0);
+	if (_pView == NULL)
+	{
+		int err = (int)GetLastError();
+		Close();
+		return err;
+	}
+
+	// The parser needs a terminating null, which we get for free from the zero filled remainder of the
+	// last page, as long as there is room for it there
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	size_t cbSlack = (si.dwPageSize - _cbView % si.dwPageSize) % si.dwPageSize;
+
+	const BYTE* pData = (const BYTE*)_pView;
+	if (_cbView >= 2 && pData[0] == 0xFF && pData[1] == 0xFE && _cbView % sizeof(WCHAR) == 0 && cbSlack >= sizeof(WCHAR))
+		_pText = (WCHAR*)_pView + 1;  // skip BOM
+	else
+		Convert(pData, _cbView);
+
+	return 0;
+}
+
+void CMappedXmlFile::Close()
+{
+	if (_pView)
+	{
+		UnmapViewOfFile(_pView);
+		_pView = NULL;
+	}
+	if (_hMapping)
+	{
+		CloseHandle(_hMapping);
+		_hMapping = NULL;
+	}
+	if (_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(_hFile);
+		_hFile = INVALID_HANDLE_VALUE;
+	}
+	_cbView = 0;
+	_converted.clear();
+	_pText = NULL;
+}
+
+#else
+
+int CMappedXmlFile::Open(const WCHAR* pszPath)
+{
+	Close();
+
+	int fd = open(NarrowPath(pszPath).c_str(), O_RDONLY);
+	if (fd < 0)
+		return errno;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		int err = errno;
+		close(fd);
+		return err;
+	}
+
+	_cbView = (size_t)st.st_size;
+	if (_cbView > 0)
+	{
+		_pView = mmap(NULL, _cbView, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (_pView == MAP_FAILED)
+		{
+			int err = errno;
+			_pView = NULL;
+			close(fd);
+			Close();
+			return err;
+		}
+	}
+	close(fd);
+
+	// wchar_t is not UTF-16 here, so the mapping is only ever a source for conversion
+	Convert((const BYTE*)_pView, _cbView);
+
+	if (_pView)
+	{
+		munmap(_pView, _cbView);
+		_pView = NULL;
+	}
+	_cbView = 0;
+	return 0;
+}
+
+void CMappedXmlFile::Close()
+{
+	if (_pView)
+	{
+		munmap(_pView, _cbView);
+		_pView = NULL;
+	}
+	_cbView = 0;
+	_converted.clear();
+	_pText = NULL;
+}
+
+#endif
+
+void CMappedXmlFile::Convert(const BYTE* pData, size_t cbData)
+{
+	_converted.clear();
+
+	// export files are now UTF-16 with BOM
+	if (cbData >= 2 && pData[0] == 0xFF && pData[1] == 0xFE)
+		DecodeUtf16(pData + 2, (cbData - 2) / 2, _converted);
+	// but also cope with ASCII files from our previous versions, or that have been hand-edited in ASCII
+	else if (cbData > 0)
+	{
+		_converted.resize(cbData + 1);
+		size_t cch = 0;
+#ifdef _WIN32
+		if (mbstowcs_s(&cch, &_converted[0], cbData + 1, (const char*)pData, cbData) == 0 && cch > 0)
+			cch--;  // count includes the terminator
+#else
+		const char* pSrc = (const char*)pData;
+		mbstate_t state;
+		memset(&state, 0, sizeof(state));
+		cch = mbsnrtowcs(&_converted[0], &pSrc, cbData, cbData, &state);
+		if (cch == (size_t)-1)
+			cch = 0;
+#endif
+		_converted.resize(cch);
+	}
+
+	// An explicit terminator, so that the parser can safely write anywhere in the buffer
+	_converted.push_back(L'\0');
+	_pText = &_converted[0];
+}
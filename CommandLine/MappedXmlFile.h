@@ -0,0 +1,42 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// The text of an XML metadata file, ready for rapidxml to parse in place.
+// On Windows, a UTF-16LE file with a BOM, which is what export writes, is mapped copy-on-write and parsed
+// directly from the mapping, so only the pages that the parser modifies are ever copied. Anything else,
+// such as ASCII files from earlier versions, or any file where wchar_t is not UTF-16, is transcoded once.
+
+#pragma once
+
+#include "PortableTypes.h"
+
+class CMappedXmlFile
+{
+public:
+	CMappedXmlFile();
+	~CMappedXmlFile();
+
+	// Returns 0, or the system error code if the file could not be opened or read
+	int Open(const WCHAR* pszPath);
+	void Close();
+
+	// Null terminated and writable, as rapidxml requires; valid until Close
+	WCHAR* Text() { return _pText; }
+
+	// Whether the text is parsed straight from the mapped file
+	bool IsMapped() const { return _pText != NULL && _converted.empty(); }
+
+private:
+	CMappedXmlFile(const CMappedXmlFile&);
+	CMappedXmlFile& operator=(const CMappedXmlFile&);
+
+	void Convert(const BYTE* pData, size_t cbData);
+
+	void*				_pView;
+	size_t				_cbView;
+#ifdef _WIN32
+	HANDLE				_hFile;
+	HANDLE				_hMapping;
+#endif
+	std::wstring		_converted;
+	WCHAR*				_pText;
+};
@@ -0,0 +1,405 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "MetadataArchive.h"
+#include <algorithm>
+#include <errno.h>
+#include <wctype.h>
+
+static const BYTE Signature[8] = { 'F', 'M', 'E', 'T', 'A', 'A', 'R', 'C' };
+
+#pragma region Helpers
+
+static int SeekFile(FILE* pfile, ULONGLONG offset)
+{
+#ifdef _WIN32
+	return _fseeki64(pfile, (__int64)offset, SEEK_SET) == 0 ? 0 : errno;
+#else
+	return fseeko(pfile, (off_t)offset, SEEK_SET) == 0 ? 0 : errno;
+#endif
+}
+
+static void PutUInt32(std::vector<BYTE>& data, DWORD dw)
+{
+	for (int i = 0; i < 4; i++)
+		data.push_back((BYTE)(dw >> (8 * i)));
+}
+
+static void PutUInt64(std::vector<BYTE>& data, ULONGLONG ull)
+{
+	for (int i = 0; i < 8; i++)
+		data.push_back((BYTE)(ull >> (8 * i)));
+}
+
+static DWORD GetUInt32(const BYTE* p)
+{
+	return (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static ULONGLONG GetUInt64(const BYTE* p)
+{
+	return (ULONGLONG)GetUInt32(p) | ((ULONGLONG)GetUInt32(p + 4) << 32);
+}
+
+static void PutHeader(std::vector<BYTE>& data, ULONGLONG indexOffset, DWORD cEntries)
+{
+	data.insert(data.end(), Signature, Signature + sizeof(Signature));
+	PutUInt32(data, CMetadataArchive::Version);
+	PutUInt32(data, 0);
+	PutUInt64(data, indexOffset);
+	PutUInt32(data, cEntries);
+	PutUInt32(data, 0);
+}
+
+#pragma endregion
+
+#pragma region CMetadataArchive
+
+std::wstring CMetadataArchive::NormalizePath(const std::wstring& path)
+{
+	std::wstring result(path);
+	std::replace(result.begin(), result.end(), L'/', L'\\');
+
+	while (result.compare(0, 2, L".\\") == 0)
+		result.erase(0, 2);
+
+	return result;
+}
+
+int CMetadataArchive::CompareIgnoringCase(const std::wstring& path1, const std::wstring& path2)
+{
+	size_t cch = std::min(path1.size(), path2.size());
+	for (size_t i = 0; i < cch; i++)
+	{
+		wint_t ch1 = towlower(path1[i]);
+		wint_t ch2 = towlower(path2[i]);
+		if (ch1 != ch2)
+			return ch1 < ch2 ? -1 : 1;
+	}
+
+	if (path1.size() != path2.size())
+		return path1.size() < path2.size() ? -1 : 1;
+	return 0;
+}
+
+int CMetadataArchive::ComparePaths(const std::wstring& path1, const std::wstring& path2)
+{
+	int result = CompareIgnoringCase(path1, path2);
+
+	// Paths that differ only in case still need a fixed order
+	return result != 0 ? result : path1.compare(path2);
+}
+
+#pragma endregion
+
+#pragma region CMetadataArchiveWriter
+
+namespace
+{
+	struct IndexOrder
+	{
+		template <class T> bool operator()(const T& entry1, const T& entry2) const
+		{
+			return CMetadataArchive::ComparePaths(entry1.path, entry2.path) < 0;
+		}
+	};
+
+	struct CaseInsensitiveOrder
+	{
+		template <class T> bool operator()(const T& entry1, const T& entry2) const
+		{
+			return CMetadataArchive::CompareIgnoringCase(entry1.path, entry2.path) < 0;
+		}
+	};
+}
+
+CMetadataArchiveWriter::CMetadataArchiveWriter() : _pfile(NULL), _offset(0)
+{
+}
+
+CMetadataArchiveWriter::~CMetadataArchiveWriter()
+{
+	// An archive that was never closed has no index
+	if (_pfile)
+		Discard();
+}
+
+int CMetadataArchiveWriter::Create(const WCHAR* pszPath)
+{
+	Discard();
+	_path = pszPath;
+
+#ifdef _WIN32
+	int err = _wfopen_s(&_pfile, pszPath, L"wb");
+	if (err != 0)
+		return err;
+#else
+	_pfile = fopen(NarrowPath(pszPath).c_str(), "wb");
+	if (!_pfile)
+		return errno;
+#endif
+
+	// A header with no index, until Close fills it in
+	_bytes.clear();
+	PutHeader(_bytes, 0, 0);
+	_offset = 0;
+	return Write(_bytes);
+}
+
+int CMetadataArchiveWriter::Add(const std::wstring& path, const std::wstring& xml)
+{
+	if (!_pfile)
+		return EBADF;
+
+	_bytes.clear();
+	AppendUtf16(_bytes, xml.c_str(), xml.size());
+	if ((ULONGLONG)_bytes.size() > 0xFFFFFFFF)
+		return ERROR_FILE_TOO_LARGE;
+
+	IndexEntry entry;
+	entry.path = NormalizePath(path);
+	entry.offset = _offset;
+	entry.cb = (DWORD)_bytes.size();
+
+	int err = Write(_bytes);
+	if (err == 0)
+		_index.push_back(entry);
+	return err;
+}
+
+int CMetadataArchiveWriter::Close()
+{
+	if (!_pfile)
+		return EBADF;
+
+	// If a path was added more than once, the last one wins
+	std::stable_sort(_index.begin(), _index.end(), IndexOrder());
+	std::vector<IndexEntry> index;
+	index.reserve(_index.size());
+	for (size_t i = 0; i < _index.size(); i++)
+	{
+		if (!index.empty() && index.back().path == _index[i].path)
+			index.back() = _index[i];
+		else
+			index.push_back(_index[i]);
+	}
+	_index.swap(index);
+
+	ULONGLONG indexOffset = _offset;
+	_bytes.clear();
+	for (size_t i = 0; i < _index.size(); i++)
+	{
+		const IndexEntry& entry = _index[i];
+		PutUInt32(_bytes, (DWORD)entry.path.size());
+		AppendUtf16(_bytes, entry.path.c_str(), entry.path.size());
+		PutUInt64(_bytes, entry.offset);
+		PutUInt32(_bytes, entry.cb);
+	}
+
+	int err = Write(_bytes);
+	if (err == 0)
+		err = SeekFile(_pfile, 0);
+	if (err == 0)
+	{
+		_bytes.clear();
+		PutHeader(_bytes, indexOffset, (DWORD)_index.size());
+		err = Write(_bytes);
+	}
+
+	if (fclose(_pfile) != 0 && err == 0)
+		err = errno;
+	_pfile = NULL;
+	_index.clear();
+
+	if (err != 0)
+		Discard();
+	else
+		_path.clear();
+	return err;
+}
+
+void CMetadataArchiveWriter::Discard()
+{
+	if (_pfile)
+	{
+		fclose(_pfile);
+		_pfile = NULL;
+	}
+
+	if (!_path.empty())
+	{
+#ifdef _WIN32
+		_wremove(_path.c_str());
+#else
+		remove(NarrowPath(_path.c_str()).c_str());
+#endif
+		_path.clear();
+	}
+
+	_index.clear();
+	_offset = 0;
+}
+
+int CMetadataArchiveWriter::Write(const std::vector<BYTE>& data)
+{
+	if (data.size() > 0 && fwrite(&data[0], 1, data.size(), _pfile) != data.size())
+		return errno;
+
+	_offset += data.size();
+	return 0;
+}
+
+#pragma endregion
+
+#pragma region CMetadataArchiveReader
+
+CMetadataArchiveReader::CMetadataArchiveReader() : _pfile(NULL), _cbFile(0)
+{
+}
+
+CMetadataArchiveReader::~CMetadataArchiveReader()
+{
+	Close();
+}
+
+int CMetadataArchiveReader::Open(const WCHAR* pszPath)
+{
+	Close();
+
+#ifdef _WIN32
+	int err = _wfopen_s(&_pfile, pszPath, L"rb");
+	if (err != 0)
+		return err;
+	if (_fseeki64(_pfile, 0, SEEK_END) != 0)
+		err = errno;
+	else
+		_cbFile = (ULONGLONG)_ftelli64(_pfile);
+#else
+	int err = 0;
+	_pfile = fopen(NarrowPath(pszPath).c_str(), "rb");
+	if (!_pfile)
+		return errno;
+	if (fseeko(_pfile, 0, SEEK_END) != 0)
+		err = errno;
+	else
+		_cbFile = (ULONGLONG)ftello(_pfile);
+#endif
+
+	BYTE header[HeaderSize];
+	if (err == 0)
+		err = SeekFile(_pfile, 0);
+	if (err == 0 && fread(header, 1, HeaderSize, _pfile) != HeaderSize)
+		err = ERROR_FILE_CORRUPT;
+
+	ULONGLONG indexOffset = 0;
+	DWORD cEntries = 0;
+	if (err == 0)
+	{
+		indexOffset = GetUInt64(header + 16);
+		cEntries = GetUInt32(header + 24);
+
+		if (memcmp(header, Signature, sizeof(Signature)) != 0 || GetUInt32(header + 8) > Version ||
+			indexOffset < HeaderSize || indexOffset > _cbFile)
+			err = ERROR_FILE_CORRUPT;
+	}
+
+	// Read the whole index in one go, and check that it describes only the entries area
+	std::vector<BYTE> data;
+	if (err == 0 && _cbFile > indexOffset)
+	{
+		data.resize((size_t)(_cbFile - indexOffset));
+		err = SeekFile(_pfile, indexOffset);
+		if (err == 0 && fread(&data[0], 1, data.size(), _pfile) != data.size())
+			err = ERROR_FILE_CORRUPT;
+	}
+
+	size_t pos = 0;
+	for (DWORD i = 0; err == 0 && i < cEntries; i++)
+	{
+		if (data.size() - pos < 4)
+		{
+			err = ERROR_FILE_CORRUPT;
+			break;
+		}
+		size_t cch = GetUInt32(&data[pos]);
+		pos += 4;
+		if ((data.size() - pos) / 2 < cch || data.size() - pos - cch * 2 < 12)
+		{
+			err = ERROR_FILE_CORRUPT;
+			break;
+		}
+
+		IndexEntry entry;
+		DecodeUtf16(&data[pos], cch, entry.path);
+		pos += cch * 2;
+		entry.offset = GetUInt64(&data[pos]);
+		entry.cb = GetUInt32(&data[pos + 8]);
+		pos += 12;
+
+		if (entry.offset < HeaderSize || entry.offset > indexOffset || entry.cb > indexOffset - entry.offset)
+			err = ERROR_FILE_CORRUPT;
+		else
+			_index.push_back(entry);
+	}
+
+	if (err != 0)
+		Close();
+	return err;
+}
+
+void CMetadataArchiveReader::Close()
+{
+	if (_pfile)
+	{
+		fclose(_pfile);
+		_pfile = NULL;
+	}
+	_cbFile = 0;
+	_index.clear();
+}
+
+int CMetadataArchiveReader::Find(const std::wstring& path) const
+{
+	IndexEntry key;
+	key.path = NormalizePath(path);
+
+	// Paths that differ only in case are adjacent in the index, so look for an exact match
+	// among them, and otherwise settle for the first
+	auto pos = std::lower_bound(_index.begin(), _index.end(), key, CaseInsensitiveOrder());
+	for (auto scan = pos; scan != _index.end() && CompareIgnoringCase(scan->path, key.path) == 0; ++scan)
+	{
+		if (scan->path == key.path)
+			return (int)(scan - _index.begin());
+	}
+
+	return pos != _index.end() && CompareIgnoringCase(pos->path, key.path) == 0 ? (int)(pos - _index.begin()) : -1;
+}
+
+int CMetadataArchiveReader::Read(size_t index, std::wstring& xml)
+{
+	xml.clear();
+	if (index >= _index.size())
+		return ERROR_FILE_NOT_FOUND;
+
+	const IndexEntry& entry = _index[index];
+	std::vector<BYTE> data(entry.cb);
+	{
+		CAutoLock lock(_lock);
+
+		if (!_pfile)
+			return EBADF;
+		int err = SeekFile(_pfile, entry.offset);
+		if (err != 0)
+			return err;
+		if (entry.cb > 0 && fread(&data[0], 1, entry.cb, _pfile) != entry.cb)
+			return ERROR_FILE_CORRUPT;
+	}
+
+	if (entry.cb > 0)
+		DecodeUtf16(&data[0], entry.cb / 2, xml);
+
+	// An explicit terminator, so that the parser can safely write anywhere in the buffer
+	xml.push_back(L'\0');
+	return 0;
+}
+
+#pragma endregion
@@ -0,0 +1,102 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// A single file holding the exported metadata of many files, keyed by relative path, so that a large
+// tree can be exported without creating a metadata file alongside every file.
+//
+// Layout, all integers little-endian:
+//	header		"FMETAARC", version (4), reserved (4), index offset (8), entry count (4), reserved (4)
+//	entries		the metadata XML of each file, as UTF-16LE without a BOM, one after another
+//	index		for each entry: path length in characters (4), path as UTF-16LE, offset (8), size in bytes (4),
+//				sorted by path ignoring case, so that a single entry can be found without reading the others
+//
+// The header is rewritten with the index offset once all the entries are in place, so an archive whose
+// export did not complete has no index, and will not open.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include <stdio.h>
+
+class CMetadataArchive
+{
+public:
+	static const DWORD Version = 1;
+
+	// Paths are stored with backslash separators and without any leading .\ so that
+	// the same file always has the same key
+	static std::wstring NormalizePath(const std::wstring& path);
+
+	// Orders paths as the index does: ignoring case, and then by case
+	static int ComparePaths(const std::wstring& path1, const std::wstring& path2);
+	static int CompareIgnoringCase(const std::wstring& path1, const std::wstring& path2);
+
+protected:
+	struct IndexEntry
+	{
+		std::wstring	path;
+		ULONGLONG		offset;
+		DWORD			cb;
+	};
+
+	static const size_t HeaderSize = 32;
+};
+
+// Writes an archive sequentially; entries may be added in any order
+class CMetadataArchiveWriter : public CMetadataArchive
+{
+public:
+	CMetadataArchiveWriter();
+	~CMetadataArchiveWriter();
+
+	// Each returns 0, or the system error code
+	int Create(const WCHAR* pszPath);
+	int Add(const std::wstring& path, const std::wstring& xml);
+	int Close();
+
+	// Abandons the archive, removing the partly written file
+	void Discard();
+
+private:
+	CMetadataArchiveWriter(const CMetadataArchiveWriter&);
+	CMetadataArchiveWriter& operator=(const CMetadataArchiveWriter&);
+
+	int Write(const std::vector<BYTE>& data);
+
+	std::wstring				_path;
+	FILE*						_pfile;
+	ULONGLONG					_offset;
+	std::vector<IndexEntry>		_index;
+	std::vector<BYTE>			_bytes;
+};
+
+// Reads entries from an archive in any order. Read may be called from several threads at once.
+class CMetadataArchiveReader : public CMetadataArchive
+{
+public:
+	CMetadataArchiveReader();
+	~CMetadataArchiveReader();
+
+	// Returns 0, or the system error code, which is ERROR_FILE_CORRUPT if the archive is damaged,
+	// incomplete or of a later version
+	int Open(const WCHAR* pszPath);
+	void Close();
+
+	// Entries in index order
+	size_t GetCount() const { return _index.size(); }
+	const std::wstring& GetPathAt(size_t index) const { return _index[index].path; }
+
+	// Returns the position of the entry for the path, or -1 if there is none
+	int Find(const std::wstring& path) const;
+
+	// Reads the metadata XML of an entry, null terminated and writable, ready to be parsed in place
+	int Read(size_t index, std::wstring& xml);
+
+private:
+	CMetadataArchiveReader(const CMetadataArchiveReader&);
+	CMetadataArchiveReader& operator=(const CMetadataArchiveReader&);
+
+	FILE*						_pfile;
+	ULONGLONG					_cbFile;
+	std::vector<IndexEntry>		_index;
+	CLock						_lock;		// serialises seeking and reading the file
+};
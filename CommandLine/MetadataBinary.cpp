@@ -0,0 +1,605 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "MetadataBinary.h"
+
+static const BYTE Signature[8] = { 'F', 'M', 'E', 'T', 'A', 'B', 'I', 'N' };
+
+#pragma region Writing
+
+static void PutVarint(std::vector<BYTE>& data, ULONGLONG ull)
+{
+	while (ull >= 0x80)
+	{
+		data.push_back((BYTE)(ull | 0x80));
+		ull >>= 7;
+	}
+	data.push_back((BYTE)ull);
+}
+
+static void PutSigned(std::vector<BYTE>& data, LONGLONG ll)
+{
+	PutVarint(data, ((ULONGLONG)ll << 1) ^ (ULONGLONG)(ll >> 63));
+}
+
+static void PutBytes(std::vector<BYTE>& data, const void* p, size_t cb)
+{
+	data.insert(data.end(), (const BYTE*)p, (const BYTE*)p + cb);
+}
+
+static void PutFixedLE(std::vector<BYTE>& data, ULONGLONG ull, size_t cb)
+{
+	for (size_t i = 0; i < cb; i++)
+		data.push_back((BYTE)(ull >> (8 * i)));
+}
+
+static void PutGuid(std::vector<BYTE>& data, REFGUID guid)
+{
+	PutFixedLE(data, guid.Data1, 4);
+	PutFixedLE(data, guid.Data2, 2);
+	PutFixedLE(data, guid.Data3, 2);
+	PutBytes(data, guid.Data4, 8);
+}
+
+static void PutString(std::vector<BYTE>& data, const WCHAR* psz)
+{
+	std::vector<BYTE> utf8;
+	if (psz)
+		AppendUtf8(utf8, psz, wcslen(psz));
+	PutVarint(data, utf8.size());
+	data.insert(data.end(), utf8.begin(), utf8.end());
+}
+
+// Writes one value of a scalar type, held at p in the layout of the PROPVARIANT union or a vector element
+static HRESULT PutScalar(std::vector<BYTE>& data, VARTYPE vt, const void* p)
+{
+	switch (vt)
+	{
+	case VT_I1:
+	case VT_UI1:
+		data.push_back(*(const BYTE*)p);
+		break;
+	case VT_I2:
+	case VT_BOOL:
+		PutSigned(data, *(const SHORT*)p);
+		break;
+	case VT_UI2:
+		PutVarint(data, *(const USHORT*)p);
+		break;
+	case VT_I4:
+	case VT_INT:
+	case VT_ERROR:
+		PutSigned(data, *(const LONG*)p);
+		break;
+	case VT_UI4:
+	case VT_UINT:
+		PutVarint(data, *(const ULONG*)p);
+		break;
+	case VT_I8:
+	case VT_CY:
+		PutSigned(data, *(const LONGLONG*)p);
+		break;
+	case VT_UI8:
+		PutVarint(data, *(const ULONGLONG*)p);
+		break;
+	case VT_FILETIME:
+		PutVarint(data, ((ULONGLONG)((const FILETIME*)p)->dwHighDateTime << 32) | ((const FILETIME*)p)->dwLowDateTime);
+		break;
+	case VT_R4:
+		{
+			DWORD dw;
+			memcpy(&dw, p, sizeof(dw));
+			PutFixedLE(data, dw, 4);
+		}
+		break;
+	case VT_R8:
+	case VT_DATE:
+		{
+			ULONGLONG ull;
+			memcpy(&ull, p, sizeof(ull));
+			PutFixedLE(data, ull, 8);
+		}
+		break;
+	case VT_CLSID:
+		PutGuid(data, *(const GUID*)p);
+		break;
+	case VT_LPWSTR:
+	case VT_BSTR:
+		PutString(data, *(const LPWSTR*)p);
+		break;
+	case VT_LPSTR:
+		{
+			LPCSTR psz = *(const LPSTR*)p;
+			size_t cb = psz ? strlen(psz) : 0;
+			PutVarint(data, cb);
+			PutBytes(data, psz, cb);
+		}
+		break;
+	default:
+		return STG_E_INVALIDPARAMETER;
+	}
+	return S_OK;
+}
+
+// Size of a vector element in memory, or 0 if the type cannot be held in a vector
+static size_t ElementSize(VARTYPE vt)
+{
+	switch (vt)
+	{
+	case VT_I1: case VT_UI1: return sizeof(CHAR);
+	case VT_I2: case VT_UI2: return sizeof(SHORT);
+	case VT_BOOL: return sizeof(VARIANT_BOOL);
+	case VT_I4: case VT_UI4: return sizeof(LONG);
+	case VT_ERROR: return sizeof(SCODE);
+	case VT_I8: case VT_UI8: return sizeof(LARGE_INTEGER);
+	case VT_CY: return sizeof(CY);
+	case VT_R4: return sizeof(FLOAT);
+	case VT_R8: return sizeof(DOUBLE);
+	case VT_DATE: return sizeof(DATE);
+	case VT_FILETIME: return sizeof(FILETIME);
+	case VT_CLSID: return sizeof(CLSID);
+	case VT_LPSTR: return sizeof(LPSTR);
+	case VT_LPWSTR: return sizeof(LPWSTR);
+	case VT_BSTR: return sizeof(BSTR);
+	case VT_VARIANT: return sizeof(PROPVARIANT);
+	default: return 0;
+	}
+}
+
+static HRESULT PutValue(std::vector<BYTE>& data, REFPROPVARIANT propvar)
+{
+	if (propvar.vt & VT_VECTOR)
+	{
+		VARTYPE vtElem = propvar.vt & VT_TYPEMASK;
+		size_t cbElem = ElementSize(vtElem);
+		if ((propvar.vt & ~(VT_VECTOR | VT_TYPEMASK)) != 0 || cbElem == 0)
+			return STG_E_INVALIDPARAMETER;
+
+		// All the counted arrays share the same layout
+		const BYTE* pElems = (const BYTE*)propvar.cac.pElems;
+		PutVarint(data, propvar.cac.cElems);
+
+		HRESULT hr = S_OK;
+		for (ULONG i = 0; i < propvar.cac.cElems && SUCCEEDED(hr); i++)
+		{
+			if (vtElem == VT_VARIANT)
+			{
+				const PROPVARIANT& elem = ((const PROPVARIANT*)pElems)[i];
+				if (elem.vt & VT_VECTOR)
+					return STG_E_INVALIDPARAMETER;
+				PutVarint(data, elem.vt);
+				hr = PutValue(data, elem);
+			}
+			else
+				hr = PutScalar(data, vtElem, pElems + i * cbElem);
+		}
+		return hr;
+	}
+
+	switch (propvar.vt)
+	{
+	case VT_EMPTY:
+	case VT_NULL:
+		return S_OK;
+	case VT_CLSID:
+		if (!propvar.puuid)
+			return STG_E_INVALIDPARAMETER;
+		PutGuid(data, *propvar.puuid);
+		return S_OK;
+	case VT_BLOB:
+		PutVarint(data, propvar.blob.cbSize);
+		PutBytes(data, propvar.blob.pBlobData, propvar.blob.cbSize);
+		return S_OK;
+	default:
+		return PutScalar(data, propvar.vt, &propvar.cVal);
+	}
+}
+
+HRESULT WriteBinaryMetadata(const std::vector<CPropertySet>& sets, std::vector<BYTE>& data)
+{
+	data.clear();
+	PutBytes(data, Signature, sizeof(Signature));
+	PutVarint(data, BinaryMetadataVersion);
+
+	bool bNames = false;
+	for (size_t i = 0; i < sets.size(); i++)
+		bNames = bNames || !sets[i].Dictionary().empty();
+	PutVarint(data, bNames ? BinaryHasNames : 0);
+
+	PutVarint(data, sets.size());
+	for (size_t i = 0; i < sets.size(); i++)
+		PutGuid(data, sets[i].GetFmtid());
+
+	// Properties are numbered across all the sets, for the name table
+	std::vector<std::pair<ULONGLONG, const std::wstring*> > names;
+	ULONGLONG iProp = 0;
+
+	for (size_t i = 0; i < sets.size(); i++)
+	{
+		const CPropertySet& set = sets[i];
+		PutVarint(data, set.GetCount());
+
+		for (DWORD j = 0; j < set.GetCount(); j++, iProp++)
+		{
+			const PROPVARIANT& propvar = set.GetValueAt(j);
+			PutVarint(data, set.GetIdAt(j));
+			PutVarint(data, propvar.vt);
+
+			HRESULT hr = PutValue(data, propvar);
+			if (FAILED(hr))
+				return hr;
+
+			auto pos = set.Dictionary().find(set.GetIdAt(j));
+			if (pos != set.Dictionary().end())
+				names.push_back(std::make_pair(iProp, &pos->second));
+		}
+	}
+
+	if (bNames)
+	{
+		PutVarint(data, names.size());
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			PutVarint(data, names[i].first);
+			PutString(data, names[i].second->c_str());
+		}
+	}
+
+	return S_OK;
+}
+
+#pragma endregion
+
+#pragma region Reading
+
+// Bounds-checked reads of the encoded data
+class CBinaryReader
+{
+public:
+	CBinaryReader(const BYTE* pData, size_t cbData) : _pData(pData), _cbData(cbData), _pos(0) {}
+
+	size_t Remaining() const { return _cbData - _pos; }
+
+	bool ReadBytes(const BYTE*& p, size_t cb)
+	{
+		if (cb > Remaining())
+			return false;
+		p = _pData + _pos;
+		_pos += cb;
+		return true;
+	}
+
+	bool ReadVarint(ULONGLONG& ull)
+	{
+		ull = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (_pos >= _cbData)
+				return false;
+			BYTE b = _pData[_pos++];
+			ull |= (ULONGLONG)(b & 0x7F) << shift;
+			if ((b & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	// A varint that must fit in a DWORD
+	bool ReadVarint(DWORD& dw)
+	{
+		ULONGLONG ull;
+		if (!ReadVarint(ull) || ull > 0xFFFFFFFF)
+			return false;
+		dw = (DWORD)ull;
+		return true;
+	}
+
+	bool ReadSigned(LONGLONG& ll)
+	{
+		ULONGLONG ull;
+		if (!ReadVarint(ull))
+			return false;
+		ll = (LONGLONG)(ull >> 1) ^ -(LONGLONG)(ull & 1);
+		return true;
+	}
+
+	bool ReadFixedLE(ULONGLONG& ull, size_t cb)
+	{
+		const BYTE* p;
+		if (!ReadBytes(p, cb))
+			return false;
+		ull = 0;
+		for (size_t i = 0; i < cb; i++)
+			ull |= (ULONGLONG)p[i] << (8 * i);
+		return true;
+	}
+
+	bool ReadGuid(GUID& guid)
+	{
+		ULONGLONG data1, data2, data3;
+		const BYTE* p;
+		if (!ReadFixedLE(data1, 4) || !ReadFixedLE(data2, 2) || !ReadFixedLE(data3, 2) || !ReadBytes(p, 8))
+			return false;
+		guid.Data1 = (DWORD)data1;
+		guid.Data2 = (WORD)data2;
+		guid.Data3 = (WORD)data3;
+		memcpy(guid.Data4, p, 8);
+		return true;
+	}
+
+	bool ReadString(std::wstring& s)
+	{
+		DWORD cb;
+		const BYTE* p;
+		return ReadVarint(cb) && ReadBytes(p, cb) && DecodeUtf8(p, cb, s);
+	}
+
+private:
+	const BYTE*	_pData;
+	size_t		_cbData;
+	size_t		_pos;
+};
+
+// Reads one value of a scalar type into p, in the layout of the PROPVARIANT union or a vector element
+static HRESULT ReadScalar(CBinaryReader& r, VARTYPE vt, void* p)
+{
+	LONGLONG ll;
+	ULONGLONG ull;
+
+	switch (vt)
+	{
+	case VT_I1:
+	case VT_UI1:
+		if (!r.ReadFixedLE(ull, 1))
+			return STG_E_DOCFILECORRUPT;
+		*(BYTE*)p = (BYTE)ull;
+		break;
+	case VT_I2:
+	case VT_BOOL:
+		if (!r.ReadSigned(ll))
+			return STG_E_DOCFILECORRUPT;
+		*(SHORT*)p = (SHORT)ll;
+		break;
+	case VT_UI2:
+		if (!r.ReadVarint(ull))
+			return STG_E_DOCFILECORRUPT;
+		*(USHORT*)p = (USHORT)ull;
+		break;
+	case VT_I4:
+	case VT_INT:
+	case VT_ERROR:
+		if (!r.ReadSigned(ll))
+			return STG_E_DOCFILECORRUPT;
+		*(LONG*)p = (LONG)ll;
+		break;
+	case VT_UI4:
+	case VT_UINT:
+		if (!r.ReadVarint(ull))
+			return STG_E_DOCFILECORRUPT;
+		*(ULONG*)p = (ULONG)ull;
+		break;
+	case VT_I8:
+	case VT_CY:
+		if (!r.ReadSigned(ll))
+			return STG_E_DOCFILECORRUPT;
+		memcpy(p, &ll, sizeof(ll));
+		break;
+	case VT_UI8:
+		if (!r.ReadVarint(ull))
+			return STG_E_DOCFILECORRUPT;
+		memcpy(p, &ull, sizeof(ull));
+		break;
+	case VT_FILETIME:
+		if (!r.ReadVarint(ull))
+			return STG_E_DOCFILECORRUPT;
+		((FILETIME*)p)->dwLowDateTime = (DWORD)ull;
+		((FILETIME*)p)->dwHighDateTime = (DWORD)(ull >> 32);
+		break;
+	case VT_R4:
+		{
+			if (!r.ReadFixedLE(ull, 4))
+				return STG_E_DOCFILECORRUPT;
+			DWORD dw = (DWORD)ull;
+			memcpy(p, &dw, sizeof(dw));
+		}
+		break;
+	case VT_R8:
+	case VT_DATE:
+		if (!r.ReadFixedLE(ull, 8))
+			return STG_E_DOCFILECORRUPT;
+		memcpy(p, &ull, sizeof(ull));
+		break;
+	case VT_CLSID:
+		if (!r.ReadGuid(*(GUID*)p))
+			return STG_E_DOCFILECORRUPT;
+		break;
+	case VT_LPWSTR:
+	case VT_BSTR:
+		{
+			std::wstring s;
+			if (!r.ReadString(s))
+				return STG_E_DOCFILECORRUPT;
+			*(LPWSTR*)p = (vt == VT_BSTR) ? AllocBstr(s) : AllocString(s);
+			if (!*(LPWSTR*)p)
+				return E_OUTOFMEMORY;
+		}
+		break;
+	case VT_LPSTR:
+		{
+			DWORD cb;
+			const BYTE* pBytes;
+			if (!r.ReadVarint(cb) || !r.ReadBytes(pBytes, cb))
+				return STG_E_DOCFILECORRUPT;
+			LPSTR psz = (LPSTR)CoTaskMemAlloc(cb + 1);
+			if (!psz)
+				return E_OUTOFMEMORY;
+			memcpy(psz, pBytes, cb);
+			psz[cb] = '\0';
+			*(LPSTR*)p = psz;
+		}
+		break;
+	default:
+		return STG_E_DOCFILECORRUPT;
+	}
+	return S_OK;
+}
+
+static HRESULT ReadValue(CBinaryReader& r, VARTYPE vt, PROPVARIANT* ppropvar, bool bInVector)
+{
+	PropVariantInit(ppropvar);
+
+	if (vt & VT_VECTOR)
+	{
+		VARTYPE vtElem = vt & VT_TYPEMASK;
+		size_t cbElem = ElementSize(vtElem);
+		DWORD cElems;
+
+		// Every element occupies at least one byte, which bounds the allocation
+		if ((vt & ~(VT_VECTOR | VT_TYPEMASK)) != 0 || cbElem == 0 || bInVector ||
+			!r.ReadVarint(cElems) || cElems > r.Remaining())
+			return STG_E_DOCFILECORRUPT;
+
+		BYTE* pElems = (BYTE*)CoTaskMemAlloc(cElems > 0 ? cElems * cbElem : 1);
+		if (!pElems)
+			return E_OUTOFMEMORY;
+		memset(pElems, 0, cElems * cbElem);
+
+		// Set up the vector first, so that clearing it releases whatever has been read
+		ppropvar->vt = vt;
+		ppropvar->cac.cElems = cElems;
+		ppropvar->cac.pElems = (CHAR*)pElems;
+
+		HRESULT hr = S_OK;
+		for (DWORD i = 0; i < cElems && SUCCEEDED(hr); i++)
+		{
+			if (vtElem == VT_VARIANT)
+			{
+				DWORD vtVariant;
+				if (!r.ReadVarint(vtVariant) || vtVariant > 0xFFFF)
+					hr = STG_E_DOCFILECORRUPT;
+				else
+					hr = ReadValue(r, (VARTYPE)vtVariant, (PROPVARIANT*)pElems + i, true);
+			}
+			else
+				hr = ReadScalar(r, vtElem, pElems + i * cbElem);
+		}
+
+		if (FAILED(hr))
+			PropVariantClear(ppropvar);
+		return hr;
+	}
+
+	HRESULT hr = S_OK;
+	switch (vt)
+	{
+	case VT_EMPTY:
+	case VT_NULL:
+		break;
+	case VT_CLSID:
+		ppropvar->puuid = (CLSID*)CoTaskMemAlloc(sizeof(CLSID));
+		if (!ppropvar->puuid)
+			return E_OUTOFMEMORY;
+		if (!r.ReadGuid(*ppropvar->puuid))
+		{
+			CoTaskMemFree(ppropvar->puuid);
+			ppropvar->puuid = NULL;
+			return STG_E_DOCFILECORRUPT;
+		}
+		break;
+	case VT_BLOB:
+		{
+			DWORD cb;
+			const BYTE* p;
+			if (!r.ReadVarint(cb) || !r.ReadBytes(p, cb))
+				return STG_E_DOCFILECORRUPT;
+			ppropvar->blob.pBlobData = (BYTE*)CoTaskMemAlloc(cb > 0 ? cb : 1);
+			if (!ppropvar->blob.pBlobData)
+				return E_OUTOFMEMORY;
+			memcpy(ppropvar->blob.pBlobData, p, cb);
+			ppropvar->blob.cbSize = cb;
+		}
+		break;
+	default:
+		hr = ReadScalar(r, vt, &ppropvar->cVal);
+		break;
+	}
+
+	if (SUCCEEDED(hr))
+		ppropvar->vt = vt;
+	return hr;
+}
+
+bool IsBinaryMetadata(const BYTE* pData, size_t cbData)
+{
+	return cbData >= sizeof(Signature) && memcmp(pData, Signature, sizeof(Signature)) == 0;
+}
+
+HRESULT ReadBinaryMetadata(const BYTE* pData, size_t cbData, std::vector<CPropertySet>& sets)
+{
+	sets.clear();
+	if (!IsBinaryMetadata(pData, cbData))
+		return STG_E_INVALIDHEADER;
+
+	CBinaryReader r(pData + sizeof(Signature), cbData - sizeof(Signature));
+	DWORD version, flags, cSets;
+	if (!r.ReadVarint(version) || !r.ReadVarint(flags))
+		return STG_E_DOCFILECORRUPT;
+	if (version > BinaryMetadataVersion)
+		return STG_E_INVALIDHEADER;
+
+	// Each FMTID takes 16 bytes, which bounds the count
+	if (!r.ReadVarint(cSets) || cSets > r.Remaining() / 16)
+		return STG_E_DOCFILECORRUPT;
+
+	sets.reserve(cSets);
+	for (DWORD i = 0; i < cSets; i++)
+	{
+		FMTID fmtid;
+		if (!r.ReadGuid(fmtid))
+			return STG_E_DOCFILECORRUPT;
+		sets.push_back(CPropertySet(fmtid));
+	}
+
+	// Remember where each property went, for the name table
+	std::vector<std::pair<size_t, PROPID> > props;
+
+	for (DWORD i = 0; i < cSets; i++)
+	{
+		DWORD cProps;
+		if (!r.ReadVarint(cProps) || cProps > r.Remaining() / 2)
+			return STG_E_DOCFILECORRUPT;
+
+		for (DWORD j = 0; j < cProps; j++)
+		{
+			DWORD pid, vt;
+			if (!r.ReadVarint(pid) || !r.ReadVarint(vt) || vt > 0xFFFF)
+				return STG_E_DOCFILECORRUPT;
+
+			PROPVARIANT propvar;
+			HRESULT hr = ReadValue(r, (VARTYPE)vt, &propvar, false);
+			if (FAILED(hr))
+				return hr;
+			sets[i].AttachValue(pid, propvar);
+			props.push_back(std::make_pair((size_t)i, (PROPID)pid));
+		}
+	}
+
+	if (flags & BinaryHasNames)
+	{
+		DWORD cNames;
+		if (!r.ReadVarint(cNames) || cNames > r.Remaining() / 2)
+			return STG_E_DOCFILECORRUPT;
+
+		for (DWORD i = 0; i < cNames; i++)
+		{
+			DWORD iProp;
+			std::wstring name;
+			if (!r.ReadVarint(iProp) || iProp >= props.size() || !r.ReadString(name))
+				return STG_E_DOCFILECORRUPT;
+			sets[props[iProp].first].Dictionary()[props[iProp].second] = name;
+		}
+	}
+
+	return S_OK;
+}
+
+#pragma endregion
@@ -0,0 +1,38 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// A compact binary form of the metadata that is otherwise exported as XML, for backups and other
+// machine-to-machine use. It holds exactly what the XML does, the typed value of every property,
+// but without the repeated attributes and text conversions, so it round-trips losslessly to and from XML.
+//
+// Layout, where varints are unsigned LEB128, and signed integers are zigzag encoded first:
+//	signature	"FMETABIN"
+//	version		varint
+//	flags		varint, BinaryHasNames if the name table is present
+//	FMTIDs		varint count, then each FMTID as 16 bytes, laid out as in a property set stream
+//	properties	for each FMTID in turn: varint count, then for each property: varint pid, varint vt, value
+//	names		if present, varint count, then for each: varint property index, string
+//
+// Values are encoded by type: 1 byte for VT_I1 and VT_UI1; varints for the other integer types,
+// VT_BOOL, VT_ERROR, VT_CY and VT_FILETIME; 4 or 8 little-endian bytes for VT_R4, VT_R8 and VT_DATE;
+// 16 bytes for VT_CLSID; a varint length and UTF-8 for VT_LPWSTR and VT_BSTR; a varint length and
+// the bytes as they are for VT_LPSTR and VT_BLOB. A vector is a varint count followed by its elements,
+// and an element of a VT_VARIANT vector is its own varint vt followed by its value.
+
+#pragma once
+
+#include "PropertySetStream.h"
+
+static const DWORD BinaryMetadataVersion	= 1;
+static const DWORD BinaryHasNames			= 0x1;
+
+// Whether data starts with the signature of the binary format
+bool IsBinaryMetadata(const BYTE* pData, size_t cbData);
+
+// Serialize property sets, replacing the contents of data. The name table is written
+// from the sets' dictionaries, if any of them hold names.
+HRESULT WriteBinaryMetadata(const std::vector<CPropertySet>& sets, std::vector<BYTE>& data);
+
+// Parse the binary format into property sets, one for each FMTID, with any names in their dictionaries.
+// Returns STG_E_INVALIDHEADER if the data is not in the format or is from a later version,
+// or STG_E_DOCFILECORRUPT if it is damaged.
+HRESULT ReadBinaryMetadata(const BYTE* pData, size_t cbData, std::vector<CPropertySet>& sets);
@@ -0,0 +1,262 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "MetadataSnapshot.h"
+#include <algorithm>
+
+#pragma region Helpers
+
+static size_t Align(size_t cb)
+{
+	return (cb + sizeof(ULONGLONG) - 1) & ~(sizeof(ULONGLONG) - 1);
+}
+
+// Size of each element of a vector whose elements hold no pointers, or 0 for any other type
+static size_t FixedElementSize(VARTYPE vt)
+{
+	switch (vt & VT_TYPEMASK)
+	{
+	case VT_I1: case VT_UI1:
+		return 1;
+	case VT_I2: case VT_UI2: case VT_BOOL:
+		return 2;
+	case VT_I4: case VT_UI4: case VT_R4: case VT_ERROR: case VT_INT: case VT_UINT:
+		return 4;
+	case VT_I8: case VT_UI8: case VT_R8: case VT_CY: case VT_DATE: case VT_FILETIME:
+		return 8;
+	case VT_CLSID:
+		return sizeof(CLSID);
+	default:
+		return 0;
+	}
+}
+
+static size_t StringSize(VARTYPE vt, const void* p)
+{
+	return (vt & VT_TYPEMASK) == VT_LPSTR ? strlen((const CHAR*)p) + 1 : (wcslen((const WCHAR*)p) + 1) * sizeof(WCHAR);
+}
+
+// How much memory the value points to, which is 0 for a value that holds it all itself.
+// Returns false if the value is not one that can be copied into the arena.
+static bool ArenaSize(REFPROPVARIANT propvar, size_t* pcb)
+{
+	*pcb = 0;
+	switch (propvar.vt)
+	{
+	case VT_EMPTY: case VT_NULL: case VT_I1: case VT_UI1: case VT_I2: case VT_UI2: case VT_I4: case VT_UI4:
+	case VT_INT: case VT_UINT: case VT_I8: case VT_UI8: case VT_R4: case VT_R8: case VT_CY: case VT_DATE:
+	case VT_BOOL: case VT_ERROR: case VT_FILETIME:
+		return true;
+
+	case VT_LPSTR:
+	case VT_LPWSTR:
+		if (propvar.pszVal)
+			*pcb = Align(StringSize(propvar.vt, propvar.pszVal));
+		return true;
+
+	case VT_CLSID:
+		if (propvar.puuid)
+			*pcb = Align(sizeof(CLSID));
+		return true;
+
+	case VT_BLOB:
+		*pcb = Align(propvar.blob.cbSize);
+		return true;
+
+	case VT_VECTOR | VT_LPSTR:
+	case VT_VECTOR | VT_LPWSTR:
+		*pcb = Align(propvar.calpstr.cElems * sizeof(LPSTR));
+		for (ULONG i = 0; i < propvar.calpstr.cElems; i++)
+		{
+			if (!propvar.calpstr.pElems[i])
+				return false;
+			*pcb += Align(StringSize(propvar.vt, propvar.calpstr.pElems[i]));
+		}
+		return true;
+
+	default:
+		if (!(propvar.vt & VT_VECTOR) || FixedElementSize(propvar.vt) == 0)
+			return false;
+		*pcb = Align(propvar.cac.cElems * FixedElementSize(propvar.vt));
+		return true;
+	}
+}
+
+// Copies what the value points to into the arena at *ppNext, which it advances by what ArenaSize gave
+static void CopyToArena(PROPVARIANT& propvar, BYTE** ppNext)
+{
+	void* pFrom = NULL;
+	size_t cb = 0;
+	switch (propvar.vt)
+	{
+	case VT_LPSTR:
+	case VT_LPWSTR:
+		if (propvar.pszVal)
+		{
+			pFrom = propvar.pszVal;
+			cb = StringSize(propvar.vt, pFrom);
+			propvar.pszVal = (LPSTR)*ppNext;
+		}
+		break;
+
+	case VT_CLSID:
+		if (propvar.puuid)
+		{
+			pFrom = propvar.puuid;
+			cb = sizeof(CLSID);
+			propvar.puuid = (CLSID*)*ppNext;
+		}
+		break;
+
+	case VT_BLOB:
+		pFrom = propvar.blob.pBlobData;
+		cb = propvar.blob.cbSize;
+		propvar.blob.pBlobData = *ppNext;
+		break;
+
+	case VT_VECTOR | VT_LPSTR:
+	case VT_VECTOR | VT_LPWSTR:
+		{
+			LPSTR* rgpsz = (LPSTR*)*ppNext;
+			*ppNext += Align(propvar.calpstr.cElems * sizeof(LPSTR));
+			for (ULONG i = 0; i < propvar.calpstr.cElems; i++)
+			{
+				size_t cbString = StringSize(propvar.vt, propvar.calpstr.pElems[i]);
+				memcpy(*ppNext, propvar.calpstr.pElems[i], cbString);
+				rgpsz[i] = (LPSTR)*ppNext;
+				*ppNext += Align(cbString);
+			}
+			propvar.calpstr.pElems = rgpsz;
+		}
+		break;
+
+	default:
+		if (propvar.vt & VT_VECTOR)
+		{
+			pFrom = propvar.cac.pElems;
+			cb = propvar.cac.cElems * FixedElementSize(propvar.vt);
+			propvar.cac.pElems = (CHAR*)*ppNext;
+		}
+		break;
+	}
+
+	if (cb > 0)
+		memcpy(*ppNext, pFrom, cb);
+	*ppNext += Align(cb);
+}
+
+#pragma endregion
+
+CMetadataSnapshot::CMetadataSnapshot() : _iLastFound(0)
+{
+}
+
+CMetadataSnapshot::~CMetadataSnapshot()
+{
+	Clear();
+}
+
+void CMetadataSnapshot::Clear()
+{
+	for (size_t i = 0; i < _values.size(); i++)
+	{
+		if (_bToClear[i])
+			PropVariantClear(&_values[i]);
+	}
+
+	_keys.clear();
+	_values.clear();
+	_bToClear.clear();
+	_sorted.clear();
+	_arena.clear();
+	_iLastFound = 0;
+}
+
+bool CMetadataSnapshot::PositionLess::operator()(DWORD i1, DWORD i2) const
+{
+	int cmp = memcmp(&_keys[i1].fmtid, &_keys[i2].fmtid, sizeof(FMTID));
+	return cmp < 0 || (cmp == 0 && _keys[i1].pid < _keys[i2].pid);
+}
+
+// The values are read as the store gives them, then those that can be are moved into an arena sized to hold
+// them all, and the store's copies freed, so that what is kept is in one allocation
+HRESULT CMetadataSnapshot::Take(IMetadataStore* pStore)
+{
+	Clear();
+
+	DWORD cProps;
+	HRESULT hr = pStore->GetCount(&cProps);
+	if (SUCCEEDED(hr))
+	{
+		_keys.resize(cProps);
+		_values.resize(cProps);
+		_bToClear.resize(cProps, false);
+	}
+	for (DWORD i = 0; i < cProps && SUCCEEDED(hr); i++)
+	{
+		hr = pStore->GetAt(i, &_keys[i]);
+		if (SUCCEEDED(hr))
+			hr = pStore->GetValue(_keys[i], &_values[i]);
+		_bToClear[i] = SUCCEEDED(hr);
+	}
+	if (FAILED(hr))
+	{
+		Clear();
+		return hr;
+	}
+
+	size_t cbArena = 0;
+	std::vector<bool> bInArena(cProps, false);
+	for (DWORD i = 0; i < cProps; i++)
+	{
+		size_t cb;
+		bInArena[i] = ArenaSize(_values[i], &cb);
+		if (bInArena[i])
+			cbArena += cb;
+	}
+
+	_arena.resize(cbArena / sizeof(ULONGLONG));
+	BYTE* pNext = _arena.empty() ? NULL : (BYTE*)&_arena[0];
+	for (DWORD i = 0; i < cProps; i++)
+	{
+		if (bInArena[i])
+		{
+			PROPVARIANT copy = _values[i];
+			CopyToArena(copy, &pNext);
+			PropVariantClear(&_values[i]);
+			_values[i] = copy;
+			_bToClear[i] = false;
+		}
+	}
+
+	_sorted.resize(cProps);
+	for (DWORD i = 0; i < cProps; i++)
+		_sorted[i] = i;
+	std::sort(_sorted.begin(), _sorted.end(), PositionLess(_keys));
+	return S_OK;
+}
+
+const PROPVARIANT* CMetadataSnapshot::Find(REFPROPERTYKEY key) const
+{
+	if (_iLastFound + 1 < _keys.size() && _keys[_iLastFound + 1] == key)
+		return &_values[++_iLastFound];
+
+	// Otherwise a binary search of the positions in order of key
+	size_t lo = 0, hi = _sorted.size();
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		const PROPERTYKEY& midKey = _keys[_sorted[mid]];
+		int cmp = memcmp(&midKey.fmtid, &key.fmtid, sizeof(FMTID));
+		if (cmp < 0 || (cmp == 0 && midKey.pid < key.pid))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < _sorted.size() && _keys[_sorted[lo]] == key)
+	{
+		_iLastFound = _sorted[lo];
+		return &_values[_iLastFound];
+	}
+	return NULL;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Every property of a store, read at once, for callers that want them all, as an indexer does. Rather than
+// a GetValue, and a copy of the value for the caller to clear, for each property in turn, the values are read
+// once, and copied into a single block of memory sized to hold them all, from which they are then handed out
+// as they are. The keys and values are each held in an array, in the order that the store enumerates them,
+// so that a caller can take the lot without a call for each.
+//
+// Values of types whose memory is not laid out simply, such as BSTRs and vectors of variants, are kept just
+// as the store returned them, and cleared with the snapshot.
+
+#pragma once
+
+#include "MetadataStore.h"
+
+class CMetadataSnapshot
+{
+public:
+	CMetadataSnapshot();
+	~CMetadataSnapshot();
+
+	// Replaces the contents with every property of an open store
+	HRESULT Take(IMetadataStore* pStore);
+	void Clear();
+
+	DWORD GetCount() const { return (DWORD)_keys.size(); }
+
+	// Both arrays have GetCount elements, or are NULL if there are none. The values belong to the snapshot,
+	// must not be cleared, and last until the snapshot is cleared or taken again.
+	const PROPERTYKEY* GetKeys() const { return _keys.empty() ? NULL : &_keys[0]; }
+	const PROPVARIANT* GetValues() const { return _values.empty() ? NULL : &_values[0]; }
+
+	// Returns NULL if there is no such property
+	const PROPVARIANT* Find(REFPROPERTYKEY key) const;
+
+private:
+	CMetadataSnapshot(const CMetadataSnapshot&);
+	CMetadataSnapshot& operator=(const CMetadataSnapshot&);
+
+	struct PositionLess
+	{
+		PositionLess(const std::vector<PROPERTYKEY>& keys) : _keys(keys) {}
+		bool operator()(DWORD i1, DWORD i2) const;
+		const std::vector<PROPERTYKEY>& _keys;
+	};
+
+	std::vector<PROPERTYKEY>	_keys;
+	std::vector<PROPVARIANT>	_values;
+	std::vector<bool>			_bToClear;		// whether each value is still the store's, to be cleared
+	std::vector<DWORD>			_sorted;		// positions, in order of key, for Find
+	std::vector<ULONGLONG>		_arena;			// what the values point to, aligned for any of them
+	mutable DWORD				_iLastFound;	// values are usually asked for in the order of the keys
+};
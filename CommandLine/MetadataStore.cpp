@@ -0,0 +1,1827 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "MetadataStore.h"
+#include <algorithm>
+#include <map>
+#include <new>
+
+#ifdef _WIN32
+#include <propsys.h>
+#include <shobjidl.h>
+#else
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#endif
+
+#pragma region CPropertySetMetadataStore
+
+CPropertySetMetadataStore::CPropertySetMetadataStore() : _bOpen(false), _bReadWrite(false), _bKeysValid(false)
+{
+}
+
+CPropertySetMetadataStore::~CPropertySetMetadataStore()
+{
+	Close();
+}
+
+HRESULT CPropertySetMetadataStore::Open(const WCHAR* pszFilePath, bool bReadWrite)
+{
+	Close();
+	_filePath = pszFilePath;
+
+	HRESULT hr = OpenFile(bReadWrite);
+
+	std::vector<std::wstring> names;
+	if (SUCCEEDED(hr))
+		hr = EnumStreams(names);
+
+	std::vector<BYTE> data;
+	for (size_t i = 0; i < names.size() && SUCCEEDED(hr); i++)
+	{
+		if (names[i].empty() || names[i][0] != PropertySetStreamPrefix)
+			continue;
+
+		hr = ReadStream(names[i], data);
+		if (SUCCEEDED(hr) && !data.empty())
+		{
+			std::vector<CPropertySet> sets;
+			hr = ReadPropertySetStream(&data[0], data.size(), sets);
+			if (SUCCEEDED(hr))
+				_sets.insert(_sets.end(), sets.begin(), sets.end());
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		_bOpen = true;
+		_bReadWrite = bReadWrite;
+	}
+	else
+		Close();
+
+	return hr;
+}
+
+void CPropertySetMetadataStore::Close()
+{
+	_bOpen = false;
+	_bReadWrite = false;
+	_sets.clear();
+	_keys.clear();
+	_bKeysValid = false;
+	_dirtyStreams.clear();
+}
+
+HRESULT CPropertySetMetadataStore::GetCount(DWORD* pcProps)
+{
+	*pcProps = 0;
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	BuildKeys();
+	*pcProps = (DWORD)_keys.size();
+	return S_OK;
+}
+
+HRESULT CPropertySetMetadataStore::GetAt(DWORD iProp, PROPERTYKEY* pkey)
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	BuildKeys();
+	if (iProp >= _keys.size())
+		return E_INVALIDARG;
+
+	*pkey = _keys[iProp];
+	return S_OK;
+}
+
+HRESULT CPropertySetMetadataStore::GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+{
+	PropVariantInit(pPropVar);
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	CPropertySet* pSet = FindSet(key.fmtid);
+	return pSet != NULL ? pSet->GetValue(key.pid, pPropVar) : S_OK;
+}
+
+HRESULT CPropertySetMetadataStore::SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar)
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	if (!_bReadWrite)
+		return STG_E_ACCESSDENIED;
+
+	CPropertySet* pSet = FindSet(key.fmtid);
+	if (pSet == NULL)
+	{
+		// Removing a property from a set that is not there is a no-op
+		if (propVar.vt == VT_EMPTY)
+			return S_OK;
+
+		_sets.push_back(CPropertySet(key.fmtid));
+		pSet = &_sets.back();
+	}
+
+	HRESULT hr = pSet->SetValue(key.pid, propVar);
+	if (SUCCEEDED(hr))
+		MarkDirty(key.fmtid);
+	return hr;
+}
+
+HRESULT CPropertySetMetadataStore::Commit()
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	if (!_bReadWrite)
+		return STG_E_ACCESSDENIED;
+
+	HRESULT hr = S_OK;
+	while (!_dirtyStreams.empty() && SUCCEEDED(hr))
+	{
+		const std::wstring& name = _dirtyStreams.back();
+
+		// Collect the sets that live in this stream. The only stream with two is DocumentSummaryInformation,
+		// where the user defined properties must be the second section, after the document summary.
+		std::vector<CPropertySet> sets;
+		bool bUserDefined = false;
+		std::wstring setName;
+		for (size_t i = 0; i < _sets.size(); i++)
+		{
+			FmtIdToStreamName(_sets[i].GetFmtid(), setName);
+			if (setName != name)
+				continue;
+
+			if (_sets[i].GetFmtid() == FMTID_UserDefinedProperties)
+				bUserDefined = true;
+			else
+				sets.push_back(_sets[i]);
+		}
+		if (bUserDefined)
+		{
+			if (sets.empty())
+				sets.push_back(CPropertySet(FMTID_DocSummaryInformation));
+			sets.push_back(*FindSet(FMTID_UserDefinedProperties));
+		}
+
+		if (sets.empty())
+			hr = DeleteStream(name);
+		else
+		{
+			std::vector<BYTE> data;
+			hr = WritePropertySetStream(sets, data);
+			if (SUCCEEDED(hr))
+				hr = WriteStream(name, data);
+		}
+
+		if (SUCCEEDED(hr))
+			_dirtyStreams.pop_back();
+	}
+
+	return hr;
+}
+
+HRESULT CPropertySetMetadataStore::EnumPropertySets(std::vector<FMTID>& fmtids)
+{
+	fmtids.clear();
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	for (size_t i = 0; i < _sets.size(); i++)
+		fmtids.push_back(_sets[i].GetFmtid());
+	return S_OK;
+}
+
+HRESULT CPropertySetMetadataStore::DeletePropertySet(REFFMTID fmtid)
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	if (!_bReadWrite)
+		return STG_E_ACCESSDENIED;
+
+	for (size_t i = 0; i < _sets.size(); i++)
+	{
+		if (_sets[i].GetFmtid() == fmtid)
+		{
+			_sets.erase(_sets.begin() + i);
+			MarkDirty(fmtid);
+			return S_OK;
+		}
+	}
+
+	// As IPropertySetStorage::Delete
+	return STG_E_FILENOTFOUND;
+}
+
+CPropertySet* CPropertySetMetadataStore::FindSet(REFFMTID fmtid)
+{
+	for (size_t i = 0; i < _sets.size(); i++)
+	{
+		if (_sets[i].GetFmtid() == fmtid)
+			return &_sets[i];
+	}
+	return NULL;
+}
+
+void CPropertySetMetadataStore::BuildKeys()
+{
+	if (_bKeysValid)
+		return;
+
+	_keys.clear();
+	for (size_t i = 0; i < _sets.size(); i++)
+	{
+		PROPERTYKEY key;
+		key.fmtid = _sets[i].GetFmtid();
+		for (DWORD j = 0; j < _sets[i].GetCount(); j++)
+		{
+			key.pid = _sets[i].GetIdAt(j);
+			_keys.push_back(key);
+		}
+	}
+	_bKeysValid = true;
+}
+
+void CPropertySetMetadataStore::MarkDirty(REFFMTID fmtid)
+{
+	_bKeysValid = false;
+
+	std::wstring name;
+	FmtIdToStreamName(fmtid, name);
+	if (std::find(_dirtyStreams.begin(), _dirtyStreams.end(), name) == _dirtyStreams.end())
+		_dirtyStreams.push_back(name);
+}
+
+#pragma endregion
+
+#pragma region CMemoryMetadataStore
+
+// Streams are shared by every memory store in the process, keyed by file path, so that what one store
+// commits can be read back by another, just as it would be from the file
+class CMemoryMetadataStore : public CPropertySetMetadataStore
+{
+protected:
+	virtual HRESULT OpenFile(bool bReadWrite);
+	virtual HRESULT EnumStreams(std::vector<std::wstring>& names);
+	virtual HRESULT ReadStream(const std::wstring& name, std::vector<BYTE>& data);
+	virtual HRESULT WriteStream(const std::wstring& name, const std::vector<BYTE>& data);
+	virtual HRESULT DeleteStream(const std::wstring& name);
+
+public:
+	virtual HRESULT Probe(const WCHAR* pszFilePath);
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp);
+
+private:
+	typedef std::map<std::wstring, std::vector<BYTE> > StreamMap;
+
+	void Changed();
+
+	static CLock							s_lock;
+	static std::map<std::wstring, StreamMap>	s_files;
+	static std::map<std::wstring, ULONGLONG>	s_changes;		// when each file was last changed, counting writes
+	static ULONGLONG						s_cChanges;
+};
+
+CLock CMemoryMetadataStore::s_lock;
+std::map<std::wstring, CMemoryMetadataStore::StreamMap> CMemoryMetadataStore::s_files;
+std::map<std::wstring, ULONGLONG> CMemoryMetadataStore::s_changes;
+ULONGLONG CMemoryMetadataStore::s_cChanges = 0;
+
+HRESULT CMemoryMetadataStore::OpenFile(bool)
+{
+	// Any path will do: a file with no streams simply has no metadata
+	return S_OK;
+}
+
+HRESULT CMemoryMetadataStore::EnumStreams(std::vector<std::wstring>& names)
+{
+	CAutoLock lock(s_lock);
+
+	names.clear();
+	std::map<std::wstring, StreamMap>::const_iterator file = s_files.find(FilePath());
+	if (file != s_files.end())
+	{
+		for (StreamMap::const_iterator i = file->second.begin(); i != file->second.end(); ++i)
+			names.push_back(i->first);
+	}
+	return S_OK;
+}
+
+HRESULT CMemoryMetadataStore::ReadStream(const std::wstring& name, std::vector<BYTE>& data)
+{
+	CAutoLock lock(s_lock);
+
+	data.clear();
+	StreamMap& streams = s_files[FilePath()];
+	StreamMap::const_iterator i = streams.find(name);
+	if (i != streams.end())
+		data = i->second;
+	return S_OK;
+}
+
+HRESULT CMemoryMetadataStore::WriteStream(const std::wstring& name, const std::vector<BYTE>& data)
+{
+	CAutoLock lock(s_lock);
+
+	s_files[FilePath()][name] = data;
+	Changed();
+	return S_OK;
+}
+
+HRESULT CMemoryMetadataStore::DeleteStream(const std::wstring& name)
+{
+	CAutoLock lock(s_lock);
+
+	s_files[FilePath()].erase(name);
+	Changed();
+	return S_OK;
+}
+
+HRESULT CMemoryMetadataStore::Probe(const WCHAR* pszFilePath)
+{
+	CAutoLock lock(s_lock);
+
+	std::map<std::wstring, StreamMap>::const_iterator file = s_files.find(pszFilePath);
+	if (file != s_files.end())
+	{
+		for (StreamMap::const_iterator i = file->second.begin(); i != file->second.end(); ++i)
+		{
+			if (!i->second.empty())
+				return S_OK;
+		}
+	}
+	return S_FALSE;
+}
+
+HRESULT CMemoryMetadataStore::Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp)
+{
+	CAutoLock lock(s_lock);
+
+	// Memory has no file identity, so the change count alone tells one state from another
+	memset(pStamp, 0, sizeof(*pStamp));
+	std::map<std::wstring, StreamMap>::const_iterator file = s_files.find(pszFilePath);
+	if (file != s_files.end())
+	{
+		for (StreamMap::const_iterator i = file->second.begin(); i != file->second.end(); ++i)
+			pStamp->size += i->second.size();
+	}
+	std::map<std::wstring, ULONGLONG>::const_iterator changed = s_changes.find(pszFilePath);
+	if (changed != s_changes.end())
+		pStamp->changed = changed->second;
+	return S_OK;
+}
+
+// Called with the lock held
+void CMemoryMetadataStore::Changed()
+{
+	s_changes[FilePath()] = ++s_cChanges;
+}
+
+#pragma endregion
+
+#ifndef _WIN32
+#pragma region CXattrMetadataStore
+
+// Each property set stream is kept in an extended attribute named after the stream, e.g.
+// user.filemeta.SummaryInformation. Note that some file systems limit the size of a single
+// attribute to one block, which is generous for metadata but is reported as STG_E_MEDIUMFULL.
+static const char XattrPrefix[] = "user.filemeta.";
+
+#ifndef ENODATA
+#define ENODATA ENOATTR
+#endif
+
+#ifdef __APPLE__
+static ssize_t ListXattr(const char* path, char* list, size_t size) { return listxattr(path, list, size, 0); }
+static ssize_t GetXattr(const char* path, const char* name, void* value, size_t size) { return getxattr(path, name, value, size, 0, 0); }
+static int SetXattr(const char* path, const char* name, const void* value, size_t size) { return setxattr(path, name, value, size, 0, 0); }
+static int RemoveXattr(const char* path, const char* name) { return removexattr(path, name, 0); }
+#else
+static ssize_t ListXattr(const char* path, char* list, size_t size) { return listxattr(path, list, size); }
+static ssize_t GetXattr(const char* path, const char* name, void* value, size_t size) { return getxattr(path, name, value, size); }
+static int SetXattr(const char* path, const char* name, const void* value, size_t size) { return setxattr(path, name, value, size, 0); }
+static int RemoveXattr(const char* path, const char* name) { return removexattr(path, name); }
+#endif
+
+static HRESULT HResultFromErrno(int err)
+{
+	switch (err)
+	{
+	case ENOENT:
+	case ENOTDIR:
+		return STG_E_FILENOTFOUND;
+	case EACCES:
+	case EPERM:
+	case EROFS:
+		return STG_E_ACCESSDENIED;
+	case ENOSPC:
+	case E2BIG:
+	case EDQUOT:
+		return STG_E_MEDIUMFULL;
+	case ENOTSUP:
+		return STG_E_UNIMPLEMENTEDFUNCTION;
+	case ENOMEM:
+		return E_OUTOFMEMORY;
+	default:
+		return E_FAIL;
+	}
+}
+
+class CXattrMetadataStore : public CPropertySetMetadataStore
+{
+public:
+	virtual HRESULT Probe(const WCHAR* pszFilePath);
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp);
+
+protected:
+	virtual HRESULT OpenFile(bool bReadWrite);
+	virtual HRESULT EnumStreams(std::vector<std::wstring>& names);
+	virtual HRESULT ReadStream(const std::wstring& name, std::vector<BYTE>& data);
+	virtual HRESULT WriteStream(const std::wstring& name, const std::vector<BYTE>& data);
+	virtual HRESULT DeleteStream(const std::wstring& name);
+
+private:
+	std::string AttributeName(const std::wstring& name);
+
+	std::string	_path;
+};
+
+HRESULT CXattrMetadataStore::OpenFile(bool bReadWrite)
+{
+	_path = NarrowPath(FilePath().c_str());
+
+	struct stat st;
+	if (_path.empty() || stat(_path.c_str(), &st) != 0)
+		return STG_E_FILENOTFOUND;
+	if (bReadWrite && access(_path.c_str(), W_OK) != 0)
+		return HResultFromErrno(errno);
+	return S_OK;
+}
+
+HRESULT CXattrMetadataStore::EnumStreams(std::vector<std::wstring>& names)
+{
+	names.clear();
+
+	// The list can grow between sizing it and reading it, so retry until it fits
+	std::vector<char> list;
+	ssize_t cb;
+	for (;;)
+	{
+		cb = ListXattr(_path.c_str(), NULL, 0);
+		if (cb <= 0)
+			break;
+		list.resize(cb);
+		cb = ListXattr(_path.c_str(), &list[0], list.size());
+		if (cb >= 0 || errno != ERANGE)
+			break;
+	}
+	if (cb < 0)
+		return errno == ENOTSUP ? S_OK : HResultFromErrno(errno);
+
+	const size_t cchPrefix = sizeof(XattrPrefix) - 1;
+	for (ssize_t i = 0; i < cb; )
+	{
+		const char* pszName = &list[i];
+		size_t cch = strlen(pszName);
+		if (cch > cchPrefix && strncmp(pszName, XattrPrefix, cchPrefix) == 0)
+		{
+			// Stream names are plain ASCII, so widen them directly
+			std::wstring name(1, PropertySetStreamPrefix);
+			for (const char* p = pszName + cchPrefix; *p; p++)
+				name.push_back((WCHAR)(unsigned char)*p);
+			names.push_back(name);
+		}
+		i += (ssize_t)cch + 1;
+	}
+	return S_OK;
+}
+
+// Finds the names of our attributes of a file. Most files have few attributes, so the list is read without sizing it first.
+static HRESULT ListOurAttributes(const std::string& path, std::vector<std::string>& names)
+{
+	names.clear();
+
+	char buffer[1024];
+	std::vector<char> list;
+	char* pList = buffer;
+	ssize_t cb = ListXattr(path.c_str(), buffer, sizeof(buffer));
+	while (cb < 0 && errno == ERANGE)
+	{
+		cb = ListXattr(path.c_str(), NULL, 0);
+		if (cb <= 0)
+			break;
+		list.resize(cb);
+		pList = &list[0];
+		cb = ListXattr(path.c_str(), pList, list.size());
+	}
+	if (cb < 0)
+		return errno == ENOTSUP ? S_OK : HResultFromErrno(errno);
+
+	const size_t cchPrefix = sizeof(XattrPrefix) - 1;
+	for (ssize_t i = 0; i < cb; )
+	{
+		const char* pszName = pList + i;
+		size_t cch = strlen(pszName);
+		if (cch > cchPrefix && strncmp(pszName, XattrPrefix, cchPrefix) == 0)
+			names.push_back(pszName);
+		i += (ssize_t)cch + 1;
+	}
+	return S_OK;
+}
+
+// Listing the attribute names is the one call needed: we never leave an empty attribute behind
+HRESULT CXattrMetadataStore::Probe(const WCHAR* pszFilePath)
+{
+	std::string path = NarrowPath(pszFilePath);
+	if (path.empty())
+		return STG_E_FILENOTFOUND;
+
+	std::vector<std::string> names;
+	HRESULT hr = ListOurAttributes(path, names);
+	if (SUCCEEDED(hr))
+		hr = names.empty() ? S_FALSE : S_OK;
+	return hr;
+}
+
+// Setting or removing an attribute updates the file's change time. That time is only as fine as the kernel's
+// clock tick, so the sizes of the attributes are asked for too, which costs a call for each but reads nothing.
+HRESULT CXattrMetadataStore::Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp)
+{
+	memset(pStamp, 0, sizeof(*pStamp));
+	std::string path = NarrowPath(pszFilePath);
+
+	struct stat st;
+	if (path.empty() || stat(path.c_str(), &st) != 0)
+		return path.empty() ? STG_E_FILENOTFOUND : HResultFromErrno(errno);
+
+	pStamp->fileId = (ULONGLONG)st.st_ino;
+#ifdef __APPLE__
+	pStamp->changed = (ULONGLONG)st.st_ctimespec.tv_sec * 1000000000 + st.st_ctimespec.tv_nsec;
+#else
+	pStamp->changed = (ULONGLONG)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+
+	std::vector<std::string> names;
+	HRESULT hr = ListOurAttributes(path, names);
+	for (size_t i = 0; i < names.size() && SUCCEEDED(hr); i++)
+	{
+		ssize_t cb = GetXattr(path.c_str(), names[i].c_str(), NULL, 0);
+		if (cb >= 0)
+			pStamp->size += cb;
+		else if (errno != ENODATA)
+			hr = HResultFromErrno(errno);
+	}
+	return hr;
+}
+
+HRESULT CXattrMetadataStore::ReadStream(const std::wstring& name, std::vector<BYTE>& data)
+{
+	data.clear();
+	std::string attr = AttributeName(name);
+
+	ssize_t cb;
+	for (;;)
+	{
+		cb = GetXattr(_path.c_str(), attr.c_str(), NULL, 0);
+		if (cb <= 0)
+			break;
+		data.resize(cb);
+		cb = GetXattr(_path.c_str(), attr.c_str(), &data[0], data.size());
+		if (cb >= 0 || errno != ERANGE)
+			break;
+	}
+	if (cb < 0)
+	{
+		data.clear();
+		return errno == ENODATA ? S_OK : HResultFromErrno(errno);
+	}
+
+	data.resize(cb);
+	return S_OK;
+}
+
+HRESULT CXattrMetadataStore::WriteStream(const std::wstring& name, const std::vector<BYTE>& data)
+{
+	std::string attr = AttributeName(name);
+	if (SetXattr(_path.c_str(), attr.c_str(), data.empty() ? NULL : &data[0], data.size()) != 0)
+		return HResultFromErrno(errno);
+	return S_OK;
+}
+
+HRESULT CXattrMetadataStore::DeleteStream(const std::wstring& name)
+{
+	std::string attr = AttributeName(name);
+	if (RemoveXattr(_path.c_str(), attr.c_str()) != 0 && errno != ENODATA)
+		return HResultFromErrno(errno);
+	return S_OK;
+}
+
+std::string CXattrMetadataStore::AttributeName(const std::wstring& name)
+{
+	std::string attr = XattrPrefix;
+	for (size_t i = (!name.empty() && name[0] == PropertySetStreamPrefix) ? 1 : 0; i < name.size(); i++)
+		attr.push_back((char)name[i]);
+	return attr;
+}
+
+#pragma endregion
+#else
+#pragma region Property store backends
+
+typedef HRESULT (CALLBACK* PFN_STGOPENSTGEX)(const WCHAR*, DWORD, DWORD, DWORD, void*, void*, REFIID riid, void **);
+
+static PFN_STGOPENSTGEX GetStgOpenStorageEx()
+{
+	static PFN_STGOPENSTGEX v_pfnStgOpenStorageEx = NULL; // StgOpenStorageEx (Win2K/XP only)
+
+	if (!v_pfnStgOpenStorageEx)
+	{
+		BOOL fRunningOnNT = ((GetVersion() & 0x80000000) != 0x80000000);
+		v_pfnStgOpenStorageEx = ((fRunningOnNT) ? (PFN_STGOPENSTGEX)GetProcAddress(GetModuleHandle(L"OLE32"), "StgOpenStorageEx") : NULL);
+	}
+
+	return v_pfnStgOpenStorageEx;
+}
+
+// Forwards to an IPropertyStore, which derived classes obtain
+class CPropertyStoreMetadataStore : public IMetadataStore
+{
+public:
+	CPropertyStoreMetadataStore() : _pStore(NULL) {}
+	virtual ~CPropertyStoreMetadataStore() { ReleaseStore(); }
+
+	virtual void Close() { ReleaseStore(); }
+
+	virtual HRESULT GetCount(DWORD* pcProps)
+	{
+		*pcProps = 0;
+		HRESULT hr = EnsureStore();
+		return SUCCEEDED(hr) ? _pStore->GetCount(pcProps) : hr;
+	}
+
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey)
+	{
+		HRESULT hr = EnsureStore();
+		return SUCCEEDED(hr) ? _pStore->GetAt(iProp, pkey) : hr;
+	}
+
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+	{
+		PropVariantInit(pPropVar);
+		HRESULT hr = EnsureStore();
+		return SUCCEEDED(hr) ? _pStore->GetValue(key, pPropVar) : hr;
+	}
+
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar)
+	{
+		HRESULT hr = EnsureStore();
+		return SUCCEEDED(hr) ? _pStore->SetValue(key, propVar) : hr;
+	}
+
+	virtual HRESULT Commit()
+	{
+		// Nothing to commit if no property was ever touched
+		return _pStore != NULL ? _pStore->Commit() : S_OK;
+	}
+
+	// The property store only tells us about sets that have properties in them
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids)
+	{
+		fmtids.clear();
+
+		DWORD cProps;
+		HRESULT hr = GetCount(&cProps);
+		for (DWORD i = 0; i < cProps && SUCCEEDED(hr); i++)
+		{
+			PROPERTYKEY key;
+			hr = _pStore->GetAt(i, &key);
+			if (SUCCEEDED(hr) && std::find(fmtids.begin(), fmtids.end(), key.fmtid) == fmtids.end())
+				fmtids.push_back(key.fmtid);
+		}
+		return hr;
+	}
+
+	virtual HRESULT DeletePropertySet(REFFMTID)
+	{
+		return E_NOTIMPL;
+	}
+
+	// Nothing cheaper than reading the properties will tell whether they have changed
+	virtual HRESULT Stamp(const WCHAR*, MetadataStamp*)
+	{
+		return E_NOTIMPL;
+	}
+
+	// Only the property store can say, so open it and count
+	virtual HRESULT Probe(const WCHAR* pszFilePath)
+	{
+		HRESULT hr = Open(pszFilePath, false);
+		if (SUCCEEDED(hr))
+		{
+			DWORD cProps;
+			hr = GetCount(&cProps);
+			Close();
+			if (SUCCEEDED(hr))
+				hr = cProps > 0 ? S_OK : S_FALSE;
+		}
+		return hr;
+	}
+
+protected:
+	virtual HRESULT EnsureStore()
+	{
+		return _pStore != NULL ? S_OK : E_UNEXPECTED;
+	}
+
+	void ReleaseStore()
+	{
+		if (_pStore)
+		{
+			_pStore->Release();
+			_pStore = NULL;
+		}
+	}
+
+	IPropertyStore* _pStore;
+};
+
+// Our own property sets through StgOpenStorageEx, for files whose property sets are not in alternate streams
+class CStorageMetadataStore : public CPropertyStoreMetadataStore
+{
+public:
+	CStorageMetadataStore() : _pPropSetStg(NULL), _bReadWrite(false) {}
+	virtual ~CStorageMetadataStore() { Close(); }
+
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite)
+	{
+		Close();
+
+		PFN_STGOPENSTGEX pfnStgOpenStorageEx = GetStgOpenStorageEx();
+		if (!pfnStgOpenStorageEx)
+			return E_UNEXPECTED;
+
+		HRESULT hr = (pfnStgOpenStorageEx)(pszFilePath, (bReadWrite ? STGM_READWRITE : STGM_READ) | STGM_SHARE_EXCLUSIVE, STGFMT_FILE, 0, NULL, 0,
+				IID_IPropertySetStorage, (void**)&_pPropSetStg);
+		if (SUCCEEDED(hr))
+			_bReadWrite = bReadWrite;
+		return hr;
+	}
+
+	virtual void Close()
+	{
+		ReleaseStore();
+		if (_pPropSetStg)
+		{
+			_pPropSetStg->Release();
+			_pPropSetStg = NULL;
+		}
+	}
+
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids)
+	{
+		fmtids.clear();
+		if (!_pPropSetStg)
+			return E_UNEXPECTED;
+
+		IEnumSTATPROPSETSTG* penum = NULL;
+		HRESULT hr = _pPropSetStg->Enum(&penum);
+		if (SUCCEEDED(hr))
+		{
+			STATPROPSETSTG statpropsetstg;
+			memset(&statpropsetstg, 0, sizeof(statpropsetstg));
+			while ((hr = penum->Next(1, &statpropsetstg, NULL)) == S_OK)
+				fmtids.push_back(statpropsetstg.fmtid);
+			penum->Release();
+		}
+		return SUCCEEDED(hr) ? S_OK : hr;
+	}
+
+	virtual HRESULT DeletePropertySet(REFFMTID fmtid)
+	{
+		// Deleting a set under an open property store would leave it stale
+		ReleaseStore();
+		return _pPropSetStg != NULL ? _pPropSetStg->Delete(fmtid) : E_UNEXPECTED;
+	}
+
+protected:
+	// The property store is only created once a property is wanted, as delete works on the sets directly
+	virtual HRESULT EnsureStore()
+	{
+		if (_pStore)
+			return S_OK;
+		if (!_pPropSetStg)
+			return E_UNEXPECTED;
+
+		// To make IPropertyStore work for Write, it is necessary to use STGM_READWRITE, which the MS documentation says
+		// explicitly will not work.  The recommended STGM_READ fails with E_ACCESSDENIED on Write and Commit, which
+		// is what you would expect. The only bug appears to be in the documentation.
+		return PSCreatePropertyStoreFromPropertySetStorage(_pPropSetStg, _bReadWrite ? STGM_READWRITE : STGM_READ, IID_IPropertyStore, (void **)&_pStore);
+	}
+
+private:
+	IPropertySetStorage*	_pPropSetStg;
+	bool					_bReadWrite;
+};
+
+// The property store that Explorer would see, which will not always be our handler
+class CShellMetadataStore : public CPropertyStoreMetadataStore
+{
+public:
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool)
+	{
+		Close();
+		return SHGetPropertyStoreFromParsingName(pszFilePath, NULL, GPS_READWRITE, IID_IPropertyStore, (void **)&_pStore);
+	}
+};
+
+// Our own alternate streams, read and written directly as property set streams. This shares the file with other
+// openers as far as it safely can, where StgOpenStorageEx wants it exclusively, and it costs no COM objects.
+class CStreamMetadataStore : public CPropertySetMetadataStore
+{
+public:
+	virtual HRESULT Probe(const WCHAR* pszFilePath);
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp);
+
+protected:
+	virtual HRESULT OpenFile(bool bReadWrite);
+	virtual HRESULT EnumStreams(std::vector<std::wstring>& names);
+	virtual HRESULT ReadStream(const std::wstring& name, std::vector<BYTE>& data);
+	virtual HRESULT WriteStream(const std::wstring& name, const std::vector<BYTE>& data);
+	virtual HRESULT DeleteStream(const std::wstring& name);
+
+private:
+	std::wstring StreamPath(const std::wstring& name) { return FilePath() + L':' + name; }
+};
+
+static HRESULT HResultFromWin32(DWORD err)
+{
+	switch (err)
+	{
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_PATH_NOT_FOUND:
+		return STG_E_FILENOTFOUND;
+	case ERROR_ACCESS_DENIED:
+	case ERROR_WRITE_PROTECT:
+		return STG_E_ACCESSDENIED;
+	case ERROR_SHARING_VIOLATION:
+	case ERROR_LOCK_VIOLATION:
+		return STG_E_SHAREVIOLATION;
+	case ERROR_DISK_FULL:
+	case ERROR_HANDLE_DISK_FULL:
+		return STG_E_MEDIUMFULL;
+	case ERROR_NOT_ENOUGH_MEMORY:
+	case ERROR_OUTOFMEMORY:
+		return E_OUTOFMEMORY;
+	default:
+		return HRESULT_FROM_WIN32(err);
+	}
+}
+
+HRESULT CStreamMetadataStore::OpenFile(bool bReadWrite)
+{
+	DWORD dwAttributes = GetFileAttributesW(FilePath().c_str());
+	if (dwAttributes == INVALID_FILE_ATTRIBUTES)
+		return HResultFromWin32(GetLastError());
+	if (bReadWrite && (dwAttributes & FILE_ATTRIBUTE_READONLY))
+		return STG_E_ACCESSDENIED;
+	return S_OK;
+}
+
+HRESULT CStreamMetadataStore::EnumStreams(std::vector<std::wstring>& names)
+{
+	names.clear();
+
+	WIN32_FIND_STREAM_DATA data;
+	HANDLE hFind = FindFirstStreamW(FilePath().c_str(), FindStreamInfoStandard, &data, 0);
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		DWORD err = GetLastError();
+		return err == ERROR_HANDLE_EOF ? S_OK : HResultFromWin32(err);
+	}
+
+	// Names look like :\005SummaryInformation:$DATA, and the unnamed data stream is just ::$DATA
+	do
+	{
+		if (data.cStreamName[0] == L':' && data.cStreamName[1] == PropertySetStreamPrefix)
+		{
+			const WCHAR* pszName = data.cStreamName + 1;
+			const WCHAR* pszEnd = wcschr(pszName, L':');
+			names.push_back(pszEnd != NULL ? std::wstring(pszName, pszEnd - pszName) : std::wstring(pszName));
+		}
+	}
+	while (FindNextStreamW(hFind, &data));
+
+	DWORD err = GetLastError();
+	FindClose(hFind);
+	return err == ERROR_HANDLE_EOF ? S_OK : HResultFromWin32(err);
+}
+
+HRESULT CStreamMetadataStore::ReadStream(const std::wstring& name, std::vector<BYTE>& data)
+{
+	data.clear();
+
+	HANDLE hStream = CreateFileW(StreamPath(name).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hStream == INVALID_HANDLE_VALUE)
+	{
+		// Deleted since it was listed, which is no different from never having been there
+		DWORD err = GetLastError();
+		return err == ERROR_FILE_NOT_FOUND ? S_OK : HResultFromWin32(err);
+	}
+
+	HRESULT hr = S_OK;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hStream, &size))
+		hr = HResultFromWin32(GetLastError());
+	else if (size.HighPart != 0)
+		hr = STG_E_DOCFILECORRUPT;
+	else if (size.LowPart > 0)
+	{
+		data.resize(size.LowPart);
+		DWORD cbRead = 0;
+		if (!ReadFile(hStream, &data[0], size.LowPart, &cbRead, NULL))
+			hr = HResultFromWin32(GetLastError());
+		else
+			data.resize(cbRead);
+	}
+
+	CloseHandle(hStream);
+	if (FAILED(hr))
+		data.clear();
+	return hr;
+}
+
+HRESULT CStreamMetadataStore::WriteStream(const std::wstring& name, const std::vector<BYTE>& data)
+{
+	// Not CREATE_ALWAYS, which fails on the streams of hidden and system files
+	HANDLE hStream = CreateFileW(StreamPath(name).c_str(), GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hStream == INVALID_HANDLE_VALUE)
+		return HResultFromWin32(GetLastError());
+
+	HRESULT hr = S_OK;
+	DWORD cbWritten = 0;
+	if (!data.empty() && !WriteFile(hStream, &data[0], (DWORD)data.size(), &cbWritten, NULL))
+		hr = HResultFromWin32(GetLastError());
+	else if (cbWritten != data.size())
+		hr = STG_E_WRITEFAULT;
+	else if (!SetEndOfFile(hStream))
+		hr = HResultFromWin32(GetLastError());
+
+	CloseHandle(hStream);
+	return hr;
+}
+
+HRESULT CStreamMetadataStore::DeleteStream(const std::wstring& name)
+{
+	if (!DeleteFileW(StreamPath(name).c_str()))
+	{
+		DWORD err = GetLastError();
+		if (err != ERROR_FILE_NOT_FOUND)
+			return HResultFromWin32(err);
+	}
+	return S_OK;
+}
+
+// NTFS keeps each property set in an alternate stream whose name starts with \005, and FindFirstStreamW
+// lists them all, with their sizes, from one query of the file's attributes. Unlike StgOpenStorageEx,
+// this does not open the file for exclusive access, so it does not fail or block while another program
+// has the file open, and it does not disturb the file's own open storage, if any.
+HRESULT CStreamMetadataStore::Probe(const WCHAR* pszFilePath)
+{
+	WIN32_FIND_STREAM_DATA data;
+	HANDLE hFind = FindFirstStreamW(pszFilePath, FindStreamInfoStandard, &data, 0);
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		DWORD err = GetLastError();
+		return err == ERROR_HANDLE_EOF ? S_FALSE : HRESULT_FROM_WIN32(err);
+	}
+
+	// Names look like :\005SummaryInformation:$DATA
+	HRESULT hr = S_FALSE;
+	do
+	{
+		if (data.cStreamName[0] == L':' && data.cStreamName[1] == PropertySetStreamPrefix && data.StreamSize.QuadPart > 0)
+			hr = S_OK;
+	}
+	while (hr == S_FALSE && FindNextStreamW(hFind, &data));
+
+	FindClose(hFind);
+	return hr;
+}
+
+// Writing to any stream of a file, our alternate streams included, updates the file's last write time.
+// The sizes of the streams also catch a change made within the resolution of that time.
+HRESULT CStreamMetadataStore::Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp)
+{
+	memset(pStamp, 0, sizeof(*pStamp));
+
+	// Asking only for attributes shares the file with any other opener
+	HANDLE hFile = CreateFileW(pszFilePath, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	HRESULT hr = S_OK;
+	BY_HANDLE_FILE_INFORMATION info;
+	if (GetFileInformationByHandle(hFile, &info))
+	{
+		pStamp->fileId = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+		pStamp->changed = ((ULONGLONG)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+		// A file with more streams than fit is rare enough to go unstamped
+		ULONGLONG buffer[1024];
+		if (GetFileInformationByHandleEx(hFile, FileStreamInfo, buffer, sizeof(buffer)))
+		{
+			const BYTE* pb = (const BYTE*)buffer;
+			for (;;)
+			{
+				const FILE_STREAM_INFO* pInfo = (const FILE_STREAM_INFO*)pb;
+				if (pInfo->StreamNameLength >= 2 * sizeof(WCHAR) && pInfo->StreamName[0] == L':' && pInfo->StreamName[1] == PropertySetStreamPrefix)
+					pStamp->size += pInfo->StreamSize.QuadPart;
+				if (pInfo->NextEntryOffset == 0)
+					break;
+				pb += pInfo->NextEntryOffset;
+			}
+		}
+		else if (GetLastError() != ERROR_HANDLE_EOF)
+			hr = HRESULT_FROM_WIN32(GetLastError());
+	}
+	else
+		hr = HRESULT_FROM_WIN32(GetLastError());
+
+	CloseHandle(hFile);
+	return hr;
+}
+
+// Alternate streams where the file has them, and otherwise the COM implementation of property set storage,
+// chosen afresh each time a file is opened. The streams are no use on a volume that does not support them,
+// or for a compound file, which keeps its property sets inside itself.
+class CNativeMetadataStore : public IMetadataStore
+{
+public:
+	CNativeMetadataStore() : _pCurrent(NULL), _bRootStreams(false) {}
+	virtual ~CNativeMetadataStore() { Close(); }
+
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite)
+	{
+		Close();
+		if (HasVolumeStreams(pszFilePath) && StgIsStorageFile(pszFilePath) != S_OK)
+			_pCurrent = &_streams;
+		else
+			_pCurrent = &_storage;
+		return _pCurrent->Open(pszFilePath, bReadWrite);
+	}
+
+	virtual void Close()
+	{
+		if (_pCurrent)
+		{
+			_pCurrent->Close();
+			_pCurrent = NULL;
+		}
+	}
+
+	virtual HRESULT GetCount(DWORD* pcProps)
+	{
+		*pcProps = 0;
+		return _pCurrent ? _pCurrent->GetCount(pcProps) : E_UNEXPECTED;
+	}
+
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey) { return _pCurrent ? _pCurrent->GetAt(iProp, pkey) : E_UNEXPECTED; }
+
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+	{
+		PropVariantInit(pPropVar);
+		return _pCurrent ? _pCurrent->GetValue(key, pPropVar) : E_UNEXPECTED;
+	}
+
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar) { return _pCurrent ? _pCurrent->SetValue(key, propVar) : E_UNEXPECTED; }
+	virtual HRESULT Commit() { return _pCurrent ? _pCurrent->Commit() : E_UNEXPECTED; }
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids) { return _pCurrent ? _pCurrent->EnumPropertySets(fmtids) : E_UNEXPECTED; }
+	virtual HRESULT DeletePropertySet(REFFMTID fmtid) { return _pCurrent ? _pCurrent->DeletePropertySet(fmtid) : E_UNEXPECTED; }
+
+	// These look only at the alternate streams, wherever the volume has them, so as not to open the file;
+	// the property sets inside a compound file are not counted
+	virtual HRESULT Probe(const WCHAR* pszFilePath)
+	{
+		return HasVolumeStreams(pszFilePath) ? _streams.Probe(pszFilePath) : _storage.Probe(pszFilePath);
+	}
+
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp)
+	{
+		return HasVolumeStreams(pszFilePath) ? _streams.Stamp(pszFilePath, pStamp) : _storage.Stamp(pszFilePath, pStamp);
+	}
+
+private:
+	// The answer for the last volume asked about is kept, as a walk stays on one volume for long stretches
+	bool HasVolumeStreams(const WCHAR* pszFilePath)
+	{
+		WCHAR szRoot[MAX_PATH];
+		if (!GetVolumePathNameW(pszFilePath, szRoot, MAX_PATH))
+			return true;	// let opening the stream report the problem with the path
+
+		if (_root != szRoot)
+		{
+			DWORD dwFlags = 0;
+			_root = szRoot;
+			_bRootStreams = GetVolumeInformationW(szRoot, NULL, 0, NULL, NULL, &dwFlags, NULL, 0) && (dwFlags & FILE_NAMED_STREAMS) != 0;
+		}
+		return _bRootStreams;
+	}
+
+	CStreamMetadataStore	_streams;
+	CStorageMetadataStore	_storage;
+	IMetadataStore*			_pCurrent;
+	std::wstring			_root;
+	bool					_bRootStreams;
+};
+
+#pragma endregion
+#endif
+
+#pragma region CDeferredWriteMetadataStore
+
+static bool SameKey(REFPROPERTYKEY key1, REFPROPERTYKEY key2)
+{
+	return key1.pid == key2.pid && key1.fmtid == key2.fmtid;
+}
+
+CDeferredWriteMetadataStore::CDeferredWriteMetadataStore(IMetadataStore* pStore) : _pStore(pStore),
+	_bOpen(false), _bReadWrite(false), _bStoreOpen(false), _bStoreWritable(false), _bKeysValid(false), _pUndoRecorder(NULL)
+{
+}
+
+CDeferredWriteMetadataStore::~CDeferredWriteMetadataStore()
+{
+	Close();
+	delete _pStore;
+}
+
+HRESULT CDeferredWriteMetadataStore::Open(const WCHAR* pszFilePath, bool bReadWrite)
+{
+	Close();
+	if (!_pStore)
+		return E_OUTOFMEMORY;
+
+	// A file with no metadata has nothing to compare with, so it is not opened until there is something to write
+	_filePath = pszFilePath;
+	HRESULT hr = _pStore->Probe(pszFilePath);
+	if (hr == S_OK)
+	{
+		hr = _pStore->Open(pszFilePath, false);
+		_bStoreOpen = SUCCEEDED(hr);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		_bOpen = true;
+		_bReadWrite = bReadWrite;
+		hr = S_OK;
+	}
+	return hr;
+}
+
+void CDeferredWriteMetadataStore::Close()
+{
+	if (_pStore && _bStoreOpen)
+		_pStore->Close();
+
+	_bOpen = false;
+	_bReadWrite = false;
+	_bStoreOpen = false;
+	_bStoreWritable = false;
+	_changes.clear();
+	_removals.clear();
+	_keys.clear();
+	_bKeysValid = false;
+}
+
+HRESULT CDeferredWriteMetadataStore::GetCount(DWORD* pcProps)
+{
+	*pcProps = 0;
+	HRESULT hr = BuildKeys();
+	if (SUCCEEDED(hr))
+		*pcProps = (DWORD)_keys.size();
+	return hr;
+}
+
+HRESULT CDeferredWriteMetadataStore::GetAt(DWORD iProp, PROPERTYKEY* pkey)
+{
+	HRESULT hr = BuildKeys();
+	if (SUCCEEDED(hr))
+	{
+		if (iProp >= _keys.size())
+			return E_INVALIDARG;
+		*pkey = _keys[iProp];
+	}
+	return hr;
+}
+
+HRESULT CDeferredWriteMetadataStore::GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+{
+	PropVariantInit(pPropVar);
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	CPropertySet* pSet = FindChanges(key.fmtid);
+	if (pSet != NULL)
+	{
+		HRESULT hr = pSet->GetValue(key.pid, pPropVar);
+		if (FAILED(hr) || pPropVar->vt != VT_EMPTY)
+			return hr;
+	}
+
+	return IsRemoved(key) ? S_OK : GetStoredValue(key, pPropVar);
+}
+
+HRESULT CDeferredWriteMetadataStore::SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar)
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	if (!_bReadWrite)
+		return STG_E_ACCESSDENIED;
+
+	PROPVARIANT stored;
+	HRESULT hr = GetStoredValue(key, &stored);
+	if (FAILED(hr))
+		return hr;
+	bool bSame = PropVariantEquals(stored, propVar);
+	PropVariantClear(&stored);
+
+	// Any earlier change is replaced
+	_bKeysValid = false;
+	CPropertySet* pSet = FindChanges(key.fmtid);
+	if (pSet != NULL)
+	{
+		PROPVARIANT empty;
+		PropVariantInit(&empty);
+		pSet->SetValue(key.pid, empty);
+		if (pSet->GetCount() == 0)
+		{
+			_changes.erase(_changes.begin() + (pSet - &_changes[0]));
+			pSet = NULL;
+		}
+	}
+	for (size_t i = 0; i < _removals.size(); i++)
+	{
+		if (SameKey(_removals[i], key))
+		{
+			_removals.erase(_removals.begin() + i);
+			break;
+		}
+	}
+
+	if (bSame)
+		return S_OK;
+	else if (propVar.vt == VT_EMPTY)
+	{
+		_removals.push_back(key);
+		return S_OK;
+	}
+
+	if (pSet == NULL)
+	{
+		_changes.push_back(CPropertySet(key.fmtid));
+		pSet = &_changes.back();
+	}
+	hr = pSet->SetValue(key.pid, propVar);
+	if (FAILED(hr) && pSet->GetCount() == 0)
+		_changes.pop_back();
+	return hr;
+}
+
+HRESULT CDeferredWriteMetadataStore::Commit()
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	if (!_bReadWrite)
+		return STG_E_ACCESSDENIED;
+	if (!HasChanges())
+		return S_OK;
+
+	// What is overwritten is recorded while the store is still only open for reading
+	HRESULT hr = S_OK;
+	if (_pUndoRecorder != NULL)
+	{
+		MetadataUndo undo;
+		hr = GetUndo(undo);
+		if (SUCCEEDED(hr))
+			hr = _pUndoRecorder->RecordUndo(_filePath.c_str(), undo);
+		if (FAILED(hr))
+			return hr;
+	}
+
+	if (!_bStoreWritable)
+	{
+		if (_bStoreOpen)
+			_pStore->Close();
+		_bStoreOpen = false;
+
+		hr = _pStore->Open(_filePath.c_str(), true);
+		if (FAILED(hr))
+			return hr;
+		_bStoreOpen = _bStoreWritable = true;
+	}
+
+	for (size_t i = 0; i < _changes.size() && SUCCEEDED(hr); i++)
+	{
+		PROPERTYKEY key;
+		key.fmtid = _changes[i].GetFmtid();
+		for (DWORD j = 0; j < _changes[i].GetCount() && SUCCEEDED(hr); j++)
+		{
+			key.pid = _changes[i].GetIdAt(j);
+			hr = _pStore->SetValue(key, _changes[i].GetValueAt(j));
+		}
+	}
+
+	PROPVARIANT empty;
+	PropVariantInit(&empty);
+	for (size_t i = 0; i < _removals.size() && SUCCEEDED(hr); i++)
+		hr = _pStore->SetValue(_removals[i], empty);
+
+	// If anything fails, the changes are kept, to be tried again
+	if (SUCCEEDED(hr))
+		hr = _pStore->Commit();
+	if (SUCCEEDED(hr) && !_removals.empty())
+		hr = DeleteEmptySets();
+	if (SUCCEEDED(hr))
+	{
+		_changes.clear();
+		_removals.clear();
+		_bKeysValid = false;
+	}
+	return hr;
+}
+
+HRESULT CDeferredWriteMetadataStore::EnumPropertySets(std::vector<FMTID>& fmtids)
+{
+	fmtids.clear();
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	return _bStoreOpen ? _pStore->EnumPropertySets(fmtids) : S_OK;
+}
+
+HRESULT CDeferredWriteMetadataStore::DeletePropertySet(REFFMTID)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT CDeferredWriteMetadataStore::Probe(const WCHAR* pszFilePath)
+{
+	return _pStore ? _pStore->Probe(pszFilePath) : E_OUTOFMEMORY;
+}
+
+HRESULT CDeferredWriteMetadataStore::Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp)
+{
+	return _pStore ? _pStore->Stamp(pszFilePath, pStamp) : E_OUTOFMEMORY;
+}
+
+HRESULT CDeferredWriteMetadataStore::GetStoredValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+{
+	PropVariantInit(pPropVar);
+	return _bStoreOpen ? _pStore->GetValue(key, pPropVar) : S_OK;
+}
+
+CPropertySet* CDeferredWriteMetadataStore::FindChanges(REFFMTID fmtid)
+{
+	for (size_t i = 0; i < _changes.size(); i++)
+	{
+		if (_changes[i].GetFmtid() == fmtid)
+			return &_changes[i];
+	}
+	return NULL;
+}
+
+bool CDeferredWriteMetadataStore::IsRemoved(REFPROPERTYKEY key) const
+{
+	for (size_t i = 0; i < _removals.size(); i++)
+	{
+		if (SameKey(_removals[i], key))
+			return true;
+	}
+	return false;
+}
+
+// The stored values of the properties that are changed or removed, or for those that are added, their keys
+HRESULT CDeferredWriteMetadataStore::GetUndo(MetadataUndo& undo)
+{
+	undo.prior.clear();
+	undo.added.clear();
+
+	std::vector<PROPERTYKEY> keys(_removals);
+	for (size_t i = 0; i < _changes.size(); i++)
+	{
+		PROPERTYKEY key;
+		key.fmtid = _changes[i].GetFmtid();
+		for (DWORD j = 0; j < _changes[i].GetCount(); j++)
+		{
+			key.pid = _changes[i].GetIdAt(j);
+			keys.push_back(key);
+		}
+	}
+
+	HRESULT hr = S_OK;
+	for (size_t i = 0; i < keys.size() && SUCCEEDED(hr); i++)
+	{
+		PROPVARIANT stored;
+		hr = GetStoredValue(keys[i], &stored);
+		if (SUCCEEDED(hr) && stored.vt == VT_EMPTY)
+			undo.added.push_back(keys[i]);
+		else if (SUCCEEDED(hr))
+		{
+			CPropertySet* pSet = NULL;
+			for (size_t j = 0; j < undo.prior.size() && pSet == NULL; j++)
+			{
+				if (undo.prior[j].GetFmtid() == keys[i].fmtid)
+					pSet = &undo.prior[j];
+			}
+			if (pSet == NULL)
+			{
+				undo.prior.push_back(CPropertySet(keys[i].fmtid));
+				pSet = &undo.prior.back();
+			}
+			hr = pSet->SetValue(keys[i].pid, stored);
+		}
+		PropVariantClear(&stored);
+	}
+	return hr;
+}
+
+// Deletes the sets that removals have left with no properties, as DeleteMetadata would, rather than leaving
+// them behind empty. This follows a commit because deleting a set can discard the store's uncommitted changes.
+HRESULT CDeferredWriteMetadataStore::DeleteEmptySets()
+{
+	std::vector<FMTID> fmtids;
+	HRESULT hr = _pStore->EnumPropertySets(fmtids);
+	for (size_t i = 0; i < fmtids.size() && SUCCEEDED(hr); )
+	{
+		bool bRemoved = false;
+		for (size_t j = 0; j < _removals.size() && !bRemoved; j++)
+			bRemoved = _removals[j].fmtid == fmtids[i];
+		if (bRemoved)
+			i++;
+		else
+			fmtids.erase(fmtids.begin() + i);
+	}
+
+	DWORD cProps = 0;
+	if (SUCCEEDED(hr) && !fmtids.empty())
+		hr = _pStore->GetCount(&cProps);
+	for (DWORD i = 0; i < cProps && !fmtids.empty() && SUCCEEDED(hr); i++)
+	{
+		PROPERTYKEY key;
+		hr = _pStore->GetAt(i, &key);
+		if (SUCCEEDED(hr))
+			fmtids.erase(std::remove(fmtids.begin(), fmtids.end(), key.fmtid), fmtids.end());
+	}
+
+	// Not every store can delete a set, and those that cannot do not keep empty ones
+	bool bDeleted = false;
+	for (size_t i = 0; i < fmtids.size() && SUCCEEDED(hr); i++)
+	{
+		hr = _pStore->DeletePropertySet(fmtids[i]);
+		if (hr == E_NOTIMPL)
+			hr = S_OK;
+		else if (SUCCEEDED(hr))
+			bDeleted = true;
+	}
+
+	if (bDeleted && SUCCEEDED(hr))
+		hr = _pStore->Commit();
+	return hr;
+}
+
+// The stored keys that have not been removed, in their order, followed by any new ones
+HRESULT CDeferredWriteMetadataStore::BuildKeys()
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+	if (_bKeysValid)
+		return S_OK;
+
+	_keys.clear();
+	HRESULT hr = S_OK;
+	if (_bStoreOpen)
+	{
+		DWORD cProps;
+		hr = _pStore->GetCount(&cProps);
+		for (DWORD i = 0; i < cProps && SUCCEEDED(hr); i++)
+		{
+			PROPERTYKEY key;
+			hr = _pStore->GetAt(i, &key);
+			if (SUCCEEDED(hr) && !IsRemoved(key))
+				_keys.push_back(key);
+		}
+	}
+
+	size_t cStored = _keys.size();
+	for (size_t i = 0; i < _changes.size() && SUCCEEDED(hr); i++)
+	{
+		PROPERTYKEY key;
+		key.fmtid = _changes[i].GetFmtid();
+		for (DWORD j = 0; j < _changes[i].GetCount(); j++)
+		{
+			key.pid = _changes[i].GetIdAt(j);
+			bool bStored = false;
+			for (size_t k = 0; k < cStored && !bStored; k++)
+				bStored = SameKey(_keys[k], key);
+			if (!bStored)
+				_keys.push_back(key);
+		}
+	}
+
+	_bKeysValid = SUCCEEDED(hr);
+	return hr;
+}
+
+#pragma endregion
+
+#pragma region CChainedMetadataStore
+
+CChainedMetadataStore::CChainedMetadataStore(IMetadataStore* pOwn, IMetadataStore* pChained) : _pOwn(pOwn), _pChained(pChained),
+	_bOpen(false), _chainedState(ChainedNotOpened), _bHaveChainedCount(false), _cChainedProps(0), _bIndexValid(false), _iLastAt(0),
+	_bHaveMarker(false)
+{
+}
+
+CChainedMetadataStore::~CChainedMetadataStore()
+{
+	Close();
+	delete _pOwn;
+	delete _pChained;
+}
+
+HRESULT CChainedMetadataStore::Open(const WCHAR* pszFilePath, bool bReadWrite)
+{
+	Close();
+	if (!_pOwn)
+		return E_OUTOFMEMORY;
+
+	HRESULT hr = _pOwn->Open(pszFilePath, bReadWrite);
+	if (SUCCEEDED(hr))
+	{
+		_filePath = pszFilePath;
+		_bOpen = true;
+	}
+	return hr;
+}
+
+void CChainedMetadataStore::Close()
+{
+	if (_bOpen)
+		_pOwn->Close();
+	if (_chainedState == ChainedOpen)
+		_pChained->Close();
+
+	_bOpen = false;
+	_chainedState = ChainedNotOpened;
+	_bHaveChainedCount = false;
+	_cChainedProps = 0;
+	_index.clear();
+	_bIndexValid = false;
+	_iLastAt = 0;
+}
+
+HRESULT CChainedMetadataStore::GetCount(DWORD* pcProps)
+{
+	*pcProps = 0;
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	HRESULT hr = BuildIndex();
+	if (SUCCEEDED(hr))
+		*pcProps = (DWORD)_index.size();
+	return hr;
+}
+
+HRESULT CChainedMetadataStore::GetAt(DWORD iProp, PROPERTYKEY* pkey)
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	HRESULT hr = BuildIndex();
+	if (SUCCEEDED(hr))
+	{
+		if (iProp >= _index.size())
+			return E_INVALIDARG;
+		*pkey = _index[iProp].key;
+		_iLastAt = iProp;
+	}
+	return hr;
+}
+
+HRESULT CChainedMetadataStore::GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar)
+{
+	PropVariantInit(pPropVar);
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	// Once the index is built, it says whether we have the key, without opening the chained store if it is not already open
+	const IndexEntry* pEntry = FindIndexEntry(key);
+	if (pEntry == NULL || pEntry->bOwn)
+	{
+		HRESULT hr = _pOwn->GetValue(key, pPropVar);
+		if (pEntry != NULL || FAILED(hr) || pPropVar->vt != VT_EMPTY)
+			return hr;
+	}
+
+	// Where we have no value, the marker comes before anything the chained store has
+	if (_bHaveMarker && SameKey(key, _markerKey))
+	{
+		PROPVARIANT marker;
+		PropVariantInit(&marker);
+		marker.vt = VT_LPWSTR;
+		marker.pwszVal = const_cast<WCHAR*>(_marker.c_str());
+		return PropVariantCopy(pPropVar, &marker);
+	}
+
+	// A chained entry in the index means that the chained store is already open
+	if (pEntry != NULL || OpenChained())
+		return _pChained->GetValue(key, pPropVar);
+	return S_OK;
+}
+
+HRESULT CChainedMetadataStore::SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar)
+{
+	if (!_bOpen)
+		return E_UNEXPECTED;
+
+	HRESULT hr = _pOwn->SetValue(key, propVar);
+
+	// The index only changes if we gain a property or lose one, which it then has to be built again to show
+	if (SUCCEEDED(hr) && _bIndexValid)
+	{
+		const IndexEntry* pEntry = FindIndexEntry(key);
+		if (propVar.vt == VT_EMPTY ? pEntry != NULL && pEntry->bOwn : pEntry == NULL || !pEntry->bOwn)
+			_bIndexValid = false;
+	}
+	return hr;
+}
+
+HRESULT CChainedMetadataStore::Commit()
+{
+	return _bOpen ? _pOwn->Commit() : E_UNEXPECTED;
+}
+
+HRESULT CChainedMetadataStore::EnumPropertySets(std::vector<FMTID>& fmtids)
+{
+	fmtids.clear();
+	return _bOpen ? _pOwn->EnumPropertySets(fmtids) : E_UNEXPECTED;
+}
+
+HRESULT CChainedMetadataStore::DeletePropertySet(REFFMTID fmtid)
+{
+	return _bOpen ? _pOwn->DeletePropertySet(fmtid) : E_UNEXPECTED;
+}
+
+HRESULT CChainedMetadataStore::Probe(const WCHAR* pszFilePath)
+{
+	return _pOwn ? _pOwn->Probe(pszFilePath) : E_OUTOFMEMORY;
+}
+
+HRESULT CChainedMetadataStore::Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp)
+{
+	return _pOwn ? _pOwn->Stamp(pszFilePath, pStamp) : E_OUTOFMEMORY;
+}
+
+void CChainedMetadataStore::SetMarker(REFPROPERTYKEY key, const WCHAR* pszValue)
+{
+	_bHaveMarker = true;
+	_markerKey = key;
+	_marker = pszValue;
+}
+
+bool CChainedMetadataStore::OpenChained()
+{
+	if (_chainedState == ChainedNotOpened)
+	{
+		if (_pChained != NULL && SUCCEEDED(_pChained->Open(_filePath.c_str(), false)))
+			_chainedState = ChainedOpen;
+		else
+			_chainedState = ChainedUnavailable;
+	}
+	return _chainedState == ChainedOpen;
+}
+
+// If the count cannot be had, the chained properties are left out, and it is asked for again next time
+DWORD CChainedMetadataStore::ChainedPropCount()
+{
+	if (!_bHaveChainedCount)
+	{
+		_cChainedProps = 0;
+		if (OpenChained())
+		{
+			_bHaveChainedCount = SUCCEEDED(_pChained->GetCount(&_cChainedProps));
+			if (!_bHaveChainedCount)
+				_cChainedProps = 0;
+		}
+		else
+			_bHaveChainedCount = true;
+	}
+	return _cChainedProps;
+}
+
+bool CChainedMetadataStore::EntryLess::operator()(const IndexEntry& entry1, const IndexEntry& entry2) const
+{
+	int cmp = memcmp(&entry1.key.fmtid, &entry2.key.fmtid, sizeof(FMTID));
+	return cmp < 0 || (cmp == 0 && entry1.key.pid < entry2.key.pid);
+}
+
+// Our keys are listed before the chained ones, so that where a key is in both, the stable sort leaves ours first,
+// and it is ours that is kept
+HRESULT CChainedMetadataStore::BuildIndex()
+{
+	if (_bIndexValid)
+		return S_OK;
+
+	_index.clear();
+	DWORD cOwn;
+	HRESULT hr = _pOwn->GetCount(&cOwn);
+	for (DWORD i = 0; i < cOwn && SUCCEEDED(hr); i++)
+	{
+		IndexEntry entry;
+		entry.bOwn = true;
+		hr = _pOwn->GetAt(i, &entry.key);
+		_index.push_back(entry);
+	}
+
+	DWORD cChained = SUCCEEDED(hr) ? ChainedPropCount() : 0;
+	for (DWORD i = 0; i < cChained && SUCCEEDED(hr); i++)
+	{
+		IndexEntry entry;
+		entry.bOwn = false;
+		hr = _pChained->GetAt(i, &entry.key);
+		_index.push_back(entry);
+	}
+
+	if (FAILED(hr))
+	{
+		_index.clear();
+		return hr;
+	}
+
+	std::stable_sort(_index.begin(), _index.end(), EntryLess());
+	size_t cUnique = 0;
+	for (size_t i = 0; i < _index.size(); i++)
+	{
+		if (cUnique == 0 || !SameKey(_index[cUnique - 1].key, _index[i].key))
+			_index[cUnique++] = _index[i];
+	}
+	_index.resize(cUnique);
+
+	_bIndexValid = true;
+	_iLastAt = 0;
+	return S_OK;
+}
+
+// Returns NULL if the index has not been built, or does not have the key
+const CChainedMetadataStore::IndexEntry* CChainedMetadataStore::FindIndexEntry(REFPROPERTYKEY key) const
+{
+	if (!_bIndexValid)
+		return NULL;
+
+	// Enumeration asks for each key and then its value, so the last key given out is the likeliest
+	if (_iLastAt < _index.size() && SameKey(_index[_iLastAt].key, key))
+		return &_index[_iLastAt];
+
+	IndexEntry sought;
+	sought.key = key;
+	std::vector<IndexEntry>::const_iterator it = std::lower_bound(_index.begin(), _index.end(), sought, EntryLess());
+	return it != _index.end() && SameKey(it->key, key) ? &*it : NULL;
+}
+
+#pragma endregion
+
+IMetadataStore* CreateMetadataStore(MetadataStoreKind kind)
+{
+	switch (kind)
+	{
+#ifdef _WIN32
+	case NativeMetadataStore:
+		return new (std::nothrow) CNativeMetadataStore();
+	case ExplorerMetadataStore:
+		return new (std::nothrow) CShellMetadataStore();
+#else
+	case NativeMetadataStore:
+		return new (std::nothrow) CXattrMetadataStore();
+#endif
+	case MemoryMetadataStore:
+		return new (std::nothrow) CMemoryMetadataStore();
+	default:
+		return NULL;
+	}
+}
+
+CDeferredWriteMetadataStore* CreateDeferredWriteMetadataStore(MetadataStoreKind kind)
+{
+	IMetadataStore* pStore = CreateMetadataStore(kind);
+	if (!pStore)
+		return NULL;
+
+	CDeferredWriteMetadataStore* pDeferred = new (std::nothrow) CDeferredWriteMetadataStore(pStore);
+	if (!pDeferred)
+		delete pStore;
+	return pDeferred;
+}
@@ -0,0 +1,264 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Storage backends for file metadata. Export, import, delete and the property handler all go through
+// IMetadataStore, so that where the metadata actually lives can vary: the NTFS alternate streams used on
+// Windows, extended attributes elsewhere, or process memory for tests and benchmarks.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include "PropertySetStream.h"
+
+enum MetadataStoreKind
+{
+	NativeMetadataStore,		// where this platform keeps our metadata: property set streams, or extended attributes
+	ExplorerMetadataStore,		// the properties Explorer sees, which may come from another handler (Windows only)
+	MemoryMetadataStore,		// process memory only, shared by all stores in the process
+};
+
+// The state of a file's metadata, as cheaply as the store can tell it, so that a later run can see whether the
+// metadata has changed without reading it. Metadata with an equal stamp is taken to be unchanged, just as
+// backup tools take a file with an unchanged size and time to be; a stamp that differs says only that the
+// metadata may have changed.
+struct MetadataStamp
+{
+	ULONGLONG	fileId;		// identifies the file on its volume, so that a file replaced by another is noticed
+	ULONGLONG	size;		// total size of the property set streams, where the store can tell it in the same query
+	ULONGLONG	changed;	// when the file or its metadata was last changed, in the store's own units
+};
+
+// The operations of IPropertyStore that we use, plus property set level enumeration and deletion
+class IMetadataStore
+{
+public:
+	virtual ~IMetadataStore() {}
+
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite) = 0;
+	virtual void Close() = 0;
+
+	virtual HRESULT GetCount(DWORD* pcProps) = 0;
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey) = 0;
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar) = 0;
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar) = 0;
+	virtual HRESULT Commit() = 0;
+
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids) = 0;
+	virtual HRESULT DeletePropertySet(REFFMTID fmtid) = 0;
+
+	// Whether the file has any metadata in this store, without opening it. Where the store can, this only asks
+	// whether a property set stream exists, which is a single query that shares the file with any other opener,
+	// so a stream that is present but holds no properties counts as metadata. Returns S_OK if there is metadata,
+	// S_FALSE if not, or an error. Any open file is left open.
+	virtual HRESULT Probe(const WCHAR* pszFilePath) = 0;
+
+	// Stamps the current state of the file's metadata, again without opening it. Returns E_NOTIMPL if the
+	// store has no cheap way to tell, in which case the metadata has to be read to see if it has changed.
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp) = 0;
+};
+
+// Returns NULL if out of memory, or if the kind of store is not available on this platform
+IMetadataStore* CreateMetadataStore(MetadataStoreKind kind = NativeMetadataStore);
+
+class CDeferredWriteMetadataStore;
+
+// The same, wrapped in a CDeferredWriteMetadataStore
+CDeferredWriteMetadataStore* CreateDeferredWriteMetadataStore(MetadataStoreKind kind = NativeMetadataStore);
+
+// A store kept as a set of named property set streams, which derived classes load and save.
+// Changes are held in memory until Commit, which rewrites only the streams that have changed.
+class CPropertySetMetadataStore : public IMetadataStore
+{
+public:
+	CPropertySetMetadataStore();
+	virtual ~CPropertySetMetadataStore();
+
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite);
+	virtual void Close();
+
+	virtual HRESULT GetCount(DWORD* pcProps);
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey);
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar);
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar);
+	virtual HRESULT Commit();
+
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids);
+	virtual HRESULT DeletePropertySet(REFFMTID fmtid);
+
+protected:
+	const std::wstring& FilePath() const { return _filePath; }
+
+	// Stream names include the leading \005
+	virtual HRESULT OpenFile(bool bReadWrite) = 0;
+	virtual HRESULT EnumStreams(std::vector<std::wstring>& names) = 0;
+	virtual HRESULT ReadStream(const std::wstring& name, std::vector<BYTE>& data) = 0;
+	virtual HRESULT WriteStream(const std::wstring& name, const std::vector<BYTE>& data) = 0;
+	virtual HRESULT DeleteStream(const std::wstring& name) = 0;
+
+private:
+	CPropertySet* FindSet(REFFMTID fmtid);
+	void BuildKeys();
+	void MarkDirty(REFFMTID fmtid);
+
+	std::wstring				_filePath;
+	bool						_bOpen;
+	bool						_bReadWrite;
+	std::vector<CPropertySet>	_sets;
+	std::vector<PROPERTYKEY>	_keys;			// flattened in set order, rebuilt after any change
+	bool						_bKeysValid;
+	std::vector<std::wstring>	_dirtyStreams;
+};
+
+// What a commit is about to overwrite: the values that properties had, and the properties that it adds,
+// which had none, so that the metadata can be put back as it was
+struct MetadataUndo
+{
+	std::vector<CPropertySet>	prior;
+	std::vector<PROPERTYKEY>	added;
+};
+
+// Told by a CDeferredWriteMetadataStore what it is about to overwrite, before it writes anything,
+// so that a failure to record it stops the commit
+class IUndoRecorder
+{
+public:
+	virtual ~IUndoRecorder() {}
+	virtual HRESULT RecordUndo(const WCHAR* pszFilePath, const MetadataUndo& undo) = 0;
+};
+
+// Reads through another store opened only for reading, and holds changes in memory until Commit, which opens
+// the store for writing only if some value actually differs from what is already there. Setting a property to
+// the value it already has costs nothing, so metadata restored onto a file that already has it is not rewritten,
+// and the file is only held for writing for as long as Commit takes. A set left with no properties is deleted.
+class CDeferredWriteMetadataStore : public IMetadataStore
+{
+public:
+	// Takes ownership of the store
+	explicit CDeferredWriteMetadataStore(IMetadataStore* pStore);
+	virtual ~CDeferredWriteMetadataStore();
+
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite);
+	virtual void Close();
+
+	virtual HRESULT GetCount(DWORD* pcProps);
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey);
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar);
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar);
+	virtual HRESULT Commit();
+
+	// Changes that have not been committed are not included
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids);
+	// Deleting a whole set is not deferred; open the store directly for writing instead
+	virtual HRESULT DeletePropertySet(REFFMTID fmtid);
+
+	virtual HRESULT Probe(const WCHAR* pszFilePath);
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp);
+
+	// Whether there are changes that Commit has still to write
+	bool HasChanges() const { return !_changes.empty() || !_removals.empty(); }
+
+	// Has Commit tell the recorder what it overwrites, if anything; NULL for none
+	void SetUndoRecorder(IUndoRecorder* pRecorder) { _pUndoRecorder = pRecorder; }
+
+private:
+	CDeferredWriteMetadataStore(const CDeferredWriteMetadataStore&);
+	CDeferredWriteMetadataStore& operator=(const CDeferredWriteMetadataStore&);
+
+	HRESULT GetStoredValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar);
+	CPropertySet* FindChanges(REFFMTID fmtid);
+	bool IsRemoved(REFPROPERTYKEY key) const;
+	HRESULT GetUndo(MetadataUndo& undo);
+	HRESULT DeleteEmptySets();
+	HRESULT BuildKeys();
+
+	IMetadataStore*				_pStore;
+	std::wstring				_filePath;
+	bool						_bOpen;
+	bool						_bReadWrite;
+	bool						_bStoreOpen;	// the file may have no metadata at all, and then is not opened to read it
+	bool						_bStoreWritable;
+	std::vector<CPropertySet>	_changes;		// new values, by property set
+	std::vector<PROPERTYKEY>	_removals;		// properties to remove
+	std::vector<PROPERTYKEY>	_keys;			// as GetAt sees them, with the changes applied
+	bool						_bKeysValid;
+	IUndoRecorder*				_pUndoRecorder;
+};
+
+// Our own properties, with those of another store behind them, as the property handler has the handler that it is
+// chained to for a file's type. The other store is only opened when it is first needed, to look up a property that
+// we have no value for, or to enumerate, so that a caller that asks only for our own properties never loads the
+// chained handler at all. If it fails to open, it is taken to have no properties, so that ours are still there.
+//
+// Enumeration goes through an index of the keys of both stores, built once, sorted, and with a key that is in both
+// listed once, as ours, since ours is the value that is returned. Each entry records which store has the key, so
+// that once the index is built, a value is asked for from that store alone, rather than from ours and then the other.
+class CChainedMetadataStore : public IMetadataStore
+{
+public:
+	// Takes ownership of both stores; pChained may be NULL if there is nothing to chain to
+	CChainedMetadataStore(IMetadataStore* pOwn, IMetadataStore* pChained);
+	virtual ~CChainedMetadataStore();
+
+	// Opens our own store now, and the chained one, only to read, when it is first needed
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite);
+	virtual void Close();
+
+	// Through the index, whose order only changes if a property is set that we did not have, or ours is removed,
+	// so that repeated calls with the same index return the same key
+	virtual HRESULT GetCount(DWORD* pcProps);
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey);
+
+	// Our value if we have one, else the marker, else the chained value; once the index is built,
+	// it says which store to ask, so that a key that is only chained is not looked for in ours
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar);
+
+	// The rest only concern our own properties
+	virtual HRESULT SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar);
+	virtual HRESULT Commit();
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>& fmtids);
+	virtual HRESULT DeletePropertySet(REFFMTID fmtid);
+	virtual HRESULT Probe(const WCHAR* pszFilePath);
+	virtual HRESULT Stamp(const WCHAR* pszFilePath, MetadataStamp* pStamp);
+
+	// Gives a property a string value wherever we have none of our own, in preference to any chained value
+	void SetMarker(REFPROPERTYKEY key, const WCHAR* pszValue);
+
+	// Whether the chained store has been opened yet
+	bool IsChainedOpen() const { return _chainedState == ChainedOpen; }
+
+private:
+	CChainedMetadataStore(const CChainedMetadataStore&);
+	CChainedMetadataStore& operator=(const CChainedMetadataStore&);
+
+	enum ChainedState { ChainedNotOpened, ChainedOpen, ChainedUnavailable };
+
+	struct IndexEntry
+	{
+		PROPERTYKEY	key;
+		bool		bOwn;		// else the chained store's
+	};
+
+	struct EntryLess
+	{
+		bool operator()(const IndexEntry& entry1, const IndexEntry& entry2) const;
+	};
+
+	// Returns false if there is no chained store to use
+	bool OpenChained();
+	DWORD ChainedPropCount();
+	HRESULT BuildIndex();
+	const IndexEntry* FindIndexEntry(REFPROPERTYKEY key) const;
+
+	IMetadataStore*	_pOwn;
+	IMetadataStore*	_pChained;
+	std::wstring	_filePath;
+	bool			_bOpen;
+	ChainedState	_chainedState;
+	bool			_bHaveChainedCount;
+	DWORD			_cChainedProps;
+	std::vector<IndexEntry>	_index;		// sorted by key
+	bool			_bIndexValid;
+	DWORD			_iLastAt;		// the entry GetAt last returned, as its value is usually asked for next
+	bool			_bHaveMarker;
+	PROPERTYKEY		_markerKey;
+	std::wstring	_marker;
+};
@@ -0,0 +1,388 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "PortableTypes.h"
+#include <errno.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+
+const FMTID FMTID_SummaryInformation	= { 0xF29F85E0, 0x4FF9, 0x1068, { 0xAB, 0x91, 0x08, 0x00, 0x2B, 0x27, 0xB3, 0xD9 } };
+const FMTID FMTID_DocSummaryInformation = { 0xD5CDD502, 0x2E9C, 0x101B, { 0x93, 0x97, 0x08, 0x00, 0x2B, 0x2C, 0xF9, 0xAE } };
+const FMTID FMTID_UserDefinedProperties = { 0xD5CDD505, 0x2E9C, 0x101B, { 0x93, 0x97, 0x08, 0x00, 0x2B, 0x2C, 0xF9, 0xAE } };
+
+void* CoTaskMemAlloc(size_t cb)
+{
+	return malloc(cb);
+}
+
+void CoTaskMemFree(void* pv)
+{
+	free(pv);
+}
+
+HRESULT PropVariantClear(PROPVARIANT* ppropvar)
+{
+	if (!ppropvar)
+		return S_OK;
+
+	switch (ppropvar->vt)
+	{
+	case VT_LPSTR:
+	case VT_LPWSTR:
+	case VT_BSTR:
+	case VT_CLSID:
+		// All of these hold a single allocated pointer in the same place
+		CoTaskMemFree(ppropvar->pwszVal);
+		break;
+
+	case VT_BLOB:
+		CoTaskMemFree(ppropvar->blob.pBlobData);
+		break;
+
+	case VT_VECTOR | VT_LPSTR:
+		for (ULONG i = 0; i < ppropvar->calpstr.cElems; i++)
+			CoTaskMemFree(ppropvar->calpstr.pElems[i]);
+		CoTaskMemFree(ppropvar->calpstr.pElems);
+		break;
+
+	case VT_VECTOR | VT_LPWSTR:
+	case VT_VECTOR | VT_BSTR:
+		for (ULONG i = 0; i < ppropvar->calpwstr.cElems; i++)
+			CoTaskMemFree(ppropvar->calpwstr.pElems[i]);
+		CoTaskMemFree(ppropvar->calpwstr.pElems);
+		break;
+
+	case VT_VECTOR | VT_VARIANT:
+		for (ULONG i = 0; i < ppropvar->capropvar.cElems; i++)
+			PropVariantClear(&ppropvar->capropvar.pElems[i]);
+		CoTaskMemFree(ppropvar->capropvar.pElems);
+		break;
+
+	default:
+		// Vectors of fixed size elements share the layout of cac
+		if (ppropvar->vt & VT_VECTOR)
+			CoTaskMemFree(ppropvar->cac.pElems);
+		break;
+	}
+
+	PropVariantInit(ppropvar);
+	return S_OK;
+}
+
+static size_t VectorElementSize(VARTYPE vt)
+{
+	switch (vt & VT_TYPEMASK)
+	{
+	case VT_I1: case VT_UI1:
+		return 1;
+	case VT_I2: case VT_UI2: case VT_BOOL:
+		return 2;
+	case VT_I4: case VT_UI4: case VT_R4: case VT_ERROR: case VT_INT: case VT_UINT:
+		return 4;
+	case VT_I8: case VT_UI8: case VT_R8: case VT_CY: case VT_DATE: case VT_FILETIME:
+		return 8;
+	case VT_CLSID:
+		return sizeof(CLSID);
+	default:
+		return 0;
+	}
+}
+
+static LPSTR DuplicateString(LPCSTR psz)
+{
+	size_t cb = strlen(psz) + 1;
+	LPSTR p = (LPSTR)CoTaskMemAlloc(cb);
+	if (p)
+		memcpy(p, psz, cb);
+	return p;
+}
+
+static LPWSTR DuplicateString(LPCWSTR psz)
+{
+	size_t cb = (wcslen(psz) + 1) * sizeof(WCHAR);
+	LPWSTR p = (LPWSTR)CoTaskMemAlloc(cb);
+	if (p)
+		memcpy(p, psz, cb);
+	return p;
+}
+
+HRESULT PropVariantCopy(PROPVARIANT* pvarDest, const PROPVARIANT* pvarSrc)
+{
+	*pvarDest = *pvarSrc;
+
+	HRESULT hr = S_OK;
+	switch (pvarSrc->vt)
+	{
+	case VT_LPSTR:
+		if (pvarSrc->pszVal && !(pvarDest->pszVal = DuplicateString(pvarSrc->pszVal)))
+			hr = E_OUTOFMEMORY;
+		break;
+
+	case VT_LPWSTR:
+	case VT_BSTR:
+		if (pvarSrc->pwszVal && !(pvarDest->pwszVal = DuplicateString(pvarSrc->pwszVal)))
+			hr = E_OUTOFMEMORY;
+		break;
+
+	case VT_CLSID:
+		if (pvarSrc->puuid)
+		{
+			pvarDest->puuid = (CLSID*)CoTaskMemAlloc(sizeof(CLSID));
+			if (pvarDest->puuid)
+				*pvarDest->puuid = *pvarSrc->puuid;
+			else
+				hr = E_OUTOFMEMORY;
+		}
+		break;
+
+	case VT_BLOB:
+		if (pvarSrc->blob.cbSize > 0)
+		{
+			pvarDest->blob.pBlobData = (BYTE*)CoTaskMemAlloc(pvarSrc->blob.cbSize);
+			if (pvarDest->blob.pBlobData)
+				memcpy(pvarDest->blob.pBlobData, pvarSrc->blob.pBlobData, pvarSrc->blob.cbSize);
+			else
+				hr = E_OUTOFMEMORY;
+		}
+		break;
+
+	case VT_VECTOR | VT_LPSTR:
+	case VT_VECTOR | VT_LPWSTR:
+	case VT_VECTOR | VT_BSTR:
+	case VT_VECTOR | VT_VARIANT:
+		{
+			ULONG cElems = pvarSrc->cac.cElems;
+			size_t cbElem = (pvarSrc->vt == (VT_VECTOR | VT_VARIANT)) ? sizeof(PROPVARIANT) : sizeof(void*);
+			pvarDest->cac.pElems = (CHAR*)CoTaskMemAlloc(cElems * cbElem);
+			if (!pvarDest->cac.pElems && cElems > 0)
+			{
+				hr = E_OUTOFMEMORY;
+				break;
+			}
+			memset(pvarDest->cac.pElems, 0, cElems * cbElem);
+
+			for (ULONG i = 0; i < cElems && SUCCEEDED(hr); i++)
+			{
+				if (pvarSrc->vt == (VT_VECTOR | VT_LPSTR))
+					hr = (pvarDest->calpstr.pElems[i] = DuplicateString(pvarSrc->calpstr.pElems[i])) ? S_OK : E_OUTOFMEMORY;
+				else if (pvarSrc->vt == (VT_VECTOR | VT_LPWSTR) || pvarSrc->vt == (VT_VECTOR | VT_BSTR))
+					hr = (pvarDest->calpwstr.pElems[i] = DuplicateString(pvarSrc->calpwstr.pElems[i])) ? S_OK : E_OUTOFMEMORY;
+				else
+					hr = PropVariantCopy(&pvarDest->capropvar.pElems[i], &pvarSrc->capropvar.pElems[i]);
+			}
+		}
+		break;
+
+	default:
+		if (pvarSrc->vt & VT_VECTOR)
+		{
+			size_t cb = pvarSrc->cac.cElems * VectorElementSize(pvarSrc->vt);
+			if (cb == 0 && pvarSrc->cac.cElems > 0)
+				return STG_E_INVALIDPARAMETER;
+			pvarDest->cac.pElems = (CHAR*)CoTaskMemAlloc(cb);
+			if (pvarDest->cac.pElems)
+				memcpy(pvarDest->cac.pElems, pvarSrc->cac.pElems, cb);
+			else if (cb > 0)
+				hr = E_OUTOFMEMORY;
+		}
+		break;
+	}
+
+	if (FAILED(hr))
+		PropVariantClear(pvarDest);
+	return hr;
+}
+
+std::string NarrowPath(const WCHAR* pszPath)
+{
+	std::string s;
+	size_t cb = wcstombs(NULL, pszPath, 0);
+	if (cb != (size_t)-1)
+	{
+		s.resize(cb);
+		wcstombs(&s[0], pszPath, cb);
+	}
+	return s;
+}
+
+std::wstring WidePath(const char* pszPath)
+{
+	std::wstring s;
+	size_t cch = mbstowcs(NULL, pszPath, 0);
+	if (cch != (size_t)-1)
+	{
+		s.resize(cch);
+		mbstowcs(&s[0], pszPath, cch);
+	}
+	return s;
+}
+
+#endif
+
+LPWSTR AllocString(const std::wstring& s)
+{
+	LPWSTR psz = (LPWSTR)CoTaskMemAlloc((s.size() + 1) * sizeof(WCHAR));
+	if (psz)
+	{
+		memcpy(psz, s.c_str(), s.size() * sizeof(WCHAR));
+		psz[s.size()] = L'\0';
+	}
+	return psz;
+}
+
+BSTR AllocBstr(const std::wstring& s)
+{
+#ifdef _WIN32
+	return SysAllocStringLen(s.c_str(), (UINT)s.size());
+#else
+	// There is no separate string allocator here, and BSTRs are freed as task memory
+	return AllocString(s);
+#endif
+}
+
+void AppendUtf16(std::vector<BYTE>& data, const WCHAR* psz, size_t cch)
+{
+	for (size_t i = 0; i < cch; i++)
+	{
+		unsigned long c = (unsigned long)psz[i];
+		if (c >= 0x10000 && sizeof(WCHAR) > 2)
+		{
+			// Characters outside the BMP need a surrogate pair when WCHAR is UTF-32
+			c -= 0x10000;
+			unsigned long hi = 0xD800 + (c >> 10), lo = 0xDC00 + (c & 0x3FF);
+			data.push_back((BYTE)(hi & 0xFF));
+			data.push_back((BYTE)(hi >> 8));
+			data.push_back((BYTE)(lo & 0xFF));
+			data.push_back((BYTE)(lo >> 8));
+		}
+		else
+		{
+			data.push_back((BYTE)(c & 0xFF));
+			data.push_back((BYTE)((c >> 8) & 0xFF));
+		}
+	}
+}
+
+void DecodeUtf16(const BYTE* pData, size_t cch, std::wstring& s)
+{
+	s.clear();
+	s.reserve(cch);
+	for (size_t i = 0; i < cch; i++)
+	{
+		unsigned long c = pData[2*i] | (pData[2*i + 1] << 8);
+		if (sizeof(WCHAR) > 2 && c >= 0xD800 && c < 0xDC00 && i + 1 < cch)
+		{
+			unsigned long lo = pData[2*i + 2] | (pData[2*i + 3] << 8);
+			if (lo >= 0xDC00 && lo < 0xE000)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+				i++;
+			}
+		}
+		s.push_back((WCHAR)c);
+	}
+}
+
+void AppendUtf8(std::vector<BYTE>& data, const WCHAR* psz, size_t cch)
+{
+	for (size_t i = 0; i < cch; i++)
+	{
+		unsigned long c = (unsigned long)psz[i];
+		if (sizeof(WCHAR) == 2 && c >= 0xD800 && c < 0xDC00 && i + 1 < cch &&
+			(unsigned long)psz[i + 1] >= 0xDC00 && (unsigned long)psz[i + 1] < 0xE000)
+		{
+			// Recombine a surrogate pair when WCHAR is UTF-16
+			c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)psz[i + 1] - 0xDC00);
+			i++;
+		}
+
+		if (c < 0x80)
+			data.push_back((BYTE)c);
+		else if (c < 0x800)
+		{
+			data.push_back((BYTE)(0xC0 | (c >> 6)));
+			data.push_back((BYTE)(0x80 | (c & 0x3F)));
+		}
+		else if (c < 0x10000)
+		{
+			data.push_back((BYTE)(0xE0 | (c >> 12)));
+			data.push_back((BYTE)(0x80 | ((c >> 6) & 0x3F)));
+			data.push_back((BYTE)(0x80 | (c & 0x3F)));
+		}
+		else
+		{
+			data.push_back((BYTE)(0xF0 | ((c >> 18) & 0x07)));
+			data.push_back((BYTE)(0x80 | ((c >> 12) & 0x3F)));
+			data.push_back((BYTE)(0x80 | ((c >> 6) & 0x3F)));
+			data.push_back((BYTE)(0x80 | (c & 0x3F)));
+		}
+	}
+}
+
+bool DecodeUtf8(const BYTE* pData, size_t cb, std::wstring& s)
+{
+	s.clear();
+	s.reserve(cb);
+	for (size_t i = 0; i < cb; )
+	{
+		BYTE b = pData[i];
+		size_t cbChar = b < 0x80 ? 1 : b < 0xC0 ? 0 : b < 0xE0 ? 2 : b < 0xF0 ? 3 : b < 0xF8 ? 4 : 0;
+		if (cbChar == 0 || cbChar > cb - i)
+			return false;
+
+		unsigned long c = cbChar == 1 ? b : (b & (0x7F >> cbChar));
+		for (size_t j = 1; j < cbChar; j++)
+		{
+			if ((pData[i + j] & 0xC0) != 0x80)
+				return false;
+			c = (c << 6) | (pData[i + j] & 0x3F);
+		}
+		i += cbChar;
+
+		if (c >= 0x10000 && sizeof(WCHAR) == 2)
+		{
+			c -= 0x10000;
+			s.push_back((WCHAR)(0xD800 + (c >> 10)));
+			s.push_back((WCHAR)(0xDC00 + (c & 0x3FF)));
+		}
+		else
+			s.push_back((WCHAR)c);
+	}
+	return true;
+}
+
+int ReadFileBytes(const WCHAR* pszPath, std::vector<BYTE>& data)
+{
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	int err = _wfopen_s(&pfile, pszPath, L"rb");
+	if (err != 0)
+		return err;
+#else
+	pfile = fopen(NarrowPath(pszPath).c_str(), "rb");
+	if (!pfile)
+		return errno;
+	int err = 0;
+#endif
+
+	data.clear();
+	BYTE buffer[8192];
+	size_t cb;
+	while ((cb = fread(buffer, 1, sizeof(buffer), pfile)) > 0)
+		data.insert(data.end(), buffer, buffer + cb);
+	if (ferror(pfile))
+		err = errno;
+	fclose(pfile);
+	return err;
+}
+
+ULONGLONG HashBytes(const void* pData, size_t cb, ULONGLONG hash)
+{
+	const BYTE* pb = (const BYTE*)pData;
+	for (size_t i = 0; i < cb; i++)
+	{
+		hash ^= pb[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
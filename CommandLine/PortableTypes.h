@@ -0,0 +1,333 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// The types that the metadata code shares with the Windows property system.
+// On Windows these come straight from the SDK; elsewhere, just enough of them is defined here
+// for the storage and serialization code to be compiled and exercised without COM.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <objbase.h>
+#include <propidl.h>
+#include <oleauto.h>
+
+#else
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+typedef uint8_t				BYTE;
+typedef uint16_t			WORD;
+typedef uint32_t			DWORD;
+typedef int32_t				LONG;
+typedef uint32_t			ULONG;
+typedef int64_t				LONGLONG;
+typedef uint64_t			ULONGLONG;
+typedef int16_t				SHORT;
+typedef uint16_t			USHORT;
+typedef char				CHAR;
+typedef unsigned char		UCHAR;
+typedef int					INT;
+typedef unsigned int		UINT;
+typedef int					BOOL;
+typedef float				FLOAT;
+typedef double				DOUBLE;
+typedef wchar_t				WCHAR;
+typedef WCHAR*				LPWSTR;
+typedef WCHAR*				PWSTR;
+typedef const WCHAR*		LPCWSTR;
+typedef const WCHAR*		PCWSTR;
+typedef CHAR*				LPSTR;
+typedef const CHAR*			LPCSTR;
+typedef WCHAR*				BSTR;
+typedef int32_t				HRESULT;
+typedef int32_t				SCODE;
+typedef uint16_t			VARTYPE;
+typedef int16_t				VARIANT_BOOL;
+typedef double				DATE;
+typedef uint32_t			PROPID;
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+
+#define MAX_PATH	260
+
+#define VARIANT_TRUE	((VARIANT_BOOL)-1)
+#define VARIANT_FALSE	((VARIANT_BOOL)0)
+
+#define S_OK						((HRESULT)0x00000000L)
+#define S_FALSE						((HRESULT)0x00000001L)
+#define E_NOTIMPL					((HRESULT)0x80004001L)
+#define E_FAIL						((HRESULT)0x80004005L)
+#define E_UNEXPECTED				((HRESULT)0x8000FFFFL)
+#define E_ACCESSDENIED				((HRESULT)0x80070005L)
+#define E_OUTOFMEMORY				((HRESULT)0x8007000EL)
+#define E_INVALIDARG				((HRESULT)0x80070057L)
+#define STG_E_FILENOTFOUND			((HRESULT)0x80030002L)
+#define STG_E_ACCESSDENIED			((HRESULT)0x80030005L)
+#define STG_E_WRITEFAULT			((HRESULT)0x8003001DL)
+#define STG_E_READFAULT				((HRESULT)0x8003001EL)
+#define STG_E_SHAREVIOLATION		((HRESULT)0x80030020L)
+#define STG_E_INVALIDPARAMETER		((HRESULT)0x80030057L)
+#define STG_E_MEDIUMFULL			((HRESULT)0x80030070L)
+#define STG_E_INVALIDHEADER			((HRESULT)0x800300FBL)
+#define STG_E_INVALIDNAME			((HRESULT)0x800300FCL)
+#define STG_E_UNIMPLEMENTEDFUNCTION	((HRESULT)0x800300FEL)
+#define STG_E_DOCFILECORRUPT		((HRESULT)0x80030109L)
+#define CO_E_CLASSSTRING			((HRESULT)0x800401F3L)
+
+// System error codes, as returned alongside errno values
+#define ERROR_INVALID_FUNCTION		1L
+#define ERROR_FILE_NOT_FOUND		2L
+#define ERROR_OUTOFMEMORY			14L
+#define ERROR_WRITE_FAULT			29L
+#define ERROR_OPEN_FAILED			110L
+#define ERROR_FILE_TOO_LARGE		223L
+#define ERROR_FILE_CORRUPT			1392L
+#define ERROR_XML_PARSE_ERROR		1465L
+#define ERROR_UNKNOWN_PROPERTY		1608L
+
+#define SUCCEEDED(hr)	(((HRESULT)(hr)) >= 0)
+#define FAILED(hr)		(((HRESULT)(hr)) < 0)
+
+#define CP_WINUNICODE	1200
+
+enum VARENUM
+{
+	VT_EMPTY = 0, VT_NULL = 1, VT_I2 = 2, VT_I4 = 3, VT_R4 = 4, VT_R8 = 5, VT_CY = 6, VT_DATE = 7,
+	VT_BSTR = 8, VT_DISPATCH = 9, VT_ERROR = 10, VT_BOOL = 11, VT_VARIANT = 12, VT_UNKNOWN = 13,
+	VT_DECIMAL = 14, VT_I1 = 16, VT_UI1 = 17, VT_UI2 = 18, VT_UI4 = 19, VT_I8 = 20, VT_UI8 = 21,
+	VT_INT = 22, VT_UINT = 23, VT_VOID = 24, VT_HRESULT = 25, VT_PTR = 26, VT_SAFEARRAY = 27,
+	VT_CARRAY = 28, VT_USERDEFINED = 29, VT_LPSTR = 30, VT_LPWSTR = 31, VT_RECORD = 36,
+	VT_INT_PTR = 37, VT_UINT_PTR = 38, VT_FILETIME = 64, VT_BLOB = 65, VT_STREAM = 66,
+	VT_STORAGE = 67, VT_STREAMED_OBJECT = 68, VT_STORED_OBJECT = 69, VT_BLOB_OBJECT = 70,
+	VT_CF = 71, VT_CLSID = 72, VT_VERSIONED_STREAM = 73, VT_BSTR_BLOB = 0xfff,
+	VT_VECTOR = 0x1000, VT_ARRAY = 0x2000, VT_BYREF = 0x4000, VT_RESERVED = 0x8000,
+	VT_ILLEGAL = 0xffff, VT_ILLEGALMASKED = 0xfff, VT_TYPEMASK = 0xfff
+};
+
+typedef union tagCY
+{
+	struct { ULONG Lo; LONG Hi; };
+	LONGLONG int64;
+} CY;
+
+typedef union _LARGE_INTEGER
+{
+	struct { DWORD LowPart; LONG HighPart; };
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER
+{
+	struct { DWORD LowPart; DWORD HighPart; };
+	ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+typedef struct _FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct _GUID
+{
+	DWORD	Data1;
+	WORD	Data2;
+	WORD	Data3;
+	BYTE	Data4[8];
+} GUID;
+
+typedef GUID CLSID;
+typedef GUID FMTID;
+typedef GUID IID;
+typedef const GUID& REFGUID;
+typedef const GUID& REFCLSID;
+typedef const GUID& REFFMTID;
+typedef const GUID& REFIID;
+
+inline bool IsEqualGUID(REFGUID a, REFGUID b) { return 0 == memcmp(&a, &b, sizeof(GUID)); }
+inline bool operator==(REFGUID a, REFGUID b) { return IsEqualGUID(a, b); }
+inline bool operator!=(REFGUID a, REFGUID b) { return !IsEqualGUID(a, b); }
+
+typedef struct _tagpropertykey
+{
+	GUID	fmtid;
+	DWORD	pid;
+} PROPERTYKEY;
+
+typedef const PROPERTYKEY& REFPROPERTYKEY;
+
+inline bool operator==(REFPROPERTYKEY a, REFPROPERTYKEY b) { return a.pid == b.pid && a.fmtid == b.fmtid; }
+inline bool operator!=(REFPROPERTYKEY a, REFPROPERTYKEY b) { return !(a == b); }
+
+typedef struct tagBLOB
+{
+	ULONG	cbSize;
+	BYTE*	pBlobData;
+} BLOB;
+
+struct tagPROPVARIANT;
+
+#define DEFINE_COUNTED_ARRAY(name, type) typedef struct tag##name { ULONG cElems; type* pElems; } name
+DEFINE_COUNTED_ARRAY(CAC, CHAR);
+DEFINE_COUNTED_ARRAY(CAUB, UCHAR);
+DEFINE_COUNTED_ARRAY(CAI, SHORT);
+DEFINE_COUNTED_ARRAY(CAUI, USHORT);
+DEFINE_COUNTED_ARRAY(CAL, LONG);
+DEFINE_COUNTED_ARRAY(CAUL, ULONG);
+DEFINE_COUNTED_ARRAY(CAH, LARGE_INTEGER);
+DEFINE_COUNTED_ARRAY(CAUH, ULARGE_INTEGER);
+DEFINE_COUNTED_ARRAY(CAFLT, FLOAT);
+DEFINE_COUNTED_ARRAY(CADBL, DOUBLE);
+DEFINE_COUNTED_ARRAY(CABOOL, VARIANT_BOOL);
+DEFINE_COUNTED_ARRAY(CASCODE, SCODE);
+DEFINE_COUNTED_ARRAY(CACY, CY);
+DEFINE_COUNTED_ARRAY(CADATE, DATE);
+DEFINE_COUNTED_ARRAY(CAFILETIME, FILETIME);
+DEFINE_COUNTED_ARRAY(CACLSID, CLSID);
+DEFINE_COUNTED_ARRAY(CALPSTR, LPSTR);
+DEFINE_COUNTED_ARRAY(CALPWSTR, LPWSTR);
+DEFINE_COUNTED_ARRAY(CABSTR, BSTR);
+DEFINE_COUNTED_ARRAY(CAPROPVARIANT, struct tagPROPVARIANT);
+#undef DEFINE_COUNTED_ARRAY
+
+typedef struct tagPROPVARIANT
+{
+	VARTYPE	vt;
+	WORD	wReserved1;
+	WORD	wReserved2;
+	WORD	wReserved3;
+	union
+	{
+		CHAR			cVal;
+		UCHAR			bVal;
+		SHORT			iVal;
+		USHORT			uiVal;
+		LONG			lVal;
+		ULONG			ulVal;
+		INT				intVal;
+		UINT			uintVal;
+		LARGE_INTEGER	hVal;
+		ULARGE_INTEGER	uhVal;
+		FLOAT			fltVal;
+		DOUBLE			dblVal;
+		VARIANT_BOOL	boolVal;
+		SCODE			scode;
+		CY				cyVal;
+		DATE			date;
+		FILETIME		filetime;
+		CLSID*			puuid;
+		BLOB			blob;
+		LPSTR			pszVal;
+		LPWSTR			pwszVal;
+		BSTR			bstrVal;
+		CAC				cac;
+		CAUB			caub;
+		CAI				cai;
+		CAUI			caui;
+		CAL				cal;
+		CAUL			caul;
+		CAH				cah;
+		CAUH			cauh;
+		CAFLT			caflt;
+		CADBL			cadbl;
+		CABOOL			cabool;
+		CASCODE			cascode;
+		CACY			cacy;
+		CADATE			cadate;
+		CAFILETIME		cafiletime;
+		CACLSID			cauuid;
+		CALPSTR			calpstr;
+		CALPWSTR		calpwstr;
+		CABSTR			cabstr;
+		CAPROPVARIANT	capropvar;
+	};
+} PROPVARIANT;
+
+typedef const PROPVARIANT& REFPROPVARIANT;
+
+extern const FMTID FMTID_SummaryInformation;
+extern const FMTID FMTID_DocSummaryInformation;
+extern const FMTID FMTID_UserDefinedProperties;
+
+// COM task memory is plain heap memory here
+void* CoTaskMemAlloc(size_t cb);
+void CoTaskMemFree(void* pv);
+
+inline void PropVariantInit(PROPVARIANT* ppropvar) { memset(ppropvar, 0, sizeof(PROPVARIANT)); }
+HRESULT PropVariantClear(PROPVARIANT* ppropvar);
+HRESULT PropVariantCopy(PROPVARIANT* pvarDest, const PROPVARIANT* pvarSrc);
+
+// Paths and attribute names are passed to the system as multibyte strings in the current locale
+std::string NarrowPath(const WCHAR* pszPath);
+std::wstring WidePath(const char* pszPath);
+
+#endif
+
+// A process-local lock, for state that is shared between threads
+class CLock
+{
+public:
+#ifdef _WIN32
+	CLock() { InitializeCriticalSection(&_cs); }
+	~CLock() { DeleteCriticalSection(&_cs); }
+	void Enter() { EnterCriticalSection(&_cs); }
+	void Leave() { LeaveCriticalSection(&_cs); }
+#else
+	CLock() { pthread_mutex_init(&_mutex, NULL); }
+	~CLock() { pthread_mutex_destroy(&_mutex); }
+	void Enter() { pthread_mutex_lock(&_mutex); }
+	void Leave() { pthread_mutex_unlock(&_mutex); }
+#endif
+
+private:
+	CLock(const CLock&);
+	CLock& operator=(const CLock&);
+
+#ifdef _WIN32
+	CRITICAL_SECTION _cs;
+#else
+	pthread_mutex_t _mutex;
+#endif
+};
+
+class CAutoLock
+{
+public:
+	CAutoLock(CLock& lock) : _lock(lock) { _lock.Enter(); }
+	~CAutoLock() { _lock.Leave(); }
+
+private:
+	CAutoLock& operator=(const CAutoLock&);
+	CLock& _lock;
+};
+
+// Copies a string into a newly allocated property value string, from COM task memory or as a BSTR
+LPWSTR AllocString(const std::wstring& s);
+BSTR AllocBstr(const std::wstring& s);
+
+// Property set streams hold their strings as UTF-16LE, whatever the width of WCHAR
+void AppendUtf16(std::vector<BYTE>& data, const WCHAR* psz, size_t cch);
+void DecodeUtf16(const BYTE* pData, size_t cch, std::wstring& s);
+
+// UTF-8 for compact storage; unpaired surrogates are kept as they are, so that any string round-trips
+void AppendUtf8(std::vector<BYTE>& data, const WCHAR* psz, size_t cch);
+bool DecodeUtf8(const BYTE* pData, size_t cb, std::wstring& s);
+
+// Reads the whole of a file, returning 0 or the system error code
+int ReadFileBytes(const WCHAR* pszPath, std::vector<BYTE>& data);
+
+// 64-bit FNV-1a, for recognising content that has been seen before; pass the previous result to continue a hash
+static const ULONGLONG HashBasis = 0xcbf29ce484222325ULL;
+ULONGLONG HashBytes(const void* pData, size_t cb, ULONGLONG hash = HashBasis);
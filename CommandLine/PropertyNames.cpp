@@ -0,0 +1,212 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "PropertyNames.h"
+#include "ValueText.h"
+#include <errno.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <propsys.h>
+#endif
+
+static const char SnapshotHeader[] = "# FileMeta property names\n";
+
+// Created before main, so that threads never race to construct it
+static CPropertyNameCache s_cache;
+
+CPropertyNameCache& CPropertyNameCache::Instance()
+{
+	return s_cache;
+}
+
+CPropertyNameCache::CPropertyNameCache()
+{
+}
+
+bool CPropertyNameCache::KeyLess::operator()(REFPROPERTYKEY key1, REFPROPERTYKEY key2) const
+{
+	int cmp = memcmp(&key1.fmtid, &key2.fmtid, sizeof(FMTID));
+	return cmp < 0 || (cmp == 0 && key1.pid < key2.pid);
+}
+
+void CPropertyNameCache::Add(REFPROPERTYKEY key, const WCHAR* pszName, size_t cchName)
+{
+	CAutoLock lock(_lock);
+	_names[key].assign(pszName, cchName);
+}
+
+bool CPropertyNameCache::GetName(REFPROPERTYKEY key, const WCHAR** ppszName)
+{
+	{
+		CAutoLock lock(_lock);
+		auto pos = _names.find(key);
+		if (pos != _names.end())
+		{
+			// Entries are never removed, and map nodes do not move, so the string outlives the lock
+			*ppszName = pos->second.c_str();
+			return !pos->second.empty();
+		}
+	}
+
+	// Looked up outside the lock; if two threads ask at once, both get the same answer
+	std::wstring name;
+#ifdef _WIN32
+	PWSTR pszName = NULL;
+	if (SUCCEEDED(PSGetNameFromPropertyKey(key, &pszName)))
+	{
+		name = pszName;
+		CoTaskMemFree(pszName);
+	}
+#endif
+
+	CAutoLock lock(_lock);
+	auto pos = _names.insert(std::make_pair(key, name)).first;
+	*ppszName = pos->second.c_str();
+	return !pos->second.empty();
+}
+
+int CPropertyNameCache::LoadSnapshot(const WCHAR* pszPath)
+{
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(pszPath, data);
+	if (err != 0)
+		return err;
+
+	std::wstring text;
+	if (data.size() < sizeof(SnapshotHeader) - 1 || memcmp(&data[0], SnapshotHeader, sizeof(SnapshotHeader) - 1) != 0 ||
+		!DecodeUtf8(&data[0], data.size(), text))
+		return ERROR_FILE_CORRUPT;
+
+	// Check every line before adding any of them
+	std::vector<std::pair<PROPERTYKEY, std::wstring> > entries;
+	CValueArena arena;
+	size_t start = 0;
+	while (start < text.size())
+	{
+		size_t end = text.find(L'\n', start);
+		if (end == std::wstring::npos)
+			end = text.size();
+		std::wstring line(text, start, end - start);
+		start = end + 1;
+
+		if (!line.empty() && line[line.size() - 1] == L'\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == L'#')
+			continue;
+
+		// {FMTID} PROPID name
+		size_t space1 = line.find(L' ');
+		size_t space2 = space1 == std::wstring::npos ? space1 : line.find(L' ', space1 + 1);
+		if (space2 == std::wstring::npos || space2 + 1 == line.size())
+			return ERROR_FILE_CORRUPT;
+
+		line[space1] = line[space2] = L'\0';
+		PROPVARIANT fmtid, pid;
+		arena.Reset();
+		if (!ParseValueText(line.c_str(), VT_CLSID, arena, &fmtid) ||
+			!ParseValueText(line.c_str() + space1 + 1, VT_UI4, arena, &pid))
+			return ERROR_FILE_CORRUPT;
+
+		PROPERTYKEY key;
+		key.fmtid = *fmtid.puuid;
+		key.pid = pid.ulVal;
+		entries.push_back(std::make_pair(key, line.substr(space2 + 1)));
+	}
+
+	for (size_t i = 0; i < entries.size(); i++)
+		Add(entries[i].first, entries[i].second.c_str(), entries[i].second.size());
+	return 0;
+}
+
+HRESULT CPropertyNameCache::LoadSchema()
+{
+#ifdef _WIN32
+	IPropertyDescriptionList* pList = NULL;
+	HRESULT hr = PSEnumeratePropertyDescriptions(PDEF_ALL, IID_PPV_ARGS(&pList));
+	if (FAILED(hr))
+		return hr;
+
+	UINT cDescs = 0;
+	hr = pList->GetCount(&cDescs);
+	for (UINT i = 0; SUCCEEDED(hr) && i < cDescs; i++)
+	{
+		IPropertyDescription* pDesc = NULL;
+		hr = pList->GetAt(i, IID_PPV_ARGS(&pDesc));
+		if (SUCCEEDED(hr))
+		{
+			PROPERTYKEY key;
+			PWSTR pszName = NULL;
+
+			// Some properties have no canonical name, which is not a failure
+			if (SUCCEEDED(pDesc->GetPropertyKey(&key)) && SUCCEEDED(pDesc->GetCanonicalName(&pszName)))
+			{
+				Add(key, pszName, wcslen(pszName));
+				CoTaskMemFree(pszName);
+			}
+			pDesc->Release();
+		}
+	}
+
+	pList->Release();
+	return hr;
+#else
+	return E_NOTIMPL;
+#endif
+}
+
+int CPropertyNameCache::SaveSnapshot(const WCHAR* pszPath)
+{
+	std::vector<BYTE> data(SnapshotHeader, SnapshotHeader + sizeof(SnapshotHeader) - 1);
+	{
+		CAutoLock lock(_lock);
+		for (auto pos = _names.begin(); pos != _names.end(); ++pos)
+		{
+			if (pos->second.empty())
+				continue;
+
+			WCHAR wszKey[64];
+			const WCHAR* pszText;
+			PROPVARIANT propvar;
+			PropVariantInit(&propvar);
+			propvar.vt = VT_CLSID;
+			propvar.puuid = const_cast<FMTID*>(&pos->first.fmtid);
+			FormatValueText(propvar, wszKey, sizeof(wszKey) / sizeof(WCHAR), &pszText);
+			AppendUtf8(data, pszText, wcslen(pszText));
+			data.push_back(' ');
+
+			propvar.vt = VT_UI4;
+			propvar.ulVal = pos->first.pid;
+			FormatValueText(propvar, wszKey, sizeof(wszKey) / sizeof(WCHAR), &pszText);
+			AppendUtf8(data, pszText, wcslen(pszText));
+			data.push_back(' ');
+
+			AppendUtf8(data, pos->second.c_str(), pos->second.size());
+			data.push_back('\n');
+		}
+	}
+
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	int err = _wfopen_s(&pfile, pszPath, L"wb");
+	if (err != 0)
+		return err;
+#else
+	pfile = fopen(NarrowPath(pszPath).c_str(), "wb");
+	if (!pfile)
+		return errno;
+	int err = 0;
+#endif
+
+	if (fwrite(&data[0], 1, data.size(), pfile) != data.size())
+		err = errno;
+	if (fclose(pfile) != 0 && err == 0)
+		err = errno;
+	if (err != 0)
+	{
+#ifdef _WIN32
+		_wremove(pszPath);
+#else
+		remove(NarrowPath(pszPath).c_str());
+#endif
+	}
+	return err;
+}
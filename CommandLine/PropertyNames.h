@@ -0,0 +1,53 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Canonical names of properties, which export writes alongside each value for documentation.
+// Asking the property system costs a search of the schema and an allocation every time, while a bulk
+// export asks about the same few keys over and over, so names are kept for the life of the process.
+// They can also be saved to and loaded from a snapshot of the schema, so that names can be written
+// where the property system is not available.
+//
+// A snapshot is UTF-8 text with one property on each line: the FMTID in braces, a space, the PROPID
+// in decimal, a space, and the canonical name. Blank lines and lines that begin with '#' are ignored.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include <map>
+
+class CPropertyNameCache
+{
+public:
+	// The cache shared by the whole process
+	static CPropertyNameCache& Instance();
+
+	CPropertyNameCache();
+
+	// Finds the canonical name of a property, asking the property system only the first time for each key.
+	// The name lasts as long as the cache. Returns false if the property has no name.
+	bool GetName(REFPROPERTYKEY key, const WCHAR** ppszName);
+
+	// Adds the names in a snapshot file. Returns 0, or the system error code,
+	// which is ERROR_FILE_CORRUPT if the file is not a snapshot.
+	int LoadSnapshot(const WCHAR* pszPath);
+
+	// Adds the name of every property in the schema; only the property system can do this,
+	// so elsewhere it returns E_NOTIMPL
+	HRESULT LoadSchema();
+
+	// Writes every name that is known to a snapshot file. Returns 0, or the system error code.
+	int SaveSnapshot(const WCHAR* pszPath);
+
+private:
+	CPropertyNameCache(const CPropertyNameCache&);
+	CPropertyNameCache& operator=(const CPropertyNameCache&);
+
+	struct KeyLess
+	{
+		bool operator()(REFPROPERTYKEY key1, REFPROPERTYKEY key2) const;
+	};
+
+	void Add(REFPROPERTYKEY key, const WCHAR* pszName, size_t cchName);
+
+	std::map<PROPERTYKEY, std::wstring, KeyLess>	_names;		// empty for keys known to have no name
+	CLock											_lock;
+};
@@ -0,0 +1,1139 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "PropertySetStream.h"
+#include <wctype.h>
+
+// Values from [MS-OLEPS] that describe the stream header
+static const WORD	ByteOrderMark		= 0xFFFE;
+static const DWORD	Win32SystemId		= 0x00020006;	// OS kind Win32, version 6.0
+static const size_t	StreamHeaderSize	= 28;
+static const size_t	SectionEntrySize	= 20;			// FMTID and offset
+
+#pragma region Property set values
+
+CPropertySet::CPropertySet() : _codePage(CP_WINUNICODE)
+{
+	memset(&_fmtid, 0, sizeof(_fmtid));
+}
+
+CPropertySet::CPropertySet(REFFMTID fmtid) : _fmtid(fmtid), _codePage(CP_WINUNICODE)
+{
+}
+
+CPropertySet::CPropertySet(const CPropertySet& other) : _codePage(CP_WINUNICODE)
+{
+	*this = other;
+}
+
+CPropertySet& CPropertySet::operator=(const CPropertySet& other)
+{
+	if (this != &other)
+	{
+		Clear();
+		_fmtid = other._fmtid;
+		_codePage = other._codePage;
+		_dictionary = other._dictionary;
+
+		_props.reserve(other._props.size());
+		for (size_t i = 0; i < other._props.size(); i++)
+		{
+			Entry entry;
+			entry.pid = other._props[i].pid;
+			if (SUCCEEDED(PropVariantCopy(&entry.var, &other._props[i].var)))
+				_props.push_back(entry);
+		}
+	}
+	return *this;
+}
+
+CPropertySet::~CPropertySet()
+{
+	Clear();
+}
+
+void CPropertySet::Clear()
+{
+	for (size_t i = 0; i < _props.size(); i++)
+		PropVariantClear(&_props[i].var);
+	_props.clear();
+	_dictionary.clear();
+}
+
+int CPropertySet::Find(PROPID pid) const
+{
+	for (size_t i = 0; i < _props.size(); i++)
+	{
+		if (_props[i].pid == pid)
+			return (int)i;
+	}
+	return -1;
+}
+
+HRESULT CPropertySet::GetValue(PROPID pid, PROPVARIANT* ppropvar) const
+{
+	PropVariantInit(ppropvar);
+	int i = Find(pid);
+	return i < 0 ? S_OK : PropVariantCopy(ppropvar, &_props[i].var);
+}
+
+HRESULT CPropertySet::SetValue(PROPID pid, REFPROPVARIANT propvar)
+{
+	// The dictionary and code page are not ordinary properties
+	if (pid == PID_DictionaryId || pid == PID_CodePageId)
+		return STG_E_INVALIDPARAMETER;
+
+	int i = Find(pid);
+	if (propvar.vt == VT_EMPTY)
+	{
+		if (i >= 0)
+		{
+			PropVariantClear(&_props[i].var);
+			_props.erase(_props.begin() + i);
+		}
+		return S_OK;
+	}
+
+	PROPVARIANT copy;
+	HRESULT hr = PropVariantCopy(&copy, &propvar);
+	if (SUCCEEDED(hr))
+		AttachValue(pid, copy);
+	return hr;
+}
+
+void CPropertySet::AttachValue(PROPID pid, PROPVARIANT& propvar)
+{
+	int i = Find(pid);
+	if (i >= 0)
+	{
+		PropVariantClear(&_props[i].var);
+		_props[i].var = propvar;
+	}
+	else
+	{
+		Entry entry;
+		entry.pid = pid;
+		entry.var = propvar;
+		_props.push_back(entry);
+	}
+	PropVariantInit(&propvar);
+}
+
+static bool StringEquals(VARTYPE vt, const void* pValue1, const void* pValue2)
+{
+	if (pValue1 == NULL || pValue2 == NULL)
+		return pValue1 == pValue2;
+
+	switch (vt)
+	{
+	case VT_LPSTR:
+		return strcmp((LPCSTR)pValue1, (LPCSTR)pValue2) == 0;
+#ifdef _WIN32
+	case VT_BSTR:
+		// A BSTR can hold nulls, so its length is part of it
+		return SysStringByteLen((BSTR)pValue1) == SysStringByteLen((BSTR)pValue2) &&
+			memcmp(pValue1, pValue2, SysStringByteLen((BSTR)pValue1)) == 0;
+#endif
+	default:
+		return wcscmp((LPCWSTR)pValue1, (LPCWSTR)pValue2) == 0;
+	}
+}
+
+// Defined below, where values are read
+static size_t MemorySize(VARTYPE vt);
+
+bool PropVariantEquals(REFPROPVARIANT propvar1, REFPROPVARIANT propvar2)
+{
+	if (propvar1.vt != propvar2.vt)
+		return false;
+
+	VARTYPE vtElem = propvar1.vt & ~VT_VECTOR;
+	switch (propvar1.vt)
+	{
+	case VT_EMPTY:
+	case VT_NULL:
+		return true;
+
+	case VT_LPSTR:
+	case VT_LPWSTR:
+	case VT_BSTR:
+		return StringEquals(vtElem, propvar1.pwszVal, propvar2.pwszVal);
+
+	case VT_CLSID:
+		if (propvar1.puuid == NULL || propvar2.puuid == NULL)
+			return propvar1.puuid == propvar2.puuid;
+		return *propvar1.puuid == *propvar2.puuid;
+
+	case VT_BLOB:
+		return propvar1.blob.cbSize == propvar2.blob.cbSize &&
+			(propvar1.blob.cbSize == 0 || memcmp(propvar1.blob.pBlobData, propvar2.blob.pBlobData, propvar1.blob.cbSize) == 0);
+
+	case VT_VECTOR | VT_LPSTR:
+	case VT_VECTOR | VT_LPWSTR:
+	case VT_VECTOR | VT_BSTR:
+		if (propvar1.calpwstr.cElems != propvar2.calpwstr.cElems)
+			return false;
+		for (ULONG i = 0; i < propvar1.calpwstr.cElems; i++)
+		{
+			if (!StringEquals(vtElem, propvar1.calpwstr.pElems[i], propvar2.calpwstr.pElems[i]))
+				return false;
+		}
+		return true;
+
+	case VT_VECTOR | VT_VARIANT:
+		if (propvar1.capropvar.cElems != propvar2.capropvar.cElems)
+			return false;
+		for (ULONG i = 0; i < propvar1.capropvar.cElems; i++)
+		{
+			if (!PropVariantEquals(propvar1.capropvar.pElems[i], propvar2.capropvar.pElems[i]))
+				return false;
+		}
+		return true;
+
+	default:
+		{
+			// Everything else is of fixed size, held in the value itself or in an array of elements
+			size_t cb = MemorySize(vtElem);
+			if (cb == 0 || vtElem == VT_BLOB)
+				return false;
+			if (!(propvar1.vt & VT_VECTOR))
+				return memcmp(&propvar1.cVal, &propvar2.cVal, cb) == 0;
+
+			return propvar1.cac.cElems == propvar2.cac.cElems &&
+				(propvar1.cac.cElems == 0 || memcmp(propvar1.cac.pElems, propvar2.cac.pElems, cb * propvar1.cac.cElems) == 0);
+		}
+	}
+}
+
+#pragma endregion
+
+#pragma region String helpers
+
+// LPSTR values are held in memory in the ANSI code page (Windows) or the current locale (elsewhere)
+static LPSTR NarrowString(const std::wstring& s)
+{
+#ifdef _WIN32
+	int cb = WideCharToMultiByte(CP_ACP, 0, s.c_str(), (int)s.size() + 1, NULL, 0, NULL, NULL);
+	LPSTR psz = (LPSTR)CoTaskMemAlloc(cb > 0 ? cb : 1);
+	if (psz)
+	{
+		if (cb > 0)
+			WideCharToMultiByte(CP_ACP, 0, s.c_str(), (int)s.size() + 1, psz, cb, NULL, NULL);
+		else
+			*psz = '\0';
+	}
+#else
+	size_t cb = wcstombs(NULL, s.c_str(), 0);
+	if (cb == (size_t)-1)
+		cb = 0;
+	LPSTR psz = (LPSTR)CoTaskMemAlloc(cb + 1);
+	if (psz)
+	{
+		if (cb > 0)
+			wcstombs(psz, s.c_str(), cb + 1);
+		psz[cb] = '\0';
+	}
+#endif
+	return psz;
+}
+
+static void WidenString(const CHAR* psz, size_t cb, UINT codePage, std::wstring& s)
+{
+	s.clear();
+#ifdef _WIN32
+	int cch = MultiByteToWideChar(codePage, 0, psz, (int)cb, NULL, 0);
+	if (cch > 0)
+	{
+		s.resize(cch);
+		MultiByteToWideChar(codePage, 0, psz, (int)cb, &s[0], cch);
+	}
+#else
+	// Without code page tables, single byte text is taken as Latin-1
+	(void)codePage;
+	for (size_t i = 0; i < cb; i++)
+		s.push_back((WCHAR)(UCHAR)psz[i]);
+#endif
+}
+
+static void TrimAtNull(std::wstring& s)
+{
+	size_t n = s.find(L'\0');
+	if (n != std::wstring::npos)
+		s.resize(n);
+}
+
+static int CompareNoCase(const WCHAR* a, const WCHAR* b)
+{
+	for (; *a && towlower(*a) == towlower(*b); a++, b++)
+		;
+	return (int)towlower(*a) - (int)towlower(*b);
+}
+
+#pragma endregion
+
+#pragma region Reading
+
+// Bounds-checked little-endian reads over one section or the whole stream
+class CStreamReader
+{
+public:
+	CStreamReader(const BYTE* pData, size_t cbData) : _pData(pData), _cbData(cbData), _pos(0) {}
+
+	size_t Position() const { return _pos; }
+	size_t Remaining() const { return _cbData - _pos; }
+
+	bool Seek(size_t pos)
+	{
+		if (pos > _cbData)
+			return false;
+		_pos = pos;
+		return true;
+	}
+
+	// Values are padded to a multiple of 4 bytes from the start of their section
+	void Align()
+	{
+		size_t pos = (_pos + 3) & ~(size_t)3;
+		_pos = pos < _cbData ? pos : _cbData;
+	}
+
+	bool ReadBytes(const BYTE*& p, size_t cb)
+	{
+		if (cb > Remaining())
+			return false;
+		p = _pData + _pos;
+		_pos += cb;
+		return true;
+	}
+
+	bool ReadUInt8(BYTE& b)
+	{
+		const BYTE* p;
+		if (!ReadBytes(p, 1))
+			return false;
+		b = p[0];
+		return true;
+	}
+
+	bool ReadUInt16(WORD& w)
+	{
+		const BYTE* p;
+		if (!ReadBytes(p, 2))
+			return false;
+		w = (WORD)(p[0] | (p[1] << 8));
+		return true;
+	}
+
+	bool ReadUInt32(DWORD& dw)
+	{
+		const BYTE* p;
+		if (!ReadBytes(p, 4))
+			return false;
+		dw = (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+		return true;
+	}
+
+	bool ReadUInt64(ULONGLONG& ull)
+	{
+		DWORD lo, hi;
+		if (!ReadUInt32(lo) || !ReadUInt32(hi))
+			return false;
+		ull = ((ULONGLONG)hi << 32) | lo;
+		return true;
+	}
+
+	bool ReadGuid(GUID& guid)
+	{
+		const BYTE* p;
+		if (!ReadUInt32(guid.Data1) || !ReadUInt16(guid.Data2) || !ReadUInt16(guid.Data3) || !ReadBytes(p, 8))
+			return false;
+		memcpy(guid.Data4, p, 8);
+		return true;
+	}
+
+private:
+	const BYTE*	_pData;
+	size_t		_cbData;
+	size_t		_pos;
+};
+
+// Size of a vector element of a fixed size type, or 0 if the type is not fixed size
+static size_t FixedSize(VARTYPE vt)
+{
+	switch (vt)
+	{
+	case VT_I1: case VT_UI1:
+		return 1;
+	case VT_I2: case VT_UI2: case VT_BOOL:
+		return 2;
+	case VT_I4: case VT_UI4: case VT_INT: case VT_UINT: case VT_ERROR: case VT_R4:
+		return 4;
+	case VT_I8: case VT_UI8: case VT_CY: case VT_R8: case VT_DATE: case VT_FILETIME:
+		return 8;
+	case VT_CLSID:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+// Size of the PROPVARIANT array element used to hold a fixed size type in memory
+static size_t MemorySize(VARTYPE vt)
+{
+	switch (vt)
+	{
+	case VT_I4: case VT_UI4: return sizeof(LONG);
+	case VT_INT: case VT_UINT: return sizeof(INT);
+	case VT_ERROR: return sizeof(SCODE);
+	case VT_R4: return sizeof(FLOAT);
+	case VT_I8: case VT_UI8: return sizeof(LARGE_INTEGER);
+	case VT_CY: return sizeof(CY);
+	case VT_R8: return sizeof(DOUBLE);
+	case VT_DATE: return sizeof(DATE);
+	case VT_FILETIME: return sizeof(FILETIME);
+	case VT_CLSID: return sizeof(CLSID);
+	default: return FixedSize(vt);
+	}
+}
+
+static bool ReadFixed(CStreamReader& r, VARTYPE vt, void* p)
+{
+	switch (FixedSize(vt))
+	{
+	case 1:
+		return r.ReadUInt8(*(BYTE*)p);
+	case 2:
+		return r.ReadUInt16(*(WORD*)p);
+	case 4:
+		{
+			DWORD dw;
+			if (!r.ReadUInt32(dw))
+				return false;
+			memcpy(p, &dw, 4);
+			return true;
+		}
+	case 8:
+		if (vt == VT_FILETIME)
+			return r.ReadUInt32(((FILETIME*)p)->dwLowDateTime) && r.ReadUInt32(((FILETIME*)p)->dwHighDateTime);
+		else
+		{
+			ULONGLONG ull;
+			if (!r.ReadUInt64(ull))
+				return false;
+			memcpy(p, &ull, 8);
+			return true;
+		}
+	case 16:
+		return r.ReadGuid(*(GUID*)p);
+	default:
+		return false;
+	}
+}
+
+// Reads a CodePageString (VT_LPSTR, VT_BSTR) or UnicodeString (VT_LPWSTR), including its padding
+static HRESULT ReadString(CStreamReader& r, VARTYPE vt, UINT codePage, void* pSlot)
+{
+	DWORD cSize;
+	const BYTE* p;
+	std::wstring s;
+
+	if (!r.ReadUInt32(cSize))
+		return STG_E_DOCFILECORRUPT;
+
+	if (vt == VT_LPWSTR || codePage == CP_WINUNICODE)
+	{
+		// Unicode strings are counted in characters, code page strings in bytes
+		size_t cch = (vt == VT_LPWSTR) ? cSize : cSize / sizeof(WORD);
+		if (cch > r.Remaining() / 2 || !r.ReadBytes(p, cch * 2))
+			return STG_E_DOCFILECORRUPT;
+		DecodeUtf16(p, cch, s);
+		TrimAtNull(s);
+
+		if (vt == VT_LPSTR)
+		{
+			*(LPSTR*)pSlot = NarrowString(s);
+			r.Align();
+			return *(LPSTR*)pSlot ? S_OK : E_OUTOFMEMORY;
+		}
+	}
+	else
+	{
+		if (!r.ReadBytes(p, cSize))
+			return STG_E_DOCFILECORRUPT;
+		size_t cb = strnlen((const CHAR*)p, cSize);
+
+		if (vt == VT_LPSTR)
+		{
+			LPSTR psz = (LPSTR)CoTaskMemAlloc(cb + 1);
+			if (!psz)
+				return E_OUTOFMEMORY;
+			memcpy(psz, p, cb);
+			psz[cb] = '\0';
+			*(LPSTR*)pSlot = psz;
+			r.Align();
+			return S_OK;
+		}
+		WidenString((const CHAR*)p, cb, codePage, s);
+	}
+
+	r.Align();
+	*(LPWSTR*)pSlot = (vt == VT_BSTR) ? AllocBstr(s) : AllocString(s);
+	return *(LPWSTR*)pSlot ? S_OK : E_OUTOFMEMORY;
+}
+
+static HRESULT ReadTypedValue(CStreamReader& r, UINT codePage, PROPVARIANT* ppropvar, bool bInVector);
+
+static HRESULT ReadVector(CStreamReader& r, VARTYPE vt, UINT codePage, PROPVARIANT* ppropvar)
+{
+	VARTYPE vtElem = vt & VT_TYPEMASK;
+	DWORD cElems;
+	if (!r.ReadUInt32(cElems))
+		return STG_E_DOCFILECORRUPT;
+
+	// Every element occupies at least one byte in the stream, which bounds the allocation
+	if (cElems > r.Remaining())
+		return STG_E_DOCFILECORRUPT;
+
+	HRESULT hr = S_OK;
+	size_t cbElem = MemorySize(vtElem);
+
+	if (vtElem == VT_LPSTR || vtElem == VT_LPWSTR || vtElem == VT_BSTR)
+		cbElem = sizeof(void*);
+	else if (vtElem == VT_VARIANT)
+		cbElem = sizeof(PROPVARIANT);
+	else if (cbElem == 0)
+		return STG_E_UNIMPLEMENTEDFUNCTION;
+
+	BYTE* pElems = (BYTE*)CoTaskMemAlloc(cElems > 0 ? cElems * cbElem : 1);
+	if (!pElems)
+		return E_OUTOFMEMORY;
+	memset(pElems, 0, cElems * cbElem);
+
+	// Set up the vector first, so that clearing it releases whatever has been read
+	ppropvar->vt = vt;
+	ppropvar->cac.cElems = cElems;
+	ppropvar->cac.pElems = (CHAR*)pElems;
+
+	for (DWORD i = 0; i < cElems && SUCCEEDED(hr); i++)
+	{
+		void* pSlot = pElems + i * cbElem;
+
+		if (vtElem == VT_LPSTR || vtElem == VT_LPWSTR || vtElem == VT_BSTR)
+			hr = ReadString(r, vtElem, codePage, pSlot);
+		else if (vtElem == VT_VARIANT)
+			hr = ReadTypedValue(r, codePage, (PROPVARIANT*)pSlot, true);
+		else if (!ReadFixed(r, vtElem, pSlot))
+			hr = STG_E_DOCFILECORRUPT;
+	}
+
+	if (FAILED(hr))
+	{
+		// Elements that were never reached are zeroed, which is safe to clear
+		PropVariantClear(ppropvar);
+		return hr;
+	}
+
+	r.Align();
+	return S_OK;
+}
+
+static HRESULT ReadTypedValue(CStreamReader& r, UINT codePage, PROPVARIANT* ppropvar, bool bInVector)
+{
+	WORD vt, padding;
+	PropVariantInit(ppropvar);
+
+	if (!r.ReadUInt16(vt) || !r.ReadUInt16(padding))
+		return STG_E_DOCFILECORRUPT;
+
+	// Arrays and by-reference values never appear in property sets
+	if ((vt & ~(VT_VECTOR | VT_TYPEMASK)) != 0)
+		return STG_E_UNIMPLEMENTEDFUNCTION;
+
+	if (vt & VT_VECTOR)
+	{
+		// A variant inside a vector cannot itself be a vector of variants
+		if (bInVector && vt == (VT_VECTOR | VT_VARIANT))
+			return STG_E_DOCFILECORRUPT;
+		return ReadVector(r, vt, codePage, ppropvar);
+	}
+
+	HRESULT hr = S_OK;
+	switch (vt)
+	{
+	case VT_EMPTY:
+	case VT_NULL:
+		break;
+
+	case VT_LPSTR:
+	case VT_LPWSTR:
+	case VT_BSTR:
+		hr = ReadString(r, vt, codePage, &ppropvar->pwszVal);
+		break;
+
+	case VT_BLOB:
+		{
+			const BYTE* p;
+			DWORD cb;
+			if (!r.ReadUInt32(cb) || !r.ReadBytes(p, cb))
+				return STG_E_DOCFILECORRUPT;
+			ppropvar->blob.pBlobData = (BYTE*)CoTaskMemAlloc(cb > 0 ? cb : 1);
+			if (!ppropvar->blob.pBlobData)
+				return E_OUTOFMEMORY;
+			memcpy(ppropvar->blob.pBlobData, p, cb);
+			ppropvar->blob.cbSize = cb;
+			r.Align();
+		}
+		break;
+
+	case VT_CLSID:
+		ppropvar->puuid = (CLSID*)CoTaskMemAlloc(sizeof(CLSID));
+		if (!ppropvar->puuid)
+			return E_OUTOFMEMORY;
+		if (!r.ReadGuid(*ppropvar->puuid))
+		{
+			CoTaskMemFree(ppropvar->puuid);
+			ppropvar->puuid = NULL;
+			return STG_E_DOCFILECORRUPT;
+		}
+		break;
+
+	default:
+		if (FixedSize(vt) == 0)
+			return STG_E_UNIMPLEMENTEDFUNCTION;
+		if (!ReadFixed(r, vt, &ppropvar->cVal))
+			return STG_E_DOCFILECORRUPT;
+		r.Align();
+		break;
+	}
+
+	if (SUCCEEDED(hr))
+		ppropvar->vt = vt;
+	return hr;
+}
+
+static HRESULT ReadDictionary(CStreamReader& r, UINT codePage, std::map<PROPID, std::wstring>& dictionary)
+{
+	DWORD cEntries;
+	if (!r.ReadUInt32(cEntries) || cEntries > r.Remaining() / 8)
+		return STG_E_DOCFILECORRUPT;
+
+	for (DWORD i = 0; i < cEntries; i++)
+	{
+		DWORD pid, cch;
+		const BYTE* p;
+		std::wstring name;
+
+		if (!r.ReadUInt32(pid) || !r.ReadUInt32(cch))
+			return STG_E_DOCFILECORRUPT;
+
+		if (codePage == CP_WINUNICODE)
+		{
+			if (cch > r.Remaining() / 2 || !r.ReadBytes(p, cch * 2))
+				return STG_E_DOCFILECORRUPT;
+			DecodeUtf16(p, cch, name);
+			r.Align();
+		}
+		else
+		{
+			if (!r.ReadBytes(p, cch))
+				return STG_E_DOCFILECORRUPT;
+			WidenString((const CHAR*)p, cch, codePage, name);
+		}
+
+		TrimAtNull(name);
+		dictionary[pid] = name;
+	}
+
+	return S_OK;
+}
+
+static HRESULT ReadSection(const BYTE* pData, size_t cbData, CPropertySet& set)
+{
+	CStreamReader r(pData, cbData);
+	DWORD cbSection, cProps;
+
+	if (!r.ReadUInt32(cbSection) || !r.ReadUInt32(cProps) || cbSection < 8 || cbSection > cbData || cProps > (cbSection - 8) / 8)
+		return STG_E_DOCFILECORRUPT;
+
+	// Values must lie within the section
+	CStreamReader section(pData, cbSection);
+	section.Seek(8);
+
+	std::vector<DWORD> pids(cProps), offsets(cProps);
+	int iDictionary = -1;
+
+	for (DWORD i = 0; i < cProps; i++)
+	{
+		if (!section.ReadUInt32(pids[i]) || !section.ReadUInt32(offsets[i]) || offsets[i] >= cbSection)
+			return STG_E_DOCFILECORRUPT;
+
+		// The code page governs how strings are read, so it must be found first
+		if (pids[i] == PID_CodePageId)
+		{
+			CStreamReader value(pData, cbSection);
+			WORD vt, padding, codePage;
+			if (!value.Seek(offsets[i]) || !value.ReadUInt16(vt) || !value.ReadUInt16(padding) || !value.ReadUInt16(codePage))
+				return STG_E_DOCFILECORRUPT;
+			set.SetCodePage(codePage);
+		}
+		else if (pids[i] == PID_DictionaryId)
+			iDictionary = (int)i;
+	}
+
+	HRESULT hr = S_OK;
+
+	if (iDictionary >= 0)
+	{
+		section.Seek(offsets[iDictionary]);
+		hr = ReadDictionary(section, set.GetCodePage(), set.Dictionary());
+	}
+
+	for (DWORD i = 0; i < cProps && SUCCEEDED(hr); i++)
+	{
+		if (pids[i] == PID_DictionaryId || pids[i] == PID_CodePageId)
+			continue;
+
+		PROPVARIANT propvar;
+		section.Seek(offsets[i]);
+		hr = ReadTypedValue(section, set.GetCodePage(), &propvar, false);
+		if (SUCCEEDED(hr))
+			set.AttachValue(pids[i], propvar);
+	}
+
+	return hr;
+}
+
+HRESULT ReadPropertySetStream(const BYTE* pData, size_t cbData, std::vector<CPropertySet>& sets)
+{
+	CStreamReader r(pData, cbData);
+	WORD byteOrder, version;
+	DWORD systemId, cSets;
+	CLSID clsid;
+
+	sets.clear();
+
+	if (!r.ReadUInt16(byteOrder) || !r.ReadUInt16(version) || !r.ReadUInt32(systemId) ||
+		!r.ReadGuid(clsid) || !r.ReadUInt32(cSets))
+		return STG_E_INVALIDHEADER;
+
+	if (byteOrder != ByteOrderMark || version > 1 || cSets == 0 || cSets > r.Remaining() / SectionEntrySize)
+		return STG_E_INVALIDHEADER;
+
+	HRESULT hr = S_OK;
+	for (DWORD i = 0; i < cSets && SUCCEEDED(hr); i++)
+	{
+		FMTID fmtid;
+		DWORD offset;
+
+		r.Seek(StreamHeaderSize + i * SectionEntrySize);
+		if (!r.ReadGuid(fmtid) || !r.ReadUInt32(offset) || offset >= cbData)
+			hr = STG_E_INVALIDHEADER;
+		else
+		{
+			sets.push_back(CPropertySet(fmtid));
+			hr = ReadSection(pData + offset, cbData - offset, sets.back());
+		}
+	}
+
+	if (FAILED(hr))
+		sets.clear();
+	return hr;
+}
+
+#pragma endregion
+
+#pragma region Writing
+
+static void PutUInt16(std::vector<BYTE>& data, WORD w)
+{
+	data.push_back((BYTE)(w & 0xFF));
+	data.push_back((BYTE)(w >> 8));
+}
+
+static void PutUInt32(std::vector<BYTE>& data, DWORD dw)
+{
+	data.push_back((BYTE)(dw & 0xFF));
+	data.push_back((BYTE)((dw >> 8) & 0xFF));
+	data.push_back((BYTE)((dw >> 16) & 0xFF));
+	data.push_back((BYTE)(dw >> 24));
+}
+
+static void PatchUInt32(std::vector<BYTE>& data, size_t pos, DWORD dw)
+{
+	data[pos] = (BYTE)(dw & 0xFF);
+	data[pos + 1] = (BYTE)((dw >> 8) & 0xFF);
+	data[pos + 2] = (BYTE)((dw >> 16) & 0xFF);
+	data[pos + 3] = (BYTE)(dw >> 24);
+}
+
+static void PutGuid(std::vector<BYTE>& data, REFGUID guid)
+{
+	PutUInt32(data, guid.Data1);
+	PutUInt16(data, guid.Data2);
+	PutUInt16(data, guid.Data3);
+	data.insert(data.end(), guid.Data4, guid.Data4 + 8);
+}
+
+// Sections start on a 4 byte boundary, so padding to one in the stream also pads within the section
+static void PutPadding(std::vector<BYTE>& data)
+{
+	while (data.size() % 4 != 0)
+		data.push_back(0);
+}
+
+static void PutFixed(std::vector<BYTE>& data, VARTYPE vt, const void* p)
+{
+	switch (FixedSize(vt))
+	{
+	case 1:
+		data.push_back(*(const BYTE*)p);
+		break;
+	case 2:
+		PutUInt16(data, *(const WORD*)p);
+		break;
+	case 4:
+		{
+			DWORD dw;
+			memcpy(&dw, p, 4);
+			PutUInt32(data, dw);
+		}
+		break;
+	case 8:
+		if (vt == VT_FILETIME)
+		{
+			PutUInt32(data, ((const FILETIME*)p)->dwLowDateTime);
+			PutUInt32(data, ((const FILETIME*)p)->dwHighDateTime);
+		}
+		else
+		{
+			ULONGLONG ull;
+			memcpy(&ull, p, 8);
+			PutUInt32(data, (DWORD)(ull & 0xFFFFFFFF));
+			PutUInt32(data, (DWORD)(ull >> 32));
+		}
+		break;
+	case 16:
+		PutGuid(data, *(const GUID*)p);
+		break;
+	}
+}
+
+static void PutString(std::vector<BYTE>& data, VARTYPE vt, UINT codePage, const void* pValue)
+{
+	std::wstring s;
+
+	if (vt == VT_LPSTR)
+	{
+		LPCSTR psz = *(const LPSTR*)pValue;
+		if (!psz)
+			psz = "";
+		if (codePage != CP_WINUNICODE)
+		{
+			// Code page strings are stored as they are held, counted in bytes including the terminator
+			DWORD cb = (DWORD)strlen(psz) + 1;
+			PutUInt32(data, cb);
+			data.insert(data.end(), (const BYTE*)psz, (const BYTE*)psz + cb);
+			PutPadding(data);
+			return;
+		}
+#ifdef _WIN32
+		WidenString(psz, strlen(psz), CP_ACP, s);
+#else
+		size_t cch = mbstowcs(NULL, psz, 0);
+		if (cch != (size_t)-1)
+		{
+			s.resize(cch);
+			mbstowcs(&s[0], psz, cch);
+		}
+#endif
+	}
+	else
+	{
+		LPCWSTR psz = *(const LPWSTR*)pValue;
+		s = psz ? psz : L"";
+	}
+
+	std::vector<BYTE> utf16;
+	AppendUtf16(utf16, s.c_str(), s.size() + 1);
+
+	if (vt == VT_LPWSTR)
+		PutUInt32(data, (DWORD)(utf16.size() / 2));
+	else
+		PutUInt32(data, (DWORD)utf16.size());
+	data.insert(data.end(), utf16.begin(), utf16.end());
+	PutPadding(data);
+}
+
+static bool IsVersion1Type(VARTYPE vt)
+{
+	VARTYPE vtElem = vt & VT_TYPEMASK;
+	return vtElem == VT_I1 || vtElem == VT_INT || vtElem == VT_UINT;
+}
+
+static HRESULT PutTypedValue(std::vector<BYTE>& data, UINT codePage, REFPROPVARIANT propvar, bool bInVector, bool& bVersion1)
+{
+	VARTYPE vtElem = propvar.vt & VT_TYPEMASK;
+
+	if (IsVersion1Type(propvar.vt))
+		bVersion1 = true;
+
+	PutUInt16(data, propvar.vt);
+	PutUInt16(data, 0);
+
+	if (propvar.vt & VT_VECTOR)
+	{
+		if ((propvar.vt & ~VT_VECTOR & ~VT_TYPEMASK) != 0 || (bInVector && vtElem == VT_VARIANT))
+			return STG_E_INVALIDPARAMETER;
+
+		ULONG cElems = propvar.cac.cElems;
+		const BYTE* pElems = (const BYTE*)propvar.cac.pElems;
+		PutUInt32(data, cElems);
+
+		HRESULT hr = S_OK;
+		for (ULONG i = 0; i < cElems && SUCCEEDED(hr); i++)
+		{
+			if (vtElem == VT_LPSTR || vtElem == VT_LPWSTR || vtElem == VT_BSTR)
+				PutString(data, vtElem, codePage, pElems + i * sizeof(void*));
+			else if (vtElem == VT_VARIANT)
+				hr = PutTypedValue(data, codePage, propvar.capropvar.pElems[i], true, bVersion1);
+			else if (MemorySize(vtElem) != 0)
+				PutFixed(data, vtElem, pElems + i * MemorySize(vtElem));
+			else
+				hr = STG_E_INVALIDPARAMETER;
+		}
+		PutPadding(data);
+		return hr;
+	}
+
+	switch (propvar.vt)
+	{
+	case VT_EMPTY:
+	case VT_NULL:
+		break;
+
+	case VT_LPSTR:
+	case VT_LPWSTR:
+	case VT_BSTR:
+		PutString(data, propvar.vt, codePage, &propvar.pwszVal);
+		break;
+
+	case VT_BLOB:
+		PutUInt32(data, propvar.blob.cbSize);
+		if (propvar.blob.cbSize > 0)
+			data.insert(data.end(), propvar.blob.pBlobData, propvar.blob.pBlobData + propvar.blob.cbSize);
+		PutPadding(data);
+		break;
+
+	case VT_CLSID:
+		if (!propvar.puuid)
+			return STG_E_INVALIDPARAMETER;
+		PutGuid(data, *propvar.puuid);
+		break;
+
+	default:
+		if (FixedSize(propvar.vt) == 0)
+			return STG_E_INVALIDPARAMETER;
+		PutFixed(data, propvar.vt, &propvar.cVal);
+		PutPadding(data);
+		break;
+	}
+
+	return S_OK;
+}
+
+static void PutDictionary(std::vector<BYTE>& data, UINT codePage, const std::map<PROPID, std::wstring>& dictionary)
+{
+	PutUInt32(data, (DWORD)dictionary.size());
+
+	for (std::map<PROPID, std::wstring>::const_iterator it = dictionary.begin(); it != dictionary.end(); ++it)
+	{
+		PutUInt32(data, it->first);
+		if (codePage == CP_WINUNICODE)
+		{
+			PutUInt32(data, (DWORD)it->second.size() + 1);
+			AppendUtf16(data, it->second.c_str(), it->second.size() + 1);
+			PutPadding(data);
+		}
+		else
+		{
+			// Names in other code pages are limited to what the C library can narrow
+			LPSTR psz = NarrowString(it->second);
+			DWORD cb = psz ? (DWORD)strlen(psz) + 1 : 1;
+			PutUInt32(data, cb);
+			if (psz)
+				data.insert(data.end(), (const BYTE*)psz, (const BYTE*)psz + cb);
+			else
+				data.push_back(0);
+			CoTaskMemFree(psz);
+		}
+	}
+	PutPadding(data);
+}
+
+static HRESULT PutSection(std::vector<BYTE>& data, const CPropertySet& set, bool& bVersion1)
+{
+	size_t start = data.size();
+	bool bDictionary = !set.Dictionary().empty();
+	DWORD cProps = 1 + (bDictionary ? 1 : 0) + set.GetCount();
+
+	PutUInt32(data, 0);		// size, filled in at the end
+	PutUInt32(data, cProps);
+	size_t table = data.size();
+	data.resize(table + cProps * 8);
+
+	DWORD iProp = 0;
+
+	PatchUInt32(data, table, PID_CodePageId);
+	PatchUInt32(data, table + 4, (DWORD)(data.size() - start));
+	PutUInt16(data, VT_I2);
+	PutUInt16(data, 0);
+	PutUInt16(data, (WORD)set.GetCodePage());
+	PutUInt16(data, 0);
+	iProp++;
+
+	if (bDictionary)
+	{
+		PatchUInt32(data, table + iProp * 8, PID_DictionaryId);
+		PatchUInt32(data, table + iProp * 8 + 4, (DWORD)(data.size() - start));
+		PutDictionary(data, set.GetCodePage(), set.Dictionary());
+		iProp++;
+	}
+
+	HRESULT hr = S_OK;
+	for (DWORD i = 0; i < set.GetCount() && SUCCEEDED(hr); i++, iProp++)
+	{
+		PatchUInt32(data, table + iProp * 8, set.GetIdAt(i));
+		PatchUInt32(data, table + iProp * 8 + 4, (DWORD)(data.size() - start));
+		hr = PutTypedValue(data, set.GetCodePage(), set.GetValueAt(i), false, bVersion1);
+	}
+
+	PutPadding(data);
+	PatchUInt32(data, start, (DWORD)(data.size() - start));
+	return hr;
+}
+
+HRESULT WritePropertySetStream(const std::vector<CPropertySet>& sets, std::vector<BYTE>& data)
+{
+	data.clear();
+	if (sets.empty())
+		return E_INVALIDARG;
+
+	CLSID clsid;
+	memset(&clsid, 0, sizeof(clsid));
+
+	PutUInt16(data, ByteOrderMark);
+	PutUInt16(data, 0);		// version, filled in at the end
+	PutUInt32(data, Win32SystemId);
+	PutGuid(data, clsid);
+	PutUInt32(data, (DWORD)sets.size());
+
+	for (size_t i = 0; i < sets.size(); i++)
+	{
+		PutGuid(data, sets[i].GetFmtid());
+		PutUInt32(data, 0);	// offset, filled in below
+	}
+
+	HRESULT hr = S_OK;
+	bool bVersion1 = false;
+	for (size_t i = 0; i < sets.size() && SUCCEEDED(hr); i++)
+	{
+		PatchUInt32(data, StreamHeaderSize + i * SectionEntrySize + 16, (DWORD)data.size());
+		hr = PutSection(data, sets[i], bVersion1);
+	}
+
+	if (bVersion1)
+		data[2] = 1;
+
+	if (FAILED(hr))
+		data.clear();
+	return hr;
+}
+
+#pragma endregion
+
+#pragma region Stream names
+
+static void GuidToBytes(REFGUID guid, BYTE bytes[16])
+{
+	std::vector<BYTE> data;
+	PutGuid(data, guid);
+	memcpy(bytes, &data[0], 16);
+}
+
+static const char StreamNameChars[] = "abcdefghijklmnopqrstuvwxyz012345";
+static const size_t StreamNameLength = 26;		// 128 bits at 5 bits per character
+
+void FmtIdToStreamName(REFFMTID fmtid, std::wstring& name)
+{
+	name = PropertySetStreamPrefix;
+
+	if (fmtid == FMTID_SummaryInformation)
+		name += L"SummaryInformation";
+	else if (fmtid == FMTID_DocSummaryInformation || fmtid == FMTID_UserDefinedProperties)
+		name += L"DocumentSummaryInformation";
+	else
+	{
+		BYTE bytes[16];
+		GuidToBytes(fmtid, bytes);
+
+		// Take 5 bits at a time, least significant first;
+		// characters that start on a byte boundary are upper case
+		for (size_t bit = 0; bit < 128; bit += 5)
+		{
+			size_t i = bit / 8, shift = bit % 8;
+			unsigned v = bytes[i] >> shift;
+			if (shift > 3 && i + 1 < 16)
+				v |= bytes[i + 1] << (8 - shift);
+
+			WCHAR c = StreamNameChars[v & 0x1F];
+			if (shift == 0 && c >= L'a' && c <= L'z')
+				c += L'A' - L'a';
+			name += c;
+		}
+	}
+}
+
+HRESULT StreamNameToFmtId(const WCHAR* pszName, FMTID* pfmtid)
+{
+	if (!pszName || !pfmtid)
+		return E_INVALIDARG;
+
+	if (*pszName == PropertySetStreamPrefix)
+		pszName++;
+
+	if (0 == CompareNoCase(pszName, L"SummaryInformation"))
+	{
+		*pfmtid = FMTID_SummaryInformation;
+		return S_OK;
+	}
+	else if (0 == CompareNoCase(pszName, L"DocumentSummaryInformation"))
+	{
+		*pfmtid = FMTID_DocSummaryInformation;
+		return S_OK;
+	}
+	else if (wcslen(pszName) != StreamNameLength)
+		return STG_E_INVALIDNAME;
+
+	BYTE bytes[16] = { 0 };
+	for (size_t k = 0; k < StreamNameLength; k++)
+	{
+		WCHAR c = (WCHAR)towlower(pszName[k]);
+		unsigned v;
+		if (c >= L'a' && c <= L'z')
+			v = c - L'a';
+		else if (c >= L'0' && c <= L'5')
+			v = c - L'0' + 26;
+		else
+			return STG_E_INVALIDNAME;
+
+		size_t bit = k * 5, i = bit / 8, shift = bit % 8;
+		bytes[i] |= (BYTE)(v << shift);
+		if (shift > 3 && i + 1 < 16)
+			bytes[i + 1] |= (BYTE)(v >> (8 - shift));
+	}
+
+	CStreamReader r(bytes, 16);
+	r.ReadGuid(*pfmtid);
+	return S_OK;
+}
+
+#pragma endregion
@@ -0,0 +1,80 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Reader and writer for the serialized property set stream format ([MS-OLEPS]), which is what
+// StgOpenStorageEx keeps in the \005 alternate streams of a file. This lets metadata be read and
+// written directly, without going through IPropertySetStorage and COM for every property.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include <map>
+
+// Property set stream names start with this character, e.g. L"\005SummaryInformation"
+static const WCHAR PropertySetStreamPrefix = L'\005';
+
+// Property identifiers with special meanings in a property set
+static const PROPID PID_DictionaryId	= 0;
+static const PROPID PID_CodePageId		= 1;
+
+// One section of a property set stream: the properties of a single FMTID, together with
+// its code page and optional dictionary of property names
+class CPropertySet
+{
+public:
+	CPropertySet();
+	explicit CPropertySet(REFFMTID fmtid);
+	CPropertySet(const CPropertySet& other);
+	CPropertySet& operator=(const CPropertySet& other);
+	~CPropertySet();
+
+	REFFMTID GetFmtid() const { return _fmtid; }
+	UINT GetCodePage() const { return _codePage; }
+	void SetCodePage(UINT codePage) { _codePage = codePage; }
+
+	// Indexed access in stream order, for enumeration
+	DWORD GetCount() const { return (DWORD)_props.size(); }
+	PROPID GetIdAt(DWORD index) const { return _props[index].pid; }
+	const PROPVARIANT& GetValueAt(DWORD index) const { return _props[index].var; }
+
+	// GetValue returns a copy of the value, or VT_EMPTY if the property is not present
+	HRESULT GetValue(PROPID pid, PROPVARIANT* ppropvar) const;
+	// SetValue stores a copy of the value; setting VT_EMPTY removes the property
+	HRESULT SetValue(PROPID pid, REFPROPVARIANT propvar);
+	// AttachValue takes ownership of the value without copying it, and leaves propvar empty
+	void AttachValue(PROPID pid, PROPVARIANT& propvar);
+
+	// Property names, keyed by property identifier
+	std::map<PROPID, std::wstring>& Dictionary() { return _dictionary; }
+	const std::map<PROPID, std::wstring>& Dictionary() const { return _dictionary; }
+
+	void Clear();
+
+private:
+	struct Entry
+	{
+		PROPID		pid;
+		PROPVARIANT	var;
+	};
+
+	int Find(PROPID pid) const;
+
+	FMTID							_fmtid;
+	UINT							_codePage;
+	std::vector<Entry>				_props;
+	std::map<PROPID, std::wstring>	_dictionary;
+};
+
+// Whether two values are of the same type and hold exactly the same data, so that writing one over
+// the other would change nothing. Values of types that are not stored in property sets never compare equal.
+bool PropVariantEquals(REFPROPVARIANT propvar1, REFPROPVARIANT propvar2);
+
+// Parse a complete property set stream into its sections
+HRESULT ReadPropertySetStream(const BYTE* pData, size_t cbData, std::vector<CPropertySet>& sets);
+
+// Serialize sections into a complete property set stream, replacing the contents of data
+HRESULT WritePropertySetStream(const std::vector<CPropertySet>& sets, std::vector<BYTE>& data);
+
+// Map between an FMTID and the name of the stream that holds it, as FmtIdToPropStgName and PropStgNameToFmtId do.
+// Note that FMTID_UserDefinedProperties shares the DocumentSummaryInformation stream, as its second section.
+void FmtIdToStreamName(REFFMTID fmtid, std::wstring& name);
+HRESULT StreamNameToFmtId(const WCHAR* pszName, FMTID* pfmtid);
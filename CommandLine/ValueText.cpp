@@ -0,0 +1,534 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "ValueText.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Writes the decimal digits of a value at the end of a buffer, returning where they start
+static WCHAR* FormatUnsigned(ULONGLONG ull, WCHAR* pchEnd)
+{
+	do
+	{
+		*--pchEnd = (WCHAR)(L'0' + ull % 10);
+		ull /= 10;
+	}
+	while (ull != 0);
+	return pchEnd;
+}
+
+// Appends text to a buffer at *pcch, keeping it terminated; fails if the buffer is too small
+static bool Append(WCHAR* pszBuffer, size_t cchBuffer, size_t* pcch, const WCHAR* pch, size_t cch)
+{
+	if (cch >= cchBuffer - *pcch)
+		return false;
+	memcpy(pszBuffer + *pcch, pch, cch * sizeof(WCHAR));
+	*pcch += cch;
+	pszBuffer[*pcch] = L'\0';
+	return true;
+}
+
+static bool AppendInteger(WCHAR* pszBuffer, size_t cchBuffer, size_t* pcch, LONGLONG ll, bool bSigned)
+{
+	WCHAR digits[24];
+	WCHAR* pchEnd = digits + sizeof(digits) / sizeof(WCHAR);
+	WCHAR* pch;
+
+	if (bSigned && ll < 0)
+	{
+		// Negate as unsigned, so that the most negative value survives
+		pch = FormatUnsigned(0 - (ULONGLONG)ll, pchEnd);
+		*--pch = L'-';
+	}
+	else
+		pch = FormatUnsigned((ULONGLONG)ll, pchEnd);
+
+	return Append(pszBuffer, cchBuffer, pcch, pch, pchEnd - pch);
+}
+
+// Reads an element of an integer type as a 64-bit value; fails for other types
+static bool GetInteger(VARTYPE vt, const void* p, LONGLONG* pll, bool* pbSigned)
+{
+	*pbSigned = true;
+	switch (vt)
+	{
+	case VT_I1:		*pll = *(const CHAR*)p;			break;
+	case VT_I2:		*pll = *(const SHORT*)p;		break;
+	case VT_I4:		*pll = *(const LONG*)p;			break;
+	case VT_INT:	*pll = *(const INT*)p;			break;
+	case VT_I8:		*pll = *(const LONGLONG*)p;		break;
+	case VT_BOOL:	*pll = *(const VARIANT_BOOL*)p;	break;
+	default:
+		*pbSigned = false;
+		switch (vt)
+		{
+		case VT_UI1:	*pll = *(const UCHAR*)p;	break;
+		case VT_UI2:	*pll = *(const USHORT*)p;	break;
+		case VT_UI4:	*pll = *(const ULONG*)p;	break;
+		case VT_UINT:	*pll = *(const UINT*)p;		break;
+		case VT_UI8:	*pll = (LONGLONG)*(const ULONGLONG*)p;	break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+// As FileTimeToSystemTime, which is what the coercion uses, but without needing Windows
+static bool AppendFileTime(WCHAR* pszBuffer, size_t cchBuffer, size_t* pcch, const FILETIME& ft)
+{
+	ULONGLONG ticks = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+
+	// FileTimeToSystemTime rejects these, and so the coercion fails
+	if (ticks >= 0x8000000000000000ULL)
+		return false;
+
+	ULONGLONG ms = ticks / 10000;
+	unsigned milliseconds = (unsigned)(ms % 1000);
+	ULONGLONG seconds = ms / 1000;
+	unsigned second = (unsigned)(seconds % 60);
+	unsigned minute = (unsigned)(seconds / 60 % 60);
+	unsigned hour = (unsigned)(seconds / 3600 % 24);
+
+	// Civil date from the day count, counting from 1 March 0000 so that leap days fall at the end of the year
+	LONGLONG days = (LONGLONG)(seconds / 86400) + 584694;	// days from 0000/03/01 to 1601/01/01
+	LONGLONG era = days / 146097;
+	unsigned dayOfEra = (unsigned)(days - era * 146097);
+	unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	unsigned mp = (5 * dayOfYear + 2) / 153;
+	unsigned day = dayOfYear - (153 * mp + 2) / 5 + 1;
+	unsigned month = mp < 10 ? mp + 3 : mp - 9;
+	unsigned year = (unsigned)(yearOfEra + era * 400) + (month <= 2 ? 1 : 0);
+
+	// yyyy/mm/dd:hh:mm:ss.fff
+	const unsigned fields[] = { year, month, day, hour, minute, second, milliseconds };
+	const unsigned widths[] = { 4, 2, 2, 2, 2, 2, 3 };
+	const WCHAR separators[] = { L'/', L'/', L':', L':', L':', L'.', L'\0' };
+
+	for (int i = 0; i < 7; i++)
+	{
+		WCHAR digits[12];
+		WCHAR* pchEnd = digits + sizeof(digits) / sizeof(WCHAR);
+		WCHAR* pch = FormatUnsigned(fields[i], pchEnd);
+		while ((unsigned)(pchEnd - pch) < widths[i])
+			*--pch = L'0';
+		if (!Append(pszBuffer, cchBuffer, pcch, pch, pchEnd - pch))
+			return false;
+		if (separators[i] != L'\0' && !Append(pszBuffer, cchBuffer, pcch, &separators[i], 1))
+			return false;
+	}
+	return true;
+}
+
+// As StringFromGUID2
+static bool AppendGuid(WCHAR* pszBuffer, size_t cchBuffer, size_t* pcch, const GUID& guid)
+{
+	static const WCHAR hex[] = L"0123456789ABCDEF";
+	WCHAR text[39];
+	WCHAR* pch = text;
+
+	*pch++ = L'{';
+	for (int i = 28; i >= 0; i -= 4)
+		*pch++ = hex[(guid.Data1 >> i) & 0xF];
+	*pch++ = L'-';
+	for (int i = 12; i >= 0; i -= 4)
+		*pch++ = hex[(guid.Data2 >> i) & 0xF];
+	*pch++ = L'-';
+	for (int i = 12; i >= 0; i -= 4)
+		*pch++ = hex[(guid.Data3 >> i) & 0xF];
+	*pch++ = L'-';
+	for (int i = 0; i < 8; i++)
+	{
+		if (i == 2)
+			*pch++ = L'-';
+		*pch++ = hex[guid.Data4[i] >> 4];
+		*pch++ = hex[guid.Data4[i] & 0xF];
+	}
+	*pch++ = L'}';
+
+	return Append(pszBuffer, cchBuffer, pcch, text, pch - text);
+}
+
+// The size of an element of a vector of the types handled here, or 0 for any other type
+static size_t VectorElementSize(VARTYPE vtElem)
+{
+	// Display formatting of other types, such as dates and booleans, depends on the locale
+	switch (vtElem)
+	{
+	case VT_LPWSTR:	return sizeof(LPWSTR);
+	case VT_I1: case VT_UI1: return sizeof(CHAR);
+	case VT_I2: case VT_UI2: return sizeof(SHORT);
+	case VT_I4: case VT_UI4: return sizeof(LONG);
+	case VT_I8: case VT_UI8: return sizeof(LONGLONG);
+	default:
+		return 0;
+	}
+}
+
+bool FormatValueText(REFPROPVARIANT propvar, WCHAR* pszBuffer, size_t cchBuffer, const WCHAR** ppszText)
+{
+	size_t cch = 0;
+	LONGLONG ll;
+	bool bSigned;
+
+	if (cchBuffer == 0)
+		return false;
+	pszBuffer[0] = L'\0';
+	*ppszText = pszBuffer;
+
+	switch (propvar.vt)
+	{
+	case VT_LPWSTR:
+	case VT_BSTR:
+		// Used as it is, with no copy
+		if (!propvar.pwszVal)
+			return false;
+		*ppszText = propvar.pwszVal;
+		return true;
+
+	case VT_FILETIME:
+		return AppendFileTime(pszBuffer, cchBuffer, &cch, propvar.filetime);
+
+	case VT_CLSID:
+		return propvar.puuid != NULL && AppendGuid(pszBuffer, cchBuffer, &cch, *propvar.puuid);
+
+	default:
+		// Booleans come out as their numeric values, -1 and 0
+		return GetInteger(propvar.vt, &propvar.cVal, &ll, &bSigned) &&
+			AppendInteger(pszBuffer, cchBuffer, &cch, ll, bSigned);
+	}
+}
+
+bool FormatVectorText(REFPROPVARIANT propvar, WCHAR* pszBuffer, size_t cchBuffer)
+{
+	VARTYPE vtElem = propvar.vt & VT_TYPEMASK;
+	size_t cbElem = VectorElementSize(vtElem);
+
+	if (cbElem == 0 || !(propvar.vt & VT_VECTOR) || cchBuffer == 0)
+		return false;
+
+	// Within the limit that PSFormatForDisplay was given
+	if (cchBuffer > MaxDisplayText)
+		cchBuffer = MaxDisplayText;
+
+	size_t cch = 0;
+	pszBuffer[0] = L'\0';
+	const BYTE* pElems = (const BYTE*)propvar.cac.pElems;
+
+	for (ULONG i = 0; i < propvar.cac.cElems; i++)
+	{
+		const void* pElem = pElems + i * cbElem;
+
+		if (i > 0 && !Append(pszBuffer, cchBuffer, &cch, L"; ", 2))
+			return false;
+
+		if (vtElem == VT_LPWSTR)
+		{
+			const WCHAR* psz = *(const LPWSTR*)pElem;
+			if (psz && !Append(pszBuffer, cchBuffer, &cch, psz, wcslen(psz)))
+				return false;
+		}
+		else
+		{
+			LONGLONG ll;
+			bool bSigned;
+			if (!GetInteger(vtElem, pElem, &ll, &bSigned) || !AppendInteger(pszBuffer, cchBuffer, &cch, ll, bSigned))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Parses decimal text, with a sign only if negative, into an element of an integer type;
+// fails for other types, and if the text is in any other form or out of range
+static bool ParseInteger(const WCHAR* pch, const WCHAR* pchEnd, VARTYPE vt, void* p)
+{
+	bool bNegative = pch < pchEnd && *pch == L'-';
+	if (bNegative)
+		pch++;
+	if (pch == pchEnd)
+		return false;
+
+	ULONGLONG ull = 0;
+	for (; pch < pchEnd; pch++)
+	{
+		if (*pch < L'0' || *pch > L'9')
+			return false;
+		unsigned digit = *pch - L'0';
+		if (ull > (0xFFFFFFFFFFFFFFFFULL - digit) / 10)
+			return false;
+		ull = ull * 10 + digit;
+	}
+
+	ULONGLONG ullMax;
+	bool bSigned = true;
+	switch (vt)
+	{
+	case VT_I1:		ullMax = 0x7F;					break;
+	case VT_I2:		ullMax = 0x7FFF;				break;
+	case VT_I4:
+	case VT_INT:
+	case VT_BOOL:	ullMax = 0x7FFFFFFF;			break;
+	case VT_I8:		ullMax = 0x7FFFFFFFFFFFFFFFULL;	break;
+	default:
+		bSigned = false;
+		switch (vt)
+		{
+		case VT_UI1:	ullMax = 0xFF;					break;
+		case VT_UI2:	ullMax = 0xFFFF;				break;
+		case VT_UI4:
+		case VT_UINT:	ullMax = 0xFFFFFFFF;			break;
+		case VT_UI8:	ullMax = 0xFFFFFFFFFFFFFFFFULL;	break;
+		default:
+			return false;
+		}
+	}
+
+	// The most negative value is one further from zero than the most positive
+	if (bNegative ? !bSigned || ull > ullMax + 1 : ull > ullMax)
+		return false;
+
+	LONGLONG ll = bNegative ? (LONGLONG)(0 - ull) : (LONGLONG)ull;
+	switch (vt)
+	{
+	case VT_I1:		*(CHAR*)p = (CHAR)ll;			break;
+	case VT_UI1:	*(UCHAR*)p = (UCHAR)ll;			break;
+	case VT_I2:		*(SHORT*)p = (SHORT)ll;			break;
+	case VT_UI2:	*(USHORT*)p = (USHORT)ll;		break;
+	case VT_I4:		*(LONG*)p = (LONG)ll;			break;
+	case VT_UI4:	*(ULONG*)p = (ULONG)ll;			break;
+	case VT_INT:	*(INT*)p = (INT)ll;				break;
+	case VT_UINT:	*(UINT*)p = (UINT)ll;			break;
+	case VT_I8:		*(LONGLONG*)p = ll;				break;
+	case VT_UI8:	*(ULONGLONG*)p = ull;			break;
+	// Any number other than zero is true, as when coercing
+	case VT_BOOL:	*(VARIANT_BOOL*)p = ll != 0 ? VARIANT_TRUE : VARIANT_FALSE;	break;
+	}
+	return true;
+}
+
+// The inverse of AppendFileTime, accepting only the form that it produces
+static bool ParseFileTime(const WCHAR* psz, FILETIME* pft)
+{
+	static const unsigned widths[] = { 4, 2, 2, 2, 2, 2, 3 };
+	static const WCHAR separators[] = { L'/', L'/', L':', L':', L':', L'.', L'\0' };
+	unsigned fields[7];
+
+	for (int i = 0; i < 7; i++)
+	{
+		fields[i] = 0;
+		for (unsigned j = 0; j < widths[i]; j++, psz++)
+		{
+			if (*psz < L'0' || *psz > L'9')
+				return false;
+			fields[i] = fields[i] * 10 + (*psz - L'0');
+		}
+		if (*psz != separators[i])
+			return false;
+		if (separators[i] != L'\0')
+			psz++;
+	}
+
+	unsigned year = fields[0], month = fields[1], day = fields[2];
+	static const unsigned daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	bool bLeap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+
+	// The range that SystemTimeToFileTime accepts
+	if (year < 1601 || year > 30827 || month < 1 || month > 12 || day < 1 ||
+		day > daysInMonth[month - 1] + (month == 2 && bLeap ? 1 : 0) ||
+		fields[3] > 23 || fields[4] > 59 || fields[5] > 59)
+		return false;
+
+	// Day count from the civil date, counting from 1 March 0000 as AppendFileTime does
+	unsigned yearFromMarch = year - (month <= 2 ? 1 : 0);
+	unsigned era = yearFromMarch / 400;
+	unsigned yearOfEra = yearFromMarch - era * 400;
+	unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	ULONGLONG days = (ULONGLONG)era * 146097 + dayOfEra - 584694;
+
+	ULONGLONG ticks = (((days * 24 + fields[3]) * 60 + fields[4]) * 60 + fields[5]) * 1000 + fields[6];
+	ticks *= 10000;
+	pft->dwLowDateTime = (DWORD)ticks;
+	pft->dwHighDateTime = (DWORD)(ticks >> 32);
+	return true;
+}
+
+static bool ParseHex(const WCHAR* pch, unsigned cDigits, ULONG* pul)
+{
+	*pul = 0;
+	for (unsigned i = 0; i < cDigits; i++, pch++)
+	{
+		unsigned digit;
+		if (*pch >= L'0' && *pch <= L'9')
+			digit = *pch - L'0';
+		else if (*pch >= L'A' && *pch <= L'F')
+			digit = *pch - L'A' + 10;
+		else if (*pch >= L'a' && *pch <= L'f')
+			digit = *pch - L'a' + 10;
+		else
+			return false;
+		*pul = (*pul << 4) | digit;
+	}
+	return true;
+}
+
+// The inverse of AppendGuid, also accepting lower case
+static bool ParseGuid(const WCHAR* psz, GUID* pguid)
+{
+	if (wcslen(psz) != 38 || psz[0] != L'{' || psz[9] != L'-' || psz[14] != L'-' ||
+		psz[19] != L'-' || psz[24] != L'-' || psz[37] != L'}')
+		return false;
+
+	ULONG ul;
+	if (!ParseHex(psz + 1, 8, &ul))
+		return false;
+	pguid->Data1 = ul;
+	if (!ParseHex(psz + 10, 4, &ul))
+		return false;
+	pguid->Data2 = (USHORT)ul;
+	if (!ParseHex(psz + 15, 4, &ul))
+		return false;
+	pguid->Data3 = (USHORT)ul;
+	for (int i = 0; i < 8; i++)
+	{
+		if (!ParseHex(psz + (i < 2 ? 20 + 2 * i : 21 + 2 * i), 2, &ul))
+			return false;
+		pguid->Data4[i] = (BYTE)ul;
+	}
+	return true;
+}
+
+static bool ParseVectorText(const WCHAR* pszText, VARTYPE vt, CValueArena& arena, PROPVARIANT* ppropvar)
+{
+	VARTYPE vtElem = vt & VT_TYPEMASK;
+	size_t cbElem = VectorElementSize(vtElem);
+	if (cbElem == 0 || vt != (VT_VECTOR | vtElem))
+		return false;
+
+	// Split at each ';' as wsplit did, which drops a final element if it is empty
+	size_t cch = wcslen(pszText);
+	ULONG cElems = 1;
+	for (const WCHAR* pch = pszText; *pch; pch++)
+	{
+		if (*pch == L';')
+			cElems++;
+	}
+	if (cch == 0 || pszText[cch - 1] == L';')
+		cElems--;
+
+	// Strings are copied into the arena after the array, where the total including terminators is no longer than the text
+	BYTE* pElems = NULL;
+	WCHAR* pchCopy = NULL;
+	if (cElems > 0)
+	{
+		pElems = (BYTE*)arena.Alloc(cElems * cbElem);
+		if (vtElem == VT_LPWSTR)
+			pchCopy = (WCHAR*)arena.Alloc((cch + 1) * sizeof(WCHAR));
+		if (!pElems || (vtElem == VT_LPWSTR && !pchCopy))
+			return false;
+	}
+
+	const WCHAR* pch = pszText;
+	for (ULONG i = 0; i < cElems; i++)
+	{
+		const WCHAR* pchEnd = wcschr(pch, L';');
+		if (!pchEnd)
+			pchEnd = pszText + cch;
+
+		// Non-first elements begin with the blank put after each ';' by formatting for display on export
+		const WCHAR* pchStart = pch;
+		if (i > 0 && pchStart < pchEnd && *pchStart == L' ')
+			pchStart++;
+
+		if (vtElem == VT_LPWSTR)
+		{
+			size_t cchElem = pchEnd - pchStart;
+			memcpy(pchCopy, pchStart, cchElem * sizeof(WCHAR));
+			pchCopy[cchElem] = L'\0';
+			((LPWSTR*)pElems)[i] = pchCopy;
+			pchCopy += cchElem + 1;
+		}
+		else if (!ParseInteger(pchStart, pchEnd, vtElem, pElems + i * cbElem))
+			return false;
+
+		pch = pchEnd + 1;
+	}
+
+	ppropvar->cac.cElems = cElems;
+	ppropvar->cac.pElems = (CHAR*)pElems;
+	return true;
+}
+
+bool ParseValueText(const WCHAR* pszText, VARTYPE vt, CValueArena& arena, PROPVARIANT* ppropvar)
+{
+	memset(ppropvar, 0, sizeof(PROPVARIANT));
+	ppropvar->vt = vt;
+
+	if (vt & VT_VECTOR)
+		return ParseVectorText(pszText, vt, arena, ppropvar);
+
+	switch (vt)
+	{
+	case VT_LPWSTR:
+		// Refers to the text, with no copy
+		ppropvar->pwszVal = const_cast<LPWSTR>(pszText);
+		return true;
+
+	case VT_FILETIME:
+		return ParseFileTime(pszText, &ppropvar->filetime);
+
+	case VT_CLSID:
+		ppropvar->puuid = (CLSID*)arena.Alloc(sizeof(CLSID));
+		return ppropvar->puuid != NULL && ParseGuid(pszText, ppropvar->puuid);
+
+	default:
+		return ParseInteger(pszText, pszText + wcslen(pszText), vt, &ppropvar->cVal);
+	}
+}
+
+CValueArena::CValueArena()
+	: _pBlock((BYTE*)_inline), _cbBlock(sizeof(_inline)), _cbUsed(0)
+{
+}
+
+CValueArena::~CValueArena()
+{
+	for (size_t i = 0; i < _heapBlocks.size(); i++)
+		free(_heapBlocks[i]);
+}
+
+void* CValueArena::Alloc(size_t cb)
+{
+	// Keep everything aligned for the largest value types
+	cb = (cb + sizeof(ULONGLONG) - 1) & ~(sizeof(ULONGLONG) - 1);
+
+	if (cb > _cbBlock - _cbUsed)
+	{
+		// Each block is at least twice the size of the one before, so the last is the largest
+		size_t cbNew = _cbBlock * 2 > cb ? _cbBlock * 2 : cb;
+		BYTE* pNew = (BYTE*)malloc(cbNew);
+		if (!pNew)
+			return NULL;
+		_heapBlocks.push_back(pNew);
+		_pBlock = pNew;
+		_cbBlock = cbNew;
+		_cbUsed = 0;
+	}
+
+	void* p = _pBlock + _cbUsed;
+	_cbUsed += cb;
+	return p;
+}
+
+void CValueArena::Reset()
+{
+	if (_heapBlocks.size() > 1)
+	{
+		for (size_t i = 0; i + 1 < _heapBlocks.size(); i++)
+			free(_heapBlocks[i]);
+		_heapBlocks.erase(_heapBlocks.begin(), _heapBlocks.end() - 1);
+	}
+	_cbUsed = 0;
+}
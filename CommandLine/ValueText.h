@@ -0,0 +1,55 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Direct conversion between property values and the text of the Value elements in exported XML,
+// for the common types. The text is exactly what export has always produced through
+// PropVariantChangeType and PSFormatForDisplay, so that files stay comparable between versions,
+// and import reads it back to the same values that coercion from the string gives, but without
+// the allocation and COM coercion. Anything else is left to those functions.
+
+#pragma once
+
+#include "PortableTypes.h"
+
+// Longest text that PSFormatForDisplay is asked for, in characters
+static const size_t MaxDisplayText = MAX_PATH;
+
+// Formats a value, which must not be a vector, as PropVariantChangeType to VT_LPWSTR would.
+// On success, *ppszText points either into pszBuffer or at the value's own string.
+// Returns false if the type is not one that is handled here.
+bool FormatValueText(REFPROPVARIANT propvar, WCHAR* pszBuffer, size_t cchBuffer, const WCHAR** ppszText);
+
+// Formats a vector value as PSFormatForDisplay would, with elements separated by "; ".
+// Returns false if the type is not one that is handled here, or the text would need more than
+// MaxDisplayText characters, so that the caller can fall back to what it did before.
+bool FormatVectorText(REFPROPVARIANT propvar, WCHAR* pszBuffer, size_t cchBuffer);
+
+// Memory for parsed values, handed out in sequence and reused from one value to the next,
+// so that parsing a value does not allocate once the arena has grown to fit
+class CValueArena
+{
+public:
+	CValueArena();
+	~CValueArena();
+
+	// Returns memory aligned for any value type, or NULL if out of memory
+	void* Alloc(size_t cb);
+
+	// Makes all the memory available again, keeping the largest block for reuse
+	void Reset();
+
+private:
+	CValueArena(const CValueArena&);
+	CValueArena& operator=(const CValueArena&);
+
+	ULONGLONG			_inline[32];	// enough for the usual values without going to the heap
+	BYTE*				_pBlock;
+	size_t				_cbBlock;
+	size_t				_cbUsed;
+	std::vector<BYTE*>	_heapBlocks;
+};
+
+// Parses the text of a Value element into a value of type vt, as PropVariantChangeType from the string would,
+// splitting vectors at each "; " as import always has. The value refers to the text and to memory in the arena,
+// so it must not be cleared, and lasts only as long as both of them. Returns false if the type is not one
+// that is handled here, or the text is not in the form that export produces, so that the caller can coerce it.
+bool ParseValueText(const WCHAR* pszText, VARTYPE vt, CValueArena& arena, PROPVARIANT* ppropvar);
@@ -0,0 +1,107 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "WorkerPool.h"
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+namespace
+{
+	struct WorkerContext
+	{
+		CParallelTask*	pTask;
+		size_t			count;
+		CLock			lock;
+		size_t			next;
+	};
+
+	void RunWorker(WorkerContext& context)
+	{
+		context.pTask->ThreadStart();
+		for (;;)
+		{
+			size_t index;
+			{
+				CAutoLock lock(context.lock);
+				if (context.next >= context.count)
+					break;
+				index = context.next++;
+			}
+			context.pTask->Execute(index);
+		}
+		context.pTask->ThreadEnd();
+	}
+
+#ifdef _WIN32
+	unsigned __stdcall WorkerThread(void* pv)
+	{
+		RunWorker(*(WorkerContext*)pv);
+		return 0;
+	}
+#else
+	void* WorkerThread(void* pv)
+	{
+		RunWorker(*(WorkerContext*)pv);
+		return NULL;
+	}
+#endif
+}
+
+void RunParallel(unsigned cThreads, size_t count, CParallelTask& task)
+{
+	WorkerContext context;
+	context.pTask = &task;
+	context.count = count;
+	context.next = 0;
+
+	if (cThreads > count)
+		cThreads = (unsigned)count;
+
+	// The calling thread is always one of the workers, so only start the others
+#ifdef _WIN32
+	std::vector<HANDLE> threads;
+	for (unsigned i = 1; i < cThreads; i++)
+	{
+		HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, WorkerThread, &context, 0, NULL);
+		if (hThread == NULL)
+			break;
+		threads.push_back(hThread);
+	}
+
+	RunWorker(context);
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+#else
+	std::vector<pthread_t> threads;
+	for (unsigned i = 1; i < cThreads; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, WorkerThread, &context) != 0)
+			break;
+		threads.push_back(thread);
+	}
+
+	RunWorker(context);
+
+	for (size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+#endif
+}
+
+COrderedResults::COrderedResults(size_t count) : _complete(count, false), _next(0)
+{
+}
+
+void COrderedResults::Complete(size_t index)
+{
+	CAutoLock lock(_lock);
+
+	_complete[index] = true;
+	while (_next < _complete.size() && _complete[_next])
+		Emit(_next++);
+}
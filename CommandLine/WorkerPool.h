@@ -0,0 +1,45 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// A minimal worker pool for independent per-file operations, using Win32 threads or pthreads
+// because the VS2010 toolset has no <thread>.
+
+#pragma once
+
+#include "PortableTypes.h"
+
+// Work to be spread across the pool, one call to Execute for each index
+class CParallelTask
+{
+public:
+	virtual ~CParallelTask() {}
+
+	// Called on each worker thread before and after it executes any items, e.g. to initialise COM
+	virtual void ThreadStart() {}
+	virtual void ThreadEnd() {}
+
+	virtual void Execute(size_t index) = 0;
+};
+
+// Executes task.Execute(i) for every i in [0, count) using up to cThreads threads, handing out
+// indexes in ascending order, and returns when all have completed. With one thread, or if threads
+// cannot be created, the items are executed in order on the calling thread.
+void RunParallel(unsigned cThreads, size_t count, CParallelTask& task);
+
+// Collects per-item results that finish in any order, and passes them to Emit strictly in index order,
+// as soon as all earlier items are complete. Emit is called under a lock, so one item at a time.
+class COrderedResults
+{
+public:
+	COrderedResults(size_t count);
+	virtual ~COrderedResults() {}
+
+	void Complete(size_t index);
+
+protected:
+	virtual void Emit(size_t index) = 0;
+
+private:
+	CLock				_lock;
+	std::vector<bool>	_complete;
+	size_t				_next;
+};
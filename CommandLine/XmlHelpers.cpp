@@ -1,15 +1,22 @@
 // Some parts copied from Microsoft's EnumAll sample: http://msdn.microsoft.com/en-us/library/aa379016(v=vs.85).aspx (no visible license terms)
 // All other code Copyright (c) 2014, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
 #include "stdafx.h"
-#include "xmlhelpers.h"
+#include "XmlHelpers.h"
 #include <iostream>
+#include <sstream>
 #include <algorithm>
+#ifdef _WIN32
 #include "tclap/CmdLine.h"
 #include <strsafe.h>
 #include <direct.h>
 #include <shobjidl.h>
+#endif
+#include <errno.h>
+#include <stdarg.h>
 
+#ifdef _WIN32
 using namespace TCLAP;
+#endif
 
 static const WCHAR* MetadataNodeName	= L"Metadata";
 static const WCHAR* StorageNodeName		= L"Storage";
@@ -22,13 +29,100 @@ static const WCHAR* TypeAttrName		= L"Type";
 static const WCHAR* TypeIdAttrName	    = L"TypeId";
 static const WCHAR* ValueNodeName		= L"Value";
 
-static const WCHAR* OurPropertyHandlerGuid64 = L"{D06391EE-2FEB-419B-9667-AD160D0849F3}";
-static const WCHAR* OurPropertyHandlerGuid32 = L"{60211757-EF87-465e-B6C1-B37CF98295F9}";
+static const WCHAR* const OurPropertyHandlerGuid64 = L"{D06391EE-2FEB-419B-9667-AD160D0849F3}";
+static const WCHAR* const OurPropertyHandlerGuid32 = L"{60211757-EF87-465e-B6C1-B37CF98295F9}";
 
 //-------------------------------------------
 // Common code for import and export of XML, used by command line and context menu
 //-------------------------------------------
 
+#ifndef _WIN32
+#pragma region Portability
+
+// The string table from FileMeta.rc, which the build generates as { IDS_..., L"..." } entries
+struct ResourceString
+{
+	UINT			uId;
+	const WCHAR*	pszText;
+};
+
+static const ResourceString ResourceStrings[] =
+{
+#include "ResourceStrings.inc"
+};
+
+// As LoadString, which the Windows hosts each define this with
+int AccessResourceString(UINT uId, LPWSTR lpBuffer, int nBufferMax)
+{
+	for (size_t i = 0; i < sizeof(ResourceStrings) / sizeof(ResourceStrings[0]); i++)
+	{
+		if (ResourceStrings[i].uId == uId)
+		{
+			wcsncpy(lpBuffer, ResourceStrings[i].pszText, nBufferMax - 1);
+			lpBuffer[nBufferMax - 1] = L'\0';
+			return (int)wcslen(lpBuffer);
+		}
+	}
+	lpBuffer[0] = L'\0';
+	return 0;
+}
+
+// The bounded string functions of the Microsoft CRT, as far as this file uses them, truncating rather than failing
+static void wcsncpy_s(WCHAR* pszDest, size_t cchDest, const WCHAR* pszSrc, size_t cchCount)
+{
+	size_t cch = std::min(std::min(wcslen(pszSrc), cchCount), cchDest - 1);
+	wmemcpy(pszDest, pszSrc, cch);
+	pszDest[cch] = L'\0';
+}
+
+static void wcsncat_s(WCHAR* pszDest, size_t cchDest, const WCHAR* pszSrc, size_t cchCount)
+{
+	size_t cchUsed = wcslen(pszDest);
+	if (cchUsed < cchDest)
+		wcsncpy_s(pszDest + cchUsed, cchDest - cchUsed, pszSrc, cchCount);
+}
+
+static void _snwprintf_s(WCHAR* pszDest, size_t cchDest, size_t /*cchCount*/, const WCHAR* pszFormat, ...)
+{
+	va_list fmtList;
+	va_start(fmtList, pszFormat);
+	vswprintf(pszDest, cchDest, pszFormat, fmtList);
+	va_end(fmtList);
+}
+
+static void StringCbPrintf(WCHAR* pszDest, size_t cbDest, const WCHAR* pszFormat, ...)
+{
+	va_list fmtList;
+	va_start(fmtList, pszFormat);
+	vswprintf(pszDest, cbDest / sizeof(WCHAR), pszFormat, fmtList);
+	va_end(fmtList);
+}
+
+// GUIDs are converted to and from text as ValueText does for VT_CLSID values, which is the form that COM uses
+static int StringFromGUID2(REFGUID guid, WCHAR* pszGuid, int cchMax)
+{
+	PROPVARIANT propvar;
+	propvar.vt = VT_CLSID;
+	propvar.puuid = const_cast<GUID*>(&guid);
+	const WCHAR* pszText;
+	if (!FormatValueText(propvar, pszGuid, cchMax, &pszText))
+		return 0;
+	return (int)wcslen(pszGuid) + 1;
+}
+
+static HRESULT CLSIDFromString(const WCHAR* pszGuid, CLSID* pclsid)
+{
+	CValueArena arena;
+	PROPVARIANT propvar;
+	if (!ParseValueText(pszGuid, VT_CLSID, arena, &propvar))
+		return CO_E_CLASSSTRING;
+	*pclsid = *propvar.puuid;
+	return S_OK;
+}
+
+#pragma endregion
+#endif
+
 // Errors are reported with both a Windows error, used in command line reporting,
 // and a COM error, used by the context menu
 CPHException::CPHException (int err, HRESULT hr, UINT uResourceId, ...)
@@ -40,7 +134,11 @@ CPHException::CPHException (int err, HRESULT hr, UINT uResourceId, ...)
 	_hr = hr;
 	AccessResourceString(uResourceId, lpszFormat, MAX_PATH);
 	va_start( fmtList, uResourceId );
+#ifdef _WIN32
 	vswprintf_s( _pszError, MAX_PATH, lpszFormat, fmtList );
+#else
+	vswprintf( _pszError, MAX_PATH, lpszFormat, fmtList );
+#endif
 	va_end( fmtList );
 }
 
@@ -59,44 +157,51 @@ WCHAR* CPHException::GetMessage()
 	return _pszError;
 }
 
-// See if file is handled by our property handler, or another one, or none
-// Returns 1 if our handler is used, 0 if no handler is set up, or -1 if a foreign handler is used
-int CExtensionChecker::HasPropertyHandler(wstring fileName)
-{
-	WCHAR pszExt[_MAX_EXT];
-	int val = 0;
-
-	// Try and get the extension
-	if (0 == _wsplitpath_s(fileName.c_str(), NULL, 0, NULL, 0, NULL, 0, pszExt, _MAX_EXT))
-	{
-		CharLower(pszExt); // use lower case for the map
-
-		// If we've already checked this extension, return the result
-		if (m_extensions.find(pszExt) != m_extensions.end())
-			return m_extensions[pszExt];
-
-		wstring subKey = L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\PropertySystem\\PropertyHandlers\\";
-		subKey.append(pszExt);
+// Read from the registry by the first checker that needs them, and again by the next after any change.
+// A table is never altered once loaded, so checkers that already hold one can go on using it.
+#ifdef _WIN32
+static CRegistryHandlerSource s_registry;
+static std::shared_ptr<const CHandlerTable> s_pRegistryTable;
+static CLock s_registryLock;
+#endif
 
-		WCHAR buffer[_MAX_EXT];
-		DWORD size = _MAX_EXT;
-		// Not finding the key results in 0
-		if (ERROR_SUCCESS == RegGetValue(HKEY_LOCAL_MACHINE, subKey.c_str(), NULL, RRF_RT_REG_SZ, NULL, buffer, &size))
-		{
-			// If the key is found, 1 iff our property handler, else -1
+CExtensionChecker::CExtensionChecker(IHandlerSource* pSource)
+{
 #ifdef _WIN64
-			val = (0 == StrCmpI(buffer, OurPropertyHandlerGuid64)) ? 1 : -1;
+	const WCHAR* pszOurHandler = OurPropertyHandlerGuid64;
 #else
-			val = (0 == StrCmpI(buffer, OurPropertyHandlerGuid32)) ? 1 : -1;
+	const WCHAR* pszOurHandler = OurPropertyHandlerGuid32;
 #endif	
-		}
-		else
-			val = 0;
 
-		m_extensions[pszExt] = val;
+	if (pSource)
+	{
+		std::shared_ptr<CHandlerTable> pTable = std::make_shared<CHandlerTable>();
+		pTable->Load(*pSource, pszOurHandler);
+		m_pTable = pTable;
 	}
+	else
+	{
+#ifdef _WIN32
+		CAutoLock lock(s_registryLock);
+		if (!s_pRegistryTable || s_registry.HasChanged())
+		{
+			std::shared_ptr<CHandlerTable> pTable = std::make_shared<CHandlerTable>();
+			pTable->Load(s_registry, pszOurHandler);
+			s_pRegistryTable = pTable;
+		}
+		m_pTable = s_pRegistryTable;
+#else
+		// Without a registry, no extension has a handler
+		m_pTable = std::make_shared<CHandlerTable>();
+#endif
+	}
+}
 
-	return val;
+// See if file is handled by our property handler, or another one, or none
+// Returns 1 if our handler is used, 0 if no handler is set up, or -1 if a foreign handler is used
+int CExtensionChecker::HasPropertyHandler(const wstring& fileName) const
+{
+	return m_pTable->Classify(fileName.c_str());
 }
 
 #pragma region Converters and string helpers
@@ -285,8 +390,6 @@ ConvertVarTypeToString( VARTYPE vt, WCHAR *pwszType, size_t cchType )
 
 #pragma region Tracing
 #if defined(_DEBUG) && defined(WIN32)
-#define TRACEF OutputDebugStringFormat
-
 void OutputDebugStringFormat( WCHAR* lpszFormat, ... )
 {
 	WCHAR    lpszBuffer[MAX_PATH];
@@ -298,59 +401,25 @@ void OutputDebugStringFormat( WCHAR* lpszFormat, ... )
 
    ::OutputDebugStringW( lpszBuffer );
 }
-#else
-#define TRACEF	__noop
 #endif
 #pragma endregion
 
-typedef HRESULT (CALLBACK* PFN_STGOPENSTGEX)(const WCHAR*, DWORD, DWORD, DWORD, void*, void*, REFIID riid, void **);
-
-PFN_STGOPENSTGEX  v_pfnStgOpenStorageEx; // StgOpenStorageEx (Win2K/XP only)
-
-BOOL GetStgOpenStorageEx()
+HRESULT MetadataPresent(wstring targetFile)
 {
-	if (!v_pfnStgOpenStorageEx)
-	{
-		BOOL fRunningOnNT = ((GetVersion() & 0x80000000) != 0x80000000);
-		v_pfnStgOpenStorageEx = ((fRunningOnNT) ? (PFN_STGOPENSTGEX)GetProcAddress(GetModuleHandle(L"OLE32"), "StgOpenStorageEx") : NULL);
-	}
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore());
+	if (!pStore)
+		return E_OUTOFMEMORY;
 
-	return (v_pfnStgOpenStorageEx != NULL);
+	return pStore->Probe(targetFile.c_str());
 }
 
-
-HRESULT MetadataPresent(wstring targetFile)
+HRESULT StampMetadata(wstring targetFile, MetadataStamp* pStamp)
 {
-    HRESULT hr = E_UNEXPECTED;
-	bool present = false;
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore());
+	if (!pStore)
+		return E_OUTOFMEMORY;
 
-	if (GetStgOpenStorageEx())
-	{
-		CComPtr<IPropertySetStorage> pPropSetStg;
-		CComPtr<IPropertyStore> pStore;		
-
-		hr = (v_pfnStgOpenStorageEx)(targetFile.c_str(), STGM_READ | STGM_SHARE_EXCLUSIVE, STGFMT_FILE, 0, NULL, 0, 
-				IID_IPropertySetStorage, (void**)&pPropSetStg);
-	
-		if (SUCCEEDED(hr))
-		{
-			// We use IPropertyStore for simplicity
-			hr = PSCreatePropertyStoreFromPropertySetStorage(pPropSetStg, STGM_READ, IID_IPropertyStore, (void **)&pStore);
-			pPropSetStg.Release();
-
-			if (SUCCEEDED(hr))
-			{
-				DWORD cProps;
-				hr = pStore->GetCount(&cProps);
-				present = cProps > 0;
-			}
-		}
-	}
-
-	if (SUCCEEDED(hr))
-		return present ? S_OK : S_FALSE;
-	else
-		return hr;
+	return pStore->Stamp(targetFile.c_str(), pStamp);
 }
 
 // Used in sort of proprty keys in ExportMetadata
@@ -367,79 +436,187 @@ inline bool operator<(const PROPERTYKEY& a, const PROPERTYKEY& b)
 		return a.pid < b.pid;
 }
 
-void ExportMetadata (xml_document<WCHAR> *doc, wstring targetFile, bool explorerView)
+// Opens the store for a file and reads its property keys, sorted into their property sets
+// throws CPHException on error
+static void ReadSortedKeys (IMetadataStore* pStore, wstring targetFile, bool explorerView, std::vector<PROPERTYKEY>& keys)
 {
-    HRESULT hr = E_UNEXPECTED;
-	CComPtr<IPropertyStore> pStore;
-	PROPERTYKEY * keys = NULL;
+	HRESULT hr = pStore->Open(targetFile.c_str(), false);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, explorerView ? IDS_E_PSCREATE_1 : IDS_E_IPSS_1, hr);
 
-	xml_node<WCHAR> *root = doc->allocate_node(node_element, MetadataNodeName);
-	doc->append_node(root);
+	DWORD cProps;
+	hr = pStore->GetCount(&cProps);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPS_GETCOUNT_1, hr);
 
-	try
+	keys.resize(cProps);
+
+	for (DWORD i = 0; i < cProps; i++)
 	{
-		if (explorerView)
-		{
-			// Access the property store that Explorer would see - will not always be our handler	
-			hr = SHGetPropertyStoreFromParsingName(targetFile.c_str(), NULL, GPS_READWRITE, IID_IPropertyStore, (void **)&pStore);
-		}
-		else
-		{
-			// Always use our own handler, which will access the alternate stream
-			CComPtr<IPropertySetStorage> pPropSetStg;
-			if (GetStgOpenStorageEx())
-			{
-				hr = (v_pfnStgOpenStorageEx)(targetFile.c_str(), STGM_READ | STGM_SHARE_EXCLUSIVE, STGFMT_FILE, 0, NULL, 0,
-						IID_IPropertySetStorage, (void**)&pPropSetStg);
-				if( FAILED(hr) ) 
-					throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
+		hr = pStore->GetAt(i, &keys[i]);
+		if( FAILED(hr) ) 
+			throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_GETAT_1, hr);
+	}
 
-				hr = PSCreatePropertyStoreFromPropertySetStorage(pPropSetStg, STGM_READ, IID_IPropertyStore, (void **)&pStore);
-				pPropSetStg.Release();
-			}
-		}
+	// Sort keys into their property sets
+	// We used to use IPropertyStorage to get the grouping, but this worked badly with Unicode property value
+	sort(keys.begin(), keys.end());
+}
 
-		if( FAILED(hr) ) 
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_PSCREATE_1, hr);
+void ExportMetadata (CXmlWriter& writer, wstring targetFile, bool explorerView)
+{
+	// Either what Explorer would see, which will not always be our handler, or always our own metadata
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(explorerView ? ExplorerMetadataStore : NativeMetadataStore));
+	if (!pStore)
+		throw CPHException(ERROR_OUTOFMEMORY, E_OUTOFMEMORY, IDS_E_PSCREATE_1, E_OUTOFMEMORY);
 
-		DWORD cProps;
-		hr = pStore->GetCount(&cProps);
-		if( FAILED(hr) ) 
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPS_GETCOUNT_1, hr);
+	ExportMetadata(writer, pStore.get(), targetFile, explorerView);
+}
 
-		keys = new PROPERTYKEY[cProps];
+// throws CPHException on error
+void ExportMetadata (CXmlWriter& writer, IMetadataStore* pStore, wstring targetFile, bool explorerView)
+{
+	std::vector<PROPERTYKEY> keys;
+	ReadSortedKeys(pStore, targetFile, explorerView, keys);
 
-		for (DWORD i = 0; i < cProps; i++)
-		{
-			hr = pStore->GetAt(i, &keys[i]);
-			if( FAILED(hr) ) 
-				throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_GETAT_1, hr);
-		}
+	writer.StartElement(MetadataNodeName);
 
-		// Sort keys into their property sets
-		// We used to use IPropertyStorage to get the grouping, but this worked badly with Unicode property value
-		sort(keys, &keys[cProps]);
+	// Loop through all the properties
+	DWORD index = 0;
+	DWORD cProps = (DWORD)keys.size();
 
-		// Loop through all the properties
-		DWORD index = 0;
+	while( index < cProps)
+	{
+		// Export the properties in the property set - throws exceptions on error
+		ExportPropertySetData( writer, &keys[0], cProps, index, pStore );
+	}
 
-		while( index < cProps)
-		{
-			// Export the properties in the property set - throws exceptions on error
-			ExportPropertySetData( doc, root, keys, index, pStore );
-		}
+	writer.EndElement();
+}
+
+// throws CPHException
+static void ThrowWriterError (const CFileXmlWriter& writer)
+{
+	if (writer.GetOpenError() != 0)
+		throw CPHException(writer.GetOpenError(), E_FAIL, IDS_E_FILEOPEN_1, writer.GetOpenError());
+	else
+		throw CPHException(writer.GetWriteError(), STG_E_WRITEFAULT, IDS_E_FILEWRITE_1, writer.GetWriteError());
+}
+
+// throws CPHException on error
+bool ExportMetadataToFile (wstring targetFile, wstring xmlFile, bool explorerView, ULONGLONG* pHash)
+{
+	CFileXmlWriter writer(xmlFile.c_str());
+
+	// To compare it with the last export, the whole document is needed before any of it is written
+	if (pHash != NULL)
+	{
+		wstring xml;
+		CStringXmlWriter stringWriter(xml);
+		ExportMetadata(stringWriter, targetFile, explorerView);
+		stringWriter.Close();
+
+		ULONGLONG hash = HashBytes(xml.data(), xml.size() * sizeof(WCHAR));
+		if (hash == *pHash)
+			return false;
+		*pHash = hash;
+
+		if (!writer.WriteDocument(xml))
+			ThrowWriterError(writer);
+		return true;
+	}
+
+	try
+	{
+		ExportMetadata(writer, targetFile, explorerView);
 	}
 	catch (CPHException& e)
 	{
-		delete [] keys;
+		writer.Discard();
 		throw e;
 	}
 
-	delete [] keys;
+	if (!writer.Close())
+		ThrowWriterError(writer);
+	return true;
 }
 
+// The same properties as ExportMetadata, in the compact binary format
 // throws CPHException on error
-void ExportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *root, PROPERTYKEY* keys, DWORD& index, CComPtr<IPropertyStore> pStore)
+bool ExportMetadataToBinaryFile (wstring targetFile, wstring binaryFile, bool explorerView, ULONGLONG* pHash)
+{
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore(explorerView ? ExplorerMetadataStore : NativeMetadataStore));
+	if (!pStore)
+		throw CPHException(ERROR_OUTOFMEMORY, E_OUTOFMEMORY, IDS_E_PSCREATE_1, E_OUTOFMEMORY);
+
+	std::vector<BYTE> data;
+	ExportMetadataToBinary(pStore.get(), targetFile, binaryFile, data, explorerView);
+
+	if (pHash != NULL)
+	{
+		ULONGLONG hash = HashBytes(&data[0], data.size());
+		if (hash == *pHash)
+			return false;
+		*pHash = hash;
+	}
+
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	int err = _wfopen_s(&pfile, binaryFile.c_str(), L"wb");
+#else
+	pfile = fopen(NarrowPath(binaryFile.c_str()).c_str(), "wb");
+	int err = pfile ? 0 : errno;
+#endif
+	if (err != 0)
+		throw CPHException(err, E_FAIL, IDS_E_FILEOPEN_1, err);
+
+	err = fwrite(&data[0], 1, data.size(), pfile) == data.size() ? 0 : errno;
+	if (fclose(pfile) != 0 && err == 0)
+		err = errno;
+	if (err != 0)
+	{
+#ifdef _WIN32
+		_wremove(binaryFile.c_str());
+#else
+		remove(NarrowPath(binaryFile.c_str()).c_str());
+#endif
+		throw CPHException(err, STG_E_WRITEFAULT, IDS_E_FILEWRITE_1, err);
+	}
+	return true;
+}
+
+// throws CPHException on error
+void ExportMetadataToBinary (IMetadataStore* pStore, wstring targetFile, wstring binaryFile, std::vector<BYTE>& data, bool explorerView)
+{
+	std::vector<PROPERTYKEY> keys;
+	ReadSortedKeys(pStore, targetFile, explorerView, keys);
+
+	// Values go straight into the property sets, without any conversion to text
+	std::vector<CPropertySet> sets;
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		if (sets.empty() || sets.back().GetFmtid() != keys[i].fmtid)
+			sets.push_back(CPropertySet(keys[i].fmtid));
+
+		PROPVARIANT propvar;
+		HRESULT hr = pStore->GetValue(keys[i], &propvar);
+		if( FAILED(hr) ) 
+		{
+			WCHAR pGuid[64];
+			StringFromGUID2( keys[i].fmtid, pGuid, 64);
+			throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_GETVALUE_3, hr, keys[i].pid, pGuid);
+		}
+		sets.back().AttachValue(keys[i].pid, propvar);
+	}
+
+	data.clear();
+	HRESULT hr = WriteBinaryMetadata(sets, data);
+	if (FAILED(hr))
+		throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_BINARYFORMAT_2, hr, binaryFile.c_str());
+}
+
+// throws CPHException on error
+void ExportPropertySetData (CXmlWriter& writer, PROPERTYKEY* keys, DWORD cKeys, DWORD& index, IMetadataStore* pStore)
 {
     HRESULT hr = E_UNEXPECTED;
 
@@ -448,30 +625,25 @@ void ExportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *root, PRO
 
 	PropVariantInit( &propvar );
 
-	WCHAR * pGuid = doc->allocate_string(NULL, 64);
+	WCHAR pGuid[64];
 	StringFromGUID2( currFmtid, pGuid, 64);
 
-	xml_node<WCHAR> *storage = doc->allocate_node(node_element, StorageNodeName);
-	root->append_node(storage);
+	writer.StartElement(StorageNodeName);
 
-	xml_attribute<WCHAR> * attr = NULL;
     if( FMTID_SummaryInformation == currFmtid )
-		attr = doc->allocate_attribute(DescriptionAttrName, L"SummaryInformation");
+		writer.Attribute(DescriptionAttrName, L"SummaryInformation");
     else if( FMTID_DocSummaryInformation == currFmtid )
-       attr = doc->allocate_attribute(DescriptionAttrName, L"DocumentSummaryInformation" );
+		writer.Attribute(DescriptionAttrName, L"DocumentSummaryInformation" );
     else if( FMTID_UserDefinedProperties == currFmtid )
-       attr = doc->allocate_attribute(DescriptionAttrName, L"UserDefined" );
-	if (attr != NULL)
-		storage->append_attribute(attr);
+		writer.Attribute(DescriptionAttrName, L"UserDefined" );
 
-	attr = doc->allocate_attribute(FormatIDAttrName, pGuid);
-	storage->append_attribute(attr);
+	writer.Attribute(FormatIDAttrName, pGuid);
 
 	try
 	{
 		// Loop through each property with the same FMTID
 
-		for(; currFmtid == keys[index].fmtid; index++ )
+		for(; index < cKeys && currFmtid == keys[index].fmtid; index++ )
 		{
 			// Read the property out of the property set
 			PropVariantInit( &propvar );
@@ -480,51 +652,54 @@ void ExportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *root, PRO
 				throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_GETVALUE_3, hr, keys[index].pid, pGuid);
 
 			// Export the property value, type, and so on.
-			WCHAR* wszId = doc->allocate_string(NULL, 20);
-			WCHAR* wszTypeId = doc->allocate_string(NULL, 20);
-			WCHAR* wszType = doc->allocate_string(NULL, MAX_PATH + 1);
-			WCHAR* wszValue = doc->allocate_string(NULL, MAX_PATH + 1);
+			WCHAR wszId[20];
+			WCHAR wszTypeId[20];
+			WCHAR wszType[MAX_PATH + 1];
+			WCHAR wszValue[MAX_PATH + 1];
 
-			StringCbPrintf (wszId, 20, L"%d", keys[index].pid);
-			StringCbPrintf (wszTypeId, 20, L"%d", propvar.vt);
+			StringCbPrintf (wszId, sizeof(wszId), L"%d", keys[index].pid);
+			StringCbPrintf (wszTypeId, sizeof(wszTypeId), L"%d", propvar.vt);
 			ConvertVarTypeToString( propvar.vt, wszType, MAX_PATH);
 
-			xml_node<WCHAR> *prop = doc->allocate_node(node_element, PropertyNodeName);
-			storage->append_node(prop);
-
-			PWSTR pName = NULL;
-			hr = PSGetNameFromPropertyKey(keys[index], &pName);
+			writer.StartElement(PropertyNodeName);
 
 			// If we don't get a name, don't worry as it is for documentation only and not read on import
-			if (SUCCEEDED(hr))
-			{
-				WCHAR* wszName = doc->allocate_string(pName, wcslen(pName)+1);
-				CoTaskMemFree(pName);
-				attr = doc->allocate_attribute(NameAttrName, wszName);
-				prop->append_attribute(attr);
-			}
-
-			attr = doc->allocate_attribute(PropertyIdAttrName, wszId);
-			prop->append_attribute(attr);
-
-			attr = doc->allocate_attribute(TypeAttrName, wszType);
-			prop->append_attribute(attr);
+			const WCHAR* pszName;
+			if (CPropertyNameCache::Instance().GetName(keys[index], &pszName))
+				writer.Attribute(NameAttrName, pszName);
 
-			attr = doc->allocate_attribute(TypeIdAttrName, wszTypeId);
-			prop->append_attribute(attr);
+			writer.Attribute(PropertyIdAttrName, wszId);
+			writer.Attribute(TypeAttrName, wszType);
+			writer.Attribute(TypeIdAttrName, wszTypeId);
 
 			// PSFormatForDisplay would be natural here if we wanted max readability, as it formats nicely and respects locale,
 			// but we use coercion because we're more concerned with round-tripping the value when we import it again.
 			// The exception is the vector (array) types where we want the multi-value formatting, and coercion to a simple string fails anyway.
 			// It does put a blank after each semicolon separator though, which we have to remove on import.
+			// The common types are formatted directly, producing the same text without the overhead.
+			const WCHAR* pszText = wszValue;
+			bool bFormatted;
 			if (propvar.vt & VT_VECTOR)
+				bFormatted = FormatVectorText(propvar, wszValue, MAX_PATH + 1);
+			else
+				bFormatted = FormatValueText(propvar, wszValue, MAX_PATH + 1, &pszText);
+
+			if (bFormatted)
+			{
+				writer.StartElement(ValueNodeName);
+				writer.Text(pszText);
+				writer.EndElement();
+			}
+#ifdef _WIN32
+			else if (propvar.vt & VT_VECTOR)
 			{
 				hr = PSFormatForDisplay(keys[index], propvar, PDFF_DEFAULT, wszValue, MAX_PATH);
 
 				if (SUCCEEDED(hr)) 
 				{
-					xml_node<WCHAR> *node = doc->allocate_node(node_element, ValueNodeName, wszValue);
-					prop->append_node(node);
+					writer.StartElement(ValueNodeName);
+					writer.Text(wszValue);
+					writer.EndElement();
 				}
 				else
 					throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_PSFORMAT_3, hr, keys[index].pid, pGuid);
@@ -536,15 +711,22 @@ void ExportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *root, PRO
 
 				if (SUCCEEDED(hr)) 
 				{
-					WCHAR* wszDisp = doc->allocate_string(propvarString.pwszVal, wcslen(propvarString.pwszVal)+1);
-
-					xml_node<WCHAR> *node = doc->allocate_node(node_element, ValueNodeName, wszDisp);
-					prop->append_node(node);
+					writer.StartElement(ValueNodeName);
+					writer.Text(propvarString.pwszVal);
+					writer.EndElement();
 				}
 				PropVariantClear(&propvarString);
 				if (FAILED(hr))
 					throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_PSFORMAT_3, hr, keys[index].pid, pGuid);
 			}
+#else
+			// Only the property system can format the other types
+			else
+				throw CPHException(ERROR_INVALID_FUNCTION, E_NOTIMPL, IDS_E_PSFORMAT_3, E_NOTIMPL, keys[index].pid, pGuid);
+#endif
+
+			writer.EndElement();
+			PropVariantClear( &propvar );
         }
     }
 	catch (CPHException& e)
@@ -553,69 +735,262 @@ void ExportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *root, PRO
 		throw e;
     }
 
-    PropVariantClear( &propvar );
+	writer.EndElement();
+}
+
+// Marks every property of an open store for removal, so that what is imported afterwards replaces them.
+// Through a CDeferredWriteMetadataStore, a property that is then imported with the value it already had
+// is left as it was, so replacing metadata with the same again writes nothing.
+// throws CPHException on error
+static void RemoveAllProperties (IMetadataStore* pStore)
+{
+	DWORD cProps;
+	HRESULT hr = pStore->GetCount(&cProps);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPS_GETCOUNT_1, hr);
+
+	// Removing properties renumbers those that are left, so collect them all first
+	std::vector<PROPERTYKEY> keys(cProps);
+	for (DWORD i = 0; i < cProps; i++)
+	{
+		hr = pStore->GetAt(i, &keys[i]);
+		if( FAILED(hr) ) 
+			throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_GETAT_1, hr);
+	}
+
+	PROPVARIANT empty;
+	PropVariantInit(&empty);
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		hr = pStore->SetValue(keys[i], empty);
+		if (FAILED(hr))
+		{
+			WCHAR wszId[20];
+			StringCbPrintf (wszId, sizeof(wszId), L"%d", keys[i].pid);
+			throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_SETVALUE_2, hr, wszId);
+		}
+	}
 }
 
+// Whether a property should be imported, which in add-only mode is only when the file does not have it
 // throws CPHException on error
-void ImportMetadata (xml_document<WCHAR> *doc, wstring targetFile)
+static bool ShouldImport (IMetadataStore* pStore, REFPROPERTYKEY key, ImportMode mode)
+{
+	if (mode != AddOnlyImport)
+		return true;
+
+	PROPVARIANT propvar;
+	HRESULT hr = pStore->GetValue(key, &propvar);
+	if (FAILED(hr))
+	{
+		WCHAR pGuid[64];
+		StringFromGUID2(key.fmtid, pGuid, 64);
+		throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_GETVALUE_3, hr, key.pid, pGuid);
+	}
+
+	bool bPresent = propvar.vt != VT_EMPTY;
+	PropVariantClear(&propvar);
+	return !bPresent;
+}
+
+// throws CPHException on error
+void ImportMetadata (xml_document<WCHAR> *doc, wstring targetFile, ImportMode mode, IUndoRecorder* pUndo)
+{
+	// Only values that differ from those already there are written, so the storage is opened
+	// for writing only if there are any
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore());
+	if (!pStore)
+		throw CPHException(ERROR_OUTOFMEMORY, E_OUTOFMEMORY, IDS_E_IPSS_1, E_OUTOFMEMORY);
+
+	ImportMetadata(doc, pStore.get(), targetFile, mode, pUndo);
+}
+
+// throws CPHException on error
+void ImportMetadata (xml_document<WCHAR> *doc, CDeferredWriteMetadataStore* pStore, wstring targetFile, ImportMode mode, IUndoRecorder* pUndo)
 {
     HRESULT hr = E_UNEXPECTED;
 
-	xml_node<WCHAR> *root = doc->allocate_node(node_element, MetadataNodeName);
-	doc->append_node(root);
+	xml_node<WCHAR>* root = doc->first_node();
+	if (!root || wcscmp(root->name(), MetadataNodeName) != 0)
+		throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_ROOT_1, root ? root->name() : L"");
+
+	// Don't touch the storage if there is no metadata, unless it is to replace what is there with nothing
+	if (!root->first_node() && mode != ReplaceImport)
+		return;
+
+	hr = pStore->Open(targetFile.c_str(), true);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
+	pStore->SetUndoRecorder(pUndo);
 
-	if (GetStgOpenStorageEx())
+	// Replacing is all one change, committed with the rest, so that it needs no separate delete
+	if (mode == ReplaceImport)
+		RemoveAllProperties(pStore);
+
+	// Holds parsed vectors, reused for each property of every storage
+	CValueArena arena;
+
+	// iterate over the storages
+	xml_node<WCHAR>* stor = root->first_node();
+	while (stor)
 	{
-		CComPtr<IPropertySetStorage> pPropSetStg;
-		CComPtr<IPropertyStore> pStore;	
-
-		xml_node<WCHAR>* root = doc->first_node();
-		if (wcscmp(root->name(), MetadataNodeName) != 0)
-			throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_ROOT_1, root->name());
-
-		// Don't touch the storage if there is no metadata
-		if (!root->first_node())
-			return;
-		 
-		hr = (v_pfnStgOpenStorageEx)(targetFile.c_str(), STGM_READWRITE | STGM_SHARE_EXCLUSIVE, STGFMT_FILE, 0, NULL, 0, 
-				IID_IPropertySetStorage, (void**)&pPropSetStg);
-		if( FAILED(hr) ) 
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
+		if (wcscmp(stor->name(), StorageNodeName) != 0)
+			throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_STORAGE_1, stor->name());
 
-		// We use IPropertyStore for writing for simplicity
-		hr = PSCreatePropertyStoreFromPropertySetStorage(pPropSetStg, STGM_READWRITE, IID_IPropertyStore, (void **)&pStore);
-		pPropSetStg.Release();
-		if( FAILED(hr) ) 
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_PSCREATE_1, hr);
+		xml_attribute<WCHAR>* id = stor->first_attribute(FormatIDAttrName);
+		if (!id)
+			throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_NOFORMATID);
 
-		// iterate over the storages
-		xml_node<WCHAR>* stor = root->first_node();
-		while (stor)
-		{
-			if (wcscmp(stor->name(), StorageNodeName) != 0)
-				throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_STORAGE_1, stor->name());
+		FMTID fmtid;
+		hr = CLSIDFromString (id->value(), &fmtid);
+		if (FAILED(hr))
+			throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_BADFORMATID_1, id->value());
 
-			xml_attribute<WCHAR>* id = stor->first_attribute(FormatIDAttrName);
-			if (!id)
-				throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_NOFORMATID);
+		ImportPropertySetData(doc, stor, fmtid, pStore, arena, mode);
 
-			FMTID fmtid;
-			hr = CLSIDFromString (id->value(), &fmtid);
-			if (FAILED(hr))
-				throw CPHException(ERROR_XML_PARSE_ERROR, E_UNEXPECTED, IDS_E_BADFORMATID_1, id->value());
+		stor = stor->next_sibling();
+	}
 
-			ImportPropertySetData(doc, stor, fmtid, pStore);
+	hr = pStore->Commit();
+	if (FAILED(hr))
+		throw CPHException(ERROR_WRITE_FAULT, hr, IDS_E_IPS_COMMIT_1, hr);
+}
 
-			stor = stor->next_sibling();
-		}
 
-		pStore->Commit();
+// Parses the text of an XML metadata file in place, and applies it
+// throws CPHException on error
+void ImportMetadataFromXml (WCHAR* pszXml, wstring targetFile, wstring xmlFile, ImportMode mode, IUndoRecorder* pUndo)
+{
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore());
+	if (!pStore)
+		throw CPHException(ERROR_OUTOFMEMORY, E_OUTOFMEMORY, IDS_E_IPSS_1, E_OUTOFMEMORY);
+
+	ImportMetadataFromXml(pszXml, pStore.get(), targetFile, xmlFile, mode, pUndo);
+}
+
+// throws CPHException on error
+void ImportMetadataFromXml (WCHAR* pszXml, CDeferredWriteMetadataStore* pStore, wstring targetFile, wstring xmlFile, ImportMode mode, IUndoRecorder* pUndo)
+{
+	xml_document<WCHAR> doc;
+
+	try
+	{
+		doc.parse<0>(pszXml);
 	}
+	catch(parse_error& e)
+	{
+		size_t size = strlen(e.what()) + 1;
+		WCHAR * error = new WCHAR[size];
+#ifdef _WIN32
+		size_t convertedChars = 0;
+		mbstowcs_s(&convertedChars, error, size, e.what(), _TRUNCATE);
+#else
+		mbstowcs(error, e.what(), size);
+		error[size - 1] = L'\0';
+#endif
+
+#define MAX_ERRLENGTH 20
+		WCHAR content[MAX_ERRLENGTH + 1];
+		size = wcslen(e.where<WCHAR>());
+		if (size > MAX_ERRLENGTH)
+			size = MAX_ERRLENGTH;
+		wmemcpy(content, e.where<WCHAR>(), size);
+		content[size] = L'\0';  // ensure termination
+
+		CPHException cphe = CPHException(ERROR_XML_PARSE_ERROR, E_FAIL, IDS_E_XML_PARSE_ERROR_3, error, content, xmlFile.c_str());
+		delete [] error;
+		throw cphe;
+	}
+
+	// apply it 
+	ImportMetadata(&doc, pStore, targetFile, mode, pUndo);
+}
+
+// Whether a metadata file is in the binary format, judging by its signature
+bool IsBinaryMetadataFile (wstring metadataFile)
+{
+	BYTE signature[8];
+	FILE* pfile = NULL;
+#ifdef _WIN32
+	if (0 != _wfopen_s(&pfile, metadataFile.c_str(), L"rb"))
+		return false;
+#else
+	pfile = fopen(NarrowPath(metadataFile.c_str()).c_str(), "rb");
+	if (!pfile)
+		return false;
+#endif
+
+	size_t cb = fread(signature, 1, sizeof(signature), pfile);
+	fclose(pfile);
+	return IsBinaryMetadata(signature, cb);
 }
 
+// throws CPHException on error
+void ImportMetadataFromBinaryFile (wstring targetFile, wstring binaryFile, ImportMode mode, IUndoRecorder* pUndo)
+{
+	std::vector<BYTE> data;
+	int err = ReadFileBytes(binaryFile.c_str(), data);
+	if (err != 0)
+		throw CPHException(err, E_FAIL, IDS_E_FILEOPEN_1, err);
+
+	// As for XML, only what has changed is written
+	std::unique_ptr<CDeferredWriteMetadataStore> pStore(CreateDeferredWriteMetadataStore());
+	if (!pStore)
+		throw CPHException(ERROR_OUTOFMEMORY, E_OUTOFMEMORY, IDS_E_IPSS_1, E_OUTOFMEMORY);
+
+	ImportMetadataFromBinary(data, pStore.get(), targetFile, binaryFile, mode, pUndo);
+}
 
 // throws CPHException on error
-void ImportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *stor, FMTID fmtid, CComPtr<IPropertyStore> pStore)
+void ImportMetadataFromBinary (const std::vector<BYTE>& data, CDeferredWriteMetadataStore* pStore, wstring targetFile, wstring binaryFile, ImportMode mode, IUndoRecorder* pUndo)
+{
+	std::vector<CPropertySet> sets;
+	HRESULT hr = ReadBinaryMetadata(data.empty() ? NULL : &data[0], data.size(), sets);
+	if (FAILED(hr))
+		throw CPHException(ERROR_FILE_CORRUPT, hr, IDS_E_BINARYFORMAT_2, hr, binaryFile.c_str());
+
+	// Don't touch the storage if there is no metadata, unless it is to replace what is there with nothing
+	DWORD cProps = 0;
+	for (size_t i = 0; i < sets.size(); i++)
+		cProps += sets[i].GetCount();
+	if (cProps == 0 && mode != ReplaceImport)
+		return;
+
+	hr = pStore->Open(targetFile.c_str(), true);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
+	pStore->SetUndoRecorder(pUndo);
+
+	if (mode == ReplaceImport)
+		RemoveAllProperties(pStore);
+
+	for (size_t i = 0; i < sets.size(); i++)
+	{
+		for (DWORD j = 0; j < sets[i].GetCount(); j++)
+		{
+			PROPERTYKEY key;
+			key.fmtid = sets[i].GetFmtid();
+			key.pid = sets[i].GetIdAt(j);
+			if (!ShouldImport(pStore, key, mode))
+				continue;
+
+			hr = pStore->SetValue(key, sets[i].GetValueAt(j));
+			if (FAILED(hr))
+			{
+				WCHAR wszId[20];
+				StringCbPrintf (wszId, sizeof(wszId), L"%d", key.pid);
+				throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_SETVALUE_2, hr, wszId);
+			}
+		}
+	}
+
+	hr = pStore->Commit();
+	if (FAILED(hr))
+		throw CPHException(ERROR_WRITE_FAULT, hr, IDS_E_IPS_COMMIT_1, hr);
+}
+
+// throws CPHException on error
+void ImportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *stor, FMTID fmtid, IMetadataStore* pStore, CValueArena& arena, ImportMode mode)
 {
  	// iterate over the properties
 	xml_node<WCHAR>* prop = stor->first_node();
@@ -645,64 +1020,90 @@ void ImportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *stor, FMT
 		key.fmtid = fmtid;
 		key.pid =  wcstol(id->value(), &stop, 10);
 
-		PROPVARIANT propvarString = {0};
-		PROPVARIANT propvarValue = {0};
+		if (!ShouldImport(pStore, key, mode))
+		{
+			prop = prop->next_sibling();
+			continue;
+		}
+
+		// The common types are parsed directly, and anything else is coerced from the string
+		PROPVARIANT propvarParsed;
+		arena.Reset();
+		if (ParseValueText(val->value(), vt, arena, &propvarParsed))
+		{
+			HRESULT hr = pStore->SetValue(key, propvarParsed);
+			if (FAILED(hr))
+				throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_SETVALUE_2, hr, name != NULL ? name->value(): id->value());
 
-		try
+			TRACEF(L"Set property with Name or Id %s to %s\n",  name != NULL ? name->value(): id->value(), val->value() );
+		}
+#ifdef _WIN32
+		else
 		{
-			HRESULT hr;
+			PROPVARIANT propvarString = {0};
+			PROPVARIANT propvarValue = {0};
 
-			// Coercion does not handle array strings well, or other array types at all
-			// We need to split the input into an array of string values that can be coerced
-			if (vt & VT_VECTOR)
+			try
 			{
-				wstring s = val->value();
-				std::vector<std::wstring> ss = wsplit(s, L';');
-				
-				PCWSTR * ps = NULL;
-				ps = new PCWSTR[ss.size()];
-				for (unsigned int i = 0; i < ss.size(); i++)
+				HRESULT hr;
+
+				// Coercion does not handle array strings well, or other array types at all
+				// We need to split the input into an array of string values that can be coerced
+				if (vt & VT_VECTOR)
 				{
-					// Non-first elements begin with a blank after each ';' put there by formatting for display on export
-					// If present, remove
-					if (i > 0 && ss[i].size() > 0 && ss[i][0] == L' ')
-						ps[i] = ss[i].c_str() + 1;
-					else
-						ps[i] = ss[i].c_str();
+					wstring s = val->value();
+					std::vector<std::wstring> ss = wsplit(s, L';');
+				
+					PCWSTR * ps = NULL;
+					ps = new PCWSTR[ss.size()];
+					for (unsigned int i = 0; i < ss.size(); i++)
+					{
+						// Non-first elements begin with a blank after each ';' put there by formatting for display on export
+						// If present, remove
+						if (i > 0 && ss[i].size() > 0 && ss[i][0] == L' ')
+							ps[i] = ss[i].c_str() + 1;
+						else
+							ps[i] = ss[i].c_str();
+					}
+
+					hr = InitPropVariantFromStringVector(ps, (ULONG)ss.size(), &propvarString);
+					delete [] ps;
 				}
+				else
+					hr = InitPropVariantFromString(val->value(), &propvarString);
 
-				hr = InitPropVariantFromStringVector(ps, (ULONG)ss.size(), &propvarString);
-				delete [] ps;
-			}
-			else
-				hr = InitPropVariantFromString(val->value(), &propvarString);
-
-			if (SUCCEEDED(hr))
-			{
-				hr = PropVariantChangeType(&propvarValue, propvarString, 0, vt);
 				if (SUCCEEDED(hr))
 				{
-					hr = pStore->SetValue(key, propvarValue);
-					if (FAILED(hr))
-						throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_SETVALUE_2, hr, name != NULL ? name->value(): id->value());
-
-					TRACEF(L"Set property with Name or Id %s to %s\n",  name != NULL ? name->value(): id->value(), val->value() );
+					hr = PropVariantChangeType(&propvarValue, propvarString, 0, vt);
+					if (SUCCEEDED(hr))
+					{
+						hr = pStore->SetValue(key, propvarValue);
+						if (FAILED(hr))
+							throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPS_SETVALUE_2, hr, name != NULL ? name->value(): id->value());
+
+						TRACEF(L"Set property with Name or Id %s to %s\n",  name != NULL ? name->value(): id->value(), val->value() );
 	
-					PropVariantClear(&propvarString);
-					PropVariantClear(&propvarValue);
+						PropVariantClear(&propvarString);
+						PropVariantClear(&propvarValue);
+					}
+					else
+						throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_VAR_COERCE_2, hr, name != NULL ? name->value(): id->value());
 				}
 				else
-					throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_VAR_COERCE_2, hr, name != NULL ? name->value(): id->value());
+					throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_VAR_INIT_2, hr, name != NULL ? name->value(): id->value());
+			}
+			catch (CPHException& e)
+			{
+				PropVariantClear(&propvarString);
+				PropVariantClear(&propvarValue);
+				throw e;
 			}
-			else
-				throw CPHException(ERROR_INVALID_FUNCTION, hr, IDS_E_VAR_INIT_2, hr, name != NULL ? name->value(): id->value());
-		}
-		catch (CPHException& e)
-		{
-			PropVariantClear(&propvarString);
-			PropVariantClear(&propvarValue);
-			throw e;
 		}
+#else
+		// Only the property system can coerce the other types
+		else
+			throw CPHException(ERROR_INVALID_FUNCTION, E_NOTIMPL, IDS_E_VAR_COERCE_2, E_NOTIMPL, name != NULL ? name->value(): id->value());
+#endif
 
 		prop = prop->next_sibling();
 	}
@@ -712,43 +1113,32 @@ void DeleteMetadata (wstring targetFile)
 {
     HRESULT hr = E_UNEXPECTED;
 
-	if (GetStgOpenStorageEx())
-	{
-		CComPtr<IPropertySetStorage> pPropSetStg;
-		CComPtr<IEnumSTATPROPSETSTG> penum;
-		STATPROPSETSTG statpropsetstg;
+	std::unique_ptr<IMetadataStore> pStore(CreateMetadataStore());
+	if (!pStore)
+		throw CPHException(ERROR_OUTOFMEMORY, E_OUTOFMEMORY, IDS_E_IPSS_1, E_OUTOFMEMORY);
 
-		hr = (v_pfnStgOpenStorageEx)(targetFile.c_str(), STGM_READWRITE | STGM_SHARE_EXCLUSIVE, STGFMT_FILE, 0, NULL, 0, 
-				IID_IPropertySetStorage, (void**)&pPropSetStg);
-		if( FAILED(hr) ) 
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
+	hr = pStore->Open(targetFile.c_str(), true);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
 
-		hr = pPropSetStg->Enum( &penum );
-		if( FAILED(hr) ) 
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_ENUM_1, hr);
-
-		memset( &statpropsetstg, 0, sizeof(statpropsetstg) );
-	    hr = penum->Next( 1, &statpropsetstg, NULL );
+	std::vector<FMTID> fmtids;
+	hr = pStore->EnumPropertySets(fmtids);
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_ENUM_1, hr);
 
-	    // Delete all the property sets.
-		while( S_OK == hr )
+	// Delete all the property sets.
+	for (size_t i = 0; i < fmtids.size(); i++)
+	{
+		hr = pStore->DeletePropertySet(fmtids[i]);
+		if( FAILED(hr) ) 
 		{
-			// Delete the property set.
-			hr = pPropSetStg->Delete( statpropsetstg.fmtid);
-			if( FAILED(hr) ) 
-			{
-				WCHAR pGuid[64];
-				StringFromGUID2( statpropsetstg.fmtid, pGuid, 64);		
-				throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPSS_DELETE_2, hr, pGuid);
-			}
-
-			// Get the next property set in the enumeration.
-			hr = penum->Next( 1, &statpropsetstg, NULL );
-
+			WCHAR pGuid[64];
+			StringFromGUID2( fmtids[i], pGuid, 64);		
+			throw CPHException(ERROR_UNKNOWN_PROPERTY, hr, IDS_E_IPSS_DELETE_2, hr, pGuid);
 		}
-		if( FAILED(hr) )
-			throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_ENUM_NEXT_1, hr);
 	}
-}
-
 
+	hr = pStore->Commit();
+	if( FAILED(hr) ) 
+		throw CPHException(ERROR_OPEN_FAILED, hr, IDS_E_IPSS_1, hr);
+}
@@ -2,20 +2,35 @@
 #include "stdafx.h"
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
+#ifdef _WIN32
 #include <shlwapi.h>
 #include <propsys.h>
 #include <propkey.h>
 #include <Propvarutil.h>
+#endif
 #undef RAPIDXML_NO_EXCEPTIONS
 #include "rapidxml.hpp"
-#include "rapidxml_print.hpp"
+#ifdef _WIN32
 #include "resource.h"
+#else
+// The string resource IDs, which the build generates from resource.h, as the compiler cannot read its UTF-16
+#include "ResourceIds.h"
+#endif
+#include "MappedXmlFile.h"
+#include "MetadataStore.h"
+#include "XmlWriter.h"
+#include "MetadataBinary.h"
+#include "ValueText.h"
+#include "PropertyNames.h"
+#include "HandlerTable.h"
 
 using namespace rapidxml;
 using namespace std;
 
-static const WCHAR* MetadataFileSuffix	= L".metadata.xml";
+static const WCHAR* const MetadataFileSuffix	= L".metadata.xml";
+static const WCHAR* const MetadataBinaryFileSuffix	= L".metadata.fmb";
 
 class CPHException 
 {
@@ -35,11 +50,16 @@ private:
 class CExtensionChecker
 {
 private:
-	std::map<std::wstring, int> m_extensions;		// map of extensions checked so far
+	std::shared_ptr<const CHandlerTable>	m_pTable;	// the table in use, which is only read
 
 public:
+	// Uses the registrations in the registry, which are read once and then shared by the whole process
+	// until they change, or else those from the given source
+	CExtensionChecker(IHandlerSource* pSource = NULL);
+
 	// See if file is handled by our property handler, or another, or none
-	int HasPropertyHandler(wstring fileName);
+	// Any number of threads may call this at once
+	int HasPropertyHandler(const wstring& fileName) const;
 };
 
 int AccessResourceString(UINT uId, LPWSTR lpBuffer, int nBufferMax);
@@ -54,18 +74,48 @@ void ConvertVarTypeToString( VARTYPE vt, WCHAR *pwszType, size_t cchType );
 #if defined(_DEBUG) && defined(WIN32)
 #define TRACEF OutputDebugStringFormat
 void OutputDebugStringFormat( WCHAR* lpszFormat, ... );
-#else
+#elif defined(_MSC_VER)
 #define TRACEF	__noop
+#else
+#define TRACEF(...)
 #endif
 
-typedef HRESULT (CALLBACK* PFN_STGOPENSTGEX)(const WCHAR*, DWORD, DWORD, DWORD, void*, void*, REFIID riid, void **);
-
 HRESULT MetadataPresent(wstring targetFile);
-void ExportMetadata (xml_document<WCHAR> *doc, wstring targetFile, bool explorerView = false);
-void ExportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *root, PROPERTYKEY* keys, DWORD& index, CComPtr<IPropertyStore> pStore);
+HRESULT StampMetadata(wstring targetFile, MetadataStamp* pStamp);
+void ExportMetadata (CXmlWriter& writer, wstring targetFile, bool explorerView = false);
+
+// The same from a store that the caller has created, of whatever kind, and not yet opened;
+// explorerView says whether it is the Explorer store, which is only used in reporting errors
+void ExportMetadata (CXmlWriter& writer, IMetadataStore* pStore, wstring targetFile, bool explorerView = false);
+
+// With pHash, the file is only written if the hash of what would be written differs from *pHash,
+// which is then updated; each returns whether the file was written
+bool ExportMetadataToFile (wstring targetFile, wstring xmlFile, bool explorerView = false, ULONGLONG* pHash = NULL);
+bool ExportMetadataToBinaryFile (wstring targetFile, wstring binaryFile, bool explorerView = false, ULONGLONG* pHash = NULL);
+
+// The binary format in memory, from a store as for ExportMetadata; binaryFile only names the data in errors
+void ExportMetadataToBinary (IMetadataStore* pStore, wstring targetFile, wstring binaryFile, std::vector<BYTE>& data, bool explorerView = false);
+void ExportPropertySetData (CXmlWriter& writer, PROPERTYKEY* keys, DWORD cKeys, DWORD& index, IMetadataStore* pStore);
+
+// How imported metadata combines with what the file already has
+enum ImportMode
+{
+	MergeImport,		// imported values replace those already there, and other properties are kept
+	ReplaceImport,		// the file is left with exactly the imported properties, and no others
+	AddOnlyImport,		// only properties that the file does not already have are imported
+};
 
-void ImportMetadata (xml_document<WCHAR> *doc, wstring targetFile);
-void ImportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *stor, FMTID fmtid, CComPtr<IPropertyStore> pStore);
+// With pUndo, what an import overwrites is recorded before it is written
+void ImportMetadata (xml_document<WCHAR> *doc, wstring targetFile, ImportMode mode = MergeImport, IUndoRecorder* pUndo = NULL);
+void ImportMetadataFromXml (WCHAR* pszXml, wstring targetFile, wstring xmlFile, ImportMode mode = MergeImport, IUndoRecorder* pUndo = NULL);
+bool IsBinaryMetadataFile (wstring metadataFile);
+void ImportMetadataFromBinaryFile (wstring targetFile, wstring binaryFile, ImportMode mode = MergeImport, IUndoRecorder* pUndo = NULL);
+
+// The same into a store that the caller has created, of whatever kind, and not yet opened
+void ImportMetadata (xml_document<WCHAR> *doc, CDeferredWriteMetadataStore* pStore, wstring targetFile, ImportMode mode = MergeImport, IUndoRecorder* pUndo = NULL);
+void ImportMetadataFromXml (WCHAR* pszXml, CDeferredWriteMetadataStore* pStore, wstring targetFile, wstring xmlFile, ImportMode mode = MergeImport, IUndoRecorder* pUndo = NULL);
+void ImportMetadataFromBinary (const std::vector<BYTE>& data, CDeferredWriteMetadataStore* pStore, wstring targetFile, wstring binaryFile, ImportMode mode = MergeImport, IUndoRecorder* pUndo = NULL);
+void ImportPropertySetData (xml_document<WCHAR> *doc, xml_node<WCHAR> *stor, FMTID fmtid, IMetadataStore* pStore, CValueArena& arena, ImportMode mode = MergeImport);
 
 void DeleteMetadata (wstring targetFile);
 
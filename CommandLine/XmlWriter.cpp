@@ -0,0 +1,299 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+#include "XmlWriter.h"
+#include <errno.h>
+
+#pragma region CXmlWriter
+
+CXmlWriter::CXmlWriter() : _bStartTagOpen(false), _bFailed(false), _bClosed(false), _cchBuffer(0)
+{
+}
+
+CXmlWriter::~CXmlWriter()
+{
+}
+
+void CXmlWriter::StartElement(const WCHAR* pszName)
+{
+	if (!_elements.empty())
+	{
+		// The parent's children go on their own lines
+		if (_bStartTagOpen)
+		{
+			Put(L'>');
+			Put(L'\n');
+		}
+		_elements.back().bHasChildren = true;
+	}
+
+	PutIndent(_elements.size());
+	Put(L'<');
+	PutString(pszName);
+
+	Element element = { pszName, false };
+	_elements.push_back(element);
+	_bStartTagOpen = true;
+}
+
+void CXmlWriter::Attribute(const WCHAR* pszName, const WCHAR* pszValue)
+{
+	if (!_bStartTagOpen)
+		return;
+
+	Put(L' ');
+	PutString(pszName);
+	Put(L'=');
+
+	// Quote with whichever of " and ' saves escaping the other, as rapidxml does
+	if (wcschr(pszValue, L'"') != NULL)
+	{
+		Put(L'\'');
+		PutEscaped(pszValue, L'"');
+		Put(L'\'');
+	}
+	else
+	{
+		Put(L'"');
+		PutEscaped(pszValue, L'\'');
+		Put(L'"');
+	}
+}
+
+void CXmlWriter::Text(const WCHAR* pszText)
+{
+	// An element with empty text is written as an empty element
+	if (*pszText == L'\0')
+		return;
+
+	if (_bStartTagOpen)
+	{
+		Put(L'>');
+		_bStartTagOpen = false;
+	}
+	PutEscaped(pszText, L'\0');
+}
+
+void CXmlWriter::EndElement()
+{
+	if (_elements.empty())
+		return;
+
+	Element element = _elements.back();
+	_elements.pop_back();
+
+	if (_bStartTagOpen)
+	{
+		Put(L'/');
+		Put(L'>');
+		_bStartTagOpen = false;
+	}
+	else
+	{
+		if (element.bHasChildren)
+			PutIndent(_elements.size());
+		Put(L'<');
+		Put(L'/');
+		PutString(element.pszName);
+		Put(L'>');
+	}
+	Put(L'\n');
+}
+
+bool CXmlWriter::Close()
+{
+	if (!_bClosed)
+	{
+		while (!_elements.empty())
+			EndElement();
+
+		// rapidxml ends the document itself with a newline too
+		Put(L'\n');
+		Flush();
+		_bClosed = true;
+	}
+	return !_bFailed;
+}
+
+void CXmlWriter::PutString(const WCHAR* psz)
+{
+	while (*psz)
+		Put(*psz++);
+}
+
+void CXmlWriter::PutEscaped(const WCHAR* psz, WCHAR noExpand)
+{
+	for (; *psz; psz++)
+	{
+		if (*psz == noExpand)
+		{
+			Put(*psz);
+			continue;
+		}
+
+		switch (*psz)
+		{
+		case L'<':	PutString(L"&lt;");		break;
+		case L'>':	PutString(L"&gt;");		break;
+		case L'\'':	PutString(L"&apos;");	break;
+		case L'"':	PutString(L"&quot;");	break;
+		case L'&':	PutString(L"&amp;");	break;
+		default:	Put(*psz);				break;
+		}
+	}
+}
+
+void CXmlWriter::PutIndent(size_t depth)
+{
+	for (size_t i = 0; i < depth; i++)
+		Put(L'\t');
+}
+
+void CXmlWriter::Flush()
+{
+	if (_cchBuffer > 0 && !_bFailed)
+		_bFailed = !WriteChars(_buffer, _cchBuffer);
+	_cchBuffer = 0;
+}
+
+#pragma endregion
+
+#pragma region CFileXmlWriter
+
+CFileXmlWriter::CFileXmlWriter(const WCHAR* pszPath) : _path(pszPath), _pfile(NULL), _errOpen(0), _errWrite(0)
+{
+}
+
+CFileXmlWriter::~CFileXmlWriter()
+{
+	// Output that was never closed is incomplete
+	if (_pfile)
+		Discard();
+}
+
+bool CFileXmlWriter::Close()
+{
+	bool bSucceeded = CXmlWriter::Close();
+
+	if (_pfile)
+	{
+		if (fclose(_pfile) != 0 && bSucceeded)
+		{
+			_errWrite = errno;
+			bSucceeded = false;
+		}
+		_pfile = NULL;
+
+		if (!bSucceeded)
+			Discard();
+	}
+
+	return bSucceeded;
+}
+
+bool CFileXmlWriter::WriteDocument(const std::wstring& xml)
+{
+	// The document is complete already, so it must not be ended again as Close would
+	bool bSucceeded = xml.empty() || WriteChars(xml.data(), xml.size());
+
+	if (_pfile)
+	{
+		if (fclose(_pfile) != 0 && bSucceeded)
+		{
+			_errWrite = errno;
+			bSucceeded = false;
+		}
+		_pfile = NULL;
+
+		if (!bSucceeded)
+			Discard();
+	}
+
+	return bSucceeded;
+}
+
+void CFileXmlWriter::Discard()
+{
+	if (_pfile)
+	{
+		fclose(_pfile);
+		_pfile = NULL;
+	}
+
+#ifdef _WIN32
+	_wremove(_path.c_str());
+#else
+	remove(NarrowPath(_path.c_str()).c_str());
+#endif
+}
+
+bool CFileXmlWriter::WriteChars(const WCHAR* pch, size_t cch)
+{
+	if (!_pfile)
+	{
+#ifdef _WIN32
+		// This used to be STL, but wofstream by default writes 8-bit encoded files, and changing that is complex
+		_errOpen = _wfopen_s(&_pfile, _path.c_str(), L"w+, ccs=UTF-16LE");
+#else
+		_pfile = fopen(NarrowPath(_path.c_str()).c_str(), "wb");
+		_errOpen = _pfile ? 0 : errno;
+
+		static const BYTE bom[] = { 0xFF, 0xFE };
+		if (_pfile && fwrite(bom, 1, sizeof(bom), _pfile) != sizeof(bom))
+		{
+			_errWrite = errno;
+			return false;
+		}
+#endif
+		if (!_pfile)
+			return false;
+	}
+
+#ifdef _WIN32
+	// The CRT writes the BOM and expands newlines for us
+	if (fwrite(pch, sizeof(WCHAR), cch, _pfile) != cch)
+#else
+	_bytes.clear();
+	for (size_t i = 0; i < cch; )
+	{
+		size_t cchLine = 0;
+		while (i + cchLine < cch && pch[i + cchLine] != L'\n')
+			cchLine++;
+		AppendUtf16(_bytes, pch + i, cchLine);
+		i += cchLine;
+		if (i < cch)
+		{
+			AppendUtf16(_bytes, L"\r\n", 2);
+			i++;
+		}
+	}
+	if (fwrite(&_bytes[0], 1, _bytes.size(), _pfile) != _bytes.size())
+#endif
+	{
+		_errWrite = errno;
+		return false;
+	}
+
+	return true;
+}
+
+#pragma endregion
+
+#pragma region CStringXmlWriter
+
+bool CStringXmlWriter::WriteChars(const WCHAR* pch, size_t cch)
+{
+	_text.append(pch, cch);
+	return true;
+}
+
+#pragma endregion
+
+#pragma region CStreamXmlWriter
+
+bool CStreamXmlWriter::WriteChars(const WCHAR* pch, size_t cch)
+{
+	_stream.write(pch, cch);
+	return !_stream.fail();
+}
+
+#pragma endregion
@@ -0,0 +1,121 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Streaming XML output, so that export can write elements as properties are enumerated rather than
+// building a DOM and then printing it. The layout is exactly that of rapidxml::print with no flags:
+// tab indentation, one element per line, and text-only elements kept on a single line.
+
+#pragma once
+
+#include "PortableTypes.h"
+#include <ostream>
+#include <stdio.h>
+
+class CXmlWriter
+{
+public:
+	CXmlWriter();
+	virtual ~CXmlWriter();
+
+	// Element names are not copied, so must remain valid until the element is ended
+	void StartElement(const WCHAR* pszName);
+	void Attribute(const WCHAR* pszName, const WCHAR* pszValue);
+	void Text(const WCHAR* pszText);
+	void EndElement();
+
+	// Ends any open elements and flushes everything written; returns false if output failed
+	virtual bool Close();
+
+protected:
+	virtual bool WriteChars(const WCHAR* pch, size_t cch) = 0;
+
+private:
+	struct Element
+	{
+		const WCHAR*	pszName;
+		bool			bHasChildren;
+	};
+
+	void Put(WCHAR ch)
+	{
+		if (_cchBuffer == BufferSize)
+			Flush();
+		_buffer[_cchBuffer++] = ch;
+	}
+	void PutString(const WCHAR* psz);
+	void PutEscaped(const WCHAR* psz, WCHAR noExpand);
+	void PutIndent(size_t depth);
+	void Flush();
+
+	static const size_t BufferSize = 8192;
+
+	std::vector<Element>	_elements;
+	bool					_bStartTagOpen;		// still possible to add attributes to the innermost element
+	bool					_bFailed;
+	bool					_bClosed;
+	size_t					_cchBuffer;
+	WCHAR					_buffer[BufferSize];
+};
+
+// Writes a UTF-16LE file with a BOM and CRLF line endings, as the Windows CRT does for ccs=UTF-16LE.
+// The file is only created when the first output is flushed, so that a failure before then leaves any
+// existing file untouched.
+class CFileXmlWriter : public CXmlWriter
+{
+public:
+	CFileXmlWriter(const WCHAR* pszPath);
+	virtual ~CFileXmlWriter();
+
+	virtual bool Close();
+
+	// Writes a whole document rendered beforehand by CStringXmlWriter, and closes the file;
+	// returns false if output failed
+	bool WriteDocument(const std::wstring& xml);
+
+	// Abandons the output, removing any partly written file
+	void Discard();
+
+	int GetOpenError() const { return _errOpen; }
+	int GetWriteError() const { return _errWrite; }
+
+protected:
+	virtual bool WriteChars(const WCHAR* pch, size_t cch);
+
+private:
+	std::wstring		_path;
+	FILE*				_pfile;
+	int					_errOpen;
+	int					_errWrite;
+#ifndef _WIN32
+	std::vector<BYTE>	_bytes;
+#endif
+};
+
+// Appends to a string held in memory
+class CStringXmlWriter : public CXmlWriter
+{
+public:
+	CStringXmlWriter(std::wstring& text) : _text(text) {}
+
+protected:
+	virtual bool WriteChars(const WCHAR* pch, size_t cch);
+
+private:
+	CStringXmlWriter& operator=(const CStringXmlWriter&);
+
+	std::wstring& _text;
+};
+
+// Writes to a wide character stream, such as the console
+class CStreamXmlWriter : public CXmlWriter
+{
+public:
+	CStreamXmlWriter(std::wostream& stream) : _stream(stream) {}
+
+protected:
+	virtual bool WriteChars(const WCHAR* pch, size_t cch);
+
+private:
+	CStreamXmlWriter& operator=(const CStreamXmlWriter&);
+
+	std::wostream& _stream;
+};
@@ -5,6 +5,8 @@
 
 #pragma once
 
+// Only the Windows build has these; elsewhere, the portable parts of the engine get what they need from PortableTypes.h
+#ifdef _WIN32
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 // Windows Header Files:
@@ -16,3 +18,4 @@
 
 #include <atlbase.h>
 #include <atlstr.h>
+#endif
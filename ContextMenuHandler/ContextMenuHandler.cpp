@@ -262,29 +262,11 @@ IFACEMETHODIMP CContextMenuHandler::InvokeCommand(LPCMINVOKECOMMANDINFO pici)
 						if (0 == m_checker.HasPropertyHandler(m_files[i]))
 							continue;
 
-					// Build an XML document containing thw metadata
-					xml_document<WCHAR> doc;
-					ExportMetadata(&doc, m_files[i]);
-
-					// writing to a string rather than directly to the stream is odd, but writing directly does not compile
-					// (trying to access a private constructor on traits - a typically arcane template issue)
-					wstring s;
-					print(std::back_inserter(s), doc, 0);
-
 					wstring szXmlTarget = m_files[i];
 					szXmlTarget += MetadataFileSuffix;
 
-					// Now write from the XML string to a file stream
-					// This used to be STL, but wofstream by default writes 8-bit encoded files, and changing that is complex
-					FILE *pfile;
-					errno_t err = _wfopen_s(&pfile, szXmlTarget.c_str(), L"w+, ccs=UTF-16LE");
-					if (0 == err)
-					{
-						fwrite(s.c_str(), sizeof(WCHAR), s.length(), pfile);
-						fclose(pfile);
-					}
-					else
-						throw CPHException(err, E_FAIL, IDS_E_FILEOPEN_1, err);
+					// Write the metadata straight out to the XML file
+					ExportMetadataToFile(m_files[i], szXmlTarget);
 				}
 
 				hr = S_OK;
@@ -312,77 +294,11 @@ IFACEMETHODIMP CContextMenuHandler::InvokeCommand(LPCMINVOKECOMMANDINFO pici)
 					wstring szXmlTarget = m_files[i];
 					szXmlTarget += MetadataFileSuffix;
 
-					// rapidxml parsing works only from a string, so read the whole file
-					FILE *pfile;
-					errno_t err = _wfopen_s(&pfile, szXmlTarget.c_str(), L"rb");
+					// Parse straight from the mapped file where we can
+					CMappedXmlFile xml;
+					int err = xml.Open(szXmlTarget.c_str());
 					if (0 == err)
-					{
-						fseek (pfile , 0 , SEEK_END);
-						size_t lSize = ftell (pfile);  // size in bytes
-						rewind (pfile);
-
-						CHAR* buffer = new CHAR[lSize + sizeof(WCHAR)];
-						WCHAR* wbuffer;
-						size_t lwSize;
-						size_t offset = 0;
-
-						fread(buffer, sizeof(CHAR), lSize, pfile);
-						fclose(pfile);
-
-						// export files are now UTF-16 with BOM
-						if (buffer[0] == (CHAR)0xFF && buffer[1] == (CHAR)0xFE)
-						{
-							wbuffer = (WCHAR*) buffer;
-							lwSize = lSize / sizeof(WCHAR);
-							wbuffer[lwSize] = L'\0';  // ensure termination
-							offset++;  // skip BOM
-						}
-						// but also cope with ASCII files from our previous versions, or that have been hand-edited in ASCII
-						else
-						{
-							wbuffer = new WCHAR[lSize + 1];
-							lwSize = lSize;
-							size_t conv;
-							mbstowcs_s(&conv, wbuffer, lSize+1, buffer, lSize);
-							delete [] buffer;
-						}
-
-						// parse the XML
-						xml_document<WCHAR> doc;
-						WCHAR * xml = doc.allocate_string(wbuffer+offset, lwSize+1-offset);  
-
-						if (offset == 0) // ASCII file
-							delete [] wbuffer;
-						else
-							delete [] buffer;
-	
-						try
-						{
-							doc.parse<0>(xml);
-						}
-						catch(parse_error& e)
-						{
-							size_t size = strlen(e.what()) + 1;
-							WCHAR * error = new WCHAR[size];
-							size_t convertedChars = 0;
-							mbstowcs_s(&convertedChars, error, size, e.what(), _TRUNCATE);
-
-	#define MAX_ERRLENGTH 20
-							WCHAR content[MAX_ERRLENGTH + 1];
-							size = wcslen(e.where<WCHAR>());
-							if (size > MAX_ERRLENGTH)
-								size = MAX_ERRLENGTH;
-							wmemcpy(content, e.where<WCHAR>(), size);
-							content[MAX_ERRLENGTH] = L'\0';  // ensure termination
-
-							CPHException cphe = CPHException(ERROR_XML_PARSE_ERROR, E_FAIL, IDS_E_XML_PARSE_ERROR_3, error, content, szXmlTarget);
-							delete [] error;
-							throw cphe;
-						}
-
-						// apply it 
-						ImportMetadata(&doc, m_files[i]);
-					}
+						ImportMetadataFromXml(xml.Text(), m_files[i], szXmlTarget);
 
 					// Tolerate file access problems in the multi-file case
 					else if (m_files.size() == 1)
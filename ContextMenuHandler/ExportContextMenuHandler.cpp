@@ -227,29 +227,11 @@ IFACEMETHODIMP CExportContextMenuHandler::InvokeCommand(LPCMINVOKECOMMANDINFO pi
 						if (0 == m_checker.HasPropertyHandler(m_files[i]))
 							continue;
 
-					// Build an XML document containing thw metadata
-					xml_document<WCHAR> doc;
-					ExportMetadata(&doc, m_files[i], true);
-
-					// writing to a string rather than directly to the stream is odd, but writing directly does not compile
-					// (trying to access a private constructor on traits - a typically arcane template issue)
-					wstring s;
-					print(std::back_inserter(s), doc, 0);
-
 					wstring szXmlTarget = m_files[i];
 					szXmlTarget += MetadataFileSuffix;
 
-					// Now write from the XML string to a file stream
-					// This used to be STL, but wofstream by default writes 8-bit encoded files, and changing that is complex
-					FILE *pfile;
-					errno_t err = _wfopen_s(&pfile, szXmlTarget.c_str(), L"w+, ccs=UTF-16LE");
-					if (0 == err)
-					{
-						fwrite(s.c_str(), sizeof(WCHAR), s.length(), pfile);
-						fclose(pfile);
-					}
-					else
-						throw CPHException(err, E_FAIL, IDS_E_FILEOPEN_1, err);
+					// Write the metadata straight out to the XML file
+					ExportMetadataToFile(m_files[i], szXmlTarget, true);
 				}
 
 				hr = S_OK;
@@ -28,8 +28,6 @@ const CLASS_OBJECT_INIT c_rgClassObjectInit[] =
 long g_cRefModule = 0;
 BOOL              v_fRunningOnNT;        // Flag Set When on Unicode OS
 
-PFN_STGOPENSTGEX  v_pfnStgOpenStorageEx; // StgOpenStorageEx (Win2K/XP only)
-
 
 // Handle the the DLL's module
 HINSTANCE g_hInst = NULL;
@@ -4,17 +4,154 @@
 #include <shlwapi.h>
 #include <propkey.h>
 #include <propvarutil.h>
+#include <map>
 #include "dll.h"
 #include "RegisterExtension.h"
-
-extern PFN_STGOPENSTGEX v_pfnStgOpenStorageEx;
+#include "PropertySnapshot.h"
+#include "..\CommandLine\MetadataSnapshot.h"
+#include "..\CommandLine\MetadataStore.h"
 
 static const WCHAR* PropertyHandlerDescription = L"File Metadata Property Handler";
 
-class CPropertyHandler : public IPropertyStore, public IInitializeWithFile
+// The chained property handler configured for each extension, as it has been looked up, shared by every
+// handler in the process. Hosts such as the indexer create a handler for every file, and the answer is the
+// same each time unless the registry changes, so the registry is watched, and the cache emptied if it does.
+class CChainedHandlerCache
 {
 public:
-    CPropertyHandler() : _cRef(1), _pStore(NULL), _bReadWrite(FALSE), _pChainedPropStore(NULL), _bHaveChainedPropCount(FALSE)
+	CChainedHandlerCache() : _hkey(NULL), _hevent(NULL), _watching(false) {}
+	~CChainedHandlerCache();
+
+	// Returns S_OK and the CLSID of the chained handler, or S_FALSE if there is none for the extension
+	HRESULT Lookup(PCWSTR pszExt, CLSID* pclsid);
+
+private:
+	CChainedHandlerCache(const CChainedHandlerCache&);
+	CChainedHandlerCache& operator=(const CChainedHandlerCache&);
+
+	void Refresh();
+
+	struct ExtensionLess
+	{
+		bool operator()(const std::wstring& ext1, const std::wstring& ext2) const { return _wcsicmp(ext1.c_str(), ext2.c_str()) < 0; }
+	};
+
+	struct Entry
+	{
+		bool	bChained;
+		CLSID	clsid;
+	};
+
+	CLock											_lock;
+	std::map<std::wstring, Entry, ExtensionLess>	_entries;
+	HKEY											_hkey;
+	HANDLE											_hevent;	// signalled when anything under the key changes
+	bool											_watching;
+};
+
+// Created as the DLL loads, so that threads never race to construct it
+static CChainedHandlerCache s_chainedHandlers;
+
+CChainedHandlerCache::~CChainedHandlerCache()
+{
+	if (_hkey)
+		RegCloseKey(_hkey);
+	if (_hevent)
+		CloseHandle(_hevent);
+}
+
+// Empties the cache if the registry may have changed since it was filled, which is always the case
+// if the registry cannot say, and watches again
+void CChainedHandlerCache::Refresh()
+{
+	if (_watching && WaitForSingleObject(_hevent, 0) == WAIT_TIMEOUT)
+		return;
+
+	_entries.clear();
+	_watching = false;
+
+	if (!_hkey && RegOpenKeyEx(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\PropertySystem\\PropertyHandlers",
+							   0, KEY_READ | KEY_NOTIFY, &_hkey) != ERROR_SUCCESS)
+	{
+		_hkey = NULL;
+		return;
+	}
+	if (!_hevent)
+		_hevent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	// Watch before reading, so that a change made while reading is not missed.
+	// The watch also ends, signalling the event, when the host thread that set it exits, which only costs a refresh.
+	if (_hevent && ResetEvent(_hevent))
+		_watching = ERROR_SUCCESS == RegNotifyChangeKeyValue(_hkey, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, _hevent, TRUE);
+}
+
+HRESULT CChainedHandlerCache::Lookup(PCWSTR pszExt, CLSID* pclsid)
+{
+	*pclsid = CLSID();
+	if (!*pszExt)
+		return S_FALSE;
+
+	CAutoLock lock(_lock);
+	Refresh();
+
+	std::map<std::wstring, Entry, ExtensionLess>::const_iterator it = _entries.find(pszExt);
+	if (it == _entries.end())
+	{
+		// Chained property handlers are configured in a Chained property value added to the standard property system key
+		Entry entry;
+		entry.bChained = false;
+		entry.clsid = CLSID();
+
+		WCHAR szBuf[64];
+		DWORD nBufLen = sizeof(szBuf);
+		if (_hkey != NULL && RegGetValue(_hkey, pszExt, L"Chained", RRF_RT_REG_SZ, NULL, szBuf, &nBufLen) == ERROR_SUCCESS)
+			entry.bChained = SUCCEEDED(CLSIDFromString(szBuf, &entry.clsid));
+
+		// Without a watch, nothing is kept, as there would be no telling when it went out of date
+		if (!_watching)
+		{
+			*pclsid = entry.clsid;
+			return entry.bChained ? S_OK : S_FALSE;
+		}
+		it = _entries.insert(std::make_pair(std::wstring(pszExt), entry)).first;
+	}
+
+	*pclsid = it->second.clsid;
+	return it->second.bChained ? S_OK : S_FALSE;
+}
+
+// The property store of the handler configured to be chained to for the file's extension, if there is one.
+// Loading and initializing it is as much work again as reading our own properties, so CChainedMetadataStore
+// only opens this when a property is wanted that we do not have ourselves.
+// This is simplified by the fact that we only ever open a chained property handler read-only
+class CChainedHandlerStore : public IMetadataStore
+{
+public:
+	CChainedHandlerStore() : _pChainedPropStore(NULL) {}
+	virtual ~CChainedHandlerStore() { Close(); }
+
+	virtual HRESULT Open(const WCHAR* pszFilePath, bool bReadWrite);
+	virtual void Close() { SafeRelease(&_pChainedPropStore); }
+
+	virtual HRESULT GetCount(DWORD* pcProps) { return _pChainedPropStore->GetCount(pcProps); }
+	virtual HRESULT GetAt(DWORD iProp, PROPERTYKEY* pkey) { return _pChainedPropStore->GetAt(iProp, pkey); }
+	virtual HRESULT GetValue(REFPROPERTYKEY key, PROPVARIANT* pPropVar) { return _pChainedPropStore->GetValue(key, pPropVar); }
+	virtual HRESULT SetValue(REFPROPERTYKEY, REFPROPVARIANT) { return STG_E_ACCESSDENIED; }
+	virtual HRESULT Commit() { return STG_E_ACCESSDENIED; }
+
+	virtual HRESULT EnumPropertySets(std::vector<FMTID>&) { return E_NOTIMPL; }
+	virtual HRESULT DeletePropertySet(REFFMTID) { return E_NOTIMPL; }
+	virtual HRESULT Probe(const WCHAR*) { return E_NOTIMPL; }
+	virtual HRESULT Stamp(const WCHAR*, MetadataStamp*) { return E_NOTIMPL; }
+
+private:
+	IPropertyStore *		_pChainedPropStore;
+};
+
+class CPropertyHandler : public IPropertyStore, public IInitializeWithFile, public IPropertySnapshot
+{
+public:
+    CPropertyHandler() : _cRef(1), _pStore(NULL), _bHaveSnapshot(FALSE)
     {
         DllAddRef();
     }
@@ -26,6 +163,7 @@ public:
         {
             QITABENT(CPropertyHandler, IPropertyStore),
             QITABENT(CPropertyHandler, IInitializeWithFile),
+            QITABENT(CPropertyHandler, IPropertySnapshot),
             {0, 0 },
         };
         return QISearch(this, qit, riid, ppv);
@@ -56,25 +194,24 @@ public:
 	// IInitializeWithFile
 	IFACEMETHODIMP Initialize(LPCWSTR pszFilePath,DWORD grfMode); 
 
+	// IPropertySnapshot
+	IFACEMETHODIMP GetAll(DWORD *pcProps, const PROPERTYKEY **prgKeys, const PROPVARIANT **prgValues);
+
 private:
 	
 	~CPropertyHandler()
     {
-        SafeRelease(&_pStore);
-		SafeRelease(&_pChainedPropStore);
+        delete _pStore;
         DllRelease();
     }
-	HRESULT OpenStore(BOOL bReadWrite);
-	DWORD ChainedPropCount();
+	HRESULT OpenStore();
 
     long _cRef;
 
 	WCHAR					_pszFilePath[MAX_PATH];
-	BOOL		            _bReadWrite;     // Whether storage set currently open read write
-	IPropertyStore *		_pStore;		// Wrapper over set of storages.
-    IPropertyStore *		_pChainedPropStore;	// Chained properties store
-	BOOL					_bHaveChainedPropCount; // Whether we have read the count of chained properties
-    DWORD					_cChainedPropCount;	// Count of properties in the chained properties store
+	CChainedMetadataStore *	_pStore;		// Wrapper over set of storages, holding edits until Commit, and over the chained properties store
+	CMetadataSnapshot		_snapshot;		// Every property, once GetAll has been asked for them
+	BOOL					_bHaveSnapshot;
 };
 
 HRESULT CPropertyHandler_CreateInstance(REFIID riid, void **ppv)
@@ -92,180 +229,161 @@ HRESULT CPropertyHandler_CreateInstance(REFIID riid, void **ppv)
 HRESULT CPropertyHandler::GetCount(DWORD *pcProps)
 {
     *pcProps = 0;
-	HRESULT hr = OpenStore(FALSE);
-    hr = SUCCEEDED(hr) ? _pStore->GetCount(pcProps) : hr;
-    if (SUCCEEDED(hr))
-         *pcProps += ChainedPropCount();
-    return hr;
+	HRESULT hr = OpenStore();
+    return SUCCEEDED(hr) ? _pStore->GetCount(pcProps) : hr;
 }
 
 HRESULT CPropertyHandler::GetAt(DWORD iProp, PROPERTYKEY *pkey)
 {
     *pkey = PKEY_Null;
-	HRESULT hr = OpenStore(FALSE);
-	// We take chained properties first because their number remains constant,
-	// whereas the number of File Meta properties varies as they are set,
-	// which would mean that if we took File Meta properties first,
-	// repeated calls with the same index into the chained properties could return different key values
-    hr = SUCCEEDED(hr) ?
-        (iProp < ChainedPropCount()) ?
-		    _pChainedPropStore->GetAt(iProp, pkey) :
-            _pStore->GetAt(iProp - ChainedPropCount(), pkey) :
-        hr;
-    return hr;
+	HRESULT hr = OpenStore();
+	// Through a sorted index of our keys and the chained ones, each listed once, which stays the same unless properties are added or removed
+    return SUCCEEDED(hr) ? _pStore->GetAt(iProp, pkey) : hr;
 }
 
 HRESULT CPropertyHandler::GetValue(REFPROPERTYKEY key, PROPVARIANT *pPropVar)
 {
     PropVariantInit(pPropVar);
-	HRESULT hr = OpenStore(FALSE);
+	HRESULT hr = OpenStore();
+	// Once there is a snapshot, its values are the ones to give, without going back to the stores
+	if (SUCCEEDED(hr) && _bHaveSnapshot)
+	{
+		const PROPVARIANT* pValue = _snapshot.Find(key);
+		if (pValue != NULL)
+			return PropVariantCopy(pPropVar, pValue);
+	}
+
 	// Take the File Meta property value first, and if there isn't one,
 	// see if this is a check for the software product name, which we use as a marker, or if not
-	// try for a chained property value
-    hr = SUCCEEDED(hr) ? _pStore->GetValue(key, pPropVar) : hr;
-	if (SUCCEEDED(hr) && pPropVar->vt == VT_EMPTY && key == PKEY_Software_ProductName)
-		hr = InitPropVariantFromString(L"FileMetadata", pPropVar);
-    else if (_pChainedPropStore != NULL && SUCCEEDED(hr) && pPropVar->vt == VT_EMPTY)
-        hr = _pChainedPropStore->GetValue(key, pPropVar);
-    return hr;
+	// try for a chained property value, loading the chained handler if this is the first time
+    return SUCCEEDED(hr) ? _pStore->GetValue(key, pPropVar) : hr;
 }
 
-// SetValue just updates the File Meta property store's value cache
+// SetValue just updates the File Meta property store's value cache, over what was read from the file
 HRESULT CPropertyHandler::SetValue(REFPROPERTYKEY key, REFPROPVARIANT propVar)
 {
-	HRESULT hr = OpenStore(TRUE);
-    return SUCCEEDED(hr) ? _pStore->SetValue(key, propVar) : hr;
+	HRESULT hr = OpenStore();
+    hr = SUCCEEDED(hr) ? _pStore->SetValue(key, propVar) : hr;
+
+	// Any snapshot no longer shows the values as they are
+	if (SUCCEEDED(hr) && _bHaveSnapshot)
+	{
+		_snapshot.Clear();
+		_bHaveSnapshot = FALSE;
+	}
+	return hr;
 }
 
-// Commit writes updates out to thw alternate stream
+// Commit writes updates out to the alternate stream, opening the file for writing only now,
+// and only if some value actually differs from what the file already holds
 HRESULT CPropertyHandler::Commit()
 {
-	HRESULT hr = OpenStore(TRUE);
+	HRESULT hr = OpenStore();
     return SUCCEEDED(hr) ? _pStore->Commit() : hr;
 }
 
-HRESULT CPropertyHandler::OpenStore(BOOL bReadWrite)
+// The store is opened once, for reading, and kept open for the life of the handler.
+// Edits are held in the deferred write layer, so that the first SetValue no longer closes the storage
+// and reads it all again, and the file is opened for writing just once, by Commit.
+// The chained handler is not loaded until a property is asked for that only it can supply.
+HRESULT CPropertyHandler::OpenStore()
 {
-    HRESULT hr = E_UNEXPECTED;
-
 	if (_pStore)
+		return S_OK;
+
+	IMetadataStore* pOwn = CreateDeferredWriteMetadataStore();
+	IMetadataStore* pChained = new (std::nothrow) CChainedHandlerStore();
+	if (pOwn && pChained)
+		_pStore = new (std::nothrow) CChainedMetadataStore(pOwn, pChained);
+	if (!_pStore)
 	{
-		// If open and read/write, or only read wanted, we're good
-		if (_bReadWrite || !bReadWrite)
-			return S_OK;
-		// Must be open read but read/write wanted - close ready to re-open
-		else 
-			SafeRelease(&_pStore);
+		delete pOwn;
+		delete pChained;
+		return E_OUTOFMEMORY;
 	}
+	_pStore->SetMarker(PKEY_Software_ProductName, L"FileMetadata");
 
-	if (v_pfnStgOpenStorageEx)
+	HRESULT hr = _pStore->Open(_pszFilePath, true);
+	if (FAILED(hr))
 	{
-		IPropertySetStorage* pPropSetStg = NULL;
-		DWORD dwReadWrite = bReadWrite ? STGM_READWRITE : STGM_READ;
-
-		hr = (v_pfnStgOpenStorageEx)(_pszFilePath, dwReadWrite | STGM_SHARE_EXCLUSIVE, STGFMT_FILE, 0, NULL, 0, 
-				IID_IPropertySetStorage, (void**)&pPropSetStg);
-
-		if (SUCCEEDED(hr))
-			// To make IPropertyStore work for Write, it is necessary to use STGM_READWRITE, which the MS documentation says
-			// explicitly will not work.  The recommended STGM_READ fails with E_ACCESSDENIED on Write and Commit, which
-			// is what you would expect. The only bug appears to be in the documentation.
-			hr = PSCreatePropertyStoreFromPropertySetStorage(pPropSetStg, dwReadWrite, IID_IPropertyStore, (void **)&_pStore);
-
-		SafeRelease(&pPropSetStg);
-
-		if (SUCCEEDED(hr))
-			_bReadWrite = bReadWrite;
+		delete _pStore;
+		_pStore = NULL;
 	}
 
 	return hr;
 }
 
-DWORD CPropertyHandler::ChainedPropCount()
+// Reads every property at once, ours and the chained ones, into a snapshot that then also serves GetValue
+HRESULT CPropertyHandler::GetAll(DWORD *pcProps, const PROPERTYKEY **prgKeys, const PROPVARIANT **prgValues)
 {
-	if (!_bHaveChainedPropCount)
+    *pcProps = 0;
+    *prgKeys = NULL;
+    *prgValues = NULL;
+
+	HRESULT hr = OpenStore();
+	if (SUCCEEDED(hr) && !_bHaveSnapshot)
 	{
-		_cChainedPropCount = 0;
+		hr = _snapshot.Take(_pStore);
+		_bHaveSnapshot = SUCCEEDED(hr);
+	}
 
-		if (_pChainedPropStore != NULL)
-			_bHaveChainedPropCount = SUCCEEDED(_pChainedPropStore->GetCount(&_cChainedPropCount));
-		else
-			_bHaveChainedPropCount = TRUE;
+	if (SUCCEEDED(hr))
+	{
+		*pcProps = _snapshot.GetCount();
+		*prgKeys = _snapshot.GetKeys();
+		*prgValues = _snapshot.GetValues();
 	}
-	return _cChainedPropCount;
+	return hr;
 }
 
+// Only the path is kept here, as everything else is put off until it is needed
 HRESULT CPropertyHandler::Initialize(LPCWSTR pszFilePath, DWORD grfMode)
 {
-    HRESULT hr = S_OK;
-
 	wcscpy_s(_pszFilePath, MAX_PATH, pszFilePath);
+    return S_OK;
+}
 
-	if (!v_pfnStgOpenStorageEx)
-	{
-		BOOL fRunningOnNT = ((GetVersion() & 0x80000000) != 0x80000000);
-		v_pfnStgOpenStorageEx = ((fRunningOnNT) ? (PFN_STGOPENSTGEX)GetProcAddress(GetModuleHandle(L"OLE32"), "StgOpenStorageEx") : NULL);
-	}
+// Check if a chained property handler is configured, and if there is one, load and initialize it.
+// Fails if there is none.
+HRESULT CChainedHandlerStore::Open(const WCHAR* pszFilePath, bool)
+{
+    Close();
+
+    CLSID clsid;
+    HRESULT hr = s_chainedHandlers.Lookup(PathFindExtension(pszFilePath), &clsid);
+    if (hr == S_FALSE)
+        return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
 
-    // Check if a chained property handler is configured, and if there is one, load and initialize it too.
-	// This is simplified by the fact that we only ever open a chained property handler read-only
-    SafeRelease(&_pChainedPropStore);
-    PCWSTR pszExt = PathFindExtension(_pszFilePath);
-    if (*pszExt)
+    if (SUCCEEDED(hr))
+        hr = CoCreateInstance(clsid, NULL, CLSCTX_ALL, IID_IPropertyStore, (void **)&_pChainedPropStore);
+    if (SUCCEEDED(hr))
     {
-        // Chained property handlers are configured in a Chained property value added to the standard property system key
-        HKEY propertyHandlerKey;
-		WCHAR szKeyName[MAX_PATH] = L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\PropertySystem\\PropertyHandlers\\";
-		wcscat_s(szKeyName, MAX_PATH, pszExt);
-        if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, szKeyName, 0, KEY_QUERY_VALUE, &propertyHandlerKey) == ERROR_SUCCESS)
+        IInitializeWithFile *pChainedPropInit;
+        hr = _pChainedPropStore->QueryInterface(IID_IInitializeWithFile, (void **)&pChainedPropInit);
+        if (SUCCEEDED(hr))
         {
-            WCHAR szBuf[64];
-            DWORD nBufLen = sizeof(szBuf);
-            DWORD dwType;
-
-            if (RegGetValue(propertyHandlerKey, NULL, L"Chained", RRF_RT_REG_SZ, &dwType, szBuf, &nBufLen) == ERROR_SUCCESS)
+            hr = pChainedPropInit->Initialize(pszFilePath, STGM_READ);
+            pChainedPropInit->Release();
+        }
+        else
+        {
+            IInitializeWithStream *pChainedPropInitWithStream;
+            hr = _pChainedPropStore->QueryInterface(IID_IInitializeWithStream, (void **)&pChainedPropInitWithStream);
+            if (SUCCEEDED(hr))
             {
-                CLSID clsid;
-                if (SUCCEEDED(CLSIDFromString(szBuf, &clsid)))
+                IStream *pStream;
+                hr = SHCreateStreamOnFileEx(pszFilePath, STGM_READ, 0, FALSE, NULL, &pStream);
+                if (SUCCEEDED(hr))
                 {
-                    HRESULT hr2 = CoCreateInstance(clsid, NULL, CLSCTX_ALL, IID_IPropertyStore, (void **)&_pChainedPropStore);
-                    if (SUCCEEDED(hr2))
-                    {
-                        IInitializeWithFile *pChainedPropInit;
-                        hr2 = _pChainedPropStore->QueryInterface(IID_IInitializeWithFile, (void **)&pChainedPropInit);
-                        if (SUCCEEDED(hr2))
-                        {
-                            hr2 = pChainedPropInit->Initialize(_pszFilePath, STGM_READ);
-                            pChainedPropInit->Release();
-                        }
-                        else
-                        {
-                            IInitializeWithStream *pChainedPropInitWithStream;
-                            hr2 = _pChainedPropStore->QueryInterface(IID_IInitializeWithStream, (void **)&pChainedPropInitWithStream);
-                            if (SUCCEEDED(hr2))
-                            {
-                                IStream *pStream;
-                                hr2 = SHCreateStreamOnFileEx(_pszFilePath, STGM_READ, 0, FALSE, NULL, &pStream);
-                                if (SUCCEEDED(hr2))
-                                {
-                                    hr2 = pChainedPropInitWithStream->Initialize(pStream, STGM_READ);
-                                    pStream->Release();
-                                }
-                                pChainedPropInitWithStream->Release();
-                            }
-                        }
-                        if (FAILED(hr2))
-                        {
-                            _pChainedPropStore->Release();
-                            _pChainedPropStore = NULL;
-                        }
-                    }
+                    hr = pChainedPropInitWithStream->Initialize(pStream, STGM_READ);
+                    pStream->Release();
                 }
+                pChainedPropInitWithStream->Release();
             }
-
-            RegCloseKey(propertyHandlerKey);
         }
- 	}
+        if (FAILED(hr))
+            Close();
+    }
 
     return hr;
 }
@@ -0,0 +1,20 @@
+// Copyright (c) 2026, Dijji, and released under Ms-PL.  This, with other relevant licenses, can be found in the root of this distribution.
+
+// Bulk access to every property that the property handler has for a file, for clients such as indexers that read
+// them all. Rather than GetCount, then GetAt and GetValue for each property in turn, with a copy of each value
+// to clear, the handler reads them all once, ours and the chained handler's, and hands back the lot.
+// Obtained by querying the handler for it once the handler has been initialized.
+
+#pragma once
+
+#include <propsys.h>
+
+MIDL_INTERFACE("619f1c73-ce01-41e1-99e2-bc832939a9b3")
+IPropertySnapshot : public IUnknown
+{
+public:
+	// Returns the count of properties and arrays of their keys and values, or 0 and NULL arrays if there are none.
+	// The arrays belong to the handler, the values must not be cleared, and all of it lasts only until
+	// the handler is released or a property is set.
+	virtual HRESULT STDMETHODCALLTYPE GetAll(DWORD *pcProps, const PROPERTYKEY **prgKeys, const PROPVARIANT **prgValues) = 0;
+};
@@ -27,8 +27,6 @@ class DECLSPEC_UUID("60211757-EF87-465e-B6C1-B37CF98295F9") CPropertyHandler;
 #endif
 HRESULT CPropertyHandler_CreateInstance(REFIID riid, void **ppv);
 
-typedef HRESULT (CALLBACK* PFN_STGOPENSTGEX)(const WCHAR*, DWORD, DWORD, DWORD, void*, void*, REFIID riid, void **);
-
 void DllAddRef();
 void DllRelease();
 